@@ -0,0 +1,141 @@
+#!/usr/bin/env bash
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Library Public License as published by
+# the Free Software Foundation; either version 2, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Library Public License for more details.
+#
+
+source $CEPH_ROOT/qa/standalone/ceph-helpers.sh
+
+function run() {
+    local dir=$1
+    shift
+
+    export CEPH_MON="127.0.0.1:7228" # git grep '\<7228\>' : there must be only one
+    export CEPH_ARGS
+    CEPH_ARGS+="--fsid=$(uuidgen) --auth-supported=none "
+    CEPH_ARGS+="--mon-host=$CEPH_MON "
+
+    local funcs=${@:-$(set | sed -n -e 's/^\(TEST_[0-9a-z_]*\) .*/\1/p')}
+    for func in $funcs ; do
+        setup $dir || return 1
+        run_mon $dir a || return 1
+        run_mgr $dir x || return 1
+        for id in 0 1 2 ; do
+            run_osd $dir $id || return 1
+        done
+        $func $dir || return 1
+        teardown $dir || return 1
+    done
+}
+
+# reads served without an op context, summed over all osds
+function fast_reads() {
+    local total=0
+    local id
+    for id in 0 1 2 ; do
+        local n=$(CEPH_ARGS='' ceph --admin-daemon $(get_asok_path osd.$id) \
+            perf dump | jq '.osd.op_r_fast')
+        total=$(($total + $n))
+    done
+    echo $total
+}
+
+# run the command and check how many reads took the fast path
+function expect_fast_reads() {
+    local expected=$1
+    shift
+    local before=$(fast_reads)
+    "$@" || return 1
+    local after=$(fast_reads)
+    if [ $(($after - $before)) != $expected ] ; then
+        echo "expected $expected fast reads from $@, got $(($after - $before))"
+        return 1
+    fi
+}
+
+function TEST_fast_read_served() {
+    local dir=$1
+
+    create_pool rep 4 4 || return 1
+    wait_for_clean || return 1
+    printf "%*s" 4096 foo > $dir/small
+    rados -p rep put obj $dir/small || return 1
+    rados -p rep setxattr obj attr value || return 1
+
+    expect_fast_reads 1 rados -p rep get obj $dir/out || return 1
+    cmp $dir/small $dir/out || return 1
+    expect_fast_reads 1 rados -p rep stat obj || return 1
+    expect_fast_reads 1 rados -p rep getxattr obj attr || return 1
+    test "$(rados -p rep getxattr obj attr)" = value || return 1
+
+    # errors go through the full path
+    expect_fast_reads 0 eval '! rados -p rep getxattr obj nope' || return 1
+    expect_fast_reads 0 eval '! rados -p rep stat nope' || return 1
+}
+
+function TEST_fast_read_fallbacks() {
+    local dir=$1
+
+    create_pool rep 4 4 || return 1
+    wait_for_clean || return 1
+    printf "%*s" 4096 foo > $dir/small
+    rados -p rep put obj $dir/small || return 1
+
+    # larger than osd_op_fast_read_max_bytes
+    dd if=/dev/urandom of=$dir/big bs=1024 count=256 || return 1
+    rados -p rep put big $dir/big || return 1
+    expect_fast_reads 0 rados -p rep get big $dir/out || return 1
+    cmp $dir/big $dir/out || return 1
+
+    # turned off at runtime
+    ceph tell osd.* injectargs '--osd_op_fast_read_max_bytes 0' || return 1
+    expect_fast_reads 0 rados -p rep get obj $dir/out || return 1
+    cmp $dir/small $dir/out || return 1
+    ceph tell osd.* injectargs '--osd_op_fast_read_max_bytes 65536' || return 1
+    expect_fast_reads 1 rados -p rep get obj $dir/out || return 1
+
+    # snapshot reads
+    rados -p rep mksnap snap1 || return 1
+    printf "%*s" 4096 bar > $dir/small2
+    rados -p rep put obj $dir/small2 || return 1
+    expect_fast_reads 0 rados -p rep -s snap1 get obj $dir/out || return 1
+    cmp $dir/small $dir/out || return 1
+    expect_fast_reads 1 rados -p rep get obj $dir/out || return 1
+    cmp $dir/small2 $dir/out || return 1
+
+    # erasure coded pools
+    ceph osd erasure-code-profile set myprofile k=2 m=1 \
+        crush-failure-domain=osd || return 1
+    create_pool ec 4 4 erasure myprofile || return 1
+    wait_for_clean || return 1
+    rados -p ec put obj $dir/small || return 1
+    expect_fast_reads 0 rados -p ec get obj $dir/out || return 1
+    cmp $dir/small $dir/out || return 1
+    expect_fast_reads 0 rados -p ec stat obj || return 1
+
+    # cache tiers
+    create_pool base 4 4 || return 1
+    create_pool cache 4 4 || return 1
+    ceph osd tier add base cache || return 1
+    ceph osd tier cache-mode cache writeback || return 1
+    ceph osd tier set-overlay base cache || return 1
+    ceph osd pool set cache hit_set_type bloom || return 1
+    wait_for_clean || return 1
+    rados -p base put obj $dir/small || return 1
+    expect_fast_reads 0 rados -p base get obj $dir/out || return 1
+    cmp $dir/small $dir/out || return 1
+    expect_fast_reads 0 rados -p base stat obj || return 1
+}
+
+main osd-fast-read "$@"
+
+# Local Variables:
+# compile-command: "cd ../../.. ; make -j4 && qa/standalone/osd/osd-fast-read.sh"
+# End:
@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Library Public License as published by
+# the Free Software Foundation; either version 2, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Library Public License for more details.
+#
+
+source $CEPH_ROOT/qa/standalone/ceph-helpers.sh
+
+function run() {
+    local dir=$1
+    shift
+
+    export CEPH_MON="127.0.0.1:7227" # git grep '\<7227\>' : there must be only one
+    export CEPH_ARGS
+    CEPH_ARGS+="--fsid=$(uuidgen) --auth-supported=none "
+    CEPH_ARGS+="--mon-host=$CEPH_MON "
+    CEPH_ARGS+="--osd_op_shard_run_to_completion=true "
+    CEPH_ARGS+="--osd_op_num_shards=3 "
+
+    local funcs=${@:-$(set | sed -n -e 's/^\(TEST_[0-9a-z_]*\) .*/\1/p')}
+    for func in $funcs ; do
+        setup $dir || return 1
+        $func $dir || return 1
+        teardown $dir || return 1
+    done
+}
+
+function TEST_run_to_completion_ops() {
+    local dir=$1
+
+    run_mon $dir a --osd_pool_default_size=2 || return 1
+    run_mgr $dir x || return 1
+    run_osd $dir 0 || return 1
+    run_osd $dir 1 || return 1
+    create_rbd_pool || return 1
+    wait_for_clean || return 1
+
+    # replicated writes and reads go through the shard inboxes
+    local obj
+    echo foo > $dir/foo
+    for obj in $(seq 1 20) ; do
+        rados -p rbd put obj$obj $dir/foo || return 1
+    done
+    for obj in $(seq 1 20) ; do
+        rados -p rbd get obj$obj $dir/foo.out || return 1
+        cmp $dir/foo $dir/foo.out || return 1
+    done
+    rados -p rbd bench 5 write -b 4096 -t 16 --no-cleanup || return 1
+    rados -p rbd bench 5 rand -t 16 || return 1
+    rados -p rbd cleanup || return 1
+
+    # one thread per shard, and the inbox shows up in the queue dump
+    CEPH_ARGS='' ceph --admin-daemon $(get_asok_path osd.0) \
+        dump_op_pq_state | jq -e '.["OSD:ShardedOpWQ:2"].inbox' || return 1
+    CEPH_ARGS='' ceph --admin-daemon $(get_asok_path osd.0) \
+        config get osd_op_shard_run_to_completion | grep true || return 1
+
+    # and the osds stay up
+    kill_daemons $dir TERM osd.1 || return 1
+    activate_osd $dir 1 || return 1
+    wait_for_clean || return 1
+    rados -p rbd get obj1 $dir/foo.out || return 1
+    cmp $dir/foo $dir/foo.out || return 1
+}
+
+main osd-run-to-completion "$@"
+
+# Local Variables:
+# compile-command: "cd ../../.. ; make -j4 && qa/standalone/osd/osd-run-to-completion.sh"
+# End:
@@ -4,6 +4,13 @@
 #ifndef CEPH_OS_BLUESTORE_CHECKSUMMER
 #define CEPH_OS_BLUESTORE_CHECKSUMMER
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include "include/buffer.h"
+#include "include/crc32c.h"
+#include "include/int_types.h"
 #include "xxHash/xxhash.h"
 
 class Checksummer {
@@ -67,6 +74,58 @@ public:
     }
   }
 
+  /// max blocks handed to Alg::calc_blocks at once
+  static constexpr size_t blocks_per_batch = 64;
+
+  /*
+   * Checksum the next blocks from p into out[0..blocks).  Whole blocks
+   * within a single buffer are handed to Alg::calc_blocks in one go;
+   * only blocks that straddle buffers are gathered into a bounce buffer.
+   * Calls check(first, n) after each run of n values is written; a
+   * negative return stops the walk and is returned.
+   */
+  template<class Alg, class F>
+  static int _calc_blocks(
+    typename Alg::init_value_t init_value,
+    size_t csum_block_size,
+    size_t blocks,
+    bufferlist::const_iterator& p,
+    typename Alg::value_t *out,
+    F&& check) {
+    size_t done = 0;
+    std::unique_ptr<char[]> bounce;
+    while (done < blocks) {
+      const char *data;
+      size_t l = p.get_ptr_and_advance((blocks - done) * csum_block_size,
+				       &data);
+      size_t n = l / csum_block_size;
+      if (n) {
+	Alg::calc_blocks(init_value, csum_block_size, n, data, out + done);
+	int r = check(done, n);
+	if (r < 0) {
+	  return r;
+	}
+	done += n;
+      }
+      size_t partial = l % csum_block_size;
+      if (partial) {
+	if (!bounce) {
+	  bounce.reset(new char[csum_block_size]);
+	}
+	memcpy(bounce.get(), data + n * csum_block_size, partial);
+	p.copy(csum_block_size - partial, bounce.get() + partial);
+	Alg::calc_blocks(init_value, csum_block_size, 1, bounce.get(),
+			 out + done);
+	int r = check(done, 1);
+	if (r < 0) {
+	  return r;
+	}
+	++done;
+      }
+    }
+    return 0;
+  }
+
   struct crc32c {
     typedef uint32_t init_value_t;
     typedef __le32 value_t;
@@ -86,6 +145,26 @@ public:
       ) {
       return p.crc32c(len, init_value);
     }
+
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t crc[blocks_per_batch];
+      while (n > 0) {
+	size_t b = std::min(n, blocks_per_batch);
+	ceph_crc32c_blocks(init_value, (const unsigned char*)data, len, b, crc);
+	for (size_t i = 0; i < b; ++i) {
+	  out[i] = crc[i];
+	}
+	data += b * len;
+	out += b;
+	n -= b;
+      }
+    }
   };
 
   struct crc32c_16 {
@@ -107,6 +186,26 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xffff;
     }
+
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t crc[blocks_per_batch];
+      while (n > 0) {
+	size_t b = std::min(n, blocks_per_batch);
+	ceph_crc32c_blocks(init_value, (const unsigned char*)data, len, b, crc);
+	for (size_t i = 0; i < b; ++i) {
+	  out[i] = crc[i] & 0xffff;
+	}
+	data += b * len;
+	out += b;
+	n -= b;
+      }
+    }
   };
 
   struct crc32c_8 {
@@ -128,6 +227,26 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xff;
     }
+
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t crc[blocks_per_batch];
+      while (n > 0) {
+	size_t b = std::min(n, blocks_per_batch);
+	ceph_crc32c_blocks(init_value, (const unsigned char*)data, len, b, crc);
+	for (size_t i = 0; i < b; ++i) {
+	  out[i] = crc[i] & 0xff;
+	}
+	data += b * len;
+	out += b;
+	n -= b;
+      }
+    }
   };
 
   struct xxhash32 {
@@ -157,6 +276,18 @@ public:
       }
       return XXH32_digest(state);
     }
+
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      for (size_t i = 0; i < n; ++i, data += len) {
+	out[i] = XXH32(data, len, init_value);
+      }
+    }
   };
 
   struct xxhash64 {
@@ -186,6 +317,18 @@ public:
       }
       return XXH64_digest(state);
     }
+
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      for (size_t i = 0; i < n; ++i, data += len) {
+	out[i] = XXH64(data, len, init_value);
+      }
+    }
   };
 
   template<class Alg>
@@ -209,23 +352,17 @@ public:
       bufferptr* csum_data) {
     assert(length % csum_block_size == 0);
     size_t blocks = length / csum_block_size;
-    bufferlist::const_iterator p = bl.begin();
     assert(bl.length() >= length);
 
-    typename Alg::state_t state;
-    Alg::init(&state);
-
     assert(csum_data->length() >= (offset + length) / csum_block_size *
 	   sizeof(typename Alg::value_t));
 
     typename Alg::value_t *pv =
       reinterpret_cast<typename Alg::value_t*>(csum_data->c_str());
     pv += offset / csum_block_size;
-    while (blocks--) {
-      *pv = Alg::calc(state, init_value, csum_block_size, p);
-      ++pv;
-    }
-    Alg::fini(&state);
+    bufferlist::const_iterator p = bl.begin();
+    _calc_blocks<Alg>(init_value, csum_block_size, blocks, p, pv,
+		      [](size_t, size_t) { return 0; });
     return 0;
   }
 
@@ -239,30 +376,40 @@ public:
     uint64_t *bad_csum=0
     ) {
     assert(length % csum_block_size == 0);
-    bufferlist::const_iterator p = bl.begin();
+    size_t blocks = length / csum_block_size;
     assert(bl.length() >= length);
 
-    typename Alg::state_t state;
-    Alg::init(&state);
-
     const typename Alg::value_t *pv =
       reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
     pv += offset / csum_block_size;
-    size_t pos = offset;
-    while (length > 0) {
-      typename Alg::value_t v = Alg::calc(state, -1, csum_block_size, p);
-      if (*pv != v) {
-	if (bad_csum) {
-	  *bad_csum = v;
-	}
-	Alg::fini(&state);
-	return pos;
-      }
-      ++pv;
-      pos += csum_block_size;
-      length -= csum_block_size;
+
+    // compute a window of values at a time and compare them against the
+    // stored ones
+    bufferlist::const_iterator p = bl.begin();
+    typename Alg::value_t v[blocks_per_batch];
+    size_t base = 0;
+    size_t bad = blocks;
+    while (base < blocks && bad == blocks) {
+      size_t n = std::min(blocks - base, blocks_per_batch);
+      _calc_blocks<Alg>(
+	(typename Alg::init_value_t)-1, csum_block_size, n, p, v,
+	[&](size_t first, size_t count) {
+	  for (size_t i = first; i < first + count; ++i) {
+	    if (pv[base + i] != v[i]) {
+	      bad = base + i;
+	      if (bad_csum) {
+		*bad_csum = v[i];
+	      }
+	      return -1;
+	    }
+	  }
+	  return 0;
+	});
+      base += n;
+    }
+    if (bad < blocks) {
+      return offset + bad * csum_block_size;
     }
-    Alg::fini(&state);
     return -1;  // no errors
   }
 };
@@ -354,6 +354,9 @@ void ShardedThreadPool::start_threads()
 
     WorkThreadSharded *wt = new WorkThreadSharded(this, thread_index);
     ldout(cct, 10) << "start_threads creating and starting " << wt << dendl;
+    if (thread_index < (int32_t)thread_cpus.size()) {
+      wt->set_affinity(thread_cpus[thread_index]);
+    }
     threads_shardedpool.push_back(wt);
     wt->create(thread_name.c_str());
     thread_index++;
@@ -693,6 +693,7 @@ private:
   };
 
   vector<WorkThreadSharded*> threads_shardedpool;
+  vector<int> thread_cpus;  ///< cpu for each thread index, if pinned
   void start_threads();
   void shardedthreadpool_worker(uint32_t thread_index);
   void set_wq(BaseShardedWQ* swq) {
@@ -707,6 +708,10 @@ public:
 
   ~ShardedThreadPool(){};
 
+  /// pin thread i to cpus[i]; must be called before start()
+  void set_thread_cpus(const vector<int>& cpus) {
+    thread_cpus = cpus;
+  }
   /// start thread pool thread
   void start();
   /// stop thread pool thread
@@ -11,6 +11,11 @@
 #include "common/crc32c_aarch64.h"
 #include "common/crc32c_ppc.h"
 
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
 /*
  * choose best implementation based on the CPU architecture.
  */
@@ -236,3 +241,57 @@ uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned len)
     crc = ceph_crc32c(crc, nullptr, remainder);
   return crc;
 }
+
+#if defined(__x86_64__)
+/*
+ * Multi-buffer crc32c: the crc32 instruction has a latency of 3 cycles but
+ * a throughput of 1 per cycle, so a single stream leaves it mostly idle.
+ * Run 4 independent blocks through it in lock step instead.
+ */
+#define CRC32C_LANES 4
+
+__attribute__((target("sse4.2")))
+static void crc32c_blocks_sse42(uint32_t crc, unsigned char const *data,
+				unsigned length, uint32_t *out)
+{
+  uint64_t c[CRC32C_LANES];
+  for (unsigned l = 0; l < CRC32C_LANES; ++l) {
+    c[l] = crc;
+  }
+  unsigned i = 0;
+  for (; i + 8 <= length; i += 8) {
+    for (unsigned l = 0; l < CRC32C_LANES; ++l) {
+      uint64_t w;
+      memcpy(&w, data + l * length + i, sizeof(w));
+      c[l] = _mm_crc32_u64(c[l], w);
+    }
+  }
+  for (; i < length; ++i) {
+    for (unsigned l = 0; l < CRC32C_LANES; ++l) {
+      c[l] = _mm_crc32_u8((uint32_t)c[l], data[l * length + i]);
+    }
+  }
+  for (unsigned l = 0; l < CRC32C_LANES; ++l) {
+    out[l] = (uint32_t)c[l];
+  }
+}
+#endif
+
+void ceph_crc32c_blocks(uint32_t crc, unsigned char const *data,
+			unsigned length, unsigned n, uint32_t *out)
+{
+#if defined(__x86_64__)
+  if (ceph_arch_intel_sse42) {
+    while (n >= CRC32C_LANES) {
+      crc32c_blocks_sse42(crc, data, length, out);
+      data += CRC32C_LANES * length;
+      out += CRC32C_LANES;
+      n -= CRC32C_LANES;
+    }
+  }
+#endif
+  while (n--) {
+    *out++ = ceph_crc32c(crc, data, length);
+    data += length;
+  }
+}
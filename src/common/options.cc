@@ -834,7 +834,8 @@ std::vector<Option> get_global_options() {
 
     Option("ms_type", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("async+posix")
-    .set_description(""),
+    .set_description("Messenger implementation to use")
+    .set_long_description("async+posix uses TCP sockets.  async+loopback only connects messengers within the same process, passing buffers between them without going through the kernel; it suits daemons run together in one process and messenger benchmarks."),
 
     Option("ms_public_type", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("")
@@ -892,6 +893,12 @@ std::vector<Option> get_global_options() {
     .set_default(100_M)
     .set_description(""),
 
+    Option("ms_dispatch_shards", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_min(1)
+    .set_description("Number of dispatch threads per messenger")
+    .set_long_description("Messages that cannot be fast dispatched are queued to one of these threads, chosen by connection, so each connection is still dispatched in order.  With more than one, ms_dispatch() is called concurrently for different connections, which every dispatcher of the daemon must tolerate."),
+
     Option("ms_bind_ipv6", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
     .set_description(""),
@@ -984,6 +991,29 @@ std::vector<Option> get_global_options() {
     .set_min_max(1, 24)
     .set_description(""),
 
+    Option("ms_async_send_batch_messages", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(32)
+    .set_min(1)
+    .set_description("Most queued messages on a connection written with one send")
+    .set_long_description("When several messages are queued on a connection they are encoded into one buffer and written with a single vectored send, until this many messages or ms_async_send_batch_bytes bytes are pending.  1 writes each message on its own.  Applies to new connections.")
+    .add_see_also("ms_async_send_batch_bytes"),
+
+    Option("ms_async_send_batch_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(128_K)
+    .set_description("Most bytes of queued messages on a connection written with one send")
+    .add_see_also("ms_async_send_batch_messages"),
+
+    Option("ms_async_send_zerocopy_min_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Send writes of at least this many bytes with MSG_ZEROCOPY")
+    .set_long_description("With the posix network stack on Linux 4.14 or later, large sends are handed to the kernel without copying; the sent buffers are held until the kernel reports it is done with them.  Zero-copy has a fixed per-send cost, so it only pays off for large payloads (tens of KB and up).  A connection that the kernel copies for anyway, such as over loopback, stops using it.  0 disables it.  Applies to new connections."),
+
+    Option("ms_async_loopback_max_queued_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4_M)
+    .set_min(1)
+    .set_description("Unread bytes an async+loopback connection holds per direction")
+    .set_long_description("Sends stop being accepted once this much is waiting for the peer, as with a full socket send buffer, and resume as the peer reads.  Applies to new connections."),
+
     Option("ms_async_max_op_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(5)
     .set_description(""),
@@ -2164,6 +2194,12 @@ std::vector<Option> get_global_options() {
     .set_default(50)
     .set_description(""),
 
+    Option("osd_map_cache_max_rebuild_epochs", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(10)
+    .set_description("Max incrementals to apply to a cached osdmap instead of decoding a full map on a cache miss")
+    .set_long_description("A map rebuilt from an older cached epoch shares its unchanged crush map, pools, and address and temp mappings with that epoch.  0 always decodes the full map.")
+    .add_see_also("osd_map_cache_size"),
+
     Option("osd_map_message_max", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(40)
     .set_description(""),
@@ -2232,6 +2268,19 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_STARTUP)
     .set_description(""),
 
+    Option("osd_op_shard_run_to_completion", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Run each op shard on a single thread that owns the shard's PGs")
+    .set_long_description("The osd_op_num_threads_per_shard* options are ignored: every shard gets exactly one thread (pinned to a cpu if osd_op_shard_cpus is set) and work from other threads is handed to it through a lock-free queue instead of the shard locks.  Consider raising osd_op_num_shards to the number of cores the OSD should use.")
+    .add_see_also({"osd_op_shard_cpus", "osd_op_num_shards"}),
+
+    Option("osd_op_shard_cpus", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Comma separated cpus to pin op shard threads to in run-to-completion mode; shard N uses the Nth cpu")
+    .add_see_also("osd_op_shard_run_to_completion"),
+
     Option("osd_op_num_shards", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(0)
     .set_flag(Option::FLAG_STARTUP)
@@ -2581,6 +2630,25 @@ std::vector<Option> get_global_options() {
     .add_see_also("osd_op_queue_mclock_scrub_wgt")
     .add_see_also("osd_op_queue_mclock_anticipation_timeout"),
 
+    Option("osd_op_queue_mclock_adaptive", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("scale mclock background op classes by object store commit latency")
+    .set_long_description("when osd_op_queue is either 'mclock_opclass' or 'mclock_client', periodically compare the object store's commit latency with osd_op_queue_mclock_adaptive_target_latency and scale the reservation, weight and limit of snap trim, recovery, scrub and pg deletion down while it is exceeded, and back up toward their configured values once it is not")
+    .add_see_also("osd_op_queue")
+    .add_see_also("osd_op_queue_mclock_adaptive_target_latency")
+    .add_see_also("osd_op_queue_mclock_adaptive_min_scale"),
+
+    Option("osd_op_queue_mclock_adaptive_target_latency", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.05)
+    .set_description("commit latency in seconds above which adaptive mclock throttles background op classes")
+    .add_see_also("osd_op_queue_mclock_adaptive"),
+
+    Option("osd_op_queue_mclock_adaptive_min_scale", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.1)
+    .set_min_max(.01, 1.0)
+    .set_description("lowest fraction of their configured values adaptive mclock scales background op classes to")
+    .add_see_also("osd_op_queue_mclock_adaptive"),
+
     Option("osd_op_queue_mclock_anticipation_timeout", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(0.0)
     .set_description("mclock anticipation timeout in seconds")
@@ -2742,6 +2810,32 @@ std::vector<Option> get_global_options() {
     .set_default(512)
     .set_description(""),
 
+    Option("osd_op_fast_read_max_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_description("Largest read served without building a full op context")
+    .set_long_description("A lone read, stat or getxattr of a head object in a replicated pool without cache tiering is executed directly in do_op when it returns at most this many bytes.  0 sends every read through the full op path."),
+
+    Option("osd_op_rx_buffer_min_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_description("Read the data of client and replica writes at least this large into OSD supplied buffers")
+    .set_long_description("The OSD hands the messenger page aligned buffers from a pool of recycled ones, so large writes do not fault in freshly mapped memory every time.  0 leaves the messenger to allocate."),
+
+    Option("osd_op_rx_buffer_pool_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64_M)
+    .set_description("Memory kept for reuse by the write data buffer pool")
+    .set_long_description("See osd_op_rx_buffer_min_bytes.  Takes effect on restart."),
+
+    Option("osd_hot_spot_tracker_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(32)
+    .set_description("Objects and clients tracked per op shard to find the busiest ones")
+    .set_long_description("Each op shard keeps a space-saving sketch of this many objects and this many clients, ranked by ops; any object or client receiving more than 1/size of a shard's ops is guaranteed to be listed by the dump_hot_objects admin socket command.  0 disables tracking.  Takes effect on restart.")
+    .add_see_also("osd_hot_spot_tracker_halflife"),
+
+    Option("osd_hot_spot_tracker_halflife", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(60)
+    .set_description("Seconds between halvings of the hot object and client counts")
+    .add_see_also("osd_hot_spot_tracker_size"),
+
     Option("osd_op_thread_timeout", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(15)
     .set_description(""),
@@ -2810,6 +2904,24 @@ std::vector<Option> get_global_options() {
     .set_default(20)
     .set_description(""),
 
+    Option("osd_heartbeat_phi_threshold", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Report a heartbeat peer failed once its phi accrual suspicion level exceeds this")
+    .set_long_description("Each peer's ping reply arrivals are tracked and the time since the last one is turned into phi = -log10(probability the peer is merely late).  When positive, a peer with enough history is reported to the monitor when its phi exceeds this value instead of when osd_heartbeat_grace passes: a peer whose replies are late but in line with their usual jitter is not reported, and one that stops replying abruptly is reported sooner.  A silent peer is still reported after osd_heartbeat_phi_grace_max.  The monitor only marks a peer down once its grace (osd_heartbeat_grace, adjusted for laggy osds) has passed since the peer's last reply, so the detector can avoid false reports but detection takes at least that long.  8 is a reasonable value.  0 disables the detector.")
+    .add_see_also("osd_heartbeat_grace")
+    .add_see_also("osd_heartbeat_phi_min_samples")
+    .add_see_also("osd_heartbeat_phi_grace_max"),
+
+    Option("osd_heartbeat_phi_grace_max", Option::TYPE_INT, Option::LEVEL_ADVANCED)
+    .set_default(60)
+    .set_description("Seconds without a reply after which a peer is reported failed even if its phi is below osd_heartbeat_phi_threshold")
+    .add_see_also("osd_heartbeat_phi_threshold"),
+
+    Option("osd_heartbeat_phi_min_samples", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(10)
+    .set_description("Ping replies needed from a peer before its phi accrual suspicion level is used")
+    .add_see_also("osd_heartbeat_phi_threshold"),
+
     Option("osd_heartbeat_min_peers", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(10)
     .set_description(""),
@@ -3284,6 +3396,12 @@ std::vector<Option> get_global_options() {
     .set_default(true)
     .set_description(""),
 
+    Option("osd_pg_log_embed_fastinfo", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Store a PG's fast info update with the newest pg log entry written in the same transaction instead of in a separate key")
+    .set_long_description("This saves one omap key update per client write.  OSDs that predate this option ignore the embedded info and see a stale PG info, so do not downgrade once it has been enabled.")
+    .add_see_also("osd_fast_info"),
+
     Option("osd_debug_pg_log_writeout", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(false)
     .set_description(""),
@@ -3606,6 +3724,24 @@ std::vector<Option> get_global_options() {
     .set_default(true)
     .set_description(""),
 
+    Option("bdev_ioring", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Use io_uring instead of libaio for kernel block devices")
+    .set_long_description("Falls back to libaio if ceph was built without liburing or the running kernel does not support io_uring.")
+    .add_see_also("bdev_aio"),
+
+    Option("bdev_ioring_hipri", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Poll for io_uring completions instead of waiting for interrupts (IORING_SETUP_IOPOLL)")
+    .set_long_description("Only valid for O_DIRECT I/O; do not combine with bluefs_buffered_io or buffered bluestore writes.  Ignored, with an error logged, if the device does not support polled I/O.")
+    .add_see_also("bdev_ioring"),
+
+    Option("bdev_ioring_sqthread_poll", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Have a kernel thread poll the io_uring submission queue (IORING_SETUP_SQPOLL)")
+    .set_long_description("Avoids the io_uring_enter(2) syscall per submission at the cost of a busy kernel thread per device.")
+    .add_see_also("bdev_ioring"),
+
     Option("bdev_aio_poll_ms", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(250)
     .set_description(""),
@@ -3948,6 +4084,12 @@ std::vector<Option> get_global_options() {
     .set_default(256)
     .set_description("Preallocated buffer for inline shards"),
 
+    Option("bluestore_extent_map_shard_compact", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Encode extent map shards in the compact (v3) format")
+    .set_long_description("v3 shards carry an exact blob count and refer to blobs by their ordinal within the shard, which keeps blob ids to a single varint byte and lets the decoder size its blob table once.  Shards are rewritten lazily as they are dirtied; a repair pass (ceph-bluestore-tool repair) rewrites all remaining shards.  Older releases cannot read v3 shards, so the first v3 write permanently raises the store's min_compat_ondisk_format and older releases will refuse to mount it; only enable this once downgrade is no longer needed."),
+
     Option("bluestore_cache_trim_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(.05)
     .set_description("How frequently we trim the bluestore cache"),
@@ -3969,6 +4111,11 @@ std::vector<Option> get_global_options() {
     .set_default(.5)
     .set_description("2Q paper suggests .5"),
 
+    Option("bluestore_cache_lockless_reads", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Serve onode and buffer cache hits without taking the cache shard lock")
+    .set_long_description("Cache hits only take a shared lock and mark the entry referenced; the lru position is updated lazily when the cache is trimmed.  Inserts and trims still take the cache shard lock.  This lets small random reads scale with the number of op shards."),
+
     Option("bluestore_cache_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(0)
     .set_description("Cache size (in bytes) for BlueStore")
@@ -4009,9 +4156,21 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_allocator", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("stupid")
-    .set_enum_allowed({"bitmap", "stupid"})
+    .set_enum_allowed({"bitmap", "stupid", "hybrid"})
     .set_description("Allocator policy"),
 
+    Option("bluestore_hybrid_alloc_mem_cap", Option::TYPE_SIZE, Option::LEVEL_DEV)
+    .set_default(64_M)
+    .set_description("Memory budget for the free extent trees of the hybrid allocator")
+    .set_long_description("Once the trees would exceed this, the smallest free extents are tracked in a bitmap instead.")
+    .add_see_also("bluestore_allocator"),
+
+    Option("bluestore_alloc_checkpoint", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Save the allocator free space to bluefs on umount and load it on the next mount instead of walking the freelist")
+    .set_long_description("The checkpoint is tied to the freelist by a nonce stored in the key/value store, which is removed as soon as the allocator is opened, so any mount that does not go through a clean umount falls back to the freelist.  While a checkpoint is outstanding the store cannot be mounted by releases that do not know about it; to downgrade, mount once with this option disabled.  Has no effect for allocators that cannot enumerate their free space (bitmap).")
+    .add_see_also("bluestore_allocator"),
+
     Option("bluestore_freelist_blocks_per_key", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(128)
     .set_description("Block (and bits) per database key"),
@@ -4068,6 +4227,17 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description("Try to submit metadata transaction to rocksdb in queuing thread context"),
 
+    Option("bluestore_kv_sync_pipeline", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Overlap the kv sync commit with preparation of the next batch")
+    .set_long_description("When enabled, a dedicated bstore_kv_commit thread performs the synchronous kv commit while bstore_kv_sync flushes the device and submits transactions for the following batch.  At most one batch is in flight between the two."),
+
+    Option("bluestore_kv_finalize_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_min(1)
+    .set_description("Number of threads completing committed transactions")
+    .set_long_description("Committed transactions are sharded across finalize threads by sequencer, so completions within a sequencer stay ordered."),
+
     Option("bluestore_throttle_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
     .set_default(64_M)
     .set_flag(Option::FLAG_RUNTIME)
@@ -4109,6 +4279,13 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Default bluestore_deferred_batch_ops for non-rotational (solid state) media"),
 
+    Option("bluestore_deferred_coalesce", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Submit deferred writes from all sequencers as one sorted batch")
+    .set_long_description("When deferred writes are flushed, merge the pending batches of all op sequencers so that writes adjacent on disk are issued as a single larger IO.  This mostly helps rotational devices, where many small deferred writes to neighbouring blocks are otherwise seek-bound.")
+    .add_see_also("bluestore_deferred_batch_ops"),
+
     Option("bluestore_nid_prealloc", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(1024)
     .set_description("Number of unique object ids to preallocate at a time"),
@@ -4127,6 +4304,37 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Cache read results by default (unless hinted NOCACHE or WONTNEED)"),
 
+    Option("bluestore_readahead_max_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Largest window to read ahead of a sequential reader (0 to use the hdd or ssd value)")
+    .set_long_description("Once an object has been read sequentially bluestore_readahead_trigger_requests times, the following data is prefetched into the buffer cache asynchronously.  The window starts at the size of the reads seen so far (at least bluestore_readahead_min_bytes) and doubles as the stream continues, up to this limit.  Changes apply to objects that enter the cache afterwards.")
+    .add_see_also({"bluestore_readahead_max_bytes_hdd", "bluestore_readahead_max_bytes_ssd"}),
+
+    Option("bluestore_readahead_max_bytes_hdd", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2_M)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Default bluestore_readahead_max_bytes for rotational media")
+    .add_see_also("bluestore_readahead_max_bytes"),
+
+    Option("bluestore_readahead_max_bytes_ssd", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Default bluestore_readahead_max_bytes for non-rotational media (0 disables readahead)")
+    .add_see_also("bluestore_readahead_max_bytes"),
+
+    Option("bluestore_readahead_min_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Smallest window to read ahead of a sequential reader")
+    .add_see_also("bluestore_readahead_max_bytes"),
+
+    Option("bluestore_readahead_trigger_requests", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Number of back to back sequential reads of an object before reading ahead")
+    .add_see_also("bluestore_readahead_max_bytes"),
+
     Option("bluestore_default_buffered_write", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
     .set_flag(Option::FLAG_RUNTIME)
@@ -4191,6 +4399,14 @@ std::vector<Option> get_global_options() {
     Option("bluestore_debug_inject_bug21040", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(false)
     .set_description(""),
+
+    Option("bluestore_debug_alloc_checkpoint_omit_key", Option::TYPE_BOOL, Option::LEVEL_DEV)
+    .set_default(false)
+    .set_description("Write the allocator checkpoint on umount but not the key that validates it"),
+
+    Option("bluestore_debug_alloc_checkpoint_stale_nonce", Option::TYPE_BOOL, Option::LEVEL_DEV)
+    .set_default(false)
+    .set_description("Record a nonce that does not match the allocator checkpoint on umount"),
     // -----------------------------------------
     // kstore
 
@@ -58,11 +58,26 @@ private:
     contents.erase(i);
   }
 
+  void lru_touch(typename list<pair<K, VPtr> >::iterator p) {
+    if (p != lru.begin())
+      lru.splice(lru.begin(), lru, p);
+  }
+
+  /// strong ref to key if it is still on the lru, without touching weak_refs
+  VPtr lru_lookup(const K& key) {
+    typename ceph::unordered_map<K, typename list<pair<K, VPtr> >::iterator, H>::iterator i =
+      contents.find(key);
+    if (i == contents.end())
+      return VPtr();
+    lru_touch(i->second);
+    return i->second->second;
+  }
+
   void lru_add(const K& key, const VPtr& val, list<VPtr> *to_release) {
     typename ceph::unordered_map<K, typename list<pair<K, VPtr> >::iterator, H>::iterator i =
       contents.find(key);
     if (i != contents.end()) {
-      lru.splice(lru.begin(), lru, i->second);
+      lru_touch(i->second);
     } else {
       ++size;
       lru.push_front(make_pair(key, val));
@@ -77,7 +92,8 @@ private:
     if (i != weak_refs.end() && i->second.second == valptr) {
       weak_refs.erase(i);
     }
-    cond.Signal();
+    if (waiting)
+      cond.Signal();
   }
 
   class Cleanup {
@@ -268,6 +284,11 @@ public:
     list<VPtr> to_release;
     {
       Mutex::Locker l(lock);
+      // hot keys are on the lru; the hash lookup there is much cheaper
+      // than walking weak_refs with the full key comparator
+      val = lru_lookup(key);
+      if (val)
+	return val;
       ++waiting;
       bool retry = false;
       do {
@@ -293,6 +314,9 @@ public:
     list<VPtr> to_release;
     {
       Mutex::Locker l(lock);
+      val = lru_lookup(key);
+      if (val)
+	return val;
       bool retry = false;
       do {
 	retry = false;
@@ -306,8 +330,11 @@ public:
 	    retry = true;
 	  }
 	}
-	if (retry)
+	if (retry) {
+	  ++waiting;
 	  cond.Wait(lock);
+	  --waiting;
+	}
       } while (retry);
 
       V *new_value = new V();
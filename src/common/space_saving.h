@@ -0,0 +1,117 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_SPACE_SAVING_H
+#define CEPH_COMMON_SPACE_SAVING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Space-saving heavy hitter sketch (Metwally et al.).
+ *
+ * Keeps at most @capacity counters.  A key that is not tracked replaces
+ * the smallest counter and inherits its count, so every key whose true
+ * count exceeds total/capacity is guaranteed to be present, and a
+ * key's count overestimates its true count by at most its error.
+ * Not thread safe.
+ */
+template <class K, class H = std::hash<K>>
+class SpaceSaving {
+public:
+  struct counter_t {
+    uint64_t count = 0;   ///< hits, including inherited ones
+    uint64_t error = 0;   ///< upper bound on the overestimate of count
+    uint64_t bytes = 0;   ///< bytes seen since the key was (re)tracked
+  };
+
+private:
+  size_t capacity;
+  std::unordered_map<K, counter_t, H> counters;
+
+  typename std::unordered_map<K, counter_t, H>::iterator find_min() {
+    auto m = counters.begin();
+    for (auto p = counters.begin(); p != counters.end(); ++p) {
+      if (p->second.count < m->second.count) {
+	m = p;
+      }
+    }
+    return m;
+  }
+
+public:
+  explicit SpaceSaving(size_t capacity) : capacity(capacity) {
+    counters.reserve(capacity);
+  }
+
+  size_t size() const {
+    return counters.size();
+  }
+  size_t get_capacity() const {
+    return capacity;
+  }
+  void clear() {
+    counters.clear();
+  }
+
+  void add(const K& k, uint64_t bytes, uint64_t n = 1) {
+    auto p = counters.find(k);
+    if (p == counters.end()) {
+      if (!capacity) {
+	return;
+      }
+      counter_t c;
+      if (counters.size() >= capacity) {
+	auto m = find_min();
+	c.count = c.error = m->second.count;
+	counters.erase(m);
+      }
+      p = counters.emplace(k, c).first;
+    }
+    p->second.count += n;
+    p->second.bytes += bytes;
+  }
+
+  /// halve every counter so that old traffic fades out
+  void decay() {
+    for (auto p = counters.begin(); p != counters.end(); ) {
+      p->second.count /= 2;
+      p->second.error /= 2;
+      p->second.bytes /= 2;
+      if (!p->second.count) {
+	p = counters.erase(p);
+      } else {
+	++p;
+      }
+    }
+  }
+
+  /// up to @n tracked keys, highest count first
+  std::vector<std::pair<K, counter_t>> top(size_t n) const {
+    std::vector<std::pair<K, counter_t>> v(counters.begin(), counters.end());
+    auto by_count = [](const std::pair<K, counter_t>& a,
+		       const std::pair<K, counter_t>& b) {
+      return a.second.count > b.second.count;
+    };
+    if (v.size() > n) {
+      std::partial_sort(v.begin(), v.begin() + n, v.end(), by_count);
+      v.resize(n);
+    } else {
+      std::sort(v.begin(), v.end(), by_count);
+    }
+    return v;
+  }
+};
+
+#endif
@@ -50,6 +50,22 @@ static inline uint32_t ceph_crc32c(uint32_t crc, unsigned char const *data, unsi
   return ceph_crc32c_func(crc, data, length);
 }
 
+/**
+ * calculate crc32c for each of n consecutive, equally sized blocks
+ *
+ * Equivalent to out[i] = ceph_crc32c(crc, data + i * length, length) for
+ * i in [0, n), but where the CPU allows several blocks are processed in
+ * parallel to hide the latency of the crc instruction.
+ *
+ * @param crc initial value for every block
+ * @param data pointer to n * length bytes
+ * @param length length of each block
+ * @param n number of blocks
+ * @param out array of n crc values
+ */
+void ceph_crc32c_blocks(uint32_t crc, unsigned char const *data,
+			unsigned length, unsigned n, uint32_t *out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -152,6 +152,25 @@ epoch_t LastEpochClean::get_lower_bound(const OSDMap& latest) const
   return floor;
 }
 
+Message::EncodingCacheRef OSDMapEncodings::get(version_t oldest,
+						 epoch_t newest,
+						 epoch_t first, epoch_t last,
+						 size_t max_entries)
+{
+  auto b = make_pair(oldest, newest);
+  auto range = make_pair(first, last);
+  if (b != bounds ||
+      (encodings.size() >= max_entries && !encodings.count(range))) {
+    encodings.clear();
+    bounds = b;
+  }
+  auto& c = encodings[range];
+  if (!c) {
+    c = std::make_shared<Message::EncodingCache>();
+  }
+  return c;
+}
+
 
 class C_UpdateCreatingPGs : public Context {
 public:
@@ -1016,7 +1035,7 @@ void OSDMonitor::encode_pending(MonitorDBStore::TransactionRef t)
 	  continue;
 	}
 	if (pending_inc.new_pools.count(p) == 0) {
-	  pending_inc.new_pools[p] = tmp.pools[p];
+	  pending_inc.new_pools[p] = tmp.pools->at(p);
 	}
 	pending_inc.new_pools[p].flags |= pg_pool_t::FLAG_FULL;
 	pending_inc.new_pools[p].flags &= ~pg_pool_t::FLAG_BACKFILLFULL;
@@ -1062,7 +1081,7 @@ void OSDMonitor::encode_pending(MonitorDBStore::TransactionRef t)
 	dout(10) << __func__ << " marking pool '" << tmp.pool_name[p]
 		 << "'s as backfillfull" << dendl;
 	if (pending_inc.new_pools.count(p) == 0) {
-	  pending_inc.new_pools[p] = tmp.pools[p];
+	  pending_inc.new_pools[p] = tmp.pools->at(p);
 	}
 	pending_inc.new_pools[p].flags |= pg_pool_t::FLAG_BACKFILLFULL;
 	pending_inc.new_pools[p].flags &= ~pg_pool_t::FLAG_NEARFULL;
@@ -1105,7 +1124,7 @@ void OSDMonitor::encode_pending(MonitorDBStore::TransactionRef t)
 	dout(10) << __func__ << " marking pool '" << tmp.pool_name[p]
 		 << "'s as nearfull" << dendl;
 	if (pending_inc.new_pools.count(p) == 0) {
-	  pending_inc.new_pools[p] = tmp.pools[p];
+	  pending_inc.new_pools[p] = tmp.pools->at(p);
 	}
 	pending_inc.new_pools[p].flags |= pg_pool_t::FLAG_NEARFULL;
       }
@@ -2872,7 +2891,7 @@ bool OSDMonitor::prepare_remove_snaps(MonOpRequestRef op)
       continue;
     }
 
-    pg_pool_t& pi = osdmap.pools[p->first];
+    const pg_pool_t& pi = osdmap.pools->at(p->first);
     for (vector<snapid_t>::iterator q = p->second.begin();
 	 q != p->second.end();
 	 ++q) {
@@ -3001,6 +3020,13 @@ MOSDMap *OSDMonitor::build_incremental(epoch_t from, epoch_t to)
   return m;
 }
 
+Message::EncodingCacheRef OSDMonitor::get_osdmap_encoding(epoch_t first,
+							  epoch_t last)
+{
+  return osdmap_encodings.get(get_first_committed(), osdmap.get_epoch(),
+			      first, last, g_conf->mon_osd_cache_size);
+}
+
 void OSDMonitor::send_full(MonOpRequestRef op)
 {
   op->mark_osdmon_event(__func__);
@@ -3075,6 +3101,7 @@ void OSDMonitor::send_incremental(epoch_t first,
     epoch_t last = std::min<epoch_t>(first + g_conf->osd_map_message_max - 1,
 				     osdmap.get_epoch());
     MOSDMap *m = build_incremental(first, last);
+    m->set_encoding_cache(get_osdmap_encoding(first, last));
 
     if (req) {
       // send some maps.  it may not be all of them, but it will get them
@@ -4055,8 +4082,8 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
     cmd_getval(cct, cmdmap, "auid", auid, int64_t(0));
     if (f)
       f->open_array_section("pools");
-    for (map<int64_t, pg_pool_t>::iterator p = osdmap.pools.begin();
-	 p != osdmap.pools.end();
+    for (auto p = osdmap.pools->begin();
+	 p != osdmap.pools->end();
 	 ++p) {
       if (!auid || p->second.auid == (uint64_t)auid) {
 	if (f) {
@@ -4066,7 +4093,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	  f->close_section();
 	} else {
 	  ds << p->first << ' ' << osdmap.pool_name[p->first];
-	  if (next(p) != osdmap.pools.end()) {
+	  if (next(p) != osdmap.pools->end()) {
 	    ds << '\n';
 	  }
 	}
@@ -4883,7 +4910,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
     if (pool_name.empty()) {
       // all
       f->open_object_section("pools");
-      for (const auto &pool : osdmap.pools) {
+      for (const auto &pool : *osdmap.pools) {
         std::string name("<unknown>");
         const auto &pni = osdmap.pool_name.find(pool.first);
         if (pni != osdmap.pool_name.end())
@@ -8429,7 +8456,7 @@ bool OSDMonitor::prepare_command_impl(MonOpRequestRef op,
     if (erasure_code_profile_in_use(pending_inc.new_pools, name, &ss))
       goto wait;
 
-    if (erasure_code_profile_in_use(osdmap.pools, name, &ss)) {
+    if (erasure_code_profile_in_use(*osdmap.pools, name, &ss)) {
       err = -EBUSY;
       goto reply;
     }
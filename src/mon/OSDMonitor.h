@@ -123,6 +123,21 @@ public:
   epoch_t get_lower_bound(const OSDMap& latest) const;
 };
 
+// encoded MOSDMaps shared by the sessions catching up over the same
+// [first,last] range.  every MOSDMap also carries oldest_map and
+// newest_map, so the entries only hold until either of those moves.
+class OSDMapEncodings {
+  map<pair<epoch_t,epoch_t>, Message::EncodingCacheRef> encodings;
+  pair<version_t,epoch_t> bounds;
+public:
+  Message::EncodingCacheRef get(version_t oldest, epoch_t newest,
+				epoch_t first, epoch_t last,
+				size_t max_entries);
+  size_t size() const {
+    return encodings.size();
+  }
+};
+
 
 class OSDMonitor : public PaxosService {
   CephContext *cct;
@@ -142,6 +157,9 @@ public:
   SimpleLRU<version_t, bufferlist> inc_osd_cache;
   SimpleLRU<version_t, bufferlist> full_osd_cache;
 
+  OSDMapEncodings osdmap_encodings;
+  Message::EncodingCacheRef get_osdmap_encoding(epoch_t first, epoch_t last);
+
   bool check_failures(utime_t now);
   bool check_failure(utime_t now, int target_osd, failure_info_t& fi);
   void force_failure(int target_osd, int by);
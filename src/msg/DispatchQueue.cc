@@ -16,6 +16,7 @@
 #include "DispatchQueue.h"
 #include "Messenger.h"
 #include "common/ceph_context.h"
+#include "include/stringify.h"
 
 #define dout_subsys ceph_subsys_ms
 #include "common/debug.h"
@@ -28,12 +29,90 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "-- " << msgr->get_myaddr() << " "
 
-double DispatchQueue::get_max_age(utime_t now) const {
+enum {
+  l_dispatch_queue_first = 94100,
+  l_dispatch_queue_len,
+  l_dispatch_queue_dispatched,
+  l_dispatch_queue_wait,
+  l_dispatch_queue_dispatch_lat,
+  l_dispatch_queue_last,
+};
+
+DispatchQueue::Shard::Shard(DispatchQueue *dq, unsigned i, const string &name,
+			    bool counters)
+  : dq(dq),
+    lock("Messenger::DispatchQueue::lock" + name),
+    mqueue(dq->cct->_conf->ms_pq_max_tokens_per_priority,
+	   dq->cct->_conf->ms_pq_min_cost),
+    dispatch_thread(this)
+{
+  if (!counters) {
+    return;
+  }
+  PerfCountersBuilder b(dq->cct,
+			"msgr_dispatch_queue-" + name + "-" + stringify(i),
+			l_dispatch_queue_first, l_dispatch_queue_last);
+  b.add_u64(l_dispatch_queue_len, "queue_len",
+	    "Messages and events waiting for dispatch");
+  b.add_u64_counter(l_dispatch_queue_dispatched, "dispatched",
+		    "Messages dispatched");
+  b.add_time_avg(l_dispatch_queue_wait, "wait",
+		 "Time from receiving a message to dispatching it");
+  b.add_time_avg(l_dispatch_queue_dispatch_lat, "dispatch_lat",
+		 "Time spent in ms_dispatch");
+  logger = { b.create_perf_counters(), dq->cct };
+  dq->cct->get_perfcounters_collection()->add(logger.get());
+}
+
+void DispatchQueue::Shard::enqueue_code(int type, Connection *con)
+{
   Mutex::Locker l(lock);
-  if (marrival.empty())
-    return 0;
-  else
-    return (now - marrival.begin()->first);
+  if (dq->stop)
+    return;
+  mqueue.enqueue_strict(
+    0,
+    CEPH_MSG_PRIO_HIGHEST,
+    QueueItem(type, con));
+  if (logger)
+    logger->set(l_dispatch_queue_len, mqueue.length());
+  cond.Signal();
+}
+
+DispatchQueue::DispatchQueue(CephContext *cct, Messenger *msgr, string &name)
+  : cct(cct), msgr(msgr),
+    next_id(1),
+    local_delivery_lock("Messenger::DispatchQueue::local_delivery_lock" + name),
+    stop_local_delivery(false),
+    local_delivery_thread(this),
+    dispatch_throttler(cct, string("msgr_dispatch_throttler-") + name,
+		       cct->_conf->ms_dispatch_throttle_bytes),
+    stop(false)
+{
+  unsigned num_shards = std::max<uint64_t>(
+    cct->_conf->get_val<uint64_t>("ms_dispatch_shards"), 1);
+  for (unsigned i = 0; i < num_shards; ++i) {
+    shards.emplace_back(new Shard(this, i, name, num_shards > 1));
+  }
+}
+
+double DispatchQueue::get_max_age(utime_t now) const {
+  double age = 0;
+  for (auto& s : shards) {
+    Mutex::Locker l(s->lock);
+    if (!s->marrival.empty())
+      age = std::max<double>(age, now - s->marrival.begin()->first);
+  }
+  return age;
+}
+
+int DispatchQueue::get_queue_len() const
+{
+  int len = 0;
+  for (auto& s : shards) {
+    Mutex::Locker l(s->lock);
+    len += s->mqueue.length();
+  }
+  return len;
 }
 
 uint64_t DispatchQueue::pre_dispatch(Message *m)
@@ -79,22 +158,24 @@ void DispatchQueue::fast_preprocess(Message *m)
 
 void DispatchQueue::enqueue(Message *m, int priority, uint64_t id)
 {
-
-  Mutex::Locker l(lock);
+  Shard& s = get_shard(m->get_connection().get());
+  Mutex::Locker l(s.lock);
   if (stop) {
     m->put();
     return;
   }
   ldout(cct,20) << "queue " << m << " prio " << priority << dendl;
-  add_arrival(m);
+  s.add_arrival(m);
   if (priority >= CEPH_MSG_PRIO_LOW) {
-    mqueue.enqueue_strict(
+    s.mqueue.enqueue_strict(
         id, priority, QueueItem(m));
   } else {
-    mqueue.enqueue(
+    s.mqueue.enqueue(
         id, priority, m->get_cost(), QueueItem(m));
   }
-  cond.Signal();
+  if (s.logger)
+    s.logger->set(l_dispatch_queue_len, s.mqueue.length());
+  s.cond.Signal();
 }
 
 void DispatchQueue::local_delivery(Message *m, int priority)
@@ -152,15 +233,17 @@ void DispatchQueue::dispatch_throttle_release(uint64_t msize)
  * end of the queue. If the queue is empty; it's removed.
  * The message is then delivered and the process starts again.
  */
-void DispatchQueue::entry()
+void DispatchQueue::entry(Shard &shard)
 {
-  lock.Lock();
+  shard.lock.Lock();
   while (true) {
-    while (!mqueue.empty()) {
-      QueueItem qitem = mqueue.dequeue();
+    while (!shard.mqueue.empty()) {
+      QueueItem qitem = shard.mqueue.dequeue();
       if (!qitem.is_code())
-	remove_arrival(qitem.get_message());
-      lock.Unlock();
+	shard.remove_arrival(qitem.get_message());
+      if (shard.logger)
+	shard.logger->set(l_dispatch_queue_len, shard.mqueue.length());
+      shard.lock.Unlock();
 
       if (qitem.is_code()) {
 	if (cct->_conf->ms_inject_internal_delays &&
@@ -196,51 +279,70 @@ void DispatchQueue::entry()
 	if (stop) {
 	  ldout(cct,10) << " stop flag set, discarding " << m << " " << *m << dendl;
 	  m->put();
+	} else if (!shard.logger) {
+	  uint64_t msize = pre_dispatch(m);
+	  msgr->ms_deliver_dispatch(m);
+	  post_dispatch(m, msize);
 	} else {
+	  utime_t start = ceph_clock_now();
+	  shard.logger->tinc(l_dispatch_queue_wait,
+			     start - m->get_recv_stamp());
 	  uint64_t msize = pre_dispatch(m);
 	  msgr->ms_deliver_dispatch(m);
 	  post_dispatch(m, msize);
+	  shard.logger->inc(l_dispatch_queue_dispatched);
+	  shard.logger->tinc(l_dispatch_queue_dispatch_lat,
+			     ceph_clock_now() - start);
 	}
       }
 
-      lock.Lock();
+      shard.lock.Lock();
     }
     if (stop)
       break;
 
     // wait for something to be put on queue
-    cond.Wait(lock);
+    shard.cond.Wait(shard.lock);
   }
-  lock.Unlock();
+  shard.lock.Unlock();
 }
 
 void DispatchQueue::discard_queue(uint64_t id) {
-  Mutex::Locker l(lock);
-  list<QueueItem> removed;
-  mqueue.remove_by_class(id, &removed);
-  for (list<QueueItem>::iterator i = removed.begin();
-       i != removed.end();
-       ++i) {
-    assert(!(i->is_code())); // We don't discard id 0, ever!
-    Message *m = i->get_message();
-    remove_arrival(m);
-    dispatch_throttle_release(m->get_dispatch_throttle_size());
-    m->put();
+  // the queue does not know which connection id belongs to
+  for (auto& s : shards) {
+    Mutex::Locker l(s->lock);
+    list<QueueItem> removed;
+    s->mqueue.remove_by_class(id, &removed);
+    for (list<QueueItem>::iterator i = removed.begin();
+	 i != removed.end();
+	 ++i) {
+      assert(!(i->is_code())); // We don't discard id 0, ever!
+      Message *m = i->get_message();
+      s->remove_arrival(m);
+      dispatch_throttle_release(m->get_dispatch_throttle_size());
+      m->put();
+    }
+    if (s->logger)
+      s->logger->set(l_dispatch_queue_len, s->mqueue.length());
   }
 }
 
 void DispatchQueue::start()
 {
   assert(!stop);
-  assert(!dispatch_thread.is_started());
-  dispatch_thread.create("ms_dispatch");
+  for (auto& s : shards) {
+    assert(!s->dispatch_thread.is_started());
+    s->dispatch_thread.create("ms_dispatch");
+  }
   local_delivery_thread.create("ms_local");
 }
 
 void DispatchQueue::wait()
 {
   local_delivery_thread.join();
-  dispatch_thread.join();
+  for (auto& s : shards) {
+    s->dispatch_thread.join();
+  }
 }
 
 void DispatchQueue::discard_local()
@@ -262,9 +364,13 @@ void DispatchQueue::shutdown()
   local_delivery_cond.Signal();
   local_delivery_lock.Unlock();
 
-  // stop my dispatch thread
-  lock.Lock();
+  // stop my dispatch threads.  taking a shard's lock before signalling
+  // means its thread is either waiting, and is woken, or has yet to
+  // check stop.
   stop = true;
-  cond.Signal();
-  lock.Unlock();
+  for (auto& s : shards) {
+    s->lock.Lock();
+    s->cond.Signal();
+    s->lock.Unlock();
+  }
 }
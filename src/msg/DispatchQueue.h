@@ -17,13 +17,17 @@
 
 #include <atomic>
 #include <map>
+#include <memory>
+#include <vector>
 #include <boost/intrusive_ptr.hpp>
 #include "include/assert.h"
+#include "include/hash.h"
 #include "include/xlist.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
 #include "common/Thread.h"
 #include "common/PrioritizedQueue.h"
+#include "common/perf_counters.h"
 
 class CephContext;
 class Messenger;
@@ -35,6 +39,13 @@ struct Connection;
  * they want to be dispatched, carefully organized by Message priority
  * and permitted to deliver in a round-robin fashion.
  * See Messenger::dispatch_entry for details.
+ *
+ * The queue is split into ms_dispatch_shards shards, each with its own
+ * dispatch thread.  A connection always maps to the same shard, so its
+ * messages and events are still delivered in order, but the dispatchers
+ * are called concurrently for different connections when there is more
+ * than one shard.  Each shard then has its own perf counters; a single
+ * shard has none, so the default path costs what it did before.
  */
 class DispatchQueue {
   class QueueItem {
@@ -63,46 +74,60 @@ class DispatchQueue {
     
   CephContext *cct;
   Messenger *msgr;
-  mutable Mutex lock;
-  Cond cond;
-
-  PrioritizedQueue<QueueItem, uint64_t> mqueue;
-
-  set<pair<double, Message*> > marrival;
-  map<Message *, set<pair<double, Message*> >::iterator> marrival_map;
-  void add_arrival(Message *m) {
-    marrival_map.insert(
-      make_pair(
-	m,
-	marrival.insert(make_pair(m->get_recv_stamp(), m)).first
-	)
-      );
-  }
-  void remove_arrival(Message *m) {
-    map<Message *, set<pair<double, Message*> >::iterator>::iterator i =
-      marrival_map.find(m);
-    assert(i != marrival_map.end());
-    marrival.erase(i->second);
-    marrival_map.erase(i);
+
+  struct Shard {
+    DispatchQueue *dq;
+    mutable Mutex lock;
+    Cond cond;
+
+    PrioritizedQueue<QueueItem, uint64_t> mqueue;
+
+    set<pair<double, Message*> > marrival;
+    map<Message *, set<pair<double, Message*> >::iterator> marrival_map;
+    void add_arrival(Message *m) {
+      marrival_map.insert(
+	make_pair(
+	  m,
+	  marrival.insert(make_pair(m->get_recv_stamp(), m)).first
+	  )
+	);
+    }
+    void remove_arrival(Message *m) {
+      map<Message *, set<pair<double, Message*> >::iterator>::iterator i =
+	marrival_map.find(m);
+      assert(i != marrival_map.end());
+      marrival.erase(i->second);
+      marrival_map.erase(i);
+    }
+
+    /**
+     * The DispatchThread runs dispatch_entry to empty out the shard.
+     */
+    class DispatchThread : public Thread {
+      Shard *shard;
+    public:
+      explicit DispatchThread(Shard *shard) : shard(shard) {}
+      void *entry() override {
+	shard->dq->entry(*shard);
+	return 0;
+      }
+    } dispatch_thread;
+
+    PerfCountersRef logger;  ///< only with more than one shard
+
+    Shard(DispatchQueue *dq, unsigned i, const string &name, bool counters);
+    void enqueue_code(int type, Connection *con);
+  };
+  vector<std::unique_ptr<Shard>> shards;
+
+  Shard& get_shard(const Connection *con) {
+    return *shards[rjhash64((uintptr_t)con) % shards.size()];
   }
 
   std::atomic<uint64_t> next_id;
     
   enum { D_CONNECT = 1, D_ACCEPT, D_BAD_REMOTE_RESET, D_BAD_RESET, D_CONN_REFUSED, D_NUM_CODES };
 
-  /**
-   * The DispatchThread runs dispatch_entry to empty out the dispatch_queue.
-   */
-  class DispatchThread : public Thread {
-    DispatchQueue *dq;
-  public:
-    explicit DispatchThread(DispatchQueue *dq) : dq(dq) {}
-    void *entry() override {
-      dq->entry();
-      return 0;
-    }
-  } dispatch_thread;
-
   Mutex local_delivery_lock;
   Cond local_delivery_cond;
   bool stop_local_delivery;
@@ -119,22 +144,21 @@ class DispatchQueue {
 
   uint64_t pre_dispatch(Message *m);
   void post_dispatch(Message *m, uint64_t msize);
+  void entry(Shard &shard);
 
  public:
 
   /// Throttle preventing us from building up a big backlog waiting for dispatch
   Throttle dispatch_throttler;
 
-  bool stop;
+  /// set by shutdown(); the messengers read it without any lock held
+  std::atomic<bool> stop;
   void local_delivery(Message *m, int priority);
   void run_local_delivery();
 
   double get_max_age(utime_t now) const;
 
-  int get_queue_len() const {
-    Mutex::Locker l(lock);
-    return mqueue.length();
-  }
+  int get_queue_len() const;
 
   /**
    * Release memory accounting back to the dispatch throttler.
@@ -144,54 +168,19 @@ class DispatchQueue {
   void dispatch_throttle_release(uint64_t msize);
 
   void queue_connect(Connection *con) {
-    Mutex::Locker l(lock);
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_CONNECT, con));
-    cond.Signal();
+    get_shard(con).enqueue_code(D_CONNECT, con);
   }
   void queue_accept(Connection *con) {
-    Mutex::Locker l(lock);
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_ACCEPT, con));
-    cond.Signal();
+    get_shard(con).enqueue_code(D_ACCEPT, con);
   }
   void queue_remote_reset(Connection *con) {
-    Mutex::Locker l(lock);
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_BAD_REMOTE_RESET, con));
-    cond.Signal();
+    get_shard(con).enqueue_code(D_BAD_REMOTE_RESET, con);
   }
   void queue_reset(Connection *con) {
-    Mutex::Locker l(lock);
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_BAD_RESET, con));
-    cond.Signal();
+    get_shard(con).enqueue_code(D_BAD_RESET, con);
   }
   void queue_refused(Connection *con) {
-    Mutex::Locker l(lock);
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_CONN_REFUSED, con));
-    cond.Signal();
+    get_shard(con).enqueue_code(D_CONN_REFUSED, con);
   }
 
   bool can_fast_dispatch(const Message *m) const;
@@ -204,28 +193,18 @@ class DispatchQueue {
     return next_id++;
   }
   void start();
-  void entry();
   void wait();
   void shutdown();
-  bool is_started() const {return dispatch_thread.is_started();}
-
-  DispatchQueue(CephContext *cct, Messenger *msgr, string &name)
-    : cct(cct), msgr(msgr),
-      lock("Messenger::DispatchQueue::lock" + name),
-      mqueue(cct->_conf->ms_pq_max_tokens_per_priority,
-	     cct->_conf->ms_pq_min_cost),
-      next_id(1),
-      dispatch_thread(this),
-      local_delivery_lock("Messenger::DispatchQueue::local_delivery_lock" + name),
-      stop_local_delivery(false),
-      local_delivery_thread(this),
-      dispatch_throttler(cct, string("msgr_dispatch_throttler-") + name,
-                         cct->_conf->ms_dispatch_throttle_bytes),
-      stop(false)
-    {}
+  bool is_started() const {
+    return shards.front()->dispatch_thread.is_started();
+  }
+
+  DispatchQueue(CephContext *cct, Messenger *msgr, string &name);
   ~DispatchQueue() {
-    assert(mqueue.empty());
-    assert(marrival.empty());
+    for (auto& s : shards) {
+      assert(s->mqueue.empty());
+      assert(s->marrival.empty());
+    }
     assert(local_messages.empty());
   }
 };
@@ -25,6 +25,7 @@ class Connection;
 class AuthAuthorizer;
 class CryptoKey;
 class CephContext;
+struct ceph_msg_header;
 
 class Dispatcher {
 public:
@@ -89,6 +90,25 @@ public:
    * @param m A message which has been received
    */
   virtual void ms_fast_preprocess(Message *m) {}
+  /**
+   * Supply the buffer the data payload of an incoming message is read
+   * into, before any of it comes off the wire, so that it lands where
+   * its consumer wants it (e.g., with the alignment the ObjectStore or a
+   * client read buffer needs) rather than in memory the Messenger
+   * allocated.  Only asked of fast-dispatch capable Dispatchers, under
+   * the same locking rules as ms_fast_preprocess.
+   *
+   * @param con The Connection the message arrives on.
+   * @param header The message header; data_len and data_off describe
+   * the payload.
+   * @param bl Set to the buffer to read into. If it is shorter than
+   * data_len the Messenger appends the rest.
+   * @returns True if bl was supplied; false to let the Messenger
+   * allocate.
+   */
+  virtual bool ms_get_rx_buffer(Connection *con,
+				const ceph_msg_header& header,
+				bufferlist *bl) { return false; }
   /**
    * The Messenger calls this function to deliver a single message.
    *
@@ -202,7 +202,17 @@ void Message::encode(uint64_t features, int crcflags)
   // encode and copy out of *m
   if (empty_payload()) {
     assert(middle.length() == 0);
-    encode_payload(features);
+    if (encoding_cache)
+      cached_encoding = encoding_cache->find(features, crcflags);
+    if (cached_encoding) {
+      payload = cached_encoding->payload;
+      middle = cached_encoding->middle;
+      data = cached_encoding->data;
+      header.version = cached_encoding->version;
+      header.compat_version = cached_encoding->compat_version;
+    } else {
+      encode_payload(features);
+    }
 
     if (byte_throttler) {
       byte_throttler->take(payload.length() + middle.length());
@@ -213,8 +223,14 @@ void Message::encode(uint64_t features, int crcflags)
     if (header.compat_version == 0)
       header.compat_version = header.version;
   }
-  if (crcflags & MSG_CRC_HEADER)
-    calc_front_crc();
+  if (crcflags & MSG_CRC_HEADER) {
+    if (cached_encoding && (cached_encoding->crcflags & MSG_CRC_HEADER)) {
+      footer.front_crc = cached_encoding->front_crc;
+      footer.middle_crc = cached_encoding->middle_crc;
+    } else {
+      calc_front_crc();
+    }
+  }
 
   // update envelope
   header.front_len = get_payload().length();
@@ -226,7 +242,10 @@ void Message::encode(uint64_t features, int crcflags)
   footer.flags = CEPH_MSG_FOOTER_COMPLETE;
 
   if (crcflags & MSG_CRC_DATA) {
-    calc_data_crc();
+    if (cached_encoding && (cached_encoding->crcflags & MSG_CRC_DATA))
+      footer.data_crc = cached_encoding->data_crc;
+    else
+      calc_data_crc();
 
 #ifdef ENCODE_DUMP
     bufferlist bl;
@@ -268,6 +287,21 @@ void Message::encode(uint64_t features, int crcflags)
   } else {
     footer.flags = (unsigned)footer.flags | CEPH_MSG_FOOTER_NOCRC;
   }
+
+  if (encoding_cache && !cached_encoding) {
+    auto e = std::make_shared<EncodingCache::encoding_t>();
+    e->crcflags = crcflags;
+    e->version = header.version;
+    e->compat_version = header.compat_version;
+    e->payload = payload;
+    e->middle = middle;
+    e->data = data;
+    e->front_crc = footer.front_crc;
+    e->middle_crc = footer.middle_crc;
+    e->data_crc = footer.data_crc;
+    encoding_cache->add(features, crcflags, e);
+    cached_encoding = e;
+  }
 }
 
 void Message::dump(Formatter *f) const
@@ -16,6 +16,7 @@
 #define CEPH_MESSAGE_H
  
 #include <stdlib.h>
+#include <mutex>
 #include <ostream>
 
 #include <boost/intrusive_ptr.hpp>
@@ -272,9 +273,50 @@ public:
 				     bi::list_member_hook<>,
 				     &Message::dispatch_q > > Queue;
 
+  /**
+   * Encoded bodies shared by identical messages sent to many peers.
+   *
+   * The first of the messages encoded for a given feature set leaves its
+   * payload, middle, data and their crcs here, and the others pick them
+   * up instead of running encode_payload() and checksumming again.  Only
+   * attach a cache to messages with identical content.
+   */
+  class EncodingCache {
+  public:
+    struct encoding_t {
+      int crcflags = 0;
+      __u16 version = 0, compat_version = 0;
+      bufferlist payload, middle, data;
+      __u32 front_crc = 0, middle_crc = 0, data_crc = 0;
+    };
+    typedef std::shared_ptr<const encoding_t> encoding_ref;
+
+  private:
+    std::mutex lock;
+    std::map<std::pair<uint64_t, int>, encoding_ref> encodings;
+
+  public:
+    encoding_ref find(uint64_t features, int crcflags) {
+      std::lock_guard<std::mutex> l(lock);
+      auto p = encodings.find(std::make_pair(features, crcflags));
+      if (p == encodings.end())
+	return nullptr;
+      return p->second;
+    }
+    void add(uint64_t features, int crcflags, encoding_ref e) {
+      std::lock_guard<std::mutex> l(lock);
+      encodings.emplace(std::make_pair(features, crcflags), std::move(e));
+    }
+  };
+  typedef std::shared_ptr<EncodingCache> EncodingCacheRef;
+
 protected:
   CompletionHook* completion_hook = nullptr; // owned by Messenger
 
+  EncodingCacheRef encoding_cache;
+  // the shared encoding our payload came from, if any
+  EncodingCache::encoding_ref cached_encoding;
+
   // release our size in bytes back to this throttler when our payload
   // is adjusted or when we are destroyed.
   Throttle *byte_throttler = nullptr;
@@ -359,6 +401,12 @@ public:
     }
     payload.clear();
     middle.clear();
+    cached_encoding.reset();
+  }
+
+  /// share the encoded body with identical messages sent to other peers
+  void set_encoding_cache(EncodingCacheRef c) {
+    encoding_cache = std::move(c);
   }
 
   virtual void clear_buffers() {}
@@ -651,6 +651,26 @@ public:
       (*p)->ms_fast_preprocess(m);
     }
   }
+  /**
+   * Ask each fast Dispatcher in turn for the buffer to read the data
+   * payload of an incoming message into.
+   *
+   * @param con The Connection the message arrives on.
+   * @param header The header of the message being read.
+   * @param bl Filled in by the Dispatcher that supplies the buffer.
+   * @returns True if a Dispatcher supplied one.
+   */
+  bool ms_deliver_get_rx_buffer(Connection *con,
+				const ceph_msg_header& header,
+				bufferlist *bl) {
+    for (list<Dispatcher*>::iterator p = fast_dispatchers.begin();
+	 p != fast_dispatchers.end();
+	 ++p) {
+      if ((*p)->ms_get_rx_buffer(con, header, bl))
+	return true;
+    }
+    return false;
+  }
   /**
    *  Deliver a single Message. Send it to each Dispatcher
    *  in sequence until one of them handles it.
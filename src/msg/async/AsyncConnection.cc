@@ -128,6 +128,8 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
     recv_start(0), recv_end(0),
     last_active(ceph::coarse_mono_clock::now()),
     inactive_timeout_us(cct->_conf->ms_tcp_read_timeout*1000*1000),
+    send_batch_bytes(cct->_conf->get_val<uint64_t>("ms_async_send_batch_bytes")),
+    send_batch_msgs(cct->_conf->get_val<uint64_t>("ms_async_send_batch_messages")),
     msg_left(0), cur_msg_size(0), got_bad_auth(false), authorizer(NULL), replacing(false),
     is_reset_from_peer(false), once_ready(false), state_buffer(NULL), state_offset(0),
     worker(w), center(&w->center)
@@ -207,11 +209,16 @@ ssize_t AsyncConnection::_try_send(bool more)
   }
 
   assert(center->in_thread());
+  if (outcoming_msgs) {
+    logger->inc(l_msgr_send_batch_messages, outcoming_msgs);
+    outcoming_msgs = 0;
+  }
   ssize_t r = cs.send(outcoming_bl, more);
   if (r < 0) {
     ldout(async_msgr->cct, 1) << __func__ << " send error: " << cpp_strerror(r) << dendl;
     return r;
   }
+  logger->inc(l_msgr_send_bytes, r);
 
   ldout(async_msgr->cct, 10) << __func__ << " sent bytes " << r
                              << " remaining bytes " << outcoming_bl.length() << dendl;
@@ -604,6 +611,13 @@ void AsyncConnection::process()
               if (data_buf.length() < data_len)
                 data_buf.push_back(buffer::create(data_len - data_buf.length()));
               data_blp = data_buf.begin();
+            } else if (async_msgr->ms_deliver_get_rx_buffer(this, current_header, &data_buf)) {
+              ldout(async_msgr->cct,20) << __func__ << " using dispatcher supplied rx buffer len "
+                                        << data_buf.length() << " at offset " << data_off << dendl;
+              if (data_buf.length() < data_len)
+                data_buf.push_back(buffer::create(data_len - data_buf.length()));
+              data_blp = data_buf.begin();
+              logger->inc(l_msgr_recv_supplied_bytes, data_len);
             } else {
               ldout(async_msgr->cct,20) << __func__ << " allocating new rx buffer at offset " << data_off << dendl;
               alloc_aligned_buffer(data_buf, data_len, data_off);
@@ -874,6 +888,8 @@ ssize_t AsyncConnection::_process_connection()
         SocketOptions opts;
         opts.priority = async_msgr->get_socket_priority();
         opts.connect_bind_addr = msgr->get_myaddr();
+        opts.zerocopy_min_bytes = async_msgr->cct->_conf->get_val<uint64_t>(
+          "ms_async_send_zerocopy_min_bytes");
         r = worker->connect(get_peer_addr(), opts, &cs);
         if (r < 0)
           goto fail;
@@ -1408,6 +1424,7 @@ int AsyncConnection::handle_connect_reply(ceph_msg_connect &connect, ceph_msg_co
     was_session_reset();
     // see was_session_reset
     outcoming_bl.clear();
+    outcoming_msgs = 0;
     state = STATE_CONNECTING_SEND_CONNECT_MSG;
   }
   if (reply.tag == CEPH_MSGR_TAG_RETRY_GLOBAL) {
@@ -1707,6 +1724,7 @@ ssize_t AsyncConnection::handle_connect_msg(ceph_msg_connect &connect, bufferlis
         existing->write_lock.lock();
         existing->requeue_sent();
         existing->outcoming_bl.clear();
+        existing->outcoming_msgs = 0;
         existing->open_write = false;
         existing->write_lock.unlock();
         if (existing->state == STATE_NONE) {
@@ -2050,6 +2068,7 @@ void AsyncConnection::fault()
   state_offset = 0;
   is_reset_from_peer = false;
   outcoming_bl.clear();
+  outcoming_msgs = 0;
   if (!once_ready && !is_queued() &&
       state >=STATE_ACCEPTING && state <= STATE_ACCEPTING_WAIT_CONNECT_MSG_AUTH &&
       !replacing) {
@@ -2238,14 +2257,22 @@ ssize_t AsyncConnection::write_message(Message *m, bufferlist& bl, bool more)
   m->trace.event("async writing message");
   ldout(async_msgr->cct, 20) << __func__ << " sending " << m->get_seq()
                              << " " << m << dendl;
-  ssize_t total_send_size = outcoming_bl.length();
-  ssize_t rc = _try_send(more);
-  if (rc < 0) {
-    ldout(async_msgr->cct, 1) << __func__ << " error sending " << m << ", "
-                              << cpp_strerror(rc) << dendl;
+  ++outcoming_msgs;
+  ssize_t rc = 0;
+  if (more && outcoming_msgs < send_batch_msgs &&
+      outcoming_bl.length() < send_batch_bytes) {
+    // more messages are queued behind this one; send them all in one go
+    ldout(async_msgr->cct, 20) << __func__ << " batched " << m << ", "
+                               << outcoming_msgs << " messages "
+                               << outcoming_bl.length() << " bytes pending" << dendl;
   } else {
-    logger->inc(l_msgr_send_bytes, total_send_size - outcoming_bl.length());
-    ldout(async_msgr->cct, 10) << __func__ << " sending " << m << (rc ? " continuely." :" done.") << dendl;
+    rc = _try_send(more);
+    if (rc < 0) {
+      ldout(async_msgr->cct, 1) << __func__ << " error sending " << m << ", "
+                                << cpp_strerror(rc) << dendl;
+    } else {
+      ldout(async_msgr->cct, 10) << __func__ << " sending " << m << (rc ? " continuely." :" done.") << dendl;
+    }
   }
   if (m->get_type() == CEPH_MSG_OSD_OP)
     OID_EVENT_TRACE_WITH_MSG(m, "SEND_MSG_OSD_OP_END", false);
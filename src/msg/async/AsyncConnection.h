@@ -303,6 +303,7 @@ class AsyncConnection : public Connection {
 
   // lockfree, only used in own thread
   bufferlist outcoming_bl;
+  unsigned outcoming_msgs = 0;  ///< messages in outcoming_bl not yet sent
   bool open_write = false;
 
   std::mutex write_lock;
@@ -331,6 +332,9 @@ class AsyncConnection : public Connection {
   ceph::coarse_mono_clock::time_point last_active;
   uint64_t last_tick_id = 0;
   const uint64_t inactive_timeout_us;
+  /// write_message batches messages into one send up to these limits
+  const uint64_t send_batch_bytes;
+  const uint64_t send_batch_msgs;
 
   // Tis section are temp variables used by state transition
 
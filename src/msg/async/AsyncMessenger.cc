@@ -165,6 +165,8 @@ void Processor::accept()
   opts.nodelay = msgr->cct->_conf->ms_tcp_nodelay;
   opts.rcbuf_size = msgr->cct->_conf->ms_tcp_rcvbuf;
   opts.priority = msgr->get_socket_priority();
+  opts.zerocopy_min_bytes = msgr->cct->_conf->get_val<uint64_t>(
+    "ms_async_send_zerocopy_min_bytes");
   while (true) {
     entity_addr_t addr;
     ConnectedSocket cli_socket;
@@ -258,6 +260,8 @@ AsyncMessenger::AsyncMessenger(CephContext *cct, entity_name_t name,
     transport_type = "rdma";
   else if (type.find("dpdk") != std::string::npos)
     transport_type = "dpdk";
+  else if (type.find("loopback") != std::string::npos)
+    transport_type = "loopback";
 
   auto single = &cct->lookup_or_create_singleton_object<StackSingleton>(
     "AsyncMessenger::NetworkStack::" + transport_type, true, cct);
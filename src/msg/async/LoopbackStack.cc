@@ -0,0 +1,376 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "LoopbackStack.h"
+
+#include "include/buffer.h"
+#include "common/dout.h"
+
+#define dout_subsys ceph_subsys_ms
+#undef dout_prefix
+#define dout_prefix *_dout << "LoopbackStack "
+
+namespace {
+
+/// a socket for the event loop to poll: readable while there is something
+/// to pick up, writable unless the owner's sends are being held back
+class LoopbackNotifier {
+  int fds[2] = {-1, -1};  ///< fds[0] is polled, fds[1] only feeds it
+  bool notified = false;
+  bool blocked = false;
+
+ public:
+  ~LoopbackNotifier() {
+    for (auto fd : fds) {
+      if (fd >= 0)
+        ::close(fd);
+    }
+  }
+  int init() {
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+      return -errno;
+    for (auto fd : fds) {
+      if (::fcntl(fd, F_SETFD, FD_CLOEXEC) < 0 ||
+          ::fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+        return -errno;
+    }
+    // the kernel rounds this up to its minimum, so block() fills it quickly
+    int sndbuf = 1;
+    if (::setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0)
+      return -errno;
+    return 0;
+  }
+  /// the end to poll
+  int fd() const {
+    return fds[0];
+  }
+  // callers serialize notify() and clear() with their own lock, and
+  // block() and unblock() likewise; the two pairs use opposite directions
+  // of the socket pair and do not interfere
+  void notify() {
+    if (!notified) {
+      char c = 0;
+      // a full socket is still readable, so a failed write loses nothing
+      (void)!::write(fds[1], &c, 1);
+      notified = true;
+    }
+  }
+  void clear() {
+    if (notified) {
+      char buf[64];
+      while (::read(fds[0], buf, sizeof(buf)) > 0) ;
+      notified = false;
+    }
+  }
+  /// stop fd() from polling writable by filling its send buffer
+  void block() {
+    if (!blocked) {
+      char buf[4096] = {};
+      while (::write(fds[0], buf, sizeof(buf)) > 0) ;
+      blocked = true;
+    }
+  }
+  void unblock() {
+    if (blocked) {
+      char buf[4096];
+      while (::read(fds[1], buf, sizeof(buf)) > 0) ;
+      blocked = false;
+    }
+  }
+};
+
+/// one direction of a connection
+class LoopbackChannel {
+  std::mutex lock;
+  bufferlist data;
+  bool shut = false;
+  bool writer_blocked = false;
+  const uint64_t max_queued;
+  std::shared_ptr<LoopbackNotifier> reader;
+  std::shared_ptr<LoopbackNotifier> writer;
+
+ public:
+  LoopbackChannel(uint64_t max, std::shared_ptr<LoopbackNotifier> r,
+                  std::shared_ptr<LoopbackNotifier> w)
+      : max_queued(max), reader(std::move(r)), writer(std::move(w)) {}
+
+  /// like a socket, takes what fits and returns -EAGAIN if nothing does;
+  /// the writer's fd polls writable again once the reader drains it
+  ssize_t write(bufferlist &bl) {
+    std::lock_guard<std::mutex> l(lock);
+    if (shut)
+      return -EPIPE;
+    if (data.length() >= max_queued) {
+      writer->block();
+      writer_blocked = true;
+      return -EAGAIN;
+    }
+    ssize_t len = std::min<uint64_t>(bl.length(), max_queued - data.length());
+    // no copy: the reader picks the sender's buffers up as they are
+    if ((size_t)len < bl.length())
+      bl.splice(0, len, &data);
+    else
+      data.claim_append(bl);
+    reader->notify();
+    return len;
+  }
+
+  ssize_t read(char *buf, size_t len) {
+    std::lock_guard<std::mutex> l(lock);
+    if (!data.length()) {
+      if (shut)
+        return 0;
+      reader->clear();
+      return -EAGAIN;
+    }
+    len = std::min<size_t>(len, data.length());
+    data.copy(0, len, buf);
+    data.splice(0, len);
+    if (writer_blocked && data.length() < max_queued) {
+      writer->unblock();
+      writer_blocked = false;
+    }
+    return len;
+  }
+
+  void shutdown() {
+    std::lock_guard<std::mutex> l(lock);
+    shut = true;
+    // wake the reader so it sees EOF, and a held back writer so it sees EPIPE
+    reader->notify();
+    if (writer_blocked) {
+      writer->unblock();
+      writer_blocked = false;
+    }
+  }
+};
+
+class LoopbackConnectedSocketImpl final : public ConnectedSocketImpl {
+  std::shared_ptr<LoopbackNotifier> events;
+  std::shared_ptr<LoopbackChannel> in;
+  std::shared_ptr<LoopbackChannel> out;  ///< null if the connect was refused
+
+ public:
+  LoopbackConnectedSocketImpl(std::shared_ptr<LoopbackNotifier> e,
+                              std::shared_ptr<LoopbackChannel> i,
+                              std::shared_ptr<LoopbackChannel> o)
+      : events(std::move(e)), in(std::move(i)), out(std::move(o)) {}
+
+  int is_connected() override {
+    return out ? 1 : -ECONNREFUSED;
+  }
+  ssize_t zero_copy_read(bufferptr&) override {
+    return -EOPNOTSUPP;
+  }
+  ssize_t read(char *buf, size_t len) override {
+    return in->read(buf, len);
+  }
+  ssize_t send(bufferlist &bl, bool more) override {
+    if (!out)
+      return -ENOTCONN;
+    ssize_t r = out->write(bl);
+    // report a full channel the way a full socket send buffer is reported
+    return r == -EAGAIN ? 0 : r;
+  }
+  void shutdown() override {
+    in->shutdown();
+    if (out)
+      out->shutdown();
+  }
+  void close() override {
+    shutdown();
+  }
+  int fd() const override {
+    return events->fd();
+  }
+};
+
+/// a listening address and the connections waiting to be accepted on it
+struct LoopbackListener {
+  std::mutex lock;
+  std::deque<std::pair<ConnectedSocket, entity_addr_t>> backlog;
+  bool closed = false;
+  LoopbackNotifier notifier;
+
+  bool enqueue(ConnectedSocket &&sock, const entity_addr_t &peer) {
+    std::lock_guard<std::mutex> l(lock);
+    if (closed)
+      return false;
+    backlog.emplace_back(std::move(sock), peer);
+    notifier.notify();
+    return true;
+  }
+};
+
+/// listening ports of every loopback stack in this process
+struct LoopbackListenTable {
+  std::mutex lock;
+  std::map<int, std::weak_ptr<LoopbackListener>> ports;
+  unsigned next_client_port = 0;
+
+  static LoopbackListenTable& get() {
+    static LoopbackListenTable table;
+    return table;
+  }
+
+  std::shared_ptr<LoopbackListener> find(int port) {
+    std::lock_guard<std::mutex> l(lock);
+    auto p = ports.find(port);
+    if (p == ports.end())
+      return nullptr;
+    return p->second.lock();
+  }
+
+  /// address a connecting socket appears to come from
+  entity_addr_t client_addr(int family) {
+    unsigned port;
+    {
+      std::lock_guard<std::mutex> l(lock);
+      port = 32768 + next_client_port++ % 28232;
+    }
+    entity_addr_t a;
+    a.set_type(entity_addr_t::TYPE_LEGACY);
+    if (family == AF_INET6) {
+      sockaddr_in6 sin6 = {};
+      sin6.sin6_family = AF_INET6;
+      sin6.sin6_addr = in6addr_loopback;
+      a.set_sockaddr((sockaddr*)&sin6);
+    } else {
+      sockaddr_in sin = {};
+      sin.sin_family = AF_INET;
+      sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      a.set_sockaddr((sockaddr*)&sin);
+    }
+    a.set_port(port);
+    return a;
+  }
+};
+
+class LoopbackServerSocketImpl : public ServerSocketImpl {
+  std::shared_ptr<LoopbackListener> listener;
+  int port;
+
+ public:
+  LoopbackServerSocketImpl(std::shared_ptr<LoopbackListener> l, int p)
+      : listener(std::move(l)), port(p) {}
+
+  int accept(ConnectedSocket *sock, const SocketOptions &opt, entity_addr_t *out,
+             Worker *w) override {
+    std::lock_guard<std::mutex> l(listener->lock);
+    if (listener->backlog.empty()) {
+      listener->notifier.clear();
+      return -EAGAIN;
+    }
+    *sock = std::move(listener->backlog.front().first);
+    *out = listener->backlog.front().second;
+    listener->backlog.pop_front();
+    return 0;
+  }
+
+  void abort_accept() override {
+    auto &table = LoopbackListenTable::get();
+    {
+      std::lock_guard<std::mutex> l(table.lock);
+      auto p = table.ports.find(port);
+      if (p != table.ports.end() && p->second.lock() == listener)
+        table.ports.erase(p);
+    }
+    std::deque<std::pair<ConnectedSocket, entity_addr_t>> refused;
+    {
+      std::lock_guard<std::mutex> l(listener->lock);
+      listener->closed = true;
+      refused.swap(listener->backlog);
+    }
+    // closing them here lets their peers see EOF
+  }
+
+  int fd() const override {
+    return listener->notifier.fd();
+  }
+};
+
+} // anonymous namespace
+
+int LoopbackWorker::listen(entity_addr_t &sa, const SocketOptions &opt,
+                           ServerSocket *sock)
+{
+  int port = sa.get_port();
+  auto listener = std::make_shared<LoopbackListener>();
+  int r = listener->notifier.init();
+  if (r < 0)
+    return r;
+
+  auto &table = LoopbackListenTable::get();
+  {
+    std::lock_guard<std::mutex> l(table.lock);
+    auto p = table.ports.find(port);
+    if (p != table.ports.end() && !p->second.expired()) {
+      ldout(cct, 10) << __func__ << " port " << port << " in use" << dendl;
+      return -EADDRINUSE;
+    }
+    table.ports[port] = listener;
+  }
+  ldout(cct, 10) << __func__ << " listening on " << sa << dendl;
+  *sock = ServerSocket(
+    std::unique_ptr<LoopbackServerSocketImpl>(
+      new LoopbackServerSocketImpl(std::move(listener), port)));
+  return 0;
+}
+
+int LoopbackWorker::connect(const entity_addr_t &addr, const SocketOptions &opts,
+                            ConnectedSocket *socket)
+{
+  auto client_events = std::make_shared<LoopbackNotifier>();
+  auto server_events = std::make_shared<LoopbackNotifier>();
+  int r = client_events->init();
+  if (r < 0)
+    return r;
+  r = server_events->init();
+  if (r < 0)
+    return r;
+  uint64_t max_queued = cct->_conf->get_val<uint64_t>(
+    "ms_async_loopback_max_queued_bytes");
+  auto in = std::make_shared<LoopbackChannel>(max_queued, client_events,
+                                              server_events);
+  auto out = std::make_shared<LoopbackChannel>(max_queued, server_events,
+                                               client_events);
+
+  auto &table = LoopbackListenTable::get();
+  auto listener = table.find(addr.get_port());
+  if (listener) {
+    ConnectedSocket server_side(
+      std::unique_ptr<LoopbackConnectedSocketImpl>(
+        new LoopbackConnectedSocketImpl(server_events, out, in)));
+    if (!listener->enqueue(std::move(server_side),
+                           table.client_addr(addr.get_family())))
+      listener.reset();
+  }
+  if (!listener) {
+    ldout(cct, 10) << __func__ << " nobody listening on " << addr << dendl;
+    out.reset();
+  }
+  *socket = ConnectedSocket(
+    std::unique_ptr<LoopbackConnectedSocketImpl>(
+      new LoopbackConnectedSocketImpl(client_events, in, out)));
+  return 0;
+}
@@ -0,0 +1,62 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_ASYNC_LOOPBACKSTACK_H
+#define CEPH_MSG_ASYNC_LOOPBACKSTACK_H
+
+#include <thread>
+
+#include "Stack.h"
+
+/*
+ * In-process transport (ms_type = async+loopback).
+ *
+ * Connects messengers living in the same process by handing the sent
+ * bufferlists straight to the peer, without a kernel socket in between;
+ * each end only keeps a local socket pair for the event loop to poll.
+ * Like a socket, a direction holds a bounded number of unread bytes
+ * (ms_async_loopback_max_queued_bytes) and sends beyond it wait for the
+ * reader.  Listening sockets are registered in a process wide table
+ * keyed by port, so a daemon is reachable at any address carrying its
+ * port, and nothing outside the process can connect.
+ */
+class LoopbackWorker : public Worker {
+ public:
+  LoopbackWorker(CephContext *c, unsigned i)
+      : Worker(c, i) {}
+  int listen(entity_addr_t &sa, const SocketOptions &opt,
+             ServerSocket *socks) override;
+  int connect(const entity_addr_t &addr, const SocketOptions &opts,
+              ConnectedSocket *socket) override;
+};
+
+class LoopbackNetworkStack : public NetworkStack {
+  vector<std::thread> threads;
+
+ public:
+  explicit LoopbackNetworkStack(CephContext *c, const string &t)
+      : NetworkStack(c, t) {}
+
+  // connect() completes immediately
+  bool nonblock_connect_need_writable_event() const override { return false; }
+
+  void spawn_worker(unsigned i, std::function<void ()> &&func) override {
+    threads.resize(i+1);
+    threads[i] = std::thread(func);
+  }
+  void join_worker(unsigned i) override {
+    assert(threads.size() > i && threads[i].joinable());
+    threads[i].join();
+  }
+};
+
+#endif //CEPH_MSG_ASYNC_LOOPBACKSTACK_H
@@ -19,8 +19,12 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
 
 #include <algorithm>
+#include <deque>
 
 #include "PosixStack.h"
 
@@ -36,15 +40,99 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "PosixStack "
 
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_MSG_ZEROCOPY
+#endif
+
 class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   NetHandler &handler;
   int _fd;
   entity_addr_t sa;
   bool connected;
 
+  CephContext *cct;
+  PerfCounters *logger;
+  /// smallest send done with MSG_ZEROCOPY, 0 if disabled
+  unsigned zerocopy_min;
+  /// id the kernel gives the next MSG_ZEROCOPY sendmsg
+  uint32_t zerocopy_next = 0;
+  /// sent data the kernel may still read, until it completes [first, last]
+  struct zerocopy_pending_t {
+    uint32_t first, last;
+    unsigned left;
+    bufferlist bl;
+  };
+  std::deque<zerocopy_pending_t> zerocopy_pending;
+
+  void zerocopy_complete(uint32_t lo, uint32_t hi) {
+    for (uint32_t id = lo; ; ++id) {
+      for (auto& p : zerocopy_pending) {
+	if (id - p.first <= p.last - p.first) {
+	  assert(p.left > 0);
+	  --p.left;
+	  break;
+	}
+      }
+      if (id == hi)
+	break;
+    }
+    // completions normally arrive in order, but do not rely on it
+    zerocopy_pending.erase(
+      std::remove_if(zerocopy_pending.begin(), zerocopy_pending.end(),
+		     [](const zerocopy_pending_t& p) { return p.left == 0; }),
+      zerocopy_pending.end());
+  }
+
+  /// release the buffers of completed MSG_ZEROCOPY sends
+  void reap_zerocopy() {
+#ifdef HAVE_MSG_ZEROCOPY
+    while (!zerocopy_pending.empty()) {
+      char control[128];
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (::recvmsg(_fd, &msg, MSG_ERRQUEUE) < 0)
+	break;  // EAGAIN: nothing more has completed
+      for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+	   cm = CMSG_NXTHDR(&msg, cm)) {
+	if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+	    !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+	  continue;
+	auto serr = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+	if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+	  continue;
+	if (zerocopy_min && (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)) {
+	  // e.g. loopback: the kernel copied anyway, so stop paying for
+	  // the notifications
+	  ldout(cct, 10) << __func__ << " fd " << _fd
+			 << " kernel copied zerocopy send, disabling" << dendl;
+	  zerocopy_min = 0;
+	}
+	zerocopy_complete(serr->ee_info, serr->ee_data);
+      }
+    }
+#endif
+  }
+
  public:
-  explicit PosixConnectedSocketImpl(NetHandler &h, const entity_addr_t &sa, int f, bool connected)
-      : handler(h), _fd(f), sa(sa), connected(connected) {}
+  explicit PosixConnectedSocketImpl(NetHandler &h, const entity_addr_t &sa, int f, bool connected,
+                                    CephContext *c, PerfCounters *l, unsigned zc_min)
+      : handler(h), _fd(f), sa(sa), connected(connected),
+        cct(c), logger(l), zerocopy_min(0) {
+#ifdef HAVE_MSG_ZEROCOPY
+    if (zc_min) {
+      int on = 1;
+      if (::setsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+        zerocopy_min = zc_min;
+      } else {
+        int r = errno;
+        ldout(cct, 1) << __func__ << " unable to set SO_ZEROCOPY on fd " << _fd
+                      << ": " << cpp_strerror(r) << dendl;
+      }
+    }
+#endif
+  }
 
   int is_connected() override {
     if (connected)
@@ -66,6 +154,9 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
 
   ssize_t read(char *buf, size_t len) override {
+    // pending completions raise EPOLLERR, which wakes the reader
+    if (!zerocopy_pending.empty())
+      reap_zerocopy();
     ssize_t r = ::read(_fd, buf, len);
     if (r < 0)
       r = -errno;
@@ -74,21 +165,31 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 
   // return the sent length
   // < 0 means error occurred
-  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more)
+  // each successful sendmsg with zerocopy_flags consumes one completion
+  // id, counted in *zerocopy_ids.  zerocopy_flags is cleared if the kernel
+  // runs out of memory for zerocopy, and the rest is sent by copying.
+  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more,
+                            int &zerocopy_flags, uint32_t *zerocopy_ids)
   {
     size_t sent = 0;
     while (1) {
       MSGR_SIGPIPE_STOPPER;
       ssize_t r;
-      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0) | zerocopy_flags);
       if (r < 0) {
         if (errno == EINTR) {
           continue;
         } else if (errno == EAGAIN) {
           break;
+        } else if (errno == ENOBUFS && zerocopy_flags) {
+          // optmem or locked page limit hit; nothing was sent
+          zerocopy_flags = 0;
+          continue;
         }
         return -errno;
       }
+      if (zerocopy_flags)
+        ++*zerocopy_ids;
 
       sent += r;
       if (len == sent) break;
@@ -110,6 +211,15 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
 
   ssize_t send(bufferlist &bl, bool more) override {
+    if (!zerocopy_pending.empty())
+      reap_zerocopy();
+    int zerocopy_flags = 0;
+#ifdef HAVE_MSG_ZEROCOPY
+    if (zerocopy_min && bl.length() >= zerocopy_min)
+      zerocopy_flags = MSG_ZEROCOPY;
+#endif
+    const bool zerocopy_requested = zerocopy_flags;
+    uint32_t zerocopy_first = zerocopy_next;
     size_t sent_bytes = 0;
     std::list<bufferptr>::const_iterator pb = bl.buffers().begin();
     uint64_t left_pbrs = bl.buffers().size();
@@ -128,9 +238,17 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 	msglen += pb->length();
 	++pb;
       }
-      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more);
+      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more,
+                             zerocopy_flags, &zerocopy_next);
       if (r < 0)
         return r;
+      if (zerocopy_min && zerocopy_requested && !zerocopy_flags) {
+        // the socket already has as much zerocopy data in flight as the
+        // kernel lets it; copy from now on rather than keep hitting that
+        ldout(cct, 1) << __func__ << " fd " << _fd
+                      << " out of zerocopy buffers, disabling" << dendl;
+        zerocopy_min = 0;
+      }
 
       // "r" is the remaining length
       sent_bytes += r;
@@ -139,7 +257,19 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
       // only "r" == 0 continue
     }
 
-    if (sent_bytes) {
+    if (zerocopy_next != zerocopy_first) {
+      // the kernel reads the sent bytes from our pages until it says it
+      // is done with them, so keep them referenced until then
+      zerocopy_pending.push_back(zerocopy_pending_t{
+	  zerocopy_first, zerocopy_next - 1, zerocopy_next - zerocopy_first, {}});
+      auto& pending = zerocopy_pending.back().bl;
+      if (sent_bytes < bl.length()) {
+        bl.splice(0, sent_bytes, &pending);
+      } else {
+        pending.swap(bl);
+      }
+      logger->inc(l_msgr_send_zerocopy_bytes, sent_bytes);
+    } else if (sent_bytes) {
       bufferlist swapped;
       if (sent_bytes < bl.length()) {
         bl.splice(sent_bytes, bl.length()-sent_bytes, &swapped);
@@ -206,7 +336,9 @@ int PosixServerSocketImpl::accept(ConnectedSocket *sock, const SocketOptions &op
   out->set_sockaddr((sockaddr*)&ss);
   handler.set_priority(sd, opt.priority, out->get_family());
 
-  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(handler, *out, sd, true));
+  std::unique_ptr<PosixConnectedSocketImpl> csi(
+    new PosixConnectedSocketImpl(handler, *out, sd, true, w->cct, w->perf_logger,
+                                 opt.zerocopy_min_bytes));
   *sock = ConnectedSocket(std::move(csi));
   return 0;
 }
@@ -274,7 +406,9 @@ int PosixWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, C
 
   net.set_priority(sd, opts.priority, addr.get_family());
   *socket = ConnectedSocket(
-      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock)));
+      std::unique_ptr<PosixConnectedSocketImpl>(
+        new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock, cct, perf_logger,
+                                     opts.zerocopy_min_bytes)));
   return 0;
 }
 
@@ -20,6 +20,7 @@
 #include "common/Cond.h"
 #include "common/errno.h"
 #include "PosixStack.h"
+#include "LoopbackStack.h"
 #ifdef HAVE_RDMA
 #include "rdma/RDMAStack.h"
 #endif
@@ -67,6 +68,8 @@ std::shared_ptr<NetworkStack> NetworkStack::create(CephContext *c, const string
 {
   if (t == "posix")
     return std::make_shared<PosixNetworkStack>(c, t);
+  else if (t == "loopback")
+    return std::make_shared<LoopbackNetworkStack>(c, t);
 #ifdef HAVE_RDMA
   else if (t == "rdma")
     return std::make_shared<RDMAStack>(c, t);
@@ -86,6 +89,8 @@ Worker* NetworkStack::create_worker(CephContext *c, const string &type, unsigned
 {
   if (type == "posix")
     return new PosixWorker(c, i);
+  else if (type == "loopback")
+    return new LoopbackWorker(c, i);
 #ifdef HAVE_RDMA
   else if (type == "rdma")
     return new RDMAWorker(c, i);
@@ -42,6 +42,7 @@ struct SocketOptions {
   int rcbuf_size = 0;
   int priority = -1;
   entity_addr_t connect_bind_addr;
+  unsigned zerocopy_min_bytes = 0;  ///< 0 disables MSG_ZEROCOPY sends
 };
 
 /// \cond internal
@@ -190,6 +191,9 @@ enum {
   l_msgr_send_messages,
   l_msgr_recv_bytes,
   l_msgr_send_bytes,
+  l_msgr_recv_supplied_bytes,
+  l_msgr_send_zerocopy_bytes,
+  l_msgr_send_batch_messages,
   l_msgr_created_connections,
   l_msgr_active_connections,
 
@@ -230,6 +234,9 @@ class Worker {
     plb.add_u64_counter(l_msgr_send_messages, "msgr_send_messages", "Network sent messages");
     plb.add_u64_counter(l_msgr_recv_bytes, "msgr_recv_bytes", "Network received bytes", NULL, 0, unit_t(BYTES));
     plb.add_u64_counter(l_msgr_send_bytes, "msgr_send_bytes", "Network sent bytes", NULL, 0, unit_t(BYTES));
+    plb.add_u64_counter(l_msgr_recv_supplied_bytes, "msgr_recv_supplied_bytes", "Network received data bytes read into dispatcher supplied buffers", NULL, 0, unit_t(BYTES));
+    plb.add_u64_avg(l_msgr_send_batch_messages, "msgr_send_batch_messages", "Messages written per socket send");
+    plb.add_u64_counter(l_msgr_send_zerocopy_bytes, "msgr_send_zerocopy_bytes", "Network sent bytes handed to the kernel with MSG_ZEROCOPY", NULL, 0, unit_t(BYTES));
     plb.add_u64_counter(l_msgr_active_connections, "msgr_active_connections", "Active connection number");
     plb.add_u64_counter(l_msgr_created_connections, "msgr_created_connections", "Created connection number");
 
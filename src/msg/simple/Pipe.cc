@@ -2132,8 +2132,15 @@ int Pipe::read_message(Message **pm, AuthSessionHandler* auth_handler)
 	}
       } else {
 	if (!newbuf.length()) {
-	  ldout(msgr->cct,20) << "reader allocating new rx buffer at offset " << offset << dendl;
-	  alloc_aligned_buffer(newbuf, data_len, data_off);
+	  if (msgr->ms_deliver_get_rx_buffer(connection_state.get(), header, &newbuf)) {
+	    ldout(msgr->cct,20) << "reader using dispatcher supplied rx buffer len "
+				<< newbuf.length() << " at offset " << offset << dendl;
+	    if (newbuf.length() < data_len)
+	      newbuf.push_back(buffer::create(data_len - newbuf.length()));
+	  } else {
+	    ldout(msgr->cct,20) << "reader allocating new rx buffer at offset " << offset << dendl;
+	    alloc_aligned_buffer(newbuf, data_len, data_off);
+	  }
 	  blp = newbuf.begin();
 	  blp.advance(offset);
 	}
@@ -12,6 +12,7 @@
 #ifndef CEPH_OS_BLUESTORE_ALLOCATOR_H
 #define CEPH_OS_BLUESTORE_ALLOCATOR_H
 
+#include <functional>
 #include <ostream>
 #include "include/assert.h"
 #include "os/bluestore/bluestore_types.h"
@@ -52,6 +53,24 @@ public:
 
   virtual uint64_t get_free() = 0;
 
+  /*
+   * Fragmentation score of the free space, from 0 (a single free extent)
+   * towards 1 (many small extents).  Computed as 1 - sqrt(sum(len^2)) / free.
+   * Negative if the allocator does not track free extents.
+   */
+  virtual double get_fragmentation() {
+    return -1.0;
+  }
+
+  /*
+   * Call notify(offset, length) for every free extent, in no particular
+   * order.  Returns false if the allocator cannot enumerate its free space.
+   */
+  virtual bool foreach_free(
+    std::function<void(uint64_t offset, uint64_t length)> notify) {
+    return false;
+  }
+
   virtual void shutdown() = 0;
   static Allocator *create(CephContext* cct, string type, int64_t size,
 			   int64_t block_size);
@@ -115,6 +115,12 @@ void BlueFS::_init_logger()
   b.add_u64_counter(l_bluefs_bytes_written_sst, "bytes_written_sst",
 		    "Bytes written to SSTs", "sst",
 		    PerfCountersBuilder::PRIO_CRITICAL, unit_t(BYTES));
+  b.add_time_avg(l_bluefs_wal_flush_lat, "wal_flush_lat",
+		 "Average flush latency (wal device)");
+  b.add_time_avg(l_bluefs_db_flush_lat, "db_flush_lat",
+		 "Average flush latency (main db device)");
+  b.add_time_avg(l_bluefs_slow_flush_lat, "slow_flush_lat",
+		 "Average flush latency (slow device)");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -123,6 +129,7 @@ void BlueFS::_shutdown_logger()
 {
   cct->get_perfcounters_collection()->remove(logger);
   delete logger;
+  logger = nullptr;
 }
 
 void BlueFS::_update_logger_stats()
@@ -1617,7 +1624,8 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
   return 0;
 }
 
-int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
+int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length,
+			 std::unique_lock<std::mutex> *l)
 {
   dout(10) << __func__ << " " << h << " pos 0x" << std::hex << h->pos
 	   << " 0x" << offset << "~" << length << std::dec
@@ -1727,12 +1735,6 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
     x_off -= partial;
     offset -= partial;
     length += partial;
-    dout(20) << __func__ << " waiting for previous aio to complete" << dendl;
-    for (auto p : h->iocv) {
-      if (p) {
-	p->aio_wait();
-      }
-    }
   }
   if (length == partial + h->buffer.length()) {
     bl.claim_append_piecewise(h->buffer);
@@ -1763,6 +1765,14 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
   h->pos = offset + length;
   h->tail_block.clear();
 
+  // carve bl up into device writes while we still hold the lock (the
+  // fnode may be updated by others once we drop it)
+  struct pending_write_t {
+    unsigned bdev;
+    uint64_t offset;
+    bufferlist bl;
+  };
+  vector<pending_write_t> writes;
   uint64_t bloff = 0;
   while (length > 0) {
     uint64_t x_len = std::min(p->length - x_off, length);
@@ -1793,16 +1803,37 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
 	t.append_zero(zlen);
       }
     }
-    if (cct->_conf->bluefs_sync_write) {
-      bdev[p->bdev]->write(p->offset + x_off, t, buffered);
-    } else {
-      bdev[p->bdev]->aio_write(p->offset + x_off, t, h->iocv[p->bdev], buffered);
-    }
+    writes.push_back(
+      pending_write_t{p->bdev, p->offset + x_off, std::move(t)});
     bloff += x_len;
     length -= x_len;
     ++p;
     x_off = 0;
   }
+
+  // The device I/O only touches h (serialized by h->lock), so let other
+  // writers (e.g. the WAL vs. compaction output) proceed meanwhile.  The
+  // log writers are left alone; they are covered by log_flushing.
+  bool unlocked = l && h->file->fnode.ino > 1;
+  if (unlocked) {
+    l->unlock();
+  }
+  if (partial) {
+    dout(20) << __func__ << " waiting for previous aio to complete" << dendl;
+    for (auto p : h->iocv) {
+      if (p) {
+	p->aio_wait();
+      }
+    }
+  }
+  for (auto& w : writes) {
+    if (cct->_conf->bluefs_sync_write) {
+      bdev[w.bdev]->write(w.offset, w.bl, buffered);
+    } else {
+      bdev[w.bdev]->aio_write(w.offset, w.bl, h->iocv[w.bdev], buffered);
+    }
+    h->dirty_devs[w.bdev] = true;
+  }
   for (unsigned i = 0; i < MAX_BDEV; ++i) {
     if (bdev[i]) {
       assert(h->iocv[i]);
@@ -1811,6 +1842,9 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
       }
     }
   }
+  if (unlocked) {
+    l->lock();
+  }
   dout(20) << __func__ << " h " << h << " pos now 0x"
            << std::hex << h->pos << std::dec << dendl;
   return 0;
@@ -1844,7 +1878,7 @@ void BlueFS::wait_for_aio(FileWriter *h)
 }
 #endif
 
-int BlueFS::_flush(FileWriter *h, bool force)
+int BlueFS::_flush(FileWriter *h, bool force, std::unique_lock<std::mutex> *l)
 {
   h->buffer_appender.flush();
   uint64_t length = h->buffer.length();
@@ -1865,7 +1899,7 @@ int BlueFS::_flush(FileWriter *h, bool force)
            << std::hex << offset << "~" << length << std::dec
 	   << " to " << h->file->fnode << dendl;
   assert(h->pos <= h->file->fnode.size);
-  return _flush_range(h, offset, length);
+  return _flush_range(h, offset, length, l);
 }
 
 int BlueFS::_truncate(FileWriter *h, uint64_t offset)
@@ -1912,12 +1946,12 @@ int BlueFS::_truncate(FileWriter *h, uint64_t offset)
 int BlueFS::_fsync(FileWriter *h, std::unique_lock<std::mutex>& l)
 {
   dout(10) << __func__ << " " << h << " " << h->file->fnode << dendl;
-  int r = _flush(h, true);
+  int r = _flush(h, true, &l);
   if (r < 0)
      return r;
   uint64_t old_dirty_seq = h->file->dirty_seq;
 
-  _flush_bdev_safely(h);
+  _flush_bdev_safely(h, false);
 
   if (old_dirty_seq) {
     uint64_t s = log_seq;
@@ -1930,8 +1964,16 @@ int BlueFS::_fsync(FileWriter *h, std::unique_lock<std::mutex>& l)
   return 0;
 }
 
-void BlueFS::_flush_bdev_safely(FileWriter *h)
+void BlueFS::_flush_bdev_safely(FileWriter *h, bool all_bdevs)
 {
+  // an fsync only needs the devices its writer has written to, so that
+  // e.g. a WAL fsync does not wait behind compaction output on another
+  // device.  a log commit makes the fnodes of every flushed file durable,
+  // so it must flush everything other writers may have written too.
+  std::array<bool, MAX_BDEV> dirty_bdevs = h->dirty_devs;
+  h->dirty_devs.fill(false);
+  if (all_bdevs)
+    dirty_bdevs.fill(true);
 #ifdef HAVE_LIBAIO
   if (!cct->_conf->bluefs_sync_write) {
     list<aio_t> completed_ios;
@@ -1939,27 +1981,50 @@ void BlueFS::_flush_bdev_safely(FileWriter *h)
     lock.unlock();
     wait_for_aio(h);
     completed_ios.clear();
-    flush_bdev();
+    flush_bdev(dirty_bdevs);
     lock.lock();
   } else
 #endif
   {
     lock.unlock();
-    flush_bdev();
+    flush_bdev(dirty_bdevs);
     lock.lock();
   }
 }
 
+void BlueFS::flush_bdev(std::array<bool, MAX_BDEV>& dirty_bdevs)
+{
+  // NOTE: this is safe to call without a lock.
+  dout(20) << __func__ << dendl;
+  for (unsigned i = 0; i < MAX_BDEV; i++) {
+    if (dirty_bdevs[i])
+      _flush_bdev(i);
+  }
+}
+
 void BlueFS::flush_bdev()
 {
   // NOTE: this is safe to call without a lock.
   dout(20) << __func__ << dendl;
-  for (auto p : bdev) {
-    if (p)
-      p->flush();
+  for (unsigned i = 0; i < MAX_BDEV; i++) {
+    _flush_bdev(i);
   }
 }
 
+void BlueFS::_flush_bdev(unsigned id)
+{
+  // NOTE: this is safe to call without a lock.
+  static const int lat_counter[MAX_BDEV] = {
+    l_bluefs_wal_flush_lat, l_bluefs_db_flush_lat, l_bluefs_slow_flush_lat
+  };
+  if (id >= bdev.size() || !bdev[id])
+    return;
+  utime_t start = ceph_clock_now();
+  bdev[id]->flush();
+  if (logger)
+    logger->tinc(lat_counter[id], ceph_clock_now() - start);
+}
+
 int BlueFS::_allocate(uint8_t id, uint64_t len,
 		      bluefs_fnode_t* node)
 {
@@ -35,6 +35,9 @@ enum {
   l_bluefs_files_written_sst,
   l_bluefs_bytes_written_wal,
   l_bluefs_bytes_written_sst,
+  l_bluefs_wal_flush_lat,
+  l_bluefs_db_flush_lat,
+  l_bluefs_slow_flush_lat,
   l_bluefs_last,
 };
 
@@ -124,8 +127,9 @@ public:
     bufferlist::page_aligned_appender buffer_appender;  //< for const char* only
     int writer_type = 0;    ///< WRITER_*
 
-    std::mutex lock;
+    std::mutex lock;        ///< serializes flush/fsync/truncate of this writer
     std::array<IOContext*,MAX_BDEV> iocv; ///< for each bdev
+    std::array<bool,MAX_BDEV> dirty_devs; ///< written since last bdev flush
 
     FileWriter(FileRef f)
       : file(f),
@@ -134,6 +138,7 @@ public:
 			  g_conf->bluefs_alloc_size / CEPH_PAGE_SIZE)) {
       ++file->num_writers;
       iocv.fill(nullptr);
+      dirty_devs.fill(false);
     }
     // NOTE: caller must call BlueFS::close_writer()
     ~FileWriter() {
@@ -270,8 +275,10 @@ private:
 
   int _allocate(uint8_t bdev, uint64_t len,
 		bluefs_fnode_t* node);
-  int _flush_range(FileWriter *h, uint64_t offset, uint64_t length);
-  int _flush(FileWriter *h, bool force);
+  int _flush_range(FileWriter *h, uint64_t offset, uint64_t length,
+		   std::unique_lock<std::mutex> *l = nullptr);
+  int _flush(FileWriter *h, bool force,
+	     std::unique_lock<std::mutex> *l = nullptr);
   int _fsync(FileWriter *h, std::unique_lock<std::mutex>& l);
 
 #ifdef HAVE_LIBAIO
@@ -290,8 +297,10 @@ private:
 
   //void _aio_finish(void *priv);
 
-  void _flush_bdev_safely(FileWriter *h);
+  void _flush_bdev_safely(FileWriter *h, bool all_bdevs = true);
   void flush_bdev();  // this is safe to call without a lock
+  void flush_bdev(std::array<bool,MAX_BDEV>& dirty_bdevs);  // ditto
+  void _flush_bdev(unsigned id);  // ditto
 
   int _preallocate(FileRef f, uint64_t off, uint64_t len);
   int _truncate(FileWriter *h, uint64_t off);
@@ -349,6 +358,9 @@ public:
   uint64_t get_total(unsigned id);
   uint64_t get_free(unsigned id);
   void get_usage(vector<pair<uint64_t,uint64_t>> *usage); // [<free,total> ...]
+  PerfCounters *get_perf_counters() const {
+    return logger;
+  }
   void dump_perf_counters(Formatter *f);
 
   void dump_block_extents(ostream& out);
@@ -410,15 +422,20 @@ public:
   // handler for discard event
   void handle_discard(unsigned dev, interval_set<uint64_t>& to_release);
 
+  // Writer operations take h->lock before the global lock, which
+  // _flush_range drops while the data is submitted to the device.
   void flush(FileWriter *h) {
-    std::lock_guard<std::mutex> l(lock);
-    _flush(h, false);
+    std::lock_guard<std::mutex> hl(h->lock);
+    std::unique_lock<std::mutex> l(lock);
+    _flush(h, false, &l);
   }
   void flush_range(FileWriter *h, uint64_t offset, uint64_t length) {
-    std::lock_guard<std::mutex> l(lock);
-    _flush_range(h, offset, length);
+    std::lock_guard<std::mutex> hl(h->lock);
+    std::unique_lock<std::mutex> l(lock);
+    _flush_range(h, offset, length, &l);
   }
   int fsync(FileWriter *h) {
+    std::lock_guard<std::mutex> hl(h->lock);
     std::unique_lock<std::mutex> l(lock);
     return _fsync(h, l);
   }
@@ -445,6 +462,7 @@ public:
     return _preallocate(f, offset, len);
   }
   int truncate(FileWriter *h, uint64_t offset) {
+    std::lock_guard<std::mutex> hl(h->lock);
     std::lock_guard<std::mutex> l(lock);
     return _truncate(h, offset);
   }
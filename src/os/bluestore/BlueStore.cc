@@ -93,6 +93,25 @@ const string PREFIX_SHARED_BLOB = "X"; // u64 offset -> shared_blob_t
 #define BLOBID_FLAG_SPANNING   0x8  // has spanning blob id
 #define BLOBID_SHIFT_BITS        4
 
+/*
+ * extent map shard encoding versions
+ *
+ * v1, v2: struct_v, #extents, then each extent followed by its blob the
+ *   first time that blob is referenced.  later references use the index
+ *   of the extent that introduced the blob.
+ * v3: struct_v, #extents, #blobs, then the same records as v2.  later
+ *   references use the ordinal of the blob within the shard instead of
+ *   the extent index, so ids stay small and fit in one varint byte, and
+ *   the decoder sizes its blob table once up front.  the shard is still
+ *   decoded from a deep copy of the kv value, as v2 is.
+ *
+ * releases that predate v3 assert on it, so the first v3 shard is only
+ * written after min_compat_ondisk_format has been raised; see
+ * _fence_extent_map_v3().
+ */
+#define EXTENT_MAP_SHARD_V_LEGACY   2
+#define EXTENT_MAP_SHARD_V_COMPACT  3
+
 /*
  * object name key structure
  *
@@ -777,6 +796,7 @@ BlueStore::Cache *BlueStore::Cache::create(CephContext* cct, string type,
     assert(0 == "unrecognized cache type");
 
   c->logger = logger;
+  c->lockless_reads = cct->_conf->get_val<bool>("bluestore_cache_lockless_reads");
   return c;
 }
 
@@ -792,7 +812,7 @@ void BlueStore::Cache::trim(
   float target_data_ratio,
   float bytes_per_onode)
 {
-  std::lock_guard<std::recursive_mutex> l(lock);
+  auto l = timed_lock();
   uint64_t current_meta = _get_num_onodes() * bytes_per_onode;
   uint64_t current_buffer = _get_buffer_bytes();
   uint64_t current = current_meta + current_buffer;
@@ -881,7 +901,13 @@ void BlueStore::LRUCache::_trim(uint64_t onode_max, uint64_t buffer_max)
 
     Buffer *b = &*i;
     assert(b->is_clean());
+    if (b->referenced.exchange(false)) {
+      dout(20) << __func__ << " referenced, keeping " << *b << dendl;
+      _touch_buffer(b);
+      continue;
+    }
     dout(20) << __func__ << " rm " << *b << dendl;
+    auto rl = b->space->_exclude_readers(this);
     b->space->_rm_buffer(this, b);
   }
 
@@ -897,6 +923,17 @@ void BlueStore::LRUCache::_trim(uint64_t onode_max, uint64_t buffer_max)
   int max_skipped = g_conf->bluestore_cache_trim_max_skip_pinned;
   while (num > 0) {
     Onode *o = &*p;
+    if (o->referenced.exchange(false)) {
+      dout(20) << __func__ << "  " << o->oid << " referenced, keeping" << dendl;
+      if (p == onode_lru.begin()) {
+	break;
+      }
+      onode_lru.erase(p--);
+      onode_lru.push_front(*o);
+      continue;
+    }
+    // hold off lockless lookups so that refs can't grow under us
+    auto ml = o->c->onode_map._exclude_readers();
     int refs = o->nref.load();
     if (refs > 1) {
       dout(20) << __func__ << "  " << o->oid << " has " << refs
@@ -1132,6 +1169,7 @@ void BlueStore::TwoQCache::_trim(uint64_t onode_max, uint64_t buffer_max)
       buffer_list_bytes[BUFFER_WARM_IN] -= b->length;
       to_evict_bytes -= b->length;
       evicted += b->length;
+      auto rl = b->space->_exclude_readers(this);
       b->state = Buffer::STATE_EMPTY;
       b->data.clear();
       buffer_warm_in.erase(buffer_warm_in.iterator_to(*b));
@@ -1157,11 +1195,18 @@ void BlueStore::TwoQCache::_trim(uint64_t onode_max, uint64_t buffer_max)
       }
 
       Buffer *b = &*p;
-      dout(20) << __func__ << " buffer_hot rm " << *b << dendl;
       assert(b->is_clean());
+      if (b->referenced.exchange(false)) {
+	dout(20) << __func__ << " buffer_hot referenced, keeping " << *b
+		 << dendl;
+	_touch_buffer(b);
+	continue;
+      }
+      dout(20) << __func__ << " buffer_hot rm " << *b << dendl;
       // adjust evict size before buffer goes invalid
       to_evict_bytes -= b->length;
       evicted += b->length;
+      auto rl = b->space->_exclude_readers(this);
       b->space->_rm_buffer(this, b);
     }
 
@@ -1177,6 +1222,7 @@ void BlueStore::TwoQCache::_trim(uint64_t onode_max, uint64_t buffer_max)
       Buffer *b = &*buffer_warm_out.rbegin();
       assert(b->is_empty());
       dout(20) << __func__ << " buffer_warm_out rm " << *b << dendl;
+      auto rl = b->space->_exclude_readers(this);
       b->space->_rm_buffer(this, b);
     }
   }
@@ -1194,6 +1240,17 @@ void BlueStore::TwoQCache::_trim(uint64_t onode_max, uint64_t buffer_max)
   while (num > 0) {
     Onode *o = &*p;
     dout(20) << __func__ << " considering " << o << dendl;
+    if (o->referenced.exchange(false)) {
+      dout(20) << __func__ << "  " << o->oid << " referenced, keeping" << dendl;
+      if (p == onode_lru.begin()) {
+	break;
+      }
+      onode_lru.erase(p--);
+      onode_lru.push_front(*o);
+      continue;
+    }
+    // hold off lockless lookups so that refs can't grow under us
+    auto ml = o->c->onode_map._exclude_readers();
     int refs = o->nref.load();
     if (refs > 1) {
       dout(20) << __func__ << "  " << o->oid << " has " << refs
@@ -1274,6 +1331,20 @@ void BlueStore::TwoQCache::_audit(const char *when)
 #undef dout_prefix
 #define dout_prefix *_dout << "bluestore.BufferSpace(" << this << " in " << cache << ") "
 
+std::shared_mutex& BlueStore::BufferSpace::_get_read_lock(const BufferSpace *bs)
+{
+  // a lock per BufferSpace would cost too much memory (there is one per
+  // SharedBlob), so hash onto a fixed set of cacheline-aligned stripes.
+  struct alignas(64) stripe_t {
+    std::shared_mutex lock;
+  };
+  static constexpr unsigned num_stripes = 256;
+  static stripe_t stripes[num_stripes];
+  uintptr_t h = reinterpret_cast<uintptr_t>(bs);
+  h ^= h >> 16;
+  return stripes[(h >> 6) % num_stripes].lock;
+}
+
 void BlueStore::BufferSpace::_clear(Cache* cache)
 {
   // note: we already hold cache->lock
@@ -1368,8 +1439,24 @@ void BlueStore::BufferSpace::read(
   uint32_t want_bytes = length;
   uint32_t end = offset + length;
 
+  // with lockless reads we only exclude writers and defer the lru
+  // update to trim
+  auto touch = [cache](Buffer *b) {
+    if (cache->lockless_reads) {
+      b->referenced.store(true, std::memory_order_relaxed);
+    } else {
+      cache->_touch_buffer(b);
+    }
+  };
+
   {
-    std::lock_guard<std::recursive_mutex> l(cache->lock);
+    std::unique_lock<std::recursive_mutex> l;
+    std::shared_lock<std::shared_mutex> rl;
+    if (cache->lockless_reads) {
+      rl = std::shared_lock<std::shared_mutex>(_get_read_lock(this));
+    } else {
+      l = cache->timed_lock();
+    }
     for (auto i = _data_lower_bound(offset);
          i != buffer_map.end() && offset < end && i->first < end;
          ++i) {
@@ -1384,7 +1471,7 @@ void BlueStore::BufferSpace::read(
 	  offset += l;
 	  length -= l;
 	  if (!b->is_writing()) {
-	    cache->_touch_buffer(b);
+	    touch(b);
 	  }
 	  continue;
         }
@@ -1397,7 +1484,7 @@ void BlueStore::BufferSpace::read(
 	  length -= gap;
         }
         if (!b->is_writing()) {
-	  cache->_touch_buffer(b);
+	  touch(b);
         }
         if (b->length > length) {
 	  res[offset].substr_of(b->data, 0, length);
@@ -1422,9 +1509,41 @@ void BlueStore::BufferSpace::read(
   cache->logger->inc(l_bluestore_buffer_miss_bytes, miss_bytes);
 }
 
+bool BlueStore::BufferSpace::probe(
+  Cache* cache,
+  uint32_t offset,
+  uint32_t length,
+  interval_set<uint32_t>& cached)
+{
+  cached.clear();
+  bool writing = false;
+  uint32_t end = offset + length;
+  std::unique_lock<std::recursive_mutex> l;
+  std::shared_lock<std::shared_mutex> rl;
+  if (cache->lockless_reads) {
+    rl = std::shared_lock<std::shared_mutex>(_get_read_lock(this));
+  } else {
+    l = cache->timed_lock();
+  }
+  for (auto i = _data_lower_bound(offset);
+       i != buffer_map.end() && i->first < end;
+       ++i) {
+    Buffer *b = i->second.get();
+    if (b->is_empty()) {
+      continue;
+    }
+    uint32_t s = std::max(offset, b->offset);
+    uint32_t e = std::min(end, b->end());
+    cached.insert(s, e - s);
+    writing |= b->is_writing();
+  }
+  return writing;
+}
+
 void BlueStore::BufferSpace::finish_write(Cache* cache, uint64_t seq)
 {
-  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  auto l = cache->timed_lock();
+  auto rl = _exclude_readers(cache);
 
   auto i = writing.begin();
   while (i != writing.end()) {
@@ -1462,6 +1581,19 @@ void BlueStore::BufferSpace::split(Cache* cache, size_t pos, BlueStore::BufferSp
   if (buffer_map.empty())
     return;
 
+  std::unique_lock<std::shared_mutex> rl, rl2;
+  if (cache->lockless_reads) {
+    rl = std::unique_lock<std::shared_mutex>(_get_read_lock(this),
+					     std::defer_lock);
+    if (&_get_read_lock(&r) != &_get_read_lock(this)) {
+      rl2 = std::unique_lock<std::shared_mutex>(_get_read_lock(&r),
+						std::defer_lock);
+      std::lock(rl, rl2);
+    } else {
+      rl.lock();
+    }
+  }
+
   auto p = --buffer_map.end();
   while (true) {
     if (p->second->end() <= pos)
@@ -1513,7 +1645,8 @@ void BlueStore::BufferSpace::split(Cache* cache, size_t pos, BlueStore::BufferSp
 
 BlueStore::OnodeRef BlueStore::OnodeSpace::add(const ghobject_t& oid, OnodeRef o)
 {
-  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  auto l = cache->timed_lock();
+  auto ml = _exclude_readers();
   auto p = onode_map.find(oid);
   if (p != onode_map.end()) {
     ldout(cache->cct, 30) << __func__ << " " << oid << " " << o
@@ -1533,8 +1666,20 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
   OnodeRef o;
   bool hit = false;
 
-  {
-    std::lock_guard<std::recursive_mutex> l(cache->lock);
+  if (cache->lockless_reads) {
+    std::shared_lock<std::shared_mutex> l(lookup_lock);
+    auto p = onode_map.find(oid);
+    if (p == onode_map.end()) {
+      ldout(cache->cct, 30) << __func__ << " " << oid << " miss" << dendl;
+    } else {
+      ldout(cache->cct, 30) << __func__ << " " << oid << " hit " << p->second
+			    << dendl;
+      p->second->referenced.store(true, std::memory_order_relaxed);
+      hit = true;
+      o = p->second;
+    }
+  } else {
+    auto l = cache->timed_lock();
     ceph::unordered_map<ghobject_t,OnodeRef>::iterator p = onode_map.find(oid);
     if (p == onode_map.end()) {
       ldout(cache->cct, 30) << __func__ << " " << oid << " miss" << dendl;
@@ -1558,6 +1703,7 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
 void BlueStore::OnodeSpace::clear()
 {
   std::lock_guard<std::recursive_mutex> l(cache->lock);
+  auto ml = _exclude_readers();
   ldout(cache->cct, 10) << __func__ << dendl;
   for (auto &p : onode_map) {
     cache->_rm_onode(p.second);
@@ -1578,6 +1724,7 @@ void BlueStore::OnodeSpace::rename(
   const mempool::bluestore_cache_other::string& new_okey)
 {
   std::lock_guard<std::recursive_mutex> l(cache->lock);
+  auto ml = _exclude_readers();
   ldout(cache->cct, 30) << __func__ << " " << old_oid << " -> " << new_oid
 			<< dendl;
   ceph::unordered_map<ghobject_t,OnodeRef>::iterator po, pn;
@@ -2189,6 +2336,7 @@ void BlueStore::ExtentMap::update(KeyValueDB::Transaction t,
     string key;
     for (auto& it : encoded_shards) {
       it.shard->dirty = false;
+      it.shard->struct_v = (__u8)it.bl[0];
       it.shard->shard_info->bytes = it.bl.length();
       generate_extent_shard_key_and_apply(
 	onode->key,
@@ -2501,9 +2649,13 @@ bool BlueStore::ExtentMap::encode_some(
   auto start = extent_map.lower_bound(dummy);
   uint32_t end = offset + length;
 
-  __u8 struct_v = 2; // Version 2 differs from v1 in blob's ref_map
-                     // serialization only. Hence there is no specific
-                     // handling at ExtentMap level.
+  BlueStore *store = onode->c->store;
+  __u8 struct_v =
+    store->extent_map_compact && store->extent_map_v3_fenced ?
+    EXTENT_MAP_SHARD_V_COMPACT : EXTENT_MAP_SHARD_V_LEGACY;
+  // Version 2 differs from v1 in blob's ref_map serialization only;
+  // v3 only changes the shard framing, blobs are still encoded as v2.
+  __u8 blob_struct_v = 2;
 
   unsigned n = 0;
   size_t bound = 0;
@@ -2527,7 +2679,7 @@ bool BlueStore::ExtentMap::encode_some(
 
       p->blob->bound_encode(
         bound,
-        struct_v,
+        blob_struct_v,
         p->blob->shared_blob->get_sbid(),
         false);
     }
@@ -2536,6 +2688,20 @@ bool BlueStore::ExtentMap::encode_some(
     return true;
   }
 
+  // v3 records the number of distinct local blobs up front
+  unsigned num_blobs = 0;
+  if (struct_v >= EXTENT_MAP_SHARD_V_COMPACT) {
+    for (auto p = start;
+	 p != extent_map.end() && p->logical_offset < end;
+	 ++p) {
+      if (!p->blob->is_spanning() && p->blob->last_encoded_id == -1) {
+	p->blob->last_encoded_id = -2;  // counted, not yet encoded
+	++num_blobs;
+      }
+    }
+    denc_varint(0, bound); // number of blobs
+  }
+
   denc(struct_v, bound);
   denc_varint(0, bound); // number of extents
 
@@ -2543,11 +2709,15 @@ bool BlueStore::ExtentMap::encode_some(
     auto app = bl.get_contiguous_appender(bound);
     denc(struct_v, app);
     denc_varint(n, app);
+    if (struct_v >= EXTENT_MAP_SHARD_V_COMPACT) {
+      denc_varint(num_blobs, app);
+    }
     if (pn) {
       *pn = n;
     }
 
     n = 0;
+    unsigned nb = 0;
     uint64_t pos = 0;
     uint64_t prev_len = 0;
     for (auto p = start;
@@ -2559,9 +2729,14 @@ bool BlueStore::ExtentMap::encode_some(
 	blobid = p->blob->id << BLOBID_SHIFT_BITS;
 	blobid |= BLOBID_FLAG_SPANNING;
       } else if (p->blob->last_encoded_id < 0) {
-	p->blob->last_encoded_id = n + 1;  // so it is always non-zero
+	// so it is always non-zero
+	if (struct_v >= EXTENT_MAP_SHARD_V_COMPACT) {
+	  p->blob->last_encoded_id = ++nb;
+	} else {
+	  p->blob->last_encoded_id = n + 1;
+	}
 	include_blob = true;
-	blobid = 0;  // the decoder will infer the id from n
+	blobid = 0;  // the decoder will infer the id from n (or nb)
       } else {
 	blobid = p->blob->last_encoded_id << BLOBID_SHIFT_BITS;
       }
@@ -2588,9 +2763,11 @@ bool BlueStore::ExtentMap::encode_some(
       }
       pos = p->logical_end();
       if (include_blob) {
-	p->blob->encode(app, struct_v, p->blob->shared_blob->get_sbid(), false);
+	p->blob->encode(app, blob_struct_v, p->blob->shared_blob->get_sbid(),
+			false);
       }
     }
+    assert(struct_v < EXTENT_MAP_SHARD_V_COMPACT || nb == num_blobs);
   }
   /*derr << __func__ << bl << dendl;
   derr << __func__ << ":";
@@ -2610,20 +2787,29 @@ unsigned BlueStore::ExtentMap::decode_some(bufferlist& bl)
   */
 
   assert(bl.get_num_buffers() <= 1);
+  assert(bl.length() > 0);
+  __u8 struct_v = *bl.front().c_str();
+  // deep: blob csum data must not pin the kv value buffer, and it is
+  // accounted to (and updated in) the cache mempool
   auto p = bl.front().begin_deep();
-  __u8 struct_v;
   denc(struct_v, p);
   // Version 2 differs from v1 in blob's ref_map
   // serialization only. Hence there is no specific
   // handling at ExtentMap level below.
-  assert(struct_v == 1 || struct_v == 2);
+  assert(struct_v >= 1 && struct_v <= EXTENT_MAP_SHARD_V_COMPACT);
+  __u8 blob_struct_v = std::min<__u8>(struct_v, 2);
 
   uint32_t num;
   denc_varint(num, p);
-  vector<BlobRef> blobs(num);
+  uint32_t num_blobs = num;
+  if (struct_v >= EXTENT_MAP_SHARD_V_COMPACT) {
+    denc_varint(num_blobs, p);
+  }
+  vector<BlobRef> blobs(num_blobs);
   uint64_t pos = 0;
   uint64_t prev_len = 0;
   unsigned n = 0;
+  unsigned nb = 0;
 
   while (!p.end()) {
     Extent *le = new Extent();
@@ -2652,13 +2838,19 @@ unsigned BlueStore::ExtentMap::decode_some(bufferlist& bl)
     } else {
       blobid >>= BLOBID_SHIFT_BITS;
       if (blobid) {
+	assert(blobid <= blobs.size());
 	le->assign_blob(blobs[blobid - 1]);
 	assert(le->blob);
       } else {
 	Blob *b = new Blob();
         uint64_t sbid = 0;
-        b->decode(onode->c, p, struct_v, &sbid, false);
-	blobs[n] = b;
+        b->decode(onode->c, p, blob_struct_v, &sbid, false);
+	if (struct_v >= EXTENT_MAP_SHARD_V_COMPACT) {
+	  assert(nb < blobs.size());
+	  blobs[nb++] = b;
+	} else {
+	  blobs[n] = b;
+	}
 	onode->c->open_shared_blob(sbid, b);
 	le->assign_blob(b);
       }
@@ -2674,9 +2866,24 @@ unsigned BlueStore::ExtentMap::decode_some(bufferlist& bl)
   }
 
   assert(n == num);
+  assert(struct_v < EXTENT_MAP_SHARD_V_COMPACT || nb == num_blobs);
   return num;
 }
 
+bool BlueStore::ExtentMap::has_legacy_encoding() const
+{
+  if (shards.empty()) {
+    return inline_bl.length() &&
+      (__u8)inline_bl[0] < EXTENT_MAP_SHARD_V_COMPACT;
+  }
+  for (auto& s : shards) {
+    if (s.loaded && !s.dirty && s.struct_v < EXTENT_MAP_SHARD_V_COMPACT) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void BlueStore::ExtentMap::bound_encode_spanning_blobs(size_t& p)
 {
   // Version 2 differs from v1 in blob's ref_map
@@ -2780,6 +2987,7 @@ void BlueStore::ExtentMap::fault_range(
         }
       );
       p->extents = decode_some(v);
+      p->struct_v = (__u8)v[0];
       p->loaded = true;
       dout(20) << __func__ << " open shard 0x" << std::hex
 	       << p->shard_info->offset << std::dec
@@ -3133,6 +3341,24 @@ void BlueStore::DeferredBatch::prepare_write(
 #endif
 }
 
+bool BlueStore::DeferredBatch::overlaps(const DeferredBatch& o) const
+{
+  for (auto& i : iomap) {
+    uint64_t end = i.first + i.second.bl.length();
+    auto p = o.iomap.lower_bound(i.first);
+    if (p != o.iomap.end() && p->first < end) {
+      return true;
+    }
+    if (p != o.iomap.begin()) {
+      --p;
+      if (p->first + p->second.bl.length() > i.first) {
+	return true;
+      }
+    }
+  }
+  return false;
+}
+
 void BlueStore::DeferredBatch::_discard(
   CephContext *cct, uint64_t offset, uint64_t length)
 {
@@ -3399,6 +3625,10 @@ void BlueStore::Collection::split_cache(
   std::lock_guard<std::recursive_mutex> l(cache->lock, std::adopt_lock);
   std::lock_guard<std::recursive_mutex> l2(dest->cache->lock, std::adopt_lock);
 
+  // keep lockless lookups out of both onode maps while we move entries
+  auto ml = onode_map._exclude_readers();
+  auto dml = dest->onode_map._exclude_readers();
+
   int destbits = dest->cnode.bits;
   spg_t destpg;
   bool is_pg = dest->cid.is_pg(&destpg);
@@ -3637,7 +3867,7 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
     kv_sync_thread(this),
-    kv_finalize_thread(this),
+    kv_commit_thread(this),
     mempool_thread(this)
 {
   _init_logger();
@@ -3656,7 +3886,7 @@ BlueStore::BlueStore(CephContext *cct,
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
     kv_sync_thread(this),
-    kv_finalize_thread(this),
+    kv_commit_thread(this),
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(ctz(_min_alloc_size)),
     mempool_thread(this)
@@ -3706,6 +3936,7 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_deferred_batch_ops",
     "bluestore_deferred_batch_ops_hdd",
     "bluestore_deferred_batch_ops_ssd",
+    "bluestore_deferred_coalesce",
     "bluestore_throttle_bytes",
     "bluestore_throttle_deferred_bytes",
     "bluestore_throttle_cost_per_io_hdd",
@@ -3714,6 +3945,12 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_max_blob_size",
     "bluestore_max_blob_size_ssd",
     "bluestore_max_blob_size_hdd",
+    "bluestore_extent_map_shard_compact",
+    "bluestore_readahead_max_bytes",
+    "bluestore_readahead_max_bytes_hdd",
+    "bluestore_readahead_max_bytes_ssd",
+    "bluestore_readahead_min_bytes",
+    "bluestore_readahead_trigger_requests",
     NULL
   };
   return KEYS;
@@ -3725,6 +3962,9 @@ void BlueStore::handle_conf_change(const struct md_config_t *conf,
   if (changed.count("bluestore_csum_type")) {
     _set_csum();
   }
+  if (changed.count("bluestore_extent_map_shard_compact")) {
+    _set_extent_map_format();
+  }
   if (changed.count("bluestore_compression_mode") ||
       changed.count("bluestore_compression_algorithm") ||
       changed.count("bluestore_compression_min_blob_size") ||
@@ -3747,12 +3987,22 @@ void BlueStore::handle_conf_change(const struct md_config_t *conf,
       changed.count("bluestore_max_alloc_size") ||
       changed.count("bluestore_deferred_batch_ops") ||
       changed.count("bluestore_deferred_batch_ops_hdd") ||
-      changed.count("bluestore_deferred_batch_ops_ssd")) {
+      changed.count("bluestore_deferred_batch_ops_ssd") ||
+      changed.count("bluestore_deferred_coalesce")) {
     if (bdev) {
       // only after startup
       _set_alloc_sizes();
     }
   }
+  if (changed.count("bluestore_readahead_max_bytes") ||
+      changed.count("bluestore_readahead_max_bytes_hdd") ||
+      changed.count("bluestore_readahead_max_bytes_ssd") ||
+      changed.count("bluestore_readahead_min_bytes") ||
+      changed.count("bluestore_readahead_trigger_requests")) {
+    if (bdev) {
+      _set_readahead();
+    }
+  }
   if (changed.count("bluestore_throttle_cost_per_io") ||
       changed.count("bluestore_throttle_cost_per_io_hdd") ||
       changed.count("bluestore_throttle_cost_per_io_ssd")) {
@@ -3840,6 +4090,34 @@ void BlueStore::_set_csum()
 	   << dendl;
 }
 
+void BlueStore::_set_extent_map_format()
+{
+  extent_map_compact =
+    cct->_conf->get_val<bool>("bluestore_extent_map_shard_compact");
+  dout(10) << __func__ << " compact " << extent_map_compact << dendl;
+}
+
+void BlueStore::_set_readahead()
+{
+  uint64_t max = cct->_conf->get_val<uint64_t>("bluestore_readahead_max_bytes");
+  if (!max) {
+    assert(bdev);
+    if (bdev->is_rotational()) {
+      max = cct->_conf->get_val<uint64_t>("bluestore_readahead_max_bytes_hdd");
+    } else {
+      max = cct->_conf->get_val<uint64_t>("bluestore_readahead_max_bytes_ssd");
+    }
+  }
+  readahead_min_bytes =
+    std::min(max, cct->_conf->get_val<uint64_t>("bluestore_readahead_min_bytes"));
+  readahead_max_bytes = max;
+  readahead_trigger_requests =
+    cct->_conf->get_val<uint64_t>("bluestore_readahead_trigger_requests");
+  dout(10) << __func__ << " min 0x" << std::hex << readahead_min_bytes
+	   << " max 0x" << readahead_max_bytes << std::dec
+	   << " trigger " << readahead_trigger_requests << dendl;
+}
+
 void BlueStore::_set_throttle_params()
 {
   if (cct->_conf->bluestore_throttle_cost_per_io) {
@@ -3979,6 +4257,35 @@ void BlueStore::_init_logger()
   b.add_time_avg(l_bluestore_kv_lat, "kv_lat",
 		 "Average kv_thread sync latency",
 		 "k_l", PerfCountersBuilder::PRIO_INTERESTING);
+
+  // Latency axis configuration for kv stage histograms, in nanoseconds
+  PerfHistogramCommon::axis_config_d kv_hist_lat_config{
+    "Latency (usec)",
+    PerfHistogramCommon::SCALE_LOG2, ///< Latency in logarithmic scale
+    0,                               ///< Start at 0
+    10000,                           ///< Quantization unit is 10usec
+    24,                              ///< Enough to cover a minute
+  };
+  // Batch size axis configuration for kv stage histograms
+  PerfHistogramCommon::axis_config_d kv_hist_txc_config{
+    "Transactions in batch",
+    PerfHistogramCommon::SCALE_LOG2, ///< Batch size in logarithmic scale
+    0,                               ///< Start at 0
+    1,                               ///< Quantization unit is 1 txc
+    16,                              ///< Enough to cover any batch
+  };
+  b.add_u64_counter_histogram(
+    l_bluestore_kv_prepare_lat_hist, "kv_prepare_lat_histogram",
+    kv_hist_lat_config, kv_hist_txc_config,
+    "Histogram of kv_sync_thread flush + submit latency by batch size");
+  b.add_u64_counter_histogram(
+    l_bluestore_kv_commit_lat_hist, "kv_commit_lat_histogram",
+    kv_hist_lat_config, kv_hist_txc_config,
+    "Histogram of kv sync commit latency by batch size");
+  b.add_u64_counter_histogram(
+    l_bluestore_kv_finalize_lat_hist, "kv_finalize_lat_histogram",
+    kv_hist_lat_config, kv_hist_txc_config,
+    "Histogram of kv finalize latency by batch size");
   b.add_time_avg(l_bluestore_state_prepare_lat, "state_prepare_lat",
     "Average prepare state latency");
   b.add_time_avg(l_bluestore_state_aio_wait_lat, "state_aio_wait_lat",
@@ -4034,6 +4341,13 @@ void BlueStore::_init_logger()
 		    "Sum for deferred write op");
   b.add_u64_counter(l_bluestore_deferred_write_bytes, "deferred_write_bytes",
 		    "Sum for deferred write bytes", "def", 0, unit_t(BYTES));
+  b.add_u64_counter(l_bluestore_deferred_write_extents, "deferred_write_extents",
+		    "Sum for deferred extents queued for write (before merging "
+		    "adjacent extents into deferred_write_ops)");
+  b.add_u64_counter(l_bluestore_deferred_coalesced_batches,
+		    "deferred_coalesced_batches",
+		    "Sum for deferred batches submitted along with another "
+		    "sequencer's batch");
   b.add_u64_counter(l_bluestore_write_penalty_read_ops, "write_penalty_read_ops",
 		    "Sum for write penalty read ops");
   b.add_u64(l_bluestore_allocated, "bluestore_allocated",
@@ -4070,6 +4384,8 @@ void BlueStore::_init_logger()
 	    "Sum for bytes of read hit in the cache", NULL, 0, unit_t(BYTES));
   b.add_u64(l_bluestore_buffer_miss_bytes, "bluestore_buffer_miss_bytes",
 	    "Sum for bytes of read missed in the cache", NULL, 0, unit_t(BYTES));
+  b.add_time_avg(l_bluestore_cache_lock_wait_lat, "cache_lock_wait_lat",
+		 "Average time spent waiting for a contended cache shard lock");
 
   b.add_u64_counter(l_bluestore_write_big, "bluestore_write_big",
 		    "Large aligned writes into fresh blobs");
@@ -4106,6 +4422,20 @@ void BlueStore::_init_logger()
 		    "collection");
   b.add_u64_counter(l_bluestore_read_eio, "bluestore_read_eio",
                     "Read EIO errors propagated to high level callers");
+  b.add_u64_counter(l_bluestore_readahead_bytes, "bluestore_readahead_bytes",
+		    "Bytes prefetched ahead of sequential readers",
+		    NULL, 0, unit_t(BYTES));
+  b.add_u64_counter(l_bluestore_readahead_hit_bytes,
+		    "bluestore_readahead_hit_bytes",
+		    "Bytes read that had been prefetched",
+		    NULL, 0, unit_t(BYTES));
+  b.add_u64_counter(l_bluestore_readahead_waste_bytes,
+		    "bluestore_readahead_waste_bytes",
+		    "Prefetched bytes dropped without being read",
+		    NULL, 0, unit_t(BYTES));
+  b.add_u64_counter(l_bluestore_alloc_checkpoint_loaded,
+		    "bluestore_alloc_checkpoint_loaded",
+		    "Allocator opens that used the checkpoint");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -4303,6 +4633,7 @@ void BlueStore::_set_alloc_sizes(void)
       deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops_ssd;
     }
   }
+  deferred_coalesce = cct->_conf->get_val<bool>("bluestore_deferred_coalesce");
 
   dout(10) << __func__ << " min_alloc_size 0x" << std::hex << min_alloc_size
 	   << std::dec << " order " << (int)min_alloc_size_order
@@ -4310,6 +4641,7 @@ void BlueStore::_set_alloc_sizes(void)
 	   << " prefer_deferred_size 0x" << prefer_deferred_size
 	   << std::dec
 	   << " deferred_batch_ops " << deferred_batch_ops
+	   << " deferred_coalesce " << deferred_coalesce
 	   << dendl;
 }
 
@@ -4472,7 +4804,7 @@ void BlueStore::_close_fm()
   fm = NULL;
 }
 
-int BlueStore::_open_alloc()
+int BlueStore::_open_alloc(bool read_only)
 {
   assert(alloc == NULL);
   assert(bdev->get_size());
@@ -4489,6 +4821,15 @@ int BlueStore::_open_alloc()
   uint64_t num = 0, bytes = 0;
 
   dout(1) << __func__ << " opening allocation metadata" << dendl;
+  if (!read_only && _load_alloc_checkpoint(&num, &bytes) == 0) {
+    // the checkpoint was taken with bluefs_extents already allocated
+    dout(1) << __func__ << " loaded " << pretty_si_t(bytes)
+	    << " in " << num << " extents from checkpoint"
+	    << dendl;
+    logger->inc(l_bluestore_alloc_checkpoint_loaded);
+    return 0;
+  }
+
   // initialize from freelist
   fm->enumerate_reset();
   uint64_t offset, length;
@@ -4512,6 +4853,227 @@ int BlueStore::_open_alloc()
   return 0;
 }
 
+/*
+ * Allocator checkpoint
+ *
+ * On a clean umount the allocator's free extents are written to a bluefs
+ * file along with a random nonce, and the same nonce is then recorded
+ * under PREFIX_SUPER.  The next _open_alloc removes the key before doing
+ * anything else and only uses the file if the nonces match, so a crash
+ * or any mount that does not end in a clean umount invalidates it.
+ *
+ * Releases that predate the checkpoint would neither remove the key nor
+ * keep the file in sync with the freelist, so while one is outstanding
+ * min_compat_ondisk_format is raised to keep them from mounting at all.
+ * A read-only open (fsck without repair) leaves the checkpoint alone and
+ * builds the allocator from the freelist.
+ */
+#define ALLOC_CHECKPOINT_DIR "bluestore"
+#define ALLOC_CHECKPOINT_FILE "allocator"
+#define ALLOC_CHECKPOINT_KEY "alloc_checkpoint"
+
+int BlueStore::_load_alloc_checkpoint(uint64_t *num, uint64_t *bytes)
+{
+  if (!bluefs) {
+    return -ENOENT;
+  }
+  bufferlist nonce_bl;
+  int r = db->get(PREFIX_SUPER, ALLOC_CHECKPOINT_KEY, &nonce_bl);
+  if (r < 0) {
+    return -ENOENT;
+  }
+  {
+    // consumed; older releases may mount us again
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkey(PREFIX_SUPER, ALLOC_CHECKPOINT_KEY);
+    _prepare_ondisk_format_super(t);
+    db->submit_transaction_sync(t);
+  }
+
+  uuid_d nonce;
+  uint64_t size = 0;
+  bufferlist bl;
+  BlueFS::FileReader *h = nullptr;
+  vector<pair<uint64_t,uint64_t>> extents;
+  utime_t start = ceph_clock_now();
+
+  if (!cct->_conf->get_val<bool>("bluestore_alloc_checkpoint")) {
+    dout(10) << __func__ << " disabled, discarding checkpoint" << dendl;
+    r = -ENOENT;
+    goto out;
+  }
+  try {
+    auto p = nonce_bl.begin();
+    decode(nonce, p);
+  } catch (buffer::error& e) {
+    derr << __func__ << " unable to decode checkpoint nonce" << dendl;
+    r = -EIO;
+    goto out;
+  }
+  r = bluefs->stat(ALLOC_CHECKPOINT_DIR, ALLOC_CHECKPOINT_FILE, &size, nullptr);
+  if (r < 0) {
+    derr << __func__ << " checkpoint file missing: " << cpp_strerror(r)
+	 << dendl;
+    goto out;
+  }
+  r = bluefs->open_for_read(ALLOC_CHECKPOINT_DIR, ALLOC_CHECKPOINT_FILE, &h);
+  if (r < 0) {
+    derr << __func__ << " unable to open checkpoint: " << cpp_strerror(r)
+	 << dendl;
+    goto out;
+  }
+  r = bluefs->read(h, &h->buf, 0, size, &bl, nullptr);
+  delete h;
+  if (r < 0 || (uint64_t)r != size || size < sizeof(uint32_t)) {
+    derr << __func__ << " short read of checkpoint: " << r << " of "
+	 << size << dendl;
+    r = -EIO;
+    goto out;
+  }
+
+  {
+    bufferlist payload;
+    payload.substr_of(bl, 0, size - sizeof(uint32_t));
+    uint32_t expected_crc, crc = payload.crc32c(-1);
+    try {
+      auto p = bl.begin();
+      p.seek(payload.length());
+      decode(expected_crc, p);
+      if (crc != expected_crc) {
+	derr << __func__ << " checkpoint crc 0x" << std::hex << crc
+	     << " != expected 0x" << expected_crc << std::dec << dendl;
+	r = -EIO;
+	goto out;
+      }
+
+      p = payload.begin();
+      __u8 struct_v;
+      uuid_d file_nonce;
+      uint64_t dev_size, au, n;
+      decode(struct_v, p);
+      decode(file_nonce, p);
+      decode(dev_size, p);
+      decode(au, p);
+      decode(n, p);
+      if (struct_v != 1 || file_nonce != nonce ||
+	  dev_size != bdev->get_size() || au != min_alloc_size) {
+	derr << __func__ << " stale checkpoint (v " << (int)struct_v
+	     << " nonce " << file_nonce << " expected " << nonce
+	     << " size 0x" << std::hex << dev_size << " au 0x" << au
+	     << std::dec << ")" << dendl;
+	r = -ESTALE;
+	goto out;
+      }
+      extents.resize(n);
+      for (auto& e : extents) {
+	decode(e.first, p);
+	decode(e.second, p);
+      }
+    } catch (buffer::error& e) {
+      derr << __func__ << " unable to decode checkpoint" << dendl;
+      r = -EIO;
+      goto out;
+    }
+  }
+
+  for (auto& e : extents) {
+    alloc->init_add_free(e.first, e.second);
+    ++*num;
+    *bytes += e.second;
+  }
+  dout(10) << __func__ << " loaded " << extents.size() << " extents in "
+	   << (ceph_clock_now() - start) << dendl;
+  r = 0;
+
+ out:
+  if (bluefs->stat(ALLOC_CHECKPOINT_DIR, ALLOC_CHECKPOINT_FILE,
+		   nullptr, nullptr) == 0) {
+    bluefs->unlink(ALLOC_CHECKPOINT_DIR, ALLOC_CHECKPOINT_FILE);
+    bluefs->sync_metadata();
+  }
+  return r;
+}
+
+void BlueStore::_save_alloc_checkpoint()
+{
+  if (!bluefs || !cct->_conf->get_val<bool>("bluestore_alloc_checkpoint")) {
+    return;
+  }
+  utime_t start = ceph_clock_now();
+  uuid_d nonce;
+  nonce.generate_random();
+
+  // outstanding discards still hold their extents
+  bdev->discard_drain();
+
+  bufferlist extents_bl;
+  uint64_t num = 0;
+  bool ok = alloc->foreach_free([&](uint64_t offset, uint64_t length) {
+      encode(offset, extents_bl);
+      encode(length, extents_bl);
+      ++num;
+    });
+  if (!ok) {
+    dout(1) << __func__ << " allocator " << cct->_conf->bluestore_allocator
+	    << " cannot enumerate free space, not saving" << dendl;
+    return;
+  }
+
+  bufferlist bl;
+  __u8 struct_v = 1;
+  encode(struct_v, bl);
+  encode(nonce, bl);
+  encode(bdev->get_size(), bl);
+  encode(min_alloc_size, bl);
+  encode(num, bl);
+  bl.claim_append(extents_bl);
+  uint32_t crc = bl.crc32c(-1);
+  encode(crc, bl);
+
+  if (!bluefs->dir_exists(ALLOC_CHECKPOINT_DIR)) {
+    bluefs->mkdir(ALLOC_CHECKPOINT_DIR);
+  }
+  BlueFS::FileWriter *h;
+  int r = bluefs->open_for_write(ALLOC_CHECKPOINT_DIR, ALLOC_CHECKPOINT_FILE,
+				 &h, false);
+  if (r < 0) {
+    derr << __func__ << " unable to open checkpoint: " << cpp_strerror(r)
+	 << dendl;
+    return;
+  }
+  uint64_t len = bl.length();
+  h->append(bl);
+  r = bluefs->fsync(h);
+  bluefs->close_writer(h);
+  if (r < 0) {
+    derr << __func__ << " unable to write checkpoint: " << cpp_strerror(r)
+	 << dendl;
+    return;
+  }
+
+  if (cct->_conf->get_val<bool>("bluestore_debug_alloc_checkpoint_omit_key")) {
+    derr << __func__ << " debug: not recording checkpoint nonce" << dendl;
+    return;
+  }
+  if (cct->_conf->get_val<bool>("bluestore_debug_alloc_checkpoint_stale_nonce")) {
+    derr << __func__ << " debug: recording a stale checkpoint nonce" << dendl;
+    nonce.generate_random();
+  }
+  int32_t compat = alloc_checkpoint_compat_ondisk_format;
+  if (extent_map_v3_fenced) {
+    compat = std::max(compat, extent_map_v3_compat_ondisk_format);
+  }
+  bufferlist nonce_bl, compat_bl;
+  encode(nonce, nonce_bl);
+  encode(compat, compat_bl);
+  KeyValueDB::Transaction t = db->get_transaction();
+  t->set(PREFIX_SUPER, ALLOC_CHECKPOINT_KEY, nonce_bl);
+  t->set(PREFIX_SUPER, "min_compat_ondisk_format", compat_bl);
+  db->submit_transaction_sync(t);
+  dout(1) << __func__ << " saved " << num << " extents (" << pretty_si_t(len)
+	  << "B) in " << (ceph_clock_now() - start) << dendl;
+}
+
 void BlueStore::_close_alloc()
 {
   assert(bdev);
@@ -5504,6 +6066,7 @@ int BlueStore::mkfs()
     }
 
     ondisk_format = latest_ondisk_format;
+    extent_map_v3_fenced = false;
     _prepare_ondisk_format_super(t);
     db->submit_transaction_sync(t);
   }
@@ -5700,6 +6263,7 @@ int BlueStore::umount()
     _flush_cache();
     dout(20) << __func__ << " closing" << dendl;
 
+    _save_alloc_checkpoint();
     _close_alloc();
     _close_fm();
   }
@@ -5858,6 +6422,7 @@ int BlueStore::_fsck(bool deep, bool repair)
   uint64_t num_blobs = 0;
   uint64_t num_spanning_blobs = 0;
   uint64_t num_shared_blobs = 0;
+  uint64_t num_legacy_encoded = 0;
   uint64_t num_sharded_objects = 0;
   uint64_t num_object_shards = 0;
   BlueStoreRepairer repairer;
@@ -5895,7 +6460,8 @@ int BlueStore::_fsck(bool deep, bool repair)
   if (r < 0)
     goto out_db;
 
-  r = _open_alloc();
+  // a repair may change the freelist, so it must consume the checkpoint
+  r = _open_alloc(!repair);
   if (r < 0)
     goto out_fm;
 
@@ -6243,6 +6809,18 @@ int BlueStore::_fsck(bool deep, bool repair)
 	  m.insert(o->onode.nid);
 	}
       }
+      // extent map encoding
+      if (extent_map_compact && o->extent_map.has_legacy_encoding()) {
+	++num_legacy_encoded;
+	if (repair) {
+	  dout(20) << __func__ << "  upgrading extent map encoding of "
+		   << oid << dendl;
+	  _fence_extent_map_v3();
+	  KeyValueDB::Transaction txn = repairer.get_upgrade_txn(db);
+	  o->extent_map.dirty_range(0, OBJECT_MAX_SIZE);
+	  _record_onode(o, txn);
+	}
+      }
     }
   }
 
@@ -6716,6 +7294,11 @@ int BlueStore::_fsck(bool deep, bool repair)
 	  << num_spanning_blobs << " spanning, "
 	  << num_shared_blobs << " shared."
 	  << dendl;
+  if (num_legacy_encoded) {
+    dout(1) << __func__ << " " << num_legacy_encoded
+	    << " objects with legacy extent map encoding"
+	    << (repair ? " upgraded" : ", run repair to upgrade") << dendl;
+  }
 
   utime_t duration = ceph_clock_now() - start;
   dout(1) << __func__ << " <<<FINISH>>> with " << errors << " errors, " << repaired
@@ -6917,8 +7500,7 @@ BlueStore::CollectionRef BlueStore::_get_collection(const coll_t& cid)
 void BlueStore::_queue_reap_collection(CollectionRef& c)
 {
   dout(10) << __func__ << " " << c << " " << c->cid << dendl;
-  // _reap_collections and this in the same thread,
-  // so no need a lock.
+  std::lock_guard<std::mutex> l(reap_lock);
   removed_collections.push_back(c);
 }
 
@@ -6927,8 +7509,7 @@ void BlueStore::_reap_collections()
 
   list<CollectionRef> removed_colls;
   {
-    // _queue_reap_collection and this in the same thread.
-    // So no need a lock.
+    std::lock_guard<std::mutex> l(reap_lock);
     if (!removed_collections.empty())
       removed_colls.swap(removed_collections);
     else
@@ -6958,6 +7539,7 @@ void BlueStore::_reap_collections()
   if (removed_colls.empty()) {
     dout(10) << __func__ << " all reaped" << dendl;
   } else {
+    std::lock_guard<std::mutex> l(reap_lock);
     removed_collections.splice(removed_collections.begin(), removed_colls);
   }
 }
@@ -7093,6 +7675,13 @@ int BlueStore::read(
     if (offset == length && offset == 0)
       length = o->onode.size;
 
+    if (readahead_max_bytes &&
+	(op_flags & (CEPH_OSD_OP_FLAG_FADVISE_RANDOM |
+		     CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+		     CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0) {
+      _do_readahead(o, offset, length);
+    }
+
     r = _do_read(c, o, offset, length, bl, op_flags);
     if (r == -EIO) {
       logger->inc(l_bluestore_read_eio);
@@ -7117,6 +7706,201 @@ int BlueStore::read(
   return r;
 }
 
+void BlueStore::_do_readahead(
+  OnodeRef& o,
+  uint64_t offset,
+  size_t length)
+{
+  if (offset >= o->onode.size) {
+    return;
+  }
+  if (offset + length > o->onode.size) {
+    length = o->onode.size - offset;
+  }
+  uint64_t end = offset + length;
+
+  std::lock_guard<std::mutex> l(o->readahead_lock);
+  if (!o->readahead) {
+    o->readahead.reset(new OnodeReadahead);
+    o->readahead->ra.set_trigger_requests(readahead_trigger_requests);
+    o->readahead->ra.set_min_readahead_size(readahead_min_bytes);
+    o->readahead->ra.set_max_readahead_size(readahead_max_bytes);
+  }
+  OnodeReadahead *ra = o->readahead.get();
+
+  // the stream broke off (or was never there): whatever we fetched ahead
+  // of it is not going to be used.  don't wait for it here, it is reaped
+  // once it completes.
+  if (offset != ra->last_end) {
+    for (auto& pf : ra->pending) {
+      pf->orphan = true;
+    }
+    logger->inc(l_bluestore_readahead_waste_bytes, ra->installed.size());
+    ra->installed.clear();
+    ra->backlog = Readahead::extent_t(0, 0);
+  }
+  ra->last_end = end;
+
+  // make prefetched data this read needs visible in the cache, waiting for
+  // it if it is still in flight
+  auto p = ra->pending.begin();
+  while (p != ra->pending.end()) {
+    OnodeReadahead::prefetch_t *pf = p->get();
+    if (pf->orphan) {
+      if (!pf->done()) {
+	++p;
+	continue;
+      }
+      for (auto& reg : pf->regions) {
+	logger->inc(l_bluestore_readahead_waste_bytes, reg.bl.length());
+      }
+    } else if (pf->offset >= end || pf->offset + pf->length <= offset) {
+      ++p;
+      continue;
+    } else {
+      _readahead_finish(o, pf);
+    }
+    p = ra->pending.erase(p);
+  }
+  interval_set<uint64_t> hit;
+  hit.insert(offset, length);
+  hit.intersection_of(ra->installed);
+  if (!hit.empty()) {
+    logger->inc(l_bluestore_readahead_hit_bytes, hit.size());
+    ra->installed.subtract(hit);
+  }
+
+  // the detector moves its window on whether or not we issue it, so
+  // windows we can't issue yet are queued up and issued in order later.
+  // successive windows are contiguous unless the reader overtook them.
+  auto e = ra->ra.update(offset, length, o->onode.size);
+  Readahead::extent_t& b = ra->backlog;
+  if (e.second) {
+    if (b.second && b.first + b.second == e.first) {
+      b.second += e.second;
+    } else {
+      b = e;
+    }
+  }
+  uint64_t b_end = b.first + b.second;
+  if (b_end <= end) {
+    // empty, or all of it has been read by now
+    b = Readahead::extent_t(0, 0);
+    return;
+  }
+  if (b.first < end) {
+    b = Readahead::extent_t(end, b_end - end);
+  }
+  if (ra->pending.size() >= 2) {
+    // the device is not keeping up with the stream; don't pile on
+    dout(20) << __func__ << " " << o->oid << " defer 0x" << std::hex
+	     << b.first << "~" << b.second << std::dec
+	     << ", " << ra->pending.size() << " in flight" << dendl;
+    return;
+  }
+  e = Readahead::extent_t(
+    b.first, std::min<uint64_t>(b.second, std::max<uint64_t>(
+				  readahead_max_bytes, readahead_min_bytes)));
+  b.first += e.second;
+  b.second -= e.second;
+  dout(20) << __func__ << " " << o->oid << " 0x" << std::hex
+	   << e.first << "~" << e.second << std::dec << dendl;
+  o->extent_map.fault_range(db, e.first, e.second);
+  std::unique_ptr<OnodeReadahead::prefetch_t> pf(
+    new OnodeReadahead::prefetch_t(cct, e.first, e.second, o->data_gen));
+  _readahead_issue(o, pf.get());
+  if (pf->ioc.has_pending_aios()) {
+    bdev->aio_submit(&pf->ioc);
+  }
+  if (!pf->regions.empty()) {
+    ra->pending.push_back(std::move(pf));
+  }
+}
+
+void BlueStore::_readahead_issue(
+  OnodeRef& o,
+  OnodeReadahead::prefetch_t *pf)
+{
+  uint64_t end = pf->offset + pf->length;
+  for (auto lp = o->extent_map.seek_lextent(pf->offset);
+       lp != o->extent_map.extent_map.end() && lp->logical_offset < end;
+       ++lp) {
+    BlobRef& bptr = lp->blob;
+    const bluestore_blob_t& blob = bptr->get_blob();
+    if (blob.is_compressed()) {
+      // would need the whole blob and a decompress; leave it to the read
+      continue;
+    }
+    uint64_t pos = std::max(pf->offset, (uint64_t)lp->logical_offset);
+    uint32_t b_off = pos - lp->logical_offset + lp->blob_offset;
+    uint32_t b_len = std::min(end, (uint64_t)lp->logical_end()) - pos;
+    uint64_t chunk_size = blob.get_chunk_size(block_size);
+    uint32_t a_off = p2align<uint64_t>(b_off, chunk_size);
+    uint32_t a_end = p2roundup<uint64_t>(b_off + b_len, chunk_size);
+
+    // don't fetch what is cached already, and never race with data that is
+    // still being written: did_read() would replace it with what is on disk
+    interval_set<uint32_t> cached;
+    if (bptr->shared_blob->bc.probe(bptr->shared_blob->get_cache(),
+				    a_off, a_end - a_off, cached)) {
+      continue;
+    }
+    interval_set<uint32_t> want;
+    want.insert(b_off, b_len);
+    cached.intersection_of(want);
+    want.subtract(cached);
+    interval_set<uint32_t> aligned;
+    for (auto q = want.begin(); q != want.end(); ++q) {
+      uint32_t r_off = p2align<uint64_t>(q.get_start(), chunk_size);
+      uint32_t r_end = p2roundup<uint64_t>(q.get_end(), chunk_size);
+      aligned.union_insert(r_off, r_end - r_off);
+    }
+
+    for (auto q = aligned.begin(); q != aligned.end(); ++q) {
+      pf->regions.emplace_back(
+	bptr, lp->logical_offset - lp->blob_offset + q.get_start(),
+	q.get_start());
+      auto& reg = pf->regions.back();
+      int r = blob.map(
+	q.get_start(), q.get_len(),
+	[&](uint64_t offset, uint64_t length) {
+	  return bdev->aio_read(offset, length, &reg.bl, &pf->ioc);
+	});
+      if (r < 0) {
+	derr << __func__ << " bdev-read failed: " << cpp_strerror(r) << dendl;
+	pf->failed = true;
+	return;
+      }
+      logger->inc(l_bluestore_readahead_bytes, q.get_len());
+    }
+  }
+}
+
+void BlueStore::_readahead_finish(
+  OnodeRef& o,
+  OnodeReadahead::prefetch_t *pf)
+{
+  pf->ioc.aio_wait();
+  OnodeReadahead *ra = o->readahead.get();
+  bool drop = pf->failed || pf->ioc.get_return_value() < 0 ||
+    pf->data_gen != o->data_gen;
+  dout(20) << __func__ << " " << o->oid << " 0x" << std::hex
+	   << pf->offset << "~" << pf->length << std::dec
+	   << (drop ? " drop" : "") << dendl;
+  for (auto& reg : pf->regions) {
+    // the read itself will report csum errors
+    if (drop ||
+	_verify_csum(o, &reg.blob->get_blob(), reg.b_off, reg.bl,
+		     reg.logical_offset) < 0) {
+      logger->inc(l_bluestore_readahead_waste_bytes, reg.bl.length());
+      continue;
+    }
+    reg.blob->shared_blob->bc.did_read(reg.blob->shared_blob->get_cache(),
+				       reg.b_off, reg.bl);
+    ra->installed.union_insert(reg.logical_offset, reg.bl.length());
+  }
+}
+
 // --------------------------------------------------------
 // intermediate data structures used while reading
 struct region_t {
@@ -8103,8 +8887,12 @@ ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator(
 
 void BlueStore::_prepare_ondisk_format_super(KeyValueDB::Transaction& t)
 {
+  int32_t compat = min_compat_ondisk_format;
+  if (extent_map_v3_fenced) {
+    compat = std::max(compat, extent_map_v3_compat_ondisk_format);
+  }
   dout(10) << __func__ << " ondisk_format " << ondisk_format
-	   << " min_compat_ondisk_format " << min_compat_ondisk_format
+	   << " min_compat_ondisk_format " << compat
 	   << dendl;
   assert(ondisk_format == latest_ondisk_format);
   {
@@ -8114,11 +8902,37 @@ void BlueStore::_prepare_ondisk_format_super(KeyValueDB::Transaction& t)
   }
   {
     bufferlist bl;
-    encode(min_compat_ondisk_format, bl);
+    encode(compat, bl);
     t->set(PREFIX_SUPER, "min_compat_ondisk_format", bl);
   }
 }
 
+/*
+ * Releases that predate v3 extent map shards assert when they decode
+ * one, so before the first one is written the store is marked for good:
+ * the fence key is recorded and min_compat_ondisk_format raised to keep
+ * those releases from mounting.  This is done in a transaction of its
+ * own, committed before any transaction that could carry a v3 shard.
+ */
+#define EXTENT_MAP_V3_KEY "extent_map_v3"
+
+void BlueStore::_fence_extent_map_v3()
+{
+  std::lock_guard<std::mutex> l(extent_map_v3_fence_lock);
+  if (extent_map_v3_fenced) {
+    return;
+  }
+  dout(1) << __func__ << " raising min_compat_ondisk_format to "
+	  << extent_map_v3_compat_ondisk_format << dendl;
+  KeyValueDB::Transaction t = db->get_transaction();
+  bufferlist bl;
+  t->set(PREFIX_SUPER, EXTENT_MAP_V3_KEY, bl);
+  extent_map_v3_fenced = true;
+  _prepare_ondisk_format_super(t);
+  int r = db->submit_transaction_sync(t);
+  assert(r == 0);
+}
+
 int BlueStore::_open_super_meta()
 {
   // nid
@@ -8229,6 +9043,12 @@ int BlueStore::_open_super_meta()
 	 << latest_ondisk_format << dendl;
     return -EPERM;
   }
+  {
+    bufferlist bl;
+    extent_map_v3_fenced = db->get(PREFIX_SUPER, EXTENT_MAP_V3_KEY, &bl) >= 0;
+    dout(10) << __func__ << " extent_map_v3_fenced " << extent_map_v3_fenced
+	     << dendl;
+  }
   if (ondisk_format < latest_ondisk_format) {
     int r = _upgrade_super();
     if (r < 0) {
@@ -8260,6 +9080,8 @@ int BlueStore::_open_super_meta()
   _set_csum();
   _set_compression();
   _set_blob_size();
+  _set_extent_map_format();
+  _set_readahead();
 
   return 0;
 }
@@ -8271,6 +9093,7 @@ int BlueStore::_upgrade_super()
   assert(ondisk_format > 0);
   assert(ondisk_format < latest_ondisk_format);
 
+  KeyValueDB::Transaction t = db->get_transaction();
   if (ondisk_format == 1) {
     // changes:
     // - super: added ondisk_format
@@ -8278,7 +9101,6 @@ int BlueStore::_upgrade_super()
     // - super: added min_compat_ondisk_format
     // - super: added min_alloc_size
     // - super: removed min_min_alloc_size
-    KeyValueDB::Transaction t = db->get_transaction();
     {
       bufferlist bl;
       db->get(PREFIX_SUPER, "min_min_alloc_size", &bl);
@@ -8295,10 +9117,18 @@ int BlueStore::_upgrade_super()
       t->rmkey(PREFIX_SUPER, "min_min_alloc_size");
     }
     ondisk_format = 2;
-    _prepare_ondisk_format_super(t);
-    int r = db->submit_transaction_sync(t);
-    assert(r == 0);
   }
+  if (ondisk_format == 2) {
+    // changes:
+    // - super: min_compat_ondisk_format is raised while an allocator
+    //   checkpoint is outstanding
+    // - super: min_compat_ondisk_format is raised for good, and
+    //   extent_map_v3 added, before the first v3 extent map shard
+    ondisk_format = 3;
+  }
+  _prepare_ondisk_format_super(t);
+  int r = db->submit_transaction_sync(t);
+  assert(r == 0);
 
   // done
   dout(1) << __func__ << " done" << dendl;
@@ -8331,6 +9161,17 @@ void BlueStore::get_db_statistics(Formatter *f)
   db->get_statistics(f);
 }
 
+void BlueStore::get_allocator_stats(Formatter *f)
+{
+  f->open_object_section("allocator");
+  f->dump_string("type", cct->_conf->bluestore_allocator);
+  if (alloc) {
+    f->dump_unsigned("free", alloc->get_free());
+    f->dump_float("fragmentation_score", alloc->get_fragmentation());
+  }
+  f->close_section();
+}
+
 BlueStore::TransContext *BlueStore::_txc_create(
   Collection *c, OpSequencer *osr)
 {
@@ -8524,6 +9365,10 @@ void BlueStore::_txc_write_nodes(TransContext *txc, KeyValueDB::Transaction t)
 	   << " shared_blobs " << txc->shared_blobs
 	   << dendl;
 
+  if (extent_map_compact && !extent_map_v3_fenced && !txc->onodes.empty()) {
+    _fence_extent_map_v3();
+  }
+
   // finalize onodes
   for (auto o : txc->onodes) {
     _record_onode(o, t);
@@ -8814,9 +9659,9 @@ void BlueStore::_osr_drain_all()
     std::lock_guard<std::mutex> l(kv_lock);
     kv_cond.notify_one();
   }
-  {
-    std::lock_guard<std::mutex> l(kv_finalize_lock);
-    kv_finalize_cond.notify_one();
+  for (auto shard : kv_finalize_shards) {
+    std::lock_guard<std::mutex> l(shard->lock);
+    shard->cond.notify_one();
   }
   for (auto osr : s) {
     dout(20) << __func__ << " drain " << osr << dendl;
@@ -8872,8 +9717,23 @@ void BlueStore::_kv_start()
   for (auto f : finishers) {
     f->start();
   }
+
+  unsigned num_finalize =
+    std::max<uint64_t>(1, cct->_conf->get_val<uint64_t>(
+			 "bluestore_kv_finalize_threads"));
+  assert(kv_finalize_shards.empty());
+  for (unsigned i = 0; i < num_finalize; ++i) {
+    kv_finalize_shards.push_back(new KVFinalizeShard(this));
+  }
+  kv_pipeline = cct->_conf->get_val<bool>("bluestore_kv_sync_pipeline");
+
   kv_sync_thread.create("bstore_kv_sync");
-  kv_finalize_thread.create("bstore_kv_final");
+  if (kv_pipeline) {
+    kv_commit_thread.create("bstore_kv_commit");
+  }
+  for (auto shard : kv_finalize_shards) {
+    shard->thread.create("bstore_kv_final");
+  }
 }
 
 void BlueStore::_kv_stop()
@@ -8887,25 +9747,40 @@ void BlueStore::_kv_stop()
     kv_stop = true;
     kv_cond.notify_all();
   }
-  {
-    std::unique_lock<std::mutex> l(kv_finalize_lock);
-    while (!kv_finalize_started) {
-      kv_finalize_cond.wait(l);
+  kv_sync_thread.join();
+  if (kv_pipeline) {
+    {
+      std::unique_lock<std::mutex> l(kv_commit_lock);
+      while (!kv_commit_started) {
+	kv_commit_cond.wait(l);
+      }
+      kv_commit_stop = true;
+      kv_commit_cond.notify_all();
+    }
+    kv_commit_thread.join();
+    {
+      std::lock_guard<std::mutex> l(kv_commit_lock);
+      kv_commit_stop = false;
     }
-    kv_finalize_stop = true;
-    kv_finalize_cond.notify_all();
   }
-  kv_sync_thread.join();
-  kv_finalize_thread.join();
+  for (auto shard : kv_finalize_shards) {
+    std::unique_lock<std::mutex> l(shard->lock);
+    while (!shard->started) {
+      shard->cond.wait(l);
+    }
+    shard->stop = true;
+    shard->cond.notify_all();
+  }
+  for (auto shard : kv_finalize_shards) {
+    shard->thread.join();
+    delete shard;
+  }
+  kv_finalize_shards.clear();
   assert(removed_collections.empty());
   {
     std::lock_guard<std::mutex> l(kv_lock);
     kv_stop = false;
   }
-  {
-    std::lock_guard<std::mutex> l(kv_finalize_lock);
-    kv_finalize_stop = false;
-  }
   dout(10) << __func__ << " stopping finishers" << dendl;
   deferred_finisher.wait_for_empty();
   deferred_finisher.stop();
@@ -8924,7 +9799,6 @@ void BlueStore::_kv_sync_thread()
   kv_sync_started = true;
   kv_cond.notify_all();
   while (true) {
-    assert(kv_committing.empty());
     if (kv_queue.empty() &&
 	((deferred_done_queue.empty() && deferred_stable_queue.empty()) ||
 	 !deferred_aggressive)) {
@@ -8934,8 +9808,8 @@ void BlueStore::_kv_sync_thread()
       kv_cond.wait(l);
       dout(20) << __func__ << " wake" << dendl;
     } else {
+      KVSyncBatch *batch = new KVSyncBatch;
       deque<TransContext*> kv_submitting;
-      deque<DeferredBatch*> deferred_done, deferred_stable;
       uint64_t aios = 0, costs = 0;
 
       dout(20) << __func__ << " committing " << kv_queue.size()
@@ -8943,246 +9817,339 @@ void BlueStore::_kv_sync_thread()
 	       << " deferred done " << deferred_done_queue.size()
 	       << " stable " << deferred_stable_queue.size()
 	       << dendl;
-      kv_committing.swap(kv_queue);
+      batch->committing.swap(kv_queue);
       kv_submitting.swap(kv_queue_unsubmitted);
-      deferred_done.swap(deferred_done_queue);
-      deferred_stable.swap(deferred_stable_queue);
+      batch->deferred_done.swap(deferred_done_queue);
+      batch->deferred_stable.swap(deferred_stable_queue);
       aios = kv_ios;
       costs = kv_throttle_costs;
       kv_ios = 0;
       kv_throttle_costs = 0;
-      utime_t start = ceph_clock_now();
+      batch->start = ceph_clock_now();
       l.unlock();
 
-      dout(30) << __func__ << " committing " << kv_committing << dendl;
-      dout(30) << __func__ << " submitting " << kv_submitting << dendl;
-      dout(30) << __func__ << " deferred_done " << deferred_done << dendl;
-      dout(30) << __func__ << " deferred_stable " << deferred_stable << dendl;
-
-      bool force_flush = false;
-      // if bluefs is sharing the same device as data (only), then we
-      // can rely on the bluefs commit to flush the device and make
-      // deferred aios stable.  that means that if we do have done deferred
-      // txcs AND we are not on a single device, we need to force a flush.
-      if (bluefs_single_shared_device && bluefs) {
-	if (aios) {
-	  force_flush = true;
-	} else if (kv_committing.empty() && kv_submitting.empty() &&
-		   deferred_stable.empty()) {
-	  force_flush = true;  // there's nothing else to commit!
-	} else if (deferred_aggressive) {
-	  force_flush = true;
+      _kv_sync_prepare(batch, kv_submitting, aios, costs);
+
+      if (kv_pipeline) {
+	// let the commit thread sync this batch while we prepare the next
+	// one, but don't get more than one batch ahead of it.
+	std::unique_lock<std::mutex> m(kv_commit_lock);
+	while (!kv_commit_queue.empty()) {
+	  kv_commit_cond.wait(m);
 	}
+	kv_commit_queue.push_back(batch);
+	kv_commit_cond.notify_all();
       } else {
-      	if (aios || !deferred_done.empty()) {
-	  force_flush = true;
-      	} else {
-	  dout(20) << __func__ << " skipping flush (no aios, no deferred_done)" << dendl;
-      	}
-      }
-
-      if (force_flush) {
-	dout(20) << __func__ << " num_aios=" << aios
-		 << " force_flush=" << (int)force_flush
-		 << ", flushing, deferred done->stable" << dendl;
-	// flush/barrier on block device
-	bdev->flush();
-
-	// if we flush then deferred done are now deferred stable
-	deferred_stable.insert(deferred_stable.end(), deferred_done.begin(),
-			       deferred_done.end());
-	deferred_done.clear();
-      }
-      utime_t after_flush = ceph_clock_now();
-
-      // we will use one final transaction to force a sync
-      KeyValueDB::Transaction synct = db->get_transaction();
-
-      // increase {nid,blobid}_max?  note that this covers both the
-      // case where we are approaching the max and the case we passed
-      // it.  in either case, we increase the max in the earlier txn
-      // we submit.
-      uint64_t new_nid_max = 0, new_blobid_max = 0;
-      if (nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
-	KeyValueDB::Transaction t =
-	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
-	new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
-	bufferlist bl;
-	encode(new_nid_max, bl);
-	t->set(PREFIX_SUPER, "nid_max", bl);
-	dout(10) << __func__ << " new_nid_max " << new_nid_max << dendl;
-      }
-      if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
-	KeyValueDB::Transaction t =
-	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
-	new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
-	bufferlist bl;
-	encode(new_blobid_max, bl);
-	t->set(PREFIX_SUPER, "blobid_max", bl);
-	dout(10) << __func__ << " new_blobid_max " << new_blobid_max << dendl;
+	_kv_sync_commit(batch);
       }
 
-      for (auto txc : kv_committing) {
-	if (txc->state == TransContext::STATE_KV_QUEUED) {
-	  txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
-	  int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction(txc->t);
-	  assert(r == 0);
-	  _txc_applied_kv(txc);
-	  --txc->osr->kv_committing_serially;
-	  txc->state = TransContext::STATE_KV_SUBMITTED;
-	  if (txc->osr->kv_submitted_waiters) {
-	    std::lock_guard<std::mutex> l(txc->osr->qlock);
-	    if (txc->osr->_is_all_kv_submitted()) {
-	      txc->osr->qcond.notify_all();
-	    }
-	  }
+      l.lock();
+    }
+  }
+  dout(10) << __func__ << " finish" << dendl;
+  kv_sync_started = false;
+}
 
-	} else {
-	  assert(txc->state == TransContext::STATE_KV_SUBMITTED);
-	  txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
-	}
-	if (txc->had_ios) {
-	  --txc->osr->txc_with_unstable_io;
-	}
-      }
+void BlueStore::_kv_sync_prepare(KVSyncBatch *batch,
+				 deque<TransContext*>& kv_submitting,
+				 uint64_t aios, uint64_t costs)
+{
+  auto& kv_committing = batch->committing;
+  auto& deferred_done = batch->deferred_done;
+  auto& deferred_stable = batch->deferred_stable;
+
+  dout(30) << __func__ << " committing " << kv_committing << dendl;
+  dout(30) << __func__ << " submitting " << kv_submitting << dendl;
+  dout(30) << __func__ << " deferred_done " << deferred_done << dendl;
+  dout(30) << __func__ << " deferred_stable " << deferred_stable << dendl;
+
+  bool force_flush = false;
+  // if bluefs is sharing the same device as data (only), then we
+  // can rely on the bluefs commit to flush the device and make
+  // deferred aios stable.  that means that if we do have done deferred
+  // txcs AND we are not on a single device, we need to force a flush.
+  if (bluefs_single_shared_device && bluefs) {
+    if (aios) {
+      force_flush = true;
+    } else if (kv_committing.empty() && kv_submitting.empty() &&
+	       deferred_stable.empty()) {
+      force_flush = true;  // there's nothing else to commit!
+    } else if (deferred_aggressive) {
+      force_flush = true;
+    }
+  } else {
+    if (aios || !deferred_done.empty()) {
+      force_flush = true;
+    } else {
+      dout(20) << __func__ << " skipping flush (no aios, no deferred_done)" << dendl;
+    }
+  }
 
-      // release throttle *before* we commit.  this allows new ops
-      // to be prepared and enter pipeline while we are waiting on
-      // the kv commit sync/flush.  then hopefully on the next
-      // iteration there will already be ops awake.  otherwise, we
-      // end up going to sleep, and then wake up when the very first
-      // transaction is ready for commit.
-      throttle_bytes.put(costs);
-
-      PExtentVector bluefs_gift_extents;
-      if (bluefs &&
-	  after_flush - bluefs_last_balance >
-	  cct->_conf->bluestore_bluefs_balance_interval) {
-	bluefs_last_balance = after_flush;
-	int r = _balance_bluefs_freespace(&bluefs_gift_extents);
-	assert(r >= 0);
-	if (r > 0) {
-	  for (auto& p : bluefs_gift_extents) {
-	    bluefs_extents.insert(p.offset, p.length);
-	  }
-	  bufferlist bl;
-	  encode(bluefs_extents, bl);
-	  dout(10) << __func__ << " bluefs_extents now 0x" << std::hex
-		   << bluefs_extents << std::dec << dendl;
-	  synct->set(PREFIX_SUPER, "bluefs_extents", bl);
-	}
-      }
+  if (force_flush) {
+    dout(20) << __func__ << " num_aios=" << aios
+	     << " force_flush=" << (int)force_flush
+	     << ", flushing, deferred done->stable" << dendl;
+    // flush/barrier on block device
+    bdev->flush();
 
-      // cleanup sync deferred keys
-      for (auto b : deferred_stable) {
-	for (auto& txc : b->txcs) {
-	  bluestore_deferred_transaction_t& wt = *txc.deferred_txn;
-	  assert(wt.released.empty()); // only kraken did this
-	  string key;
-	  get_deferred_key(wt.seq, &key);
-	  synct->rm_single_key(PREFIX_DEFERRED, key);
-	}
-      }
+    // if we flush then deferred done are now deferred stable
+    deferred_stable.insert(deferred_stable.end(), deferred_done.begin(),
+			   deferred_done.end());
+    deferred_done.clear();
+  }
+  batch->after_flush = ceph_clock_now();
 
-      // submit synct synchronously (block and wait for it to commit)
-      int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction_sync(synct);
-      assert(r == 0);
+  // we will use one final transaction to force a sync
+  KeyValueDB::Transaction synct = batch->synct = db->get_transaction();
 
-      {
-	std::unique_lock<std::mutex> m(kv_finalize_lock);
-	if (kv_committing_to_finalize.empty()) {
-	  kv_committing_to_finalize.swap(kv_committing);
-	} else {
-	  kv_committing_to_finalize.insert(
-	      kv_committing_to_finalize.end(),
-	      kv_committing.begin(),
-	      kv_committing.end());
-	  kv_committing.clear();
-	}
-	if (deferred_stable_to_finalize.empty()) {
-	  deferred_stable_to_finalize.swap(deferred_stable);
-	} else {
-	  deferred_stable_to_finalize.insert(
-	      deferred_stable_to_finalize.end(),
-	      deferred_stable.begin(),
-	      deferred_stable.end());
-	  deferred_stable.clear();
+  // increase {nid,blobid}_max?  note that this covers both the
+  // case where we are approaching the max and the case we passed
+  // it.  in either case, we increase the max in the earlier txn
+  // we submit.
+  if (nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
+    KeyValueDB::Transaction t =
+      kv_submitting.empty() ? synct : kv_submitting.front()->t;
+    batch->new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
+    bufferlist bl;
+    encode(batch->new_nid_max, bl);
+    t->set(PREFIX_SUPER, "nid_max", bl);
+    dout(10) << __func__ << " new_nid_max " << batch->new_nid_max << dendl;
+  }
+  if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
+    KeyValueDB::Transaction t =
+      kv_submitting.empty() ? synct : kv_submitting.front()->t;
+    batch->new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
+    bufferlist bl;
+    encode(batch->new_blobid_max, bl);
+    t->set(PREFIX_SUPER, "blobid_max", bl);
+    dout(10) << __func__ << " new_blobid_max " << batch->new_blobid_max << dendl;
+  }
+
+  for (auto txc : kv_committing) {
+    if (txc->state == TransContext::STATE_KV_QUEUED) {
+      txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
+      int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction(txc->t);
+      assert(r == 0);
+      _txc_applied_kv(txc);
+      --txc->osr->kv_committing_serially;
+      txc->state = TransContext::STATE_KV_SUBMITTED;
+      if (txc->osr->kv_submitted_waiters) {
+	std::lock_guard<std::mutex> l(txc->osr->qlock);
+	if (txc->osr->_is_all_kv_submitted()) {
+	  txc->osr->qcond.notify_all();
 	}
-	kv_finalize_cond.notify_one();
       }
 
-      if (new_nid_max) {
-	nid_max = new_nid_max;
-	dout(10) << __func__ << " nid_max now " << nid_max << dendl;
-      }
-      if (new_blobid_max) {
-	blobid_max = new_blobid_max;
-	dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
-      }
+    } else {
+      assert(txc->state == TransContext::STATE_KV_SUBMITTED);
+      txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
+    }
+    if (txc->had_ios) {
+      --txc->osr->txc_with_unstable_io;
+    }
+  }
 
-      {
-	utime_t finish = ceph_clock_now();
-	utime_t dur_flush = after_flush - start;
-	utime_t dur_kv = finish - after_flush;
-	utime_t dur = finish - start;
-	dout(20) << __func__ << " committed " << kv_committing.size()
-	  << " cleaned " << deferred_stable.size()
-	  << " in " << dur
-	  << " (" << dur_flush << " flush + " << dur_kv << " kv commit)"
-	  << dendl;
-	logger->tinc(l_bluestore_kv_flush_lat, dur_flush);
-	logger->tinc(l_bluestore_kv_commit_lat, dur_kv);
-	logger->tinc(l_bluestore_kv_lat, dur);
-      }
+  // release throttle *before* we commit.  this allows new ops
+  // to be prepared and enter pipeline while we are waiting on
+  // the kv commit sync/flush.  then hopefully on the next
+  // iteration there will already be ops awake.  otherwise, we
+  // end up going to sleep, and then wake up when the very first
+  // transaction is ready for commit.
+  throttle_bytes.put(costs);
 
-      if (bluefs) {
-	if (!bluefs_gift_extents.empty()) {
-	  _commit_bluefs_freespace(bluefs_gift_extents);
-	}
-	if (!bluefs_extents_reclaiming.empty()) {
-	  dout(0) << __func__ << " releasing old bluefs 0x" << std::hex
-		   << bluefs_extents_reclaiming << std::dec << dendl;
-	  alloc->release(bluefs_extents_reclaiming);
-	  bluefs_extents_reclaiming.clear();
-	}
+  if (bluefs &&
+      batch->after_flush - bluefs_last_balance >
+      cct->_conf->bluestore_bluefs_balance_interval) {
+    bluefs_last_balance = batch->after_flush;
+    int r = _balance_bluefs_freespace(&batch->bluefs_gift_extents);
+    assert(r >= 0);
+    if (r > 0) {
+      for (auto& p : batch->bluefs_gift_extents) {
+	bluefs_extents.insert(p.offset, p.length);
       }
+      bufferlist bl;
+      encode(bluefs_extents, bl);
+      dout(10) << __func__ << " bluefs_extents now 0x" << std::hex
+	       << bluefs_extents << std::dec << dendl;
+      synct->set(PREFIX_SUPER, "bluefs_extents", bl);
+    }
+  }
+  // anything reclaimed so far can be released once this batch commits
+  batch->bluefs_extents_reclaiming.swap(bluefs_extents_reclaiming);
+
+  // cleanup sync deferred keys
+  for (auto b : deferred_stable) {
+    for (auto& txc : b->txcs) {
+      bluestore_deferred_transaction_t& wt = *txc.deferred_txn;
+      assert(wt.released.empty()); // only kraken did this
+      string key;
+      get_deferred_key(wt.seq, &key);
+      synct->rm_single_key(PREFIX_DEFERRED, key);
+    }
+  }
+
+  logger->hinc(l_bluestore_kv_prepare_lat_hist,
+	       (batch->after_flush - batch->start).to_nsec(),
+	       kv_committing.size());
+}
+
+void BlueStore::_kv_sync_commit(KVSyncBatch *batch)
+{
+  utime_t commit_start = ceph_clock_now();
+
+  // submit synct synchronously (block and wait for it to commit)
+  int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction_sync(batch->synct);
+  assert(r == 0);
+
+  if (batch->new_nid_max) {
+    nid_max = batch->new_nid_max;
+    dout(10) << __func__ << " nid_max now " << nid_max << dendl;
+  }
+  if (batch->new_blobid_max) {
+    blobid_max = batch->new_blobid_max;
+    dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
+  }
+
+  {
+    utime_t finish = ceph_clock_now();
+    utime_t dur_flush = batch->after_flush - batch->start;
+    utime_t dur_kv = finish - batch->after_flush;
+    utime_t dur = finish - batch->start;
+    dout(20) << __func__ << " committed " << batch->committing.size()
+	     << " cleaned " << batch->deferred_stable.size()
+	     << " in " << dur
+	     << " (" << dur_flush << " flush + " << dur_kv << " kv commit)"
+	     << dendl;
+    logger->tinc(l_bluestore_kv_flush_lat, dur_flush);
+    logger->tinc(l_bluestore_kv_commit_lat, dur_kv);
+    logger->tinc(l_bluestore_kv_lat, dur);
+    logger->hinc(l_bluestore_kv_commit_lat_hist,
+		 (finish - commit_start).to_nsec(),
+		 batch->committing.size());
+  }
+
+  _kv_finalize_queue(batch);
 
+  if (bluefs) {
+    if (!batch->bluefs_gift_extents.empty()) {
+      _commit_bluefs_freespace(batch->bluefs_gift_extents);
+    }
+    if (!batch->bluefs_extents_reclaiming.empty()) {
+      dout(0) << __func__ << " releasing old bluefs 0x" << std::hex
+	       << batch->bluefs_extents_reclaiming << std::dec << dendl;
+      alloc->release(batch->bluefs_extents_reclaiming);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> l(kv_lock);
+    // previously deferred "done" are now "stable" by virtue of this
+    // commit cycle.
+    deferred_stable_queue.insert(deferred_stable_queue.end(),
+				 batch->deferred_done.begin(),
+				 batch->deferred_done.end());
+    if (kv_pipeline && deferred_aggressive) {
+      kv_cond.notify_one();
+    }
+  }
+  delete batch;
+}
+
+void BlueStore::_kv_commit_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  std::unique_lock<std::mutex> l(kv_commit_lock);
+  assert(!kv_commit_started);
+  kv_commit_started = true;
+  kv_commit_cond.notify_all();
+  while (true) {
+    if (kv_commit_queue.empty()) {
+      if (kv_commit_stop)
+	break;
+      dout(20) << __func__ << " sleep" << dendl;
+      kv_commit_cond.wait(l);
+      dout(20) << __func__ << " wake" << dendl;
+    } else {
+      KVSyncBatch *batch = kv_commit_queue.front();
+      l.unlock();
+      _kv_sync_commit(batch);
       l.lock();
-      // previously deferred "done" are now "stable" by virtue of this
-      // commit cycle.
-      deferred_stable_queue.swap(deferred_done);
+      // only dequeue once committed so kv_sync_thread stays one batch ahead
+      kv_commit_queue.pop_front();
+      kv_commit_cond.notify_all();
     }
   }
   dout(10) << __func__ << " finish" << dendl;
-  kv_sync_started = false;
+  kv_commit_started = false;
+}
+
+void BlueStore::_kv_finalize_queue(KVSyncBatch *batch)
+{
+  // keep each OpSequencer's txcs on a single shard so they are still
+  // finalized in order.
+  unsigned n = kv_finalize_shards.size();
+  vector<deque<TransContext*>> committed(n);
+  vector<deque<DeferredBatch*>> stable(n);
+  for (auto txc : batch->committing) {
+    committed[txc->osr->id % n].push_back(txc);
+  }
+  for (auto b : batch->deferred_stable) {
+    stable[b->osr->id % n].push_back(b);
+  }
+  for (unsigned i = 0; i < n; ++i) {
+    if (committed[i].empty() && stable[i].empty()) {
+      continue;
+    }
+    KVFinalizeShard *shard = kv_finalize_shards[i];
+    std::unique_lock<std::mutex> m(shard->lock);
+    if (shard->kv_committing_to_finalize.empty()) {
+      shard->kv_committing_to_finalize.swap(committed[i]);
+    } else {
+      shard->kv_committing_to_finalize.insert(
+	shard->kv_committing_to_finalize.end(),
+	committed[i].begin(),
+	committed[i].end());
+    }
+    if (shard->deferred_stable_to_finalize.empty()) {
+      shard->deferred_stable_to_finalize.swap(stable[i]);
+    } else {
+      shard->deferred_stable_to_finalize.insert(
+	shard->deferred_stable_to_finalize.end(),
+	stable[i].begin(),
+	stable[i].end());
+    }
+    shard->cond.notify_one();
+  }
 }
 
-void BlueStore::_kv_finalize_thread()
+void BlueStore::_kv_finalize_thread(KVFinalizeShard *shard)
 {
   deque<TransContext*> kv_committed;
   deque<DeferredBatch*> deferred_stable;
   dout(10) << __func__ << " start" << dendl;
-  std::unique_lock<std::mutex> l(kv_finalize_lock);
-  assert(!kv_finalize_started);
-  kv_finalize_started = true;
-  kv_finalize_cond.notify_all();
+  std::unique_lock<std::mutex> l(shard->lock);
+  assert(!shard->started);
+  shard->started = true;
+  shard->cond.notify_all();
   while (true) {
     assert(kv_committed.empty());
     assert(deferred_stable.empty());
-    if (kv_committing_to_finalize.empty() &&
-	deferred_stable_to_finalize.empty()) {
-      if (kv_finalize_stop)
+    if (shard->kv_committing_to_finalize.empty() &&
+	shard->deferred_stable_to_finalize.empty()) {
+      if (shard->stop)
 	break;
       dout(20) << __func__ << " sleep" << dendl;
-      kv_finalize_cond.wait(l);
+      shard->cond.wait(l);
       dout(20) << __func__ << " wake" << dendl;
     } else {
-      kv_committed.swap(kv_committing_to_finalize);
-      deferred_stable.swap(deferred_stable_to_finalize);
+      kv_committed.swap(shard->kv_committing_to_finalize);
+      deferred_stable.swap(shard->deferred_stable_to_finalize);
       l.unlock();
       dout(20) << __func__ << " kv_committed " << kv_committed << dendl;
       dout(20) << __func__ << " deferred_stable " << deferred_stable << dendl;
 
+      utime_t start = ceph_clock_now();
+      size_t num = kv_committed.size();
       while (!kv_committed.empty()) {
 	TransContext *txc = kv_committed.front();
 	assert(txc->state == TransContext::STATE_KV_SUBMITTED);
@@ -9200,6 +10167,8 @@ void BlueStore::_kv_finalize_thread()
 	delete b;
       }
       deferred_stable.clear();
+      logger->hinc(l_bluestore_kv_finalize_lat_hist,
+		   (ceph_clock_now() - start).to_nsec(), num);
 
       if (!deferred_aggressive) {
 	if (deferred_queue_size >= deferred_batch_ops.load() ||
@@ -9215,7 +10184,7 @@ void BlueStore::_kv_finalize_thread()
     }
   }
   dout(10) << __func__ << " finish" << dendl;
-  kv_finalize_started = false;
+  shard->started = false;
 }
 
 bluestore_deferred_op_t *BlueStore::_get_deferred_op(
@@ -9269,6 +10238,19 @@ void BlueStore::deferred_try_submit()
   for (auto& osr : deferred_queue) {
     osrs.push_back(&osr);
   }
+  if (deferred_coalesce) {
+    vector<OpSequencer*> ready;
+    for (auto& osr : osrs) {
+      if (osr->deferred_pending && !osr->deferred_running) {
+	ready.push_back(osr.get());
+      }
+    }
+    if (ready.size() > 1) {
+      _deferred_submit_coalesced_unlock(ready);
+      deferred_lock.lock();
+      return;
+    }
+  }
   for (auto& osr : osrs) {
     if (osr->deferred_pending) {
       if (!osr->deferred_running) {
@@ -9304,6 +10286,60 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
   for (auto& txc : b->txcs) {
     txc.log_state_latency(logger, l_bluestore_state_deferred_queued_lat);
   }
+  _deferred_issue(b);
+}
+
+void BlueStore::_deferred_submit_coalesced_unlock(
+  const vector<OpSequencer*>& osrs)
+{
+  dout(10) << __func__ << " " << osrs.size() << " osrs" << dendl;
+  for (auto osr : osrs) {
+    assert(osr->deferred_pending);
+    assert(!osr->deferred_running);
+    deferred_queue_size -= osr->deferred_pending->seq_bytes.size();
+    osr->deferred_running = osr->deferred_pending;
+    osr->deferred_pending = nullptr;
+  }
+  assert(deferred_queue_size >= 0);
+
+  deferred_lock.unlock();
+
+  // fold every batch that does not overlap the ones before it into the
+  // first batch so that ios adjacent on disk go out as a single write.
+  // overlapping batches are submitted on their own since we can't order
+  // their ios relative to each other.
+  DeferredBatch *lead = nullptr;
+  vector<DeferredBatch*> apart;
+  for (auto osr : osrs) {
+    DeferredBatch *b = osr->deferred_running;
+    for (auto& txc : b->txcs) {
+      txc.log_state_latency(logger, l_bluestore_state_deferred_queued_lat);
+    }
+    if (!lead) {
+      lead = b;
+    } else if (lead->overlaps(*b)) {
+      dout(20) << __func__ << "  osr " << osr << " overlaps, not coalescing"
+	       << dendl;
+      apart.push_back(b);
+    } else {
+      dout(20) << __func__ << "  coalescing osr " << osr << " "
+	       << b->iomap.size() << " ios" << dendl;
+      lead->iomap.merge(b->iomap);
+      assert(b->iomap.empty());
+      lead->coalesced.push_back(osr);
+    }
+  }
+  logger->inc(l_bluestore_deferred_coalesced_batches, lead->coalesced.size());
+
+  for (auto b : apart) {
+    _deferred_issue(b);
+  }
+  _deferred_issue(lead);
+}
+
+void BlueStore::_deferred_issue(DeferredBatch *b)
+{
+  logger->inc(l_bluestore_deferred_write_extents, b->iomap.size());
   uint64_t start = 0, pos = 0;
   bufferlist bl;
   auto i = b->iomap.begin();
@@ -12355,6 +13391,10 @@ unsigned BlueStoreRepairer::apply(KeyValueDB* db)
     db->submit_transaction_sync(fix_shared_blob_txn);
     fix_shared_blob_txn = nullptr;
   }
+  if (upgrade_txn) {
+    db->submit_transaction_sync(upgrade_txn);
+    upgrade_txn = nullptr;
+  }
 
   if (fix_statfs_txn) {
     db->submit_transaction_sync(fix_statfs_txn);
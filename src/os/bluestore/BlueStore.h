@@ -21,6 +21,7 @@
 
 #include <atomic>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
 
 #include <boost/intrusive/list.hpp>
@@ -35,6 +36,7 @@
 #include "include/mempool.h"
 #include "common/bloom_filter.hpp"
 #include "common/Finisher.h"
+#include "common/Readahead.h"
 #include "common/perf_counters.h"
 #include "compressor/Compressor.h"
 #include "os/ObjectStore.h"
@@ -62,6 +64,9 @@ enum {
   l_bluestore_kv_flush_lat,
   l_bluestore_kv_commit_lat,
   l_bluestore_kv_lat,
+  l_bluestore_kv_prepare_lat_hist,
+  l_bluestore_kv_commit_lat_hist,
+  l_bluestore_kv_finalize_lat_hist,
   l_bluestore_state_prepare_lat,
   l_bluestore_state_aio_wait_lat,
   l_bluestore_state_io_done_lat,
@@ -87,6 +92,8 @@ enum {
   l_bluestore_write_pad_bytes,
   l_bluestore_deferred_write_ops,
   l_bluestore_deferred_write_bytes,
+  l_bluestore_deferred_write_extents,
+  l_bluestore_deferred_coalesced_batches,
   l_bluestore_write_penalty_read_ops,
   l_bluestore_allocated,
   l_bluestore_stored,
@@ -104,6 +111,7 @@ enum {
   l_bluestore_buffer_bytes,
   l_bluestore_buffer_hit_bytes,
   l_bluestore_buffer_miss_bytes,
+  l_bluestore_cache_lock_wait_lat,
   l_bluestore_write_big,
   l_bluestore_write_big_bytes,
   l_bluestore_write_big_blobs,
@@ -119,6 +127,10 @@ enum {
   l_bluestore_extent_compress,
   l_bluestore_gc_merged,
   l_bluestore_read_eio,
+  l_bluestore_readahead_bytes,
+  l_bluestore_readahead_hit_bytes,
+  l_bluestore_readahead_waste_bytes,
+  l_bluestore_alloc_checkpoint_loaded,
   l_bluestore_last
 };
 
@@ -138,6 +150,8 @@ public:
   void _set_csum();
   void _set_compression();
   void _set_throttle_params();
+  void _set_extent_map_format();
+  void _set_readahead();
   int _set_cache_sizes();
 
   class TransContext;
@@ -185,6 +199,7 @@ public:
     uint16_t state;             ///< STATE_*
     uint16_t cache_private = 0; ///< opaque (to us) value used by Cache impl
     uint32_t flags;             ///< FLAG_*
+    std::atomic<bool> referenced = {false}; ///< hit by a lockless read
     uint64_t seq;
     uint32_t offset, length;
     bufferlist data;
@@ -264,6 +279,17 @@ public:
       assert(writing.empty());
     }
 
+    /// striped lock taken shared by lockless readers (see Cache::lockless_reads)
+    static std::shared_mutex& _get_read_lock(const BufferSpace *bs);
+
+    /// exclude lockless readers while we modify buffer_map or buffer data;
+    /// must be called with cache->lock held
+    std::unique_lock<std::shared_mutex> _exclude_readers(Cache* cache) {
+      if (!cache->lockless_reads)
+	return std::unique_lock<std::shared_mutex>();
+      return std::unique_lock<std::shared_mutex>(_get_read_lock(this));
+    }
+
     void _add_buffer(Cache* cache, Buffer *b, int level, Buffer *near) {
       cache->_audit("_add_buffer start");
       buffer_map[b->offset].reset(b);
@@ -320,14 +346,16 @@ public:
 
     // return value is the highest cache_private of a trimmed buffer, or 0.
     int discard(Cache* cache, uint32_t offset, uint32_t length) {
-      std::lock_guard<std::recursive_mutex> l(cache->lock);
+      auto l = cache->timed_lock();
+      auto rl = _exclude_readers(cache);
       return _discard(cache, offset, length);
     }
     int _discard(Cache* cache, uint32_t offset, uint32_t length);
 
     void write(Cache* cache, uint64_t seq, uint32_t offset, bufferlist& bl,
 	       unsigned flags) {
-      std::lock_guard<std::recursive_mutex> l(cache->lock);
+      auto l = cache->timed_lock();
+      auto rl = _exclude_readers(cache);
       Buffer *b = new Buffer(this, Buffer::STATE_WRITING, seq, offset, bl,
 			     flags);
       b->cache_private = _discard(cache, offset, bl.length());
@@ -335,7 +363,8 @@ public:
     }
     void finish_write(Cache* cache, uint64_t seq);
     void did_read(Cache* cache, uint32_t offset, bufferlist& bl) {
-      std::lock_guard<std::recursive_mutex> l(cache->lock);
+      auto l = cache->timed_lock();
+      auto rl = _exclude_readers(cache);
       Buffer *b = new Buffer(this, Buffer::STATE_CLEAN, 0, offset, bl);
       b->cache_private = _discard(cache, offset, bl.length());
       _add_buffer(cache, b, 1, nullptr);
@@ -345,6 +374,11 @@ public:
 	      BlueStore::ready_regions_t& res,
 	      interval_set<uint32_t>& res_intervals);
 
+    /// collect the ranges within offset~length we hold data for, without
+    /// touching them; return true if any of it is still being written
+    bool probe(Cache* cache, uint32_t offset, uint32_t length,
+	       interval_set<uint32_t>& cached);
+
     void truncate(Cache* cache, uint32_t offset) {
       discard(cache, offset, (uint32_t)-1 - offset);
     }
@@ -750,6 +784,7 @@ public:
       unsigned extents = 0;  ///< count extents in this shard
       bool loaded = false;   ///< true if shard is loaded
       bool dirty = false;    ///< true if shard is dirty and needs reencoding
+      uint8_t struct_v = 0;  ///< encoding version of the shard as loaded
     };
     mempool::bluestore_cache_other::vector<Shard> shards;    ///< shards
 
@@ -795,6 +830,8 @@ public:
     bool encode_some(uint32_t offset, uint32_t length, bufferlist& bl,
 		     unsigned *pn);
     unsigned decode_some(bufferlist& bl);
+    /// true if any loaded part of the map is in an older encoding
+    bool has_legacy_encoding() const;
 
     void bound_encode_spanning_blobs(size_t& p);
     void encode_spanning_blobs(bufferlist::contiguous_appender& p);
@@ -1010,11 +1047,47 @@ public:
 
   struct OnodeSpace;
 
+  /// sequential read detector and outstanding prefetches for an onode
+  struct OnodeReadahead {
+    /// one chunk-aligned blob range being read ahead
+    struct region_t {
+      BlobRef blob;
+      uint64_t logical_offset;
+      uint32_t b_off;
+      bufferlist bl;
+      region_t(const BlobRef& b, uint64_t lo, uint32_t bo)
+	: blob(b), logical_offset(lo), b_off(bo) {}
+    };
+    struct prefetch_t {
+      uint64_t offset, length;  ///< logical range
+      uint64_t data_gen;        ///< Onode::data_gen when issued
+      bool failed = false;
+      bool orphan = false;      ///< the stream moved on; reap when done
+      IOContext ioc;
+      list<region_t> regions;
+      prefetch_t(CephContext *cct, uint64_t o, uint64_t l, uint64_t g)
+	: offset(o), length(l), data_gen(g), ioc(cct, nullptr, true) {}
+      ~prefetch_t() {
+	ioc.aio_wait();
+      }
+      bool done() {
+	return ioc.num_running == 0;
+      }
+    };
+
+    Readahead ra;
+    uint64_t last_end = 0;  ///< end of the previous read
+    list<std::unique_ptr<prefetch_t>> pending;  ///< oldest first
+    interval_set<uint64_t> installed;  ///< prefetched, not yet read
+    Readahead::extent_t backlog = {0, 0};  ///< windows not yet issued
+  };
+
   /// an in-memory object
   struct Onode {
     MEMPOOL_CLASS_HELPERS();
 
     std::atomic_int nref;  ///< reference count
+    std::atomic<bool> referenced = {false}; ///< hit by a lockless lookup
     Collection *c;
 
     ghobject_t oid;
@@ -1035,6 +1108,13 @@ public:
     std::mutex flush_lock;  ///< protect flush_txns
     std::condition_variable flush_cond;   ///< wait here for uncommitted txns
 
+    /// bumped by each txc that modifies us, so readahead can tell its
+    /// prefetched data went stale.  only touched under the collection lock.
+    uint64_t data_gen = 0;
+
+    std::mutex readahead_lock;  ///< protect readahead
+    std::unique_ptr<OnodeReadahead> readahead;  ///< created on first read
+
     Onode(Collection *c, const ghobject_t& o,
 	  const mempool::bluestore_cache_other::string& k)
       : nref(0),
@@ -1063,6 +1143,11 @@ public:
     PerfCounters *logger;
     std::recursive_mutex lock;          ///< protect lru and other structures
 
+    /// serve onode and buffer hits without taking lock.  hits only mark
+    /// the entry referenced; trim gives referenced entries a second chance
+    /// instead of promoting them in the lru on every access.
+    bool lockless_reads = false;
+
     std::atomic<uint64_t> num_extents = {0};
     std::atomic<uint64_t> num_blobs = {0};
 
@@ -1071,6 +1156,18 @@ public:
     Cache(CephContext* cct) : cct(cct), logger(nullptr) {}
     virtual ~Cache() {}
 
+    /// take lock, accounting any time spent waiting for it
+    std::unique_lock<std::recursive_mutex> timed_lock() {
+      std::unique_lock<std::recursive_mutex> l(lock, std::try_to_lock);
+      if (!l.owns_lock()) {
+	utime_t start = ceph_clock_now();
+	l.lock();
+	logger->tinc(l_bluestore_cache_lock_wait_lat,
+		     ceph_clock_now() - start);
+      }
+      return l;
+    }
+
     virtual void _add_onode(OnodeRef& o, int level) = 0;
     virtual void _rm_onode(OnodeRef& o) = 0;
     virtual void _touch_onode(OnodeRef& o) = 0;
@@ -1318,6 +1415,9 @@ public:
     /// forward lookups
     mempool::bluestore_cache_other::unordered_map<ghobject_t,OnodeRef> onode_map;
 
+    /// taken shared by lockless lookups (see Cache::lockless_reads)
+    std::shared_mutex lookup_lock;
+
     friend class Collection; // for split_cache()
 
   public:
@@ -1326,8 +1426,17 @@ public:
       clear();
     }
 
+    /// exclude lockless lookups while we modify onode_map; must be called
+    /// with cache->lock held
+    std::unique_lock<std::shared_mutex> _exclude_readers() {
+      if (!cache->lockless_reads)
+	return std::unique_lock<std::shared_mutex>();
+      return std::unique_lock<std::shared_mutex>(lookup_lock);
+    }
+
     OnodeRef add(const ghobject_t& oid, OnodeRef o);
     OnodeRef lookup(const ghobject_t& o);
+    /// caller must hold cache->lock and have excluded readers
     void remove(const ghobject_t& oid) {
       onode_map.erase(oid);
     }
@@ -1604,6 +1713,7 @@ public:
     }
 
     void write_onode(OnodeRef &o) {
+      ++o->data_gen;
       onodes.insert(o);
     }
     void write_shared_blob(SharedBlobRef &sb) {
@@ -1646,6 +1756,8 @@ public:
     IOContext ioc;                   ///< our aios
     /// bytes of pending io for each deferred seq (may be 0)
     map<uint64_t,int> seq_bytes;
+    /// other osrs whose batches were submitted with (and complete with) ours
+    vector<OpSequencer*> coalesced;
 
     void _discard(CephContext *cct, uint64_t offset, uint64_t length);
     void _audit(CephContext *cct);
@@ -1658,7 +1770,14 @@ public:
 		       uint64_t seq, uint64_t offset, uint64_t length,
 		       bufferlist::const_iterator& p);
 
+    /// true if any of our ios overlaps one in the other batch
+    bool overlaps(const DeferredBatch& o) const;
+
     void aio_finish(BlueStore *store) override {
+      // finish ourselves last; we may be freed as soon as we are done
+      for (auto o : coalesced) {
+	store->_deferred_aio_finish(o);
+      }
       store->_deferred_aio_finish(osr);
     }
   };
@@ -1684,6 +1803,8 @@ public:
 
     size_t shard;
 
+    const uint32_t id;  ///< unique per store; picks our kv finalize shard
+
     uint64_t last_seq = 0;
 
     std::atomic_int txc_with_unstable_io = {0};  ///< num txcs with unstable io
@@ -1696,7 +1817,8 @@ public:
 
     OpSequencer(BlueStore *store)
       : RefCountedObject(store->cct, 0),
-	store(store) {
+	store(store),
+	id(store->next_osr_id++) {
     }
     ~OpSequencer() {
       assert(q.empty());
@@ -1775,14 +1897,46 @@ public:
       return NULL;
     }
   };
+  struct KVCommitThread : public Thread {
+    BlueStore *store;
+    explicit KVCommitThread(BlueStore *s) : store(s) {}
+    void *entry() override {
+      store->_kv_commit_thread();
+      return NULL;
+    }
+  };
+  struct KVFinalizeShard;
   struct KVFinalizeThread : public Thread {
     BlueStore *store;
-    explicit KVFinalizeThread(BlueStore *s) : store(s) {}
-    void *entry() {
-      store->_kv_finalize_thread();
+    KVFinalizeShard *shard;
+    KVFinalizeThread(BlueStore *s, KVFinalizeShard *sh) : store(s), shard(sh) {}
+    void *entry() override {
+      store->_kv_finalize_thread(shard);
       return NULL;
     }
   };
+  /// finalizes the txcs of the OpSequencers that hash to it, in order
+  struct KVFinalizeShard {
+    std::mutex lock;
+    std::condition_variable cond;
+    bool started = false;
+    bool stop = false;
+    deque<TransContext*> kv_committing_to_finalize;   ///< pending finalization
+    deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
+    KVFinalizeThread thread;
+    explicit KVFinalizeShard(BlueStore *s) : thread(s, this) {}
+  };
+
+  /// state of one kv_sync_thread cycle, from prepare through commit
+  struct KVSyncBatch {
+    deque<TransContext*> committing;
+    deque<DeferredBatch*> deferred_done, deferred_stable;
+    KeyValueDB::Transaction synct;
+    uint64_t new_nid_max = 0, new_blobid_max = 0;
+    PExtentVector bluefs_gift_extents;
+    interval_set<uint64_t> bluefs_extents_reclaiming;
+    utime_t start, after_flush;
+  };
 
   struct DBHistogram {
     struct value_dist {
@@ -1862,22 +2016,27 @@ private:
   bool _kv_only = false;
   bool kv_sync_started = false;
   bool kv_stop = false;
-  bool kv_finalize_started = false;
-  bool kv_finalize_stop = false;
   deque<TransContext*> kv_queue;             ///< ready, already submitted
   deque<TransContext*> kv_queue_unsubmitted; ///< ready, need submit by kv thread
-  deque<TransContext*> kv_committing;        ///< currently syncing
   deque<DeferredBatch*> deferred_done_queue;   ///< deferred ios done
   deque<DeferredBatch*> deferred_stable_queue; ///< deferred ios done + stable
 
-  KVFinalizeThread kv_finalize_thread;
-  std::mutex kv_finalize_lock;
-  std::condition_variable kv_finalize_cond;
-  deque<TransContext*> kv_committing_to_finalize;   ///< pending finalization
-  deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
+  /// if set, kv_sync_thread prepares the next batch while the commit
+  /// thread syncs the previous one
+  bool kv_pipeline = false;
+  KVCommitThread kv_commit_thread;
+  std::mutex kv_commit_lock;
+  std::condition_variable kv_commit_cond;
+  bool kv_commit_started = false;
+  bool kv_commit_stop = false;
+  deque<KVSyncBatch*> kv_commit_queue;  ///< prepared, waiting for sync
+
+  vector<KVFinalizeShard*> kv_finalize_shards;
+  std::atomic<uint32_t> next_osr_id = {0};
 
   PerfCounters *logger = nullptr;
 
+  std::mutex reap_lock;  ///< protect removed_collections
   list<CollectionRef> removed_collections;
 
   RWLock debug_read_error_lock = {"BlueStore::debug_read_error_lock"};
@@ -1885,6 +2044,7 @@ private:
   set<ghobject_t> debug_mdata_error_objects;
 
   std::atomic<int> csum_type = {Checksummer::CSUM_CRC32C};
+  std::atomic<bool> extent_map_compact = {false}; ///< encode shards as v3
 
   uint64_t block_size = 0;     ///< block size of block device (power of 2)
   uint64_t block_mask = 0;     ///< mask to get just the block offset
@@ -1903,6 +2063,9 @@ private:
   ///< number threshold for forced deferred writes
   std::atomic<int> deferred_batch_ops = {0};
 
+  ///< submit the deferred batches of several sequencers together
+  std::atomic<bool> deferred_coalesce = {false};
+
   ///< size threshold for forced deferred writes
   std::atomic<uint64_t> prefer_deferred_size = {0};
 
@@ -1917,6 +2080,11 @@ private:
 
   std::atomic<uint64_t> max_blob_size = {0};  ///< maximum blob size
 
+  ///< readahead window limits; max 0 disables readahead
+  std::atomic<uint64_t> readahead_min_bytes = {0};
+  std::atomic<uint64_t> readahead_max_bytes = {0};
+  std::atomic<int> readahead_trigger_requests = {0};
+
   uint64_t kv_ios = 0;
   uint64_t kv_throttle_costs = 0;
 
@@ -1979,8 +2147,10 @@ private:
   void _close_db();
   int _open_fm(bool create);
   void _close_fm();
-  int _open_alloc();
+  int _open_alloc(bool read_only = false);
   void _close_alloc();
+  int _load_alloc_checkpoint(uint64_t *num, uint64_t *bytes);
+  void _save_alloc_checkpoint();
   int _open_collections(int *errors=0);
   void _close_collections();
 
@@ -2043,7 +2213,13 @@ private:
   void _kv_start();
   void _kv_stop();
   void _kv_sync_thread();
-  void _kv_finalize_thread();
+  void _kv_sync_prepare(KVSyncBatch *batch,
+			deque<TransContext*>& kv_submitting,
+			uint64_t aios, uint64_t costs);
+  void _kv_sync_commit(KVSyncBatch *batch);
+  void _kv_commit_thread();
+  void _kv_finalize_queue(KVSyncBatch *batch);
+  void _kv_finalize_thread(KVFinalizeShard *shard);
 
   bluestore_deferred_op_t *_get_deferred_op(TransContext *txc, OnodeRef o);
   void _deferred_queue(TransContext *txc);
@@ -2051,6 +2227,8 @@ public:
   void deferred_try_submit();
 private:
   void _deferred_submit_unlock(OpSequencer *osr);
+  void _deferred_submit_coalesced_unlock(const vector<OpSequencer*>& osrs);
+  void _deferred_issue(DeferredBatch *b);
   void _deferred_aio_finish(OpSequencer *osr);
   int _deferred_replay();
 
@@ -2103,15 +2281,23 @@ private:
 
   // -- ondisk version ---
 public:
-  const int32_t latest_ondisk_format = 2;        ///< our version
+  const int32_t latest_ondisk_format = 3;        ///< our version
   const int32_t min_readable_ondisk_format = 1;  ///< what we can read
   const int32_t min_compat_ondisk_format = 2;    ///< who can read us
+  /// who can read us while an allocator checkpoint is outstanding
+  const int32_t alloc_checkpoint_compat_ondisk_format = 3;
+  /// who can read us once a v3 extent map shard has been written
+  const int32_t extent_map_v3_compat_ondisk_format = 3;
 
 private:
   int32_t ondisk_format = 0;  ///< value detected on mount
 
+  std::mutex extent_map_v3_fence_lock;
+  std::atomic<bool> extent_map_v3_fenced = {false}; ///< v3 shards allowed
+
   int _upgrade_super();  ///< upgrade (called during open_super)
   void _prepare_ondisk_format_super(KeyValueDB::Transaction& t);
+  void _fence_extent_map_v3();
 
   // --- public interface ---
 public:
@@ -2192,6 +2378,7 @@ public:
 
   void get_db_statistics(Formatter *f) override;
   void generate_db_histogram(Formatter *f) override;
+  void get_allocator_stats(Formatter *f) override;
   void _flush_cache();
   void flush_cache() override;
   void dump_perf_counters(Formatter *f) override {
@@ -2229,6 +2416,19 @@ public:
     bufferlist& bl,
     uint32_t op_flags = 0);
 
+private:
+  void _do_readahead(
+    OnodeRef& o,
+    uint64_t offset,
+    size_t length);
+  void _readahead_issue(
+    OnodeRef& o,
+    OnodeReadahead::prefetch_t *pf);
+  void _readahead_finish(
+    OnodeRef& o,
+    OnodeReadahead::prefetch_t *pf);
+public:
+
 private:
   int _fiemap(CollectionHandle &c_, const ghobject_t& oid,
  	     uint64_t offset, size_t len, interval_set<uint64_t>& destset);
@@ -2362,6 +2562,14 @@ public:
 			   coll_t cid2, ghobject_t oid2,
 			   uint64_t offset);
 
+  /// let a store that was never mounted write v3 extent map shards
+  void inject_extent_map_v3_fence() {
+    extent_map_v3_fenced = true;
+  }
+  bool is_extent_map_v3_fenced() const {
+    return extent_map_v3_fenced;
+  }
+
   void compact() override {
     assert(db);
     db->compact();
@@ -2830,6 +3038,13 @@ public:
   KeyValueDB::Transaction get_fix_misreferences_txn() {
     return fix_misreferences_txn;
   }
+  /// txn for format upgrades; these are not errors so are not counted
+  KeyValueDB::Transaction get_upgrade_txn(KeyValueDB *db) {
+    if (!upgrade_txn) {
+      upgrade_txn = db->get_transaction();
+    }
+    return upgrade_txn;
+  }
 
 private:
   unsigned to_repair_cnt = 0;
@@ -2840,6 +3055,7 @@ private:
   KeyValueDB::Transaction fix_shared_blob_txn;
 
   KeyValueDB::Transaction fix_misreferences_txn;
+  KeyValueDB::Transaction upgrade_txn;
 
   StoreSpaceTracker space_usage_tracker;
 
@@ -0,0 +1,570 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <cmath>
+
+#include "HybridAllocator.h"
+#include "bluestore_types.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "hybridalloc 0x" << this << " "
+
+// rough per-extent cost of the two btrees, used to turn the memory cap
+// into an extent count
+static const size_t bytes_per_range = 64;
+
+HybridAllocator::HybridAllocator(CephContext* cct,
+				 int64_t device_size,
+				 int64_t block_size)
+  : cct(cct),
+    device_size(device_size),
+    block_size(block_size),
+    block_order(ctz(block_size))
+{
+  assert(block_size > 0 && isp2(block_size));
+  range_count_cap = std::max<size_t>(
+    1,
+    cct->_conf->get_val<uint64_t>("bluestore_hybrid_alloc_mem_cap") /
+    bytes_per_range);
+  ldout(cct, 10) << __func__ << " device_size 0x" << std::hex << device_size
+		 << " block_size 0x" << block_size << std::dec
+		 << " range_count_cap " << range_count_cap << dendl;
+}
+
+HybridAllocator::~HybridAllocator()
+{
+}
+
+int HybridAllocator::reserve(uint64_t need)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " need 0x" << std::hex << need
+		 << " num_free 0x" << num_free
+		 << " num_reserved 0x" << num_reserved << std::dec << dendl;
+  if ((int64_t)need > num_free - num_reserved)
+    return -ENOSPC;
+  num_reserved += need;
+  return 0;
+}
+
+void HybridAllocator::unreserve(uint64_t unused)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " unused 0x" << std::hex << unused
+		 << " num_free 0x" << num_free
+		 << " num_reserved 0x" << num_reserved << std::dec << dendl;
+  assert(num_reserved >= (int64_t)unused);
+  num_reserved -= unused;
+}
+
+void HybridAllocator::_tree_erase(range_tree_t::iterator p)
+{
+  range_size_tree.erase(make_pair(p->second - p->first, p->first));
+  range_tree.erase(p);
+}
+
+/// insert a free extent, coalescing with its neighbours
+void HybridAllocator::_tree_insert(uint64_t start, uint64_t end)
+{
+  // pull in adjacent free blocks that were spilled to the bitmap
+  if (!bitmap.empty()) {
+    uint64_t b = _bitmap_run_begin(start >> block_order);
+    uint64_t e = _bitmap_run_end(end >> block_order, UINT64_MAX);
+    if ((b << block_order) < start) {
+      bitmap_free -= _bitmap_clear(b << block_order, start);
+      start = b << block_order;
+    }
+    if ((e << block_order) > end) {
+      bitmap_free -= _bitmap_clear(end, e << block_order);
+      end = e << block_order;
+    }
+  }
+
+  auto p = range_tree.lower_bound(start);
+  if (p != range_tree.end()) {
+    assert(p->first >= end);
+    if (p->first == end) {
+      end = p->second;
+      _tree_erase(p);
+      p = range_tree.lower_bound(start);
+    }
+  }
+  if (p != range_tree.begin()) {
+    --p;
+    assert(p->second <= start);
+    if (p->second == start) {
+      start = p->first;
+      _tree_erase(p);
+    }
+  }
+  ldout(cct, 30) << __func__ << " 0x" << std::hex << start << "~"
+		 << (end - start) << std::dec << dendl;
+  range_tree[start] = end;
+  range_size_tree.insert(make_pair(end - start, start));
+}
+
+/// remove [start, end) from the trees; it need not be fully present
+void HybridAllocator::_tree_remove(uint64_t start, uint64_t end)
+{
+  auto p = range_tree.upper_bound(start);
+  if (p != range_tree.begin()) {
+    --p;
+    if (p->second <= start) {
+      ++p;
+    }
+  }
+  while (p != range_tree.end() && p->first < end) {
+    uint64_t rs = p->first;
+    uint64_t re = p->second;
+    _tree_erase(p);
+    if (rs < start) {
+      range_tree[rs] = start;
+      range_size_tree.insert(make_pair(start - rs, rs));
+    }
+    if (re > end) {
+      range_tree[end] = re;
+      range_size_tree.insert(make_pair(re - end, end));
+    }
+    p = range_tree.lower_bound(end > re ? re : end);
+  }
+}
+
+/// call f(word index, mask) for the bits of blocks [b, e), a word at a time
+template <typename F>
+static void for_each_word(uint64_t b, uint64_t e, F&& f)
+{
+  while (b < e) {
+    unsigned bit = b & 63;
+    uint64_t n = std::min<uint64_t>(64 - bit, e - b);
+    uint64_t mask = n == 64 ? ~0ull : ((1ull << n) - 1) << bit;
+    f(b >> 6, mask);
+    b += n;
+  }
+}
+
+void HybridAllocator::_bitmap_set(uint64_t start, uint64_t end)
+{
+  assert(((start | end) & (block_size - 1)) == 0);
+  for_each_word(start >> block_order, end >> block_order,
+		[this](uint64_t w, uint64_t mask) {
+		  bitmap[w] |= mask;
+		});
+}
+
+/// clear free bits in [start, end), returning the number of bytes cleared
+uint64_t HybridAllocator::_bitmap_clear(uint64_t start, uint64_t end)
+{
+  if (bitmap.empty()) {
+    return 0;
+  }
+  uint64_t cleared = 0;
+  uint64_t last = std::min<uint64_t>(end >> block_order, bitmap.size() * 64);
+  for_each_word(start >> block_order, last,
+		[this, &cleared](uint64_t w, uint64_t mask) {
+		  cleared += __builtin_popcountll(bitmap[w] & mask);
+		  bitmap[w] &= ~mask;
+		});
+  return cleared << block_order;
+}
+
+uint64_t HybridAllocator::_bitmap_run_begin(uint64_t b) const
+{
+  while (b > 0) {
+    unsigned top = (b - 1) & 63;
+    // block b - 1 lands on bit 63, blocks of the next word are shifted out
+    uint64_t used = ~bitmap[(b - 1) >> 6] << (63 - top);
+    if (used) {
+      return b - clz(used);
+    }
+    b -= top + 1;
+  }
+  return 0;
+}
+
+uint64_t HybridAllocator::_bitmap_run_end(uint64_t b, uint64_t limit) const
+{
+  uint64_t start = b;
+  limit = std::min<uint64_t>(limit, bitmap.size() * 64);
+  while (b < limit) {
+    uint64_t used = ~bitmap[b >> 6] >> (b & 63);
+    if (used) {
+      return std::min(limit, b + ctz(used));
+    }
+    b = p2align<uint64_t>(b, 64) + 64;
+  }
+  return std::max(start, limit);
+}
+
+template <typename F>
+void HybridAllocator::_bitmap_runs(size_t wbegin, size_t wend,
+				   uint64_t *run_start, F&& f) const
+{
+  for (size_t w = wbegin; w < wend; ++w) {
+    uint64_t word = bitmap[w];
+    uint64_t base = w * 64;
+    // most words are all free or all used
+    if (word == 0) {
+      if (*run_start != UINT64_MAX) {
+	f(*run_start, base);
+	*run_start = UINT64_MAX;
+      }
+      continue;
+    }
+    if (word == ~0ull) {
+      if (*run_start == UINT64_MAX) {
+	*run_start = base;
+      }
+      continue;
+    }
+    unsigned pos = 0;
+    while (pos < 64) {
+      if (*run_start != UINT64_MAX) {
+	uint64_t used = ~word >> pos;
+	if (!used) {
+	  break;
+	}
+	pos += ctz(used);
+	f(*run_start, base + pos);
+	*run_start = UINT64_MAX;
+      } else {
+	uint64_t avail = word >> pos;
+	if (!avail) {
+	  break;
+	}
+	pos += ctz(avail);
+	*run_start = base + pos;
+      }
+    }
+  }
+}
+
+void HybridAllocator::_spill_to_bitmap()
+{
+  if (range_tree.size() <= range_count_cap) {
+    return;
+  }
+  if (bitmap.empty()) {
+    uint64_t nblocks = (device_size + block_size - 1) >> block_order;
+    bitmap.resize((nblocks + 63) / 64);
+  }
+  // leave some slack so that we don't spill on every release
+  size_t target = range_count_cap - range_count_cap / 8;
+  ldout(cct, 10) << __func__ << " " << range_tree.size() << " extents > cap "
+		 << range_count_cap << ", spilling down to " << target
+		 << dendl;
+  while (range_tree.size() > target) {
+    auto s = range_size_tree.begin();
+    uint64_t start = s->second;
+    uint64_t len = s->first;
+    range_size_tree.erase(s);
+    range_tree.erase(start);
+    _bitmap_set(start, start + len);
+    bitmap_free += len;
+  }
+}
+
+void HybridAllocator::_add_free(uint64_t offset, uint64_t length)
+{
+  assert(offset + length <= device_size);
+  _tree_insert(offset, offset + length);
+  _spill_to_bitmap();
+}
+
+bool HybridAllocator::_bitmap_find(
+  uint64_t want, uint64_t alloc_unit, uint64_t hint,
+  uint64_t *offset, uint64_t *length)
+{
+  if (bitmap_free < (int64_t)alloc_unit) {
+    return false;
+  }
+  uint64_t unit = std::max<uint64_t>(1, alloc_unit >> block_order);
+  uint64_t nblocks = bitmap.size() * 64;
+  uint64_t hint_block = p2align<uint64_t>(
+    std::min<uint64_t>(hint >> block_order, nblocks), unit);
+
+  // first fit, from the hint to the end and then from the start
+  auto search = [&](uint64_t b, uint64_t stop) {
+    while (b + unit <= stop) {
+      if (bitmap[b >> 6] == 0) {
+	b = p2roundup<uint64_t>(p2align<uint64_t>(b, 64) + 64, unit);
+	continue;
+      }
+      uint64_t want_end = b + (p2roundup(want, alloc_unit) >> block_order);
+      uint64_t e = _bitmap_run_end(b, std::min(stop, want_end));
+      e = b + p2align(e - b, unit);
+      if (e > b) {
+	*offset = b << block_order;
+	*length = std::min<uint64_t>(want, (e - b) << block_order);
+	return true;
+      }
+      b += unit;
+    }
+    return false;
+  };
+  return search(hint_block, nblocks) ||
+    search(0, std::min(nblocks, hint_block + unit - 1));
+}
+
+int64_t HybridAllocator::allocate_int(
+  uint64_t want_size, uint64_t alloc_unit, int64_t hint,
+  uint64_t *offset, uint32_t *length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " want_size 0x" << std::hex << want_size
+		 << " alloc_unit 0x" << alloc_unit
+		 << " hint 0x" << hint << std::dec
+		 << dendl;
+  uint64_t want = std::max(alloc_unit, want_size);
+  if (!hint)
+    hint = last_alloc;
+
+  auto aligned_start = [&](uint64_t start) {
+    return p2roundup(start, alloc_unit);
+  };
+  auto aligned_len = [&](uint64_t start, uint64_t end) -> uint64_t {
+    uint64_t s = aligned_start(start);
+    return s < end ? end - s : 0;
+  };
+
+  uint64_t start = 0, len = 0;
+
+  // keep extending the previous allocation if there is room
+  if (hint) {
+    auto p = range_tree.upper_bound(hint);
+    if (p != range_tree.begin()) {
+      --p;
+      if (p->second > (uint64_t)hint &&
+	  aligned_len(hint, p->second) >= want) {
+	start = aligned_start(hint);
+	len = want;
+	goto found;
+      }
+    }
+  }
+
+  // best fit
+  for (auto s = range_size_tree.lower_bound(make_pair(want, (uint64_t)0));
+       s != range_size_tree.end();
+       ++s) {
+    if (aligned_len(s->second, s->second + s->first) >= want) {
+      start = aligned_start(s->second);
+      len = want;
+      goto found;
+    }
+  }
+
+  // nothing big enough; take what we can from the largest extents
+  for (auto s = range_size_tree.rbegin();
+       s != range_size_tree.rend() && s->first >= alloc_unit;
+       ++s) {
+    uint64_t a = aligned_len(s->second, s->second + s->first);
+    if (a >= alloc_unit) {
+      start = aligned_start(s->second);
+      len = p2align(a, alloc_unit);
+      goto found;
+    }
+  }
+
+  // last resort, the spilled small extents
+  if (!bitmap.empty() &&
+      _bitmap_find(want, alloc_unit, hint, &start, &len)) {
+    bitmap_free -= _bitmap_clear(start, start + len);
+    ldout(cct, 30) << __func__ << " got 0x" << std::hex << start << "~" << len
+		   << std::dec << " from bitmap" << dendl;
+    goto done;
+  }
+
+  return -ENOSPC;
+
+ found:
+  ldout(cct, 30) << __func__ << " got 0x" << std::hex << start << "~" << len
+		 << std::dec << dendl;
+  _tree_remove(start, start + len);
+
+ done:
+  *offset = start;
+  *length = len;
+  num_free -= len;
+  num_reserved -= len;
+  assert(num_free >= 0);
+  assert(num_reserved >= 0);
+  last_alloc = start + len;
+  return 0;
+}
+
+int64_t HybridAllocator::allocate(
+  uint64_t want_size,
+  uint64_t alloc_unit,
+  uint64_t max_alloc_size,
+  int64_t hint,
+  PExtentVector *extents)
+{
+  uint64_t allocated_size = 0;
+  uint64_t offset = 0;
+  uint32_t length = 0;
+  int res = 0;
+
+  if (max_alloc_size == 0) {
+    max_alloc_size = want_size;
+  }
+
+  while (allocated_size < want_size) {
+    res = allocate_int(std::min(max_alloc_size, (want_size - allocated_size)),
+       alloc_unit, hint, &offset, &length);
+    if (res != 0) {
+      break;
+    }
+    bool can_append = true;
+    if (!extents->empty()) {
+      bluestore_pextent_t &last_extent  = extents->back();
+      if ((last_extent.end() == offset) &&
+	  ((last_extent.length + length) <= max_alloc_size)) {
+	can_append = false;
+	last_extent.length += length;
+      }
+    }
+    if (can_append) {
+      extents->emplace_back(bluestore_pextent_t(offset, length));
+    }
+
+    allocated_size += length;
+    hint = offset + length;
+  }
+
+  if (allocated_size == 0) {
+    return -ENOSPC;
+  }
+  return allocated_size;
+}
+
+void HybridAllocator::release(
+  const interval_set<uint64_t>& release_set)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+    const auto offset = p.get_start();
+    const auto length = p.get_len();
+    ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		   << std::dec << dendl;
+    _add_free(offset, length);
+    num_free += length;
+  }
+}
+
+uint64_t HybridAllocator::get_free()
+{
+  std::lock_guard<std::mutex> l(lock);
+  return num_free;
+}
+
+double HybridAllocator::get_fragmentation()
+{
+  // this is an admin socket query, so walk the free space in slices and
+  // let allocations in between; the score is approximate if they do
+  const size_t slice = 4096;
+  int64_t free_bytes;
+  {
+    std::lock_guard<std::mutex> l(lock);
+    free_bytes = num_free;
+  }
+  if (free_bytes == 0) {
+    return 0.0;
+  }
+  double sum_sq = 0;
+  uint64_t pos = 0;
+  bool more = true;
+  while (more) {
+    std::lock_guard<std::mutex> l(lock);
+    auto p = range_tree.lower_bound(pos);
+    for (size_t n = 0; n < slice && p != range_tree.end(); ++n, ++p) {
+      double len = p->second - p->first;
+      sum_sq += len * len;
+    }
+    more = p != range_tree.end();
+    if (more) {
+      pos = p->first;
+    }
+  }
+  auto add_run = [&](uint64_t start, uint64_t end) {
+    double len = (end - start) << block_order;
+    sum_sq += len * len;
+  };
+  uint64_t run_start = UINT64_MAX;
+  size_t nwords = 0;
+  for (size_t w = 0; ; w += slice) {
+    std::lock_guard<std::mutex> l(lock);
+    nwords = bitmap.size();
+    if (w >= nwords) {
+      break;
+    }
+    _bitmap_runs(w, std::min(nwords, w + slice), &run_start, add_run);
+  }
+  if (run_start != UINT64_MAX) {
+    add_run(run_start, nwords * 64);
+  }
+  return std::max(0.0, 1.0 - sqrt(sum_sq) / free_bytes);
+}
+
+bool HybridAllocator::foreach_free(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (auto& p : range_tree) {
+    notify(p.first, p.second - p.first);
+  }
+  if (bitmap_free) {
+    uint64_t run_start = UINT64_MAX;
+    auto report = [&](uint64_t start, uint64_t end) {
+      notify(start << block_order, (end - start) << block_order);
+    };
+    _bitmap_runs(0, bitmap.size(), &run_start, report);
+    if (run_start != UINT64_MAX) {
+      report(run_start, bitmap.size() * 64);
+    }
+  }
+  return true;
+}
+
+void HybridAllocator::dump()
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 0) << __func__ << " " << range_tree.size() << " extents, 0x"
+		<< std::hex << bitmap_free << std::dec
+		<< " bytes in bitmap" << dendl;
+  for (auto& p : range_tree) {
+    ldout(cct, 0) << __func__ << "  0x" << std::hex << p.first << "~"
+		  << (p.second - p.first) << std::dec << dendl;
+  }
+}
+
+void HybridAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		 << std::dec << dendl;
+  _add_free(offset, length);
+  num_free += length;
+}
+
+void HybridAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		 << std::dec << dendl;
+  _tree_remove(offset, offset + length);
+  bitmap_free -= _bitmap_clear(offset, offset + length);
+  num_free -= length;
+  assert(num_free >= 0);
+}
+
+void HybridAllocator::shutdown()
+{
+  ldout(cct, 1) << __func__ << dendl;
+  range_size_tree.clear();
+  range_tree.clear();
+  bitmap.clear();
+  bitmap_free = 0;
+}
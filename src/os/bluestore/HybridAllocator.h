@@ -0,0 +1,111 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_HYBRIDALLOCATOR_H
+#define CEPH_OS_BLUESTORE_HYBRIDALLOCATOR_H
+
+#include <mutex>
+
+#include "Allocator.h"
+#include "include/btree_map.h"
+#include "include/cpp-btree/btree_set.h"
+#include "include/mempool.h"
+#include "os/bluestore/bluestore_types.h"
+
+/**
+ * HybridAllocator
+ *
+ * Free space is tracked as extents in two btrees: one keyed by offset,
+ * used to coalesce on release, and one keyed by (length, offset), used
+ * for best-fit allocation.  When the number of extents exceeds the
+ * memory budget (bluestore_hybrid_alloc_mem_cap) the smallest extents
+ * are moved to a bitmap with one bit per block, which is only consulted
+ * once the trees cannot satisfy a request.  Extents released next to a
+ * bitmap run absorb it back into the trees.
+ */
+class HybridAllocator : public Allocator {
+  CephContext* cct;
+  std::mutex lock;
+
+  uint64_t device_size;
+  uint64_t block_size;
+  unsigned block_order;
+
+  int64_t num_free = 0;     ///< total bytes free (trees + bitmap)
+  int64_t num_reserved = 0; ///< reserved bytes
+
+  typedef mempool::bluestore_alloc::pool_allocator<
+    pair<const uint64_t,uint64_t>> range_allocator_t;
+  /// offset -> end
+  typedef btree::btree_map<uint64_t,uint64_t,std::less<uint64_t>,
+			   range_allocator_t> range_tree_t;
+  typedef mempool::bluestore_alloc::pool_allocator<
+    pair<uint64_t,uint64_t>> size_allocator_t;
+  /// (length, offset)
+  typedef btree::btree_set<pair<uint64_t,uint64_t>,
+			   std::less<pair<uint64_t,uint64_t>>,
+			   size_allocator_t> range_size_tree_t;
+
+  range_tree_t range_tree;
+  range_size_tree_t range_size_tree;
+  size_t range_count_cap;   ///< spill to bitmap above this many extents
+
+  /// one bit per block, set if free; allocated on first spill
+  mempool::bluestore_alloc::vector<uint64_t> bitmap;
+  int64_t bitmap_free = 0;  ///< bytes free in the bitmap
+
+  uint64_t last_alloc = 0;
+
+  void _tree_insert(uint64_t start, uint64_t end);
+  void _tree_erase(range_tree_t::iterator p);
+  void _tree_remove(uint64_t start, uint64_t end);
+  void _add_free(uint64_t offset, uint64_t length);
+  void _spill_to_bitmap();
+
+  void _bitmap_set(uint64_t start, uint64_t end);
+  uint64_t _bitmap_clear(uint64_t start, uint64_t end);
+  /// first block of the free run that ends right before block b
+  uint64_t _bitmap_run_begin(uint64_t b) const;
+  /// first block at or after b that is not free, at most limit
+  uint64_t _bitmap_run_end(uint64_t b, uint64_t limit) const;
+  bool _bitmap_find(uint64_t want, uint64_t alloc_unit, uint64_t hint,
+		    uint64_t *offset, uint64_t *length);
+  /// report f(start_block, end_block) for the free runs closed in words
+  /// [wbegin, wend); *run_start carries an open run between calls and is
+  /// UINT64_MAX when there is none
+  template <typename F>
+  void _bitmap_runs(size_t wbegin, size_t wend, uint64_t *run_start,
+		    F&& f) const;
+
+  int64_t allocate_int(
+    uint64_t want_size, uint64_t alloc_unit, int64_t hint,
+    uint64_t *offset, uint32_t *length);
+
+public:
+  HybridAllocator(CephContext* cct, int64_t device_size, int64_t block_size);
+  ~HybridAllocator() override;
+
+  int reserve(uint64_t need) override;
+  void unreserve(uint64_t unused) override;
+
+  int64_t allocate(
+    uint64_t want_size, uint64_t alloc_unit, uint64_t max_alloc_size,
+    int64_t hint, PExtentVector *extents) override;
+
+  void release(
+    const interval_set<uint64_t>& release_set) override;
+
+  uint64_t get_free() override;
+  double get_fragmentation() override;
+  bool foreach_free(
+    std::function<void(uint64_t offset, uint64_t length)> notify) override;
+
+  void dump() override;
+
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+
+  void shutdown() override;
+};
+
+#endif
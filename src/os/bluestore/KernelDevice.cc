@@ -19,6 +19,7 @@
 #include <fcntl.h>
 
 #include "KernelDevice.h"
+#include "ioring.h"
 #include "include/types.h"
 #include "include/compat.h"
 #include "include/stringify.h"
@@ -38,7 +39,6 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, ai
     fd_buffered(-1),
     aio(false), dio(false),
     debug_lock("KernelDevice::debug_lock"),
-    aio_queue(cct->_conf->bdev_aio_max_queue_depth),
     discard_callback(d_cb),
     discard_callback_priv(d_cbpriv),
     aio_stop(false),
@@ -48,6 +48,22 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, ai
     discard_thread(this),
     injecting_crash(0)
 {
+  unsigned iodepth = cct->_conf->bdev_aio_max_queue_depth;
+  if (cct->_conf->get_val<bool>("bdev_ioring")) {
+    if (ioring_queue_t::supported()) {
+      io_queue = std::unique_ptr<io_queue_t>(
+	new ioring_queue_t(iodepth,
+			   cct->_conf->get_val<bool>("bdev_ioring_hipri"),
+			   cct->_conf->get_val<bool>("bdev_ioring_sqthread_poll")));
+    } else {
+      derr << __func__ << " bdev_ioring is set but io_uring is not supported"
+	   << " (not built with liburing, or kernel too old); using libaio"
+	   << dendl;
+    }
+  }
+  if (!io_queue) {
+    io_queue = std::unique_ptr<io_queue_t>(new aio_queue_t(iodepth));
+  }
 }
 
 int KernelDevice::_lock()
@@ -316,13 +332,22 @@ int KernelDevice::_aio_start()
 {
   if (aio) {
     dout(10) << __func__ << dendl;
-    int r = aio_queue.init();
+    std::vector<int> fds = {fd_direct, fd_buffered};
+    int r = io_queue->init(fds);
+    auto ioring = dynamic_cast<ioring_queue_t*>(io_queue.get());
+    if (r < 0 && ioring && ioring->hipri) {
+      derr << __func__ << " polled io_uring not supported for " << path
+	   << ": " << cpp_strerror(r) << "; ignoring bdev_ioring_hipri"
+	   << dendl;
+      ioring->hipri = false;
+      r = io_queue->init(fds);
+    }
     if (r < 0) {
       if (r == -EAGAIN) {
 	derr << __func__ << " io_setup(2) failed with EAGAIN; "
 	     << "try increasing /proc/sys/fs/aio-max-nr" << dendl;
       } else {
-	derr << __func__ << " io_setup(2) failed: " << cpp_strerror(r) << dendl;
+	derr << __func__ << " io queue init failed: " << cpp_strerror(r) << dendl;
       }
       return r;
     }
@@ -338,7 +363,7 @@ void KernelDevice::_aio_stop()
     aio_stop = true;
     aio_thread.join();
     aio_stop = false;
-    aio_queue.shutdown();
+    io_queue->shutdown();
   }
 }
 
@@ -384,7 +409,7 @@ void KernelDevice::_aio_thread()
     dout(40) << __func__ << " polling" << dendl;
     int max = cct->_conf->bdev_aio_reap_max;
     aio_t *aio[max];
-    int r = aio_queue.get_next_completed(cct->_conf->bdev_aio_poll_ms,
+    int r = io_queue->get_next_completed(cct->_conf->bdev_aio_poll_ms,
 					 aio, max);
     if (r < 0) {
       derr << __func__ << " got " << cpp_strerror(r) << dendl;
@@ -612,7 +637,7 @@ void KernelDevice::aio_submit(IOContext *ioc)
 
   void *priv = static_cast<void*>(ioc);
   int r, retries = 0;
-  r = aio_queue.submit_batch(ioc->running_aios.begin(), e, 
+  r = io_queue->submit_batch(ioc->running_aios.begin(), e, 
 			     pending, priv, &retries);
   
   if (retries)
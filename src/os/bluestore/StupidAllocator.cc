@@ -1,6 +1,8 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 // vim: ts=8 sw=2 smarttab
 
+#include <cmath>
+
 #include "StupidAllocator.h"
 #include "bluestore_types.h"
 #include "common/debug.h"
@@ -31,19 +33,39 @@ unsigned StupidAllocator::_choose_bin(uint64_t orig_len)
   return bin;
 }
 
+void StupidAllocator::_bin_insert(unsigned bin, uint64_t off, uint64_t len,
+				  uint64_t *new_off, uint64_t *new_len)
+{
+  free[bin].insert(off, len, new_off, new_len);
+  // whatever it merged with were whole extents on either side
+  free_sum_sq += _sq(*new_len);
+  free_sum_sq -= _sq(off - *new_off) + _sq(*new_off + *new_len - off - len);
+}
+
+void StupidAllocator::_bin_erase(unsigned bin, uint64_t off, uint64_t len)
+{
+  uint64_t ext_off = 0, ext_len = 0;
+  bool found = free[bin].contains(off, &ext_off, &ext_len);
+  assert(found);
+  assert(off + len <= ext_off + ext_len);
+  free[bin].erase(off, len);
+  free_sum_sq += _sq(off - ext_off) + _sq(ext_off + ext_len - off - len);
+  free_sum_sq -= _sq(ext_len);
+}
+
 void StupidAllocator::_insert_free(uint64_t off, uint64_t len)
 {
   unsigned bin = _choose_bin(len);
   ldout(cct, 30) << __func__ << " 0x" << std::hex << off << "~" << len
 		 << std::dec << " in bin " << bin << dendl;
   while (true) {
-    free[bin].insert(off, len, &off, &len);
+    _bin_insert(bin, off, len, &off, &len);
     unsigned newbin = _choose_bin(len);
     if (newbin == bin)
       break;
     ldout(cct, 30) << __func__ << " promoting 0x" << std::hex << off << "~" << len
 		   << std::dec << " to bin " << newbin << dendl;
-    free[bin].erase(off, len);
+    _bin_erase(bin, off, len);
     bin = newbin;
   }
 }
@@ -174,14 +196,14 @@ int64_t StupidAllocator::allocate_int(
   ldout(cct, 30) << __func__ << " got 0x" << std::hex << *offset << "~" << *length
 	   	 << " from bin " << std::dec << bin << dendl;
 
-  free[bin].erase(*offset, *length);
+  _bin_erase(bin, *offset, *length);
   uint64_t off, len;
   if (*offset && free[bin].contains(*offset - skew - 1, &off, &len)) {
     int newbin = _choose_bin(len);
     if (newbin != bin) {
       ldout(cct, 30) << __func__ << " demoting 0x" << std::hex << off << "~" << len
 	       	     << std::dec << " to bin " << newbin << dendl;
-      free[bin].erase(off, len);
+      _bin_erase(bin, off, len);
       _insert_free(off, len);
     }
   }
@@ -190,7 +212,7 @@ int64_t StupidAllocator::allocate_int(
     if (newbin != bin) {
       ldout(cct, 30) << __func__ << " demoting 0x" << std::hex << off << "~" << len
 	       	     << std::dec << " to bin " << newbin << dendl;
-      free[bin].erase(off, len);
+      _bin_erase(bin, off, len);
       _insert_free(off, len);
     }
   }
@@ -273,6 +295,27 @@ uint64_t StupidAllocator::get_free()
   return num_free;
 }
 
+double StupidAllocator::get_fragmentation()
+{
+  std::lock_guard<std::mutex> l(lock);
+  if (num_free == 0) {
+    return 0.0;
+  }
+  return 1.0 - sqrt((double)free_sum_sq) / num_free;
+}
+
+bool StupidAllocator::foreach_free(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (auto& bin : free) {
+    for (auto p = bin.begin(); p != bin.end(); ++p) {
+      notify(p.get_start(), p.get_len());
+    }
+  }
+  return true;
+}
+
 void StupidAllocator::dump()
 {
   std::lock_guard<std::mutex> l(lock);
@@ -316,6 +359,10 @@ void StupidAllocator::init_rm_free(uint64_t offset, uint64_t length)
         auto o = it.get_start();
         auto l = it.get_len();
 
+        uint64_t ext_off = 0, ext_len = 0;
+        bool found = free[i].contains(o, &ext_off, &ext_len);
+        assert(found);
+        free_sum_sq -= _sq(ext_len);
         free[i].erase(o, l,
           [&](uint64_t off, uint64_t len) {
             unsigned newbin = _choose_bin(len);
@@ -325,6 +372,7 @@ void StupidAllocator::init_rm_free(uint64_t offset, uint64_t length)
               _insert_free(off, len);
               return true;
             }
+            free_sum_sq += _sq(len);
             return false;
           });
         ++it;
@@ -24,9 +24,20 @@ class StupidAllocator : public Allocator {
   typedef btree::btree_map<uint64_t,uint64_t,std::less<uint64_t>,allocator_t> interval_set_map_t;
   typedef interval_set<uint64_t,interval_set_map_t> interval_set_t;
   std::vector<interval_set_t> free;  ///< leading-edge copy
+  /// sum of the squares of the free extent lengths, for get_fragmentation()
+  unsigned __int128 free_sum_sq = 0;
 
   uint64_t last_alloc;
 
+  static unsigned __int128 _sq(uint64_t len) {
+    return (unsigned __int128)len * len;
+  }
+  /// insert into free[bin] as is, keeping free_sum_sq up to date
+  void _bin_insert(unsigned bin, uint64_t off, uint64_t len,
+		   uint64_t *new_off, uint64_t *new_len);
+  /// erase from free[bin] as is, keeping free_sum_sq up to date
+  void _bin_erase(unsigned bin, uint64_t off, uint64_t len);
+
   unsigned _choose_bin(uint64_t len);
   void _insert_free(uint64_t offset, uint64_t len);
 
@@ -53,6 +64,9 @@ public:
     const interval_set<uint64_t>& release_set) override;
 
   uint64_t get_free() override;
+  double get_fragmentation() override;
+  bool foreach_free(
+    std::function<void(uint64_t offset, uint64_t length)> notify) override;
 
   void dump() override;
 
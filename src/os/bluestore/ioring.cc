@@ -0,0 +1,331 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "ioring.h"
+
+#if defined(HAVE_LIBURING)
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+#include <liburing.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+struct ioring_data {
+  struct io_uring io_uring;
+  bool ring_open = false;
+  std::mutex sq_mutex;
+  std::mutex cq_mutex;
+  int epoll_fd = -1;               ///< interrupt driven rings only
+  std::map<int,int> fixed_fds_map;  ///< real fd -> registered index
+
+  // a polled (IOPOLL) ring never signals its fd; completions are only
+  // found by io_uring_enter(GETEVENTS), which returns at once when
+  // nothing is in flight, so the reaper sleeps on this instead
+  std::atomic<unsigned> inflight = {0};
+  std::mutex inflight_mutex;
+  std::condition_variable inflight_cond;
+};
+
+static int ioring_get_cqe(ioring_data *d, unsigned max, aio_t **paio)
+{
+  struct io_uring *ring = &d->io_uring;
+  struct io_uring_cqe *cqe;
+  unsigned head;
+  unsigned nr = 0;
+
+  io_uring_for_each_cqe(ring, head, cqe) {
+    aio_t *io = (aio_t *)(uintptr_t)io_uring_cqe_get_data(cqe);
+    io->rval = cqe->res;
+    paio[nr++] = io;
+    if (nr == max) {
+      break;
+    }
+  }
+  io_uring_cq_advance(ring, nr);
+  d->inflight -= nr;
+  return nr;
+}
+
+/// submit one polled read through fixed file 0 to see whether the
+/// device (or filesystem) supports IOPOLL at all
+static int ioring_probe_iopoll(ioring_data *d)
+{
+  const size_t len = 4096;
+  void *buf;
+  if (posix_memalign(&buf, len, len)) {
+    return -ENOMEM;
+  }
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&d->io_uring);
+  io_uring_prep_readv(sqe, 0, &iov, 1, 0);
+  io_uring_sqe_set_data(sqe, nullptr);
+  io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  int r = io_uring_submit(&d->io_uring);
+  if (r >= 0) {
+    struct io_uring_cqe *cqe;
+    r = io_uring_wait_cqe(&d->io_uring, &cqe);
+    if (r == 0) {
+      r = cqe->res < 0 ? cqe->res : 0;
+      io_uring_cqe_seen(&d->io_uring, cqe);
+    }
+  }
+  free(buf);
+  return r;
+}
+
+static void init_sqe(ioring_data *d, struct io_uring_sqe *sqe, aio_t *io)
+{
+  auto p = d->fixed_fds_map.find(io->fd);
+  assert(p != d->fixed_fds_map.end());
+  int fixed_fd = p->second;
+
+  // the aio_t was prepared for libaio; translate the iocb
+  switch (io->iocb.aio_lio_opcode) {
+  case IO_CMD_PWRITEV:
+    io_uring_prep_writev(sqe, fixed_fd, &io->iov[0], io->iov.size(),
+			 io->offset);
+    break;
+  case IO_CMD_PREAD:
+    io_uring_prep_readv(sqe, fixed_fd, &io->iov[0], io->iov.size(),
+			io->offset);
+    break;
+  default:
+    assert(0 == "unsupported aio opcode");
+  }
+  io_uring_sqe_set_data(sqe, io);
+  io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+}
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_,
+			       bool sq_thread_)
+  : d(new ioring_data),
+    iodepth(iodepth_),
+    hipri(hipri_),
+    sq_thread(sq_thread_)
+{
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+  assert(!d->ring_open);
+}
+
+int ioring_queue_t::init(std::vector<int>& fds)
+{
+  unsigned flags = 0;
+  if (hipri) {
+    flags |= IORING_SETUP_IOPOLL;
+  }
+  if (sq_thread) {
+    flags |= IORING_SETUP_SQPOLL;
+  }
+
+  int r = io_uring_queue_init(iodepth, &d->io_uring, flags);
+  if (r < 0) {
+    return r;
+  }
+  r = io_uring_register_files(&d->io_uring, &fds[0], fds.size());
+  if (r < 0) {
+    goto out_ring;
+  }
+  d->fixed_fds_map.clear();
+  for (unsigned i = 0; i < fds.size(); ++i) {
+    d->fixed_fds_map[fds[i]] = i;
+  }
+  d->inflight = 0;
+
+  if (hipri) {
+    r = ioring_probe_iopoll(d.get());
+    if (r < 0) {
+      goto out_ring;
+    }
+    d->ring_open = true;
+    return 0;
+  }
+
+  d->epoll_fd = epoll_create1(0);
+  if (d->epoll_fd < 0) {
+    r = -errno;
+    goto out_ring;
+  }
+  {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    r = epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, d->io_uring.ring_fd, &ev);
+    if (r < 0) {
+      r = -errno;
+      goto out_epoll;
+    }
+  }
+  d->ring_open = true;
+  return 0;
+
+ out_epoll:
+  ::close(d->epoll_fd);
+  d->epoll_fd = -1;
+ out_ring:
+  io_uring_queue_exit(&d->io_uring);
+  return r;
+}
+
+void ioring_queue_t::shutdown()
+{
+  if (!d->ring_open) {
+    return;
+  }
+  d->fixed_fds_map.clear();
+  if (d->epoll_fd >= 0) {
+    ::close(d->epoll_fd);
+    d->epoll_fd = -1;
+  }
+  io_uring_queue_exit(&d->io_uring);
+  d->ring_open = false;
+}
+
+int ioring_queue_t::submit_batch(aio_iter beg, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  // same backoff as aio_queue_t when the submission ring is full
+  int attempts = 16;
+  int delay = 125;
+  int done = 0;
+
+  while (beg != end) {
+    int queued = 0;
+    {
+      std::lock_guard<std::mutex> l(d->sq_mutex);
+      while (beg != end) {
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&d->io_uring);
+	if (!sqe) {
+	  break;
+	}
+	aio_t *io = &*beg;
+	io->priv = priv;
+	init_sqe(d.get(), sqe, io);
+	++queued;
+	++beg;
+      }
+      if (queued) {
+	// count before submitting so the reaper never sees more
+	// completions than inflight
+	unsigned prev = d->inflight.fetch_add(queued);
+	int r = io_uring_submit(&d->io_uring);
+	if (r < 0) {
+	  d->inflight -= queued;
+	  return r;
+	}
+	if (prev == 0 && hipri) {
+	  std::lock_guard<std::mutex> l(d->inflight_mutex);
+	  d->inflight_cond.notify_all();
+	}
+      }
+    }
+    done += queued;
+    if (beg != end) {
+      if (attempts-- <= 0) {
+	return -EAGAIN;
+      }
+      usleep(delay);
+      delay *= 2;
+      (*retries)++;
+    }
+  }
+  assert(done <= aios_size);
+  return done;
+}
+
+int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
+{
+  std::lock_guard<std::mutex> l(d->cq_mutex);
+  int events = ioring_get_cqe(d.get(), max, paio);
+  if (events == 0 && hipri) {
+    {
+      std::unique_lock<std::mutex> il(d->inflight_mutex);
+      if (!d->inflight_cond.wait_for(
+	    il, std::chrono::milliseconds(timeout_ms),
+	    [this] { return d->inflight > 0; })) {
+	return 0;
+      }
+    }
+    // spins in the kernel until at least one completes
+    struct io_uring_cqe *cqe;
+    int r = io_uring_wait_cqe(&d->io_uring, &cqe);
+    if (r < 0) {
+      return r == -EINTR ? 0 : r;
+    }
+    events = ioring_get_cqe(d.get(), max, paio);
+  } else if (events == 0) {
+    struct epoll_event ev;
+    int r = epoll_wait(d->epoll_fd, &ev, 1, timeout_ms);
+    if (r < 0) {
+      return errno == EINTR ? 0 : -errno;
+    }
+    events = ioring_get_cqe(d.get(), max, paio);
+  }
+  return events;
+}
+
+bool ioring_queue_t::supported()
+{
+  struct io_uring ring;
+  int r = io_uring_queue_init(16, &ring, 0);
+  if (r < 0) {
+    return false;
+  }
+  io_uring_queue_exit(&ring);
+  return true;
+}
+
+#else // #if defined(HAVE_LIBURING)
+
+struct ioring_data {};
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_,
+			       bool sq_thread_)
+{
+  assert(0);
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+}
+
+int ioring_queue_t::init(std::vector<int>& fds)
+{
+  assert(0);
+}
+
+void ioring_queue_t::shutdown()
+{
+  assert(0);
+}
+
+int ioring_queue_t::submit_batch(aio_iter beg, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  assert(0);
+}
+
+int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
+{
+  assert(0);
+}
+
+bool ioring_queue_t::supported()
+{
+  return false;
+}
+
+#endif // #if defined(HAVE_LIBURING)
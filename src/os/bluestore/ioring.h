@@ -0,0 +1,41 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <memory>
+
+#include "acconfig.h"
+#include "aio.h"
+
+struct ioring_data;
+
+/**
+ * ioring_queue_t
+ *
+ * io_uring implementation of io_queue_t.  The device fds are registered
+ * with the ring so submissions skip the per-IO file lookup, and the ring
+ * may optionally be set up for polled completions (hipri, O_DIRECT only)
+ * or with a kernel submission polling thread (sq_thread).  A polled ring
+ * is reaped with io_uring_enter(GETEVENTS) rather than epoll, and init()
+ * fails if the first fd does not support polled reads.
+ */
+struct ioring_queue_t final : public io_queue_t {
+  std::unique_ptr<ioring_data> d;
+  unsigned iodepth = 0;
+  bool hipri = false;
+  bool sq_thread = false;
+
+  /// true if we were built with liburing and the kernel supports io_uring
+  static bool supported();
+
+  ioring_queue_t(unsigned iodepth, bool hipri, bool sq_thread);
+  ~ioring_queue_t() final;
+
+  int init(std::vector<int>& fds) final;
+  void shutdown() final;
+
+  int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
+		   void *priv, int *retries) final;
+  int get_next_completed(int timeout_ms, aio_t **paio, int max) final;
+};
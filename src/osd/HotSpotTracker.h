@@ -0,0 +1,148 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_HOTSPOTTRACKER_H
+#define CEPH_OSD_HOTSPOTTRACKER_H
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "common/Formatter.h"
+#include "common/Mutex.h"
+#include "common/space_saving.h"
+#include "common/hobject.h"
+#include "msg/msg_types.h"
+#include "osd/osd_types.h"
+
+/**
+ * Tracks the objects and clients receiving the most ops on this OSD.
+ *
+ * Each shard holds a space-saving sketch of objects and one of clients,
+ * and a PG always maps to the same shard, so recording only contends
+ * with ops of PGs on the same op shard.
+ */
+class HotSpotTracker {
+  struct Shard {
+    Mutex lock;
+    SpaceSaving<hobject_t> objects;
+    SpaceSaving<entity_name_t> clients;
+
+    explicit Shard(size_t capacity)
+      : lock("HotSpotTracker::Shard::lock"),
+	objects(capacity),
+	clients(capacity) {}
+  };
+  std::vector<std::unique_ptr<Shard>> shards;
+  size_t capacity;
+
+public:
+  HotSpotTracker(unsigned num_shards, size_t capacity)
+    : capacity(capacity) {
+    for (unsigned i = 0; i < std::max(num_shards, 1u); ++i) {
+      shards.emplace_back(new Shard(capacity));
+    }
+  }
+
+  bool enabled() const {
+    return capacity > 0;
+  }
+
+  void record(spg_t pgid, const hobject_t& oid, const entity_name_t& client,
+	      uint64_t bytes) {
+    if (!capacity) {
+      return;
+    }
+    Shard& s = *shards[pgid.hash_to_shard(shards.size())];
+    Mutex::Locker l(s.lock);
+    s.objects.add(oid, bytes);
+    s.clients.add(client, bytes);
+  }
+
+  /// halve all counts so the sketches follow the current workload
+  void decay() {
+    for (auto& s : shards) {
+      Mutex::Locker l(s->lock);
+      s->objects.decay();
+      s->clients.decay();
+    }
+  }
+
+  void dump(Formatter *f, size_t n) {
+    typedef SpaceSaving<hobject_t>::counter_t counter_t;
+    std::vector<std::pair<hobject_t, counter_t>> objects;
+    std::map<entity_name_t, counter_t> clients;
+    for (auto& s : shards) {
+      Mutex::Locker l(s->lock);
+      // a PG lives on one shard, so objects never repeat across shards
+      for (auto& p : s->objects.top(n)) {
+	objects.push_back(p);
+      }
+      // but a client does, so add up its counts
+      for (auto& p : s->clients.top(n)) {
+	counter_t& c = clients[p.first];
+	c.count += p.second.count;
+	c.error += p.second.error;
+	c.bytes += p.second.bytes;
+      }
+    }
+    auto by_count = [](const counter_t& a, const counter_t& b) {
+      return a.count > b.count;
+    };
+    std::sort(objects.begin(), objects.end(),
+	      [&](const std::pair<hobject_t, counter_t>& a,
+		  const std::pair<hobject_t, counter_t>& b) {
+		return by_count(a.second, b.second);
+	      });
+    if (objects.size() > n) {
+      objects.resize(n);
+    }
+    std::vector<std::pair<entity_name_t, counter_t>> top_clients(
+      clients.begin(), clients.end());
+    std::sort(top_clients.begin(), top_clients.end(),
+	      [&](const std::pair<entity_name_t, counter_t>& a,
+		  const std::pair<entity_name_t, counter_t>& b) {
+		return by_count(a.second, b.second);
+	      });
+    if (top_clients.size() > n) {
+      top_clients.resize(n);
+    }
+
+    f->open_object_section("hot_spots");
+    f->dump_unsigned("capacity_per_shard", capacity);
+    f->dump_unsigned("num_shards", shards.size());
+    f->open_array_section("objects");
+    for (auto& p : objects) {
+      f->open_object_section("object");
+      f->dump_stream("oid") << p.first;
+      f->dump_unsigned("ops", p.second.count);
+      f->dump_unsigned("error", p.second.error);
+      f->dump_unsigned("bytes", p.second.bytes);
+      f->close_section();
+    }
+    f->close_section();
+    f->open_array_section("clients");
+    for (auto& p : top_clients) {
+      f->open_object_section("client");
+      f->dump_stream("name") << p.first;
+      f->dump_unsigned("ops", p.second.count);
+      f->dump_unsigned("error", p.second.error);
+      f->dump_unsigned("bytes", p.second.bytes);
+      f->close_section();
+    }
+    f->close_section();
+    f->close_section();
+  }
+};
+
+#endif
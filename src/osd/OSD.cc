@@ -227,6 +227,11 @@ OSDService::OSDService(OSD *osd) :
   class_handler(osd->class_handler),
   osd_max_object_size(*cct->_conf, "osd_max_object_size"),
   osd_skip_data_digest(*cct->_conf, "osd_skip_data_digest"),
+  osd_pg_log_embed_fastinfo(*cct->_conf, "osd_pg_log_embed_fastinfo"),
+  osd_op_fast_read_max_bytes(*cct->_conf, "osd_op_fast_read_max_bytes"),
+  osd_op_rx_buffer_min_bytes(*cct->_conf, "osd_op_rx_buffer_min_bytes"),
+  rx_buffer_pool(std::make_shared<RxBufferPool>(
+    cct->_conf->get_val<uint64_t>("osd_op_rx_buffer_pool_bytes"))),
   pg_epoch_lock("OSDService::pg_epoch_lock"),
   publish_lock("OSDService::publish_lock"),
   pre_publish_lock("OSDService::pre_publish_lock"),
@@ -246,6 +251,9 @@ OSDService::OSDService(OSD *osd) :
   last_recalibrate(ceph_clock_now()),
   promote_max_objects(0),
   promote_max_bytes(0),
+  hot_spots(osd->get_num_op_shards(),
+	    cct->_conf->get_val<uint64_t>("osd_hot_spot_tracker_size")),
+  last_hot_spot_decay(ceph_clock_now()),
   objecter(new Objecter(osd->client_messenger->cct, osd->objecter_messenger, osd->monc, NULL, 0, 0)),
   m_objecter_finishers(cct->_conf->osd_objecter_finishers),
   watch_lock("OSDService::watch_lock"),
@@ -762,6 +770,19 @@ void OSDService::promote_throttle_recalibrate()
   promote_max_bytes = target_bytes_sec * OSD::OSD_TICK_INTERVAL * 2;
 }
 
+void OSDService::hot_spot_decay()
+{
+  if (!hot_spots.enabled())
+    return;
+  double halflife = cct->_conf->get_val<double>("osd_hot_spot_tracker_halflife");
+  utime_t now = ceph_clock_now();
+  if (halflife <= 0 || now - last_hot_spot_decay < halflife)
+    return;
+  last_hot_spot_decay = now;
+  dout(20) << __func__ << dendl;
+  hot_spots.decay();
+}
+
 // -------------------------------------
 
 float OSDService::get_failsafe_full_ratio()
@@ -1480,9 +1501,9 @@ bool OSDService::_get_map_bl(epoch_t e, bufferlist& bl)
   return found;
 }
 
-bool OSDService::get_inc_map_bl(epoch_t e, bufferlist& bl)
+bool OSDService::_get_inc_map_bl(epoch_t e, bufferlist& bl)
 {
-  Mutex::Locker l(map_cache_lock);
+  assert(map_cache_lock.is_locked());
   bool found = map_bl_inc_cache.lookup(e, &bl);
   if (found) {
     if (logger)
@@ -1582,6 +1603,16 @@ OSDMapRef OSDService::try_get_map(epoch_t epoch)
     }
   }
 
+  if (epoch > 1) {
+    OSDMap *map = _rebuild_map(epoch);
+    if (map) {
+      if (logger) {
+	logger->inc(l_osd_map_cache_rebuild);
+      }
+      return _add_map(map);
+    }
+  }
+
   OSDMap *map = new OSDMap;
   if (epoch > 0) {
     dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
@@ -1598,6 +1629,57 @@ OSDMapRef OSDService::try_get_map(epoch_t epoch)
   return _add_map(map);
 }
 
+OSDMap *OSDService::_rebuild_map(epoch_t epoch)
+{
+  assert(map_cache_lock.is_locked());
+  epoch_t max = cct->_conf->get_val<uint64_t>("osd_map_cache_max_rebuild_epochs");
+  OSDMapRef base;
+  for (epoch_t e = epoch - 1; e > 0 && epoch - e <= max; --e) {
+    base = map_cache.lookup(e);
+    if (base) {
+      break;
+    }
+  }
+  if (!base) {
+    return nullptr;
+  }
+
+  // start from the cached map so that whatever the incrementals leave
+  // untouched (crush, pools, addrs, ...) stays shared with it
+  dout(20) << "get_map " << epoch << " - rebuilding from "
+	   << base->get_epoch() << dendl;
+  OSDMap *map = new OSDMap;
+  map->deepish_copy_from(*base);
+  for (epoch_t e = base->get_epoch() + 1; e <= epoch; ++e) {
+    bufferlist bl;
+    if (!_get_inc_map_bl(e, bl) || bl.length() == 0) {
+      dout(20) << "get_map " << epoch << " - no incremental " << e << dendl;
+      delete map;
+      return nullptr;
+    }
+    OSDMap::Incremental inc;
+    bufferlist::iterator p = bl.begin();
+    inc.decode(p);
+    if (map->apply_incremental(inc) < 0) {
+      delete map;
+      return nullptr;
+    }
+    if (e == epoch) {
+      // an incremental that failed its crc when it arrived was replaced by
+      // a full map; only trust the result if it encodes identically
+      bufferlist fbl;
+      map->encode(fbl, inc.encode_features | CEPH_FEATURE_RESERVED);
+      if (!inc.have_crc || map->get_crc() != inc.full_crc) {
+	dout(10) << "get_map " << epoch << " - cannot verify rebuilt map"
+		 << ", decoding full map" << dendl;
+	delete map;
+	return nullptr;
+      }
+    }
+  }
+  return map;
+}
+
 // ops
 
 
@@ -2009,8 +2091,11 @@ OSD::OSD(CephContext *cct_, ObjectStore *store_,
   test_ops_hook(NULL),
   op_queue(get_io_queue()),
   op_prio_cutoff(get_io_prio_cut()),
+  op_run_to_completion(
+    cct->_conf->get_val<bool>("osd_op_shard_run_to_completion")),
   op_shardedwq(
     get_num_op_shards(),
+    op_run_to_completion,
     this,
     cct->_conf->osd_op_thread_timeout,
     cct->_conf->osd_op_thread_suicide_timeout,
@@ -2238,6 +2323,14 @@ will start to track new ops received afterwards.";
     service.remote_reserver.dump(f);
     f->close_section();
     f->close_section();
+  } else if (admin_command == "dump_heartbeat_peers") {
+    dump_heartbeat_peers(f);
+  } else if (admin_command == "dump_hot_objects") {
+    int64_t num;
+    if (!cmd_getval(cct, cmdmap, "num", num) || num <= 0) {
+      num = 10;
+    }
+    service.hot_spots.dump(f, num);
   } else if (admin_command == "get_latest_osdmap") {
     get_latest_osdmap();
   } else if (admin_command == "heap") {
@@ -2297,6 +2390,8 @@ will start to track new ops received afterwards.";
     service.dumps_scrub(f);
   } else if (admin_command == "calc_objectstore_db_histogram") {
     store->generate_db_histogram(f);
+  } else if (admin_command == "dump_objectstore_allocator_stats") {
+    store->get_allocator_stats(f);
   } else if (admin_command == "flush_store_cache") {
     store->flush_cache();
   } else if (admin_command == "dump_pgstate_history") {
@@ -2438,6 +2533,9 @@ int OSD::get_num_op_shards()
 
 int OSD::get_num_op_threads()
 {
+  // a shard's pgs are owned by its one thread
+  if (cct->_conf->get_val<bool>("osd_op_shard_run_to_completion"))
+    return get_num_op_shards();
   if (cct->_conf->osd_op_num_threads_per_shard)
     return get_num_op_shards() * cct->_conf->osd_op_num_threads_per_shard;
   if (store_is_rotational)
@@ -2675,6 +2773,25 @@ int OSD::init()
   monc->set_log_client(&log_client);
   update_log_config();
 
+  if (op_run_to_completion) {
+    const string& cpus_str = cct->_conf->get_val<string>("osd_op_shard_cpus");
+    vector<string> strs;
+    get_str_vec(cpus_str, strs);
+    vector<int> cpus;
+    for (auto& str : strs) {
+      string err;
+      int cpu = strict_strtol(str.c_str(), 10, &err);
+      if (err == "") {
+	cpus.push_back(cpu);
+      } else {
+	derr << __func__ << " failed to parse " << str << " in "
+	     << cpus_str << dendl;
+      }
+    }
+    dout(1) << __func__ << " run-to-completion with "
+	    << get_num_op_shards() << " op shards, cpus " << cpus << dendl;
+    osd_op_tp.set_thread_cpus(cpus);
+  }
   osd_op_tp.start();
   disk_tp.start();
   command_tp.start();
@@ -2830,6 +2947,19 @@ void OSD::final_init()
 				     asok_hook,
 				     "show recovery reservations");
   assert(r == 0);
+  r = admin_socket->register_command("dump_heartbeat_peers",
+				     "dump_heartbeat_peers",
+				     asok_hook,
+				     "show heartbeat peers with their suspicion"
+				     " level and ping round trip times");
+  assert(r == 0);
+  r = admin_socket->register_command("dump_hot_objects",
+				     "dump_hot_objects "
+				     "name=num,type=CephInt,req=false",
+				     asok_hook,
+				     "show the objects and clients receiving"
+				     " the most ops");
+  assert(r == 0);
   r = admin_socket->register_command("get_latest_osdmap", "get_latest_osdmap",
 				     asok_hook,
 				     "force osd to update the latest map from "
@@ -2877,6 +3007,12 @@ void OSD::final_init()
                                      "Generate key value histogram of kvdb(rocksdb) which used by bluestore");
   assert(r == 0);
 
+  r = admin_socket->register_command("dump_objectstore_allocator_stats",
+                                     "dump_objectstore_allocator_stats",
+                                     asok_hook,
+                                     "print free space and fragmentation score of the bluestore allocator");
+  assert(r == 0);
+
   r = admin_socket->register_command("flush_store_cache",
                                      "flush_store_cache",
                                      asok_hook,
@@ -3074,6 +3210,12 @@ void OSD::create_logger()
   osd_plb.add_time_avg(
     l_osd_op_r_prepare_lat, "op_r_prepare_latency",
     "Latency of read operations (excluding queue time and wait for finished)");
+  osd_plb.add_u64_counter(
+    l_osd_op_r_fast, "op_r_fast",
+    "Client reads served without an op context");
+  osd_plb.add_u64_counter(
+    l_osd_op_r_slow, "op_r_slow",
+    "Client reads executed through the full op path");
   osd_plb.add_u64_counter(
     l_osd_op_w, "op_w", "Client write operations");
   osd_plb.add_u64_counter(
@@ -3148,6 +3290,20 @@ void OSD::create_logger()
     l_osd_sop_push_inb, "subop_push_in_bytes", "Suboperations pushed size", NULL, 0, unit_t(BYTES));
   osd_plb.add_time_avg(
     l_osd_sop_push_lat, "subop_push_latency", "Suboperations push latency");
+  osd_plb.add_time_avg(
+    l_osd_repop_commit_lat, "repop_commit_latency",
+    "Latency from sending a replicated write until a replica commits it");
+  PerfHistogramCommon::axis_config_d repop_hist_y_axis_config{
+    "Replica reply order",
+    PerfHistogramCommon::SCALE_LINEAR, ///< 1st, 2nd, ... replica to commit
+    1,                                 ///< Start at the first reply
+    1,                                 ///< One bucket per replica
+    8,                                 ///< Enough for any sane pool size
+  };
+  osd_plb.add_u64_counter_histogram(
+    l_osd_repop_commit_lat_hist, "repop_commit_latency_histogram",
+    op_hist_x_axis_config, repop_hist_y_axis_config,
+    "Histogram of replica commit latency by order of reply");
 
   osd_plb.add_u64_counter(l_osd_pull, "pull", "Pull requests sent");
   osd_plb.add_u64_counter(l_osd_push, "push", "Push messages sent");
@@ -3187,6 +3343,11 @@ void OSD::create_logger()
     PerfCountersBuilder::PRIO_USEFUL);
   osd_plb.add_u64(
     l_osd_hb_to, "heartbeat_to_peers", "Heartbeat (ping) peers we send to");
+  osd_plb.add_time_avg(
+    l_osd_hb_rtt, "heartbeat_ping_rtt", "Heartbeat (ping) round trip time");
+  osd_plb.add_u64_counter(
+    l_osd_hb_phi_fail, "heartbeat_phi_failures",
+    "Peers reported failed by the phi accrual detector before their grace");
   osd_plb.add_u64_counter(l_osd_map, "map_messages", "OSD map messages");
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs", "OSD map epochs");
   osd_plb.add_u64_counter(
@@ -3205,6 +3366,9 @@ void OSD::create_logger()
   osd_plb.add_u64_avg(
     l_osd_map_cache_miss_low_avg, "osd_map_cache_miss_low_avg",
     "osdmap cache miss, avg distance below cache lower bound");
+  osd_plb.add_u64_counter(
+    l_osd_map_cache_rebuild, "osd_map_cache_rebuild",
+    "osdmap cache miss served from an older cached map and incrementals");
   osd_plb.add_u64_counter(
     l_osd_map_bl_cache_hit, "osd_map_bl_cache_hit",
     "OSDMap buffer cache hits");
@@ -3276,6 +3440,12 @@ void OSD::create_logger()
     "PG updated its info using fastinfo attr");
   osd_plb.add_u64_counter(
     l_osd_pg_biginfo, "osd_pg_biginfo", "PG updated its biginfo attr");
+  osd_plb.add_u64_counter(
+    l_osd_pg_fastinfo_embedded, "osd_pg_fastinfo_embedded",
+    "PG stored its fastinfo with its newest log entry");
+  osd_plb.add_u64_avg(
+    l_osd_pg_meta_keys, "osd_pg_meta_keys",
+    "omap keys set per PG log/info update");
 
   logger = osd_plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
@@ -3384,6 +3554,8 @@ int OSD::shutdown()
   cct->get_admin_socket()->unregister_command("dump_blacklist");
   cct->get_admin_socket()->unregister_command("dump_watchers");
   cct->get_admin_socket()->unregister_command("dump_reservations");
+  cct->get_admin_socket()->unregister_command("dump_heartbeat_peers");
+  cct->get_admin_socket()->unregister_command("dump_hot_objects");
   cct->get_admin_socket()->unregister_command("get_latest_osdmap");
   cct->get_admin_socket()->unregister_command("heap");
   cct->get_admin_socket()->unregister_command("set_heap_property");
@@ -3391,6 +3563,7 @@ int OSD::shutdown()
   cct->get_admin_socket()->unregister_command("dump_objectstore_kv_stats");
   cct->get_admin_socket()->unregister_command("dump_scrubs");
   cct->get_admin_socket()->unregister_command("calc_objectstore_db_histogram");
+  cct->get_admin_socket()->unregister_command("dump_objectstore_allocator_stats");
   cct->get_admin_socket()->unregister_command("flush_store_cache");
   cct->get_admin_socket()->unregister_command("dump_pgstate_history");
   cct->get_admin_socket()->unregister_command("compact");
@@ -4675,7 +4848,14 @@ void OSD::handle_osd_ping(MOSDPing *m)
     {
       map<int,HeartbeatInfo>::iterator i = heartbeat_peers.find(from);
       if (i != heartbeat_peers.end()) {
+	utime_t now = ceph_clock_now();
+	if (now > m->stamp) {
+	  utime_t rtt = now - m->stamp;
+	  i->second.rtt_hist.add(rtt.to_nsec() / 1000);
+	  logger->tinc(l_osd_hb_rtt, rtt);
+	}
 	if (m->get_connection() == i->second.con_back) {
+	  i->second.phi_back.heartbeat(now);
 	  dout(25) << "handle_osd_ping got reply from osd." << from
 		   << " first_tx " << i->second.first_tx
 		   << " last_tx " << i->second.last_tx
@@ -4687,6 +4867,7 @@ void OSD::handle_osd_ping(MOSDPing *m)
 	  if (i->second.con_front == NULL)
 	    i->second.last_rx_front = m->stamp;
 	} else if (m->get_connection() == i->second.con_front) {
+	  i->second.phi_front.heartbeat(now);
 	  dout(25) << "handle_osd_ping got reply from osd." << from
 		   << " first_tx " << i->second.first_tx
 		   << " last_tx " << i->second.last_tx
@@ -4769,6 +4950,12 @@ void OSD::heartbeat_check()
   // check for heartbeat replies (move me elsewhere?)
   utime_t cutoff = now;
   cutoff -= cct->_conf->osd_heartbeat_grace;
+  double phi_threshold = cct->_conf->get_val<double>(
+    "osd_heartbeat_phi_threshold");
+  uint64_t phi_min_samples = cct->_conf->get_val<uint64_t>(
+    "osd_heartbeat_phi_min_samples");
+  utime_t phi_cutoff = now;
+  phi_cutoff -= cct->_conf->get_val<int64_t>("osd_heartbeat_phi_grace_max");
   for (map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin();
        p != heartbeat_peers.end();
        ++p) {
@@ -4785,7 +4972,39 @@ void OSD::heartbeat_check()
 	     << " last_rx_back " << p->second.last_rx_back
 	     << " last_rx_front " << p->second.last_rx_front
 	     << dendl;
-    if (p->second.is_unhealthy(cutoff)) {
+    bool unhealthy = p->second.is_unhealthy(cutoff);
+    if (phi_threshold > 0 && p->second.has_phi(phi_min_samples)) {
+      // phi decides instead of the fixed grace, which may report a peer
+      // early or not at all; osd_heartbeat_phi_grace_max bounds how long
+      // a silent peer goes unreported.  the monitor still waits for its
+      // own grace since the last reply before marking the peer down.
+      double phi = p->second.get_phi(now, phi_min_samples);
+      if (phi > phi_threshold) {
+	derr << "heartbeat_check: osd." << p->first << " suspected, phi "
+	     << phi << " > " << phi_threshold << " since back "
+	     << p->second.last_rx_back << " front " << p->second.last_rx_front
+	     << dendl;
+	if (!unhealthy &&
+	    !failure_queue.count(p->first) && !failure_pending.count(p->first))
+	  logger->inc(l_osd_hb_phi_fail);
+      } else if (p->second.is_unhealthy(phi_cutoff)) {
+	derr << "heartbeat_check: no reply from osd." << p->first
+	     << " since back " << p->second.last_rx_back
+	     << " front " << p->second.last_rx_front
+	     << " (phi " << phi << ", cutoff " << phi_cutoff << ")" << dendl;
+      } else {
+	if (unhealthy) {
+	  dout(10) << "heartbeat_check: osd." << p->first
+		   << " past grace but phi " << phi << " <= " << phi_threshold
+		   << ", not reporting" << dendl;
+	}
+	continue;
+      }
+      failure_queue[p->first] = std::min(p->second.last_rx_back,
+					 p->second.last_rx_front);
+      continue;
+    }
+    if (unhealthy) {
       if (p->second.last_rx_back == utime_t() ||
 	  p->second.last_rx_front == utime_t()) {
 	derr << "heartbeat_check: no reply from " << p->second.con_front->get_peer_addr().get_sockaddr()
@@ -4805,6 +5024,33 @@ void OSD::heartbeat_check()
   }
 }
 
+void OSD::dump_heartbeat_peers(Formatter *f)
+{
+  Mutex::Locker l(heartbeat_lock);
+  utime_t now = ceph_clock_now();
+  uint64_t phi_min_samples = cct->_conf->get_val<uint64_t>(
+    "osd_heartbeat_phi_min_samples");
+  f->open_array_section("heartbeat_peers");
+  for (auto& p : heartbeat_peers) {
+    f->open_object_section("peer");
+    f->dump_int("osd", p.first);
+    f->dump_stream("first_tx") << p.second.first_tx;
+    f->dump_stream("last_tx") << p.second.last_tx;
+    f->dump_stream("last_rx_back") << p.second.last_rx_back;
+    f->dump_stream("last_rx_front") << p.second.last_rx_front;
+    f->dump_float("phi", p.second.get_phi(now, phi_min_samples));
+    f->dump_unsigned("phi_samples", std::min(
+		       p.second.phi_back.num_samples(),
+		       p.second.con_front ? p.second.phi_front.num_samples()
+		       : p.second.phi_back.num_samples()));
+    f->open_object_section("rtt_usec");
+    p.second.rtt_hist.dump(f);
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section();
+}
+
 void OSD::heartbeat()
 {
   dout(30) << "heartbeat" << dendl;
@@ -4974,6 +5220,7 @@ void OSD::tick_without_osd_lock()
       sched_scrub();
     }
     service.promote_throttle_recalibrate();
+    service.hot_spot_decay();
     resume_creating_pg();
     bool need_send_beacon = false;
     const auto now = ceph::coarse_mono_clock::now();
@@ -6608,6 +6855,21 @@ void OSD::ms_fast_preprocess(Message *m)
   }
 }
 
+bool OSD::ms_get_rx_buffer(Connection *con, const ceph_msg_header& header,
+			   bufferlist *bl)
+{
+  // client and replica writes, whose data goes on to the store
+  int type = le16_to_cpu(header.type);
+  if (type != CEPH_MSG_OSD_OP && type != MSG_OSD_REPOP)
+    return false;
+  uint64_t min_bytes = service.osd_op_rx_buffer_min_bytes;
+  unsigned len = le32_to_cpu(header.data_len);
+  if (!min_bytes || len < min_bytes)
+    return false;
+  bl->push_back(service.rx_buffer_pool->get(len, le32_to_cpu(header.data_off)));
+  return true;
+}
+
 bool OSD::ms_get_authorizer(int dest_type, AuthAuthorizer **authorizer, bool force_new)
 {
   dout(10) << "OSD::ms_get_authorizer type=" << ceph_entity_type_name(dest_type) << dendl;
@@ -7072,6 +7334,21 @@ MPGStats* OSD::collect_pg_stats()
   utime_t had_for = ceph_clock_now() - had_map_since;
   osd_stat_t cur_stat = service.get_osd_stat();
   cur_stat.os_perf_stat = store->get_cur_stats();
+  if (cct->_conf->get_val<bool>("osd_op_queue_mclock_adaptive")) {
+    // piggyback on the periodic store stats sample
+    double prev = mclock_bg_scale.get();
+    double scale = mclock_bg_scale.update(
+      cur_stat.os_perf_stat.os_commit_latency_ns / 1000000000.0,
+      cct->_conf->get_val<double>(
+	"osd_op_queue_mclock_adaptive_target_latency"),
+      cct->_conf->get_val<double>("osd_op_queue_mclock_adaptive_min_scale"));
+    if (scale != prev) {
+      dout(10) << __func__ << " commit latency "
+	       << cur_stat.os_perf_stat.os_commit_latency_ns
+	       << "ns, mclock background scale " << prev << " -> " << scale
+	       << dendl;
+    }
+  }
 
   auto m = new MPGStats(monc->get_fsid(), osdmap->get_epoch(), had_for);
   m->osd_stat = cur_stat;
@@ -7389,14 +7666,27 @@ void OSD::handle_osd_map(MOSDMap *m)
 
       OSDMap *o = new OSDMap;
       if (e > 1) {
-	bufferlist obl;
-        bool got = get_map_bl(e - 1, obl);
-	if (!got) {
-	  auto p = added_maps_bl.find(e - 1);
-	  assert(p != added_maps_bl.end());
-	  obl = p->second;
+	// build on the previous epoch's map rather than decoding it again;
+	// this also leaves unchanged parts shared between the two epochs
+	OSDMapRef prev;
+	auto q = added_maps.find(e - 1);
+	if (q != added_maps.end()) {
+	  prev = q->second;
+	} else {
+	  prev = service.try_get_map(e - 1);
+	}
+	if (prev) {
+	  o->deepish_copy_from(*prev);
+	} else {
+	  bufferlist obl;
+	  bool got = get_map_bl(e - 1, obl);
+	  if (!got) {
+	    auto p = added_maps_bl.find(e - 1);
+	    assert(p != added_maps_bl.end());
+	    obl = p->second;
+	  }
+	  o->decode(obl);
 	}
-	o->decode(obl);
       }
 
       OSDMap::Incremental inc;
@@ -9720,15 +10010,29 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
   assert(sdata);
   // peek at spg_t
   sdata->sdata_op_ordering_lock.Lock();
+  if (run_to_completion) {
+    sdata->_drain_inbox(osd->op_prio_cutoff);
+  }
   if (sdata->pqueue->empty()) {
     sdata->sdata_lock.Lock();
     if (!sdata->stop_waiting) {
       dout(20) << __func__ << " empty q, waiting" << dendl;
       osd->cct->get_heartbeat_map()->clear_timeout(hb);
       sdata->sdata_op_ordering_lock.Unlock();
+      if (run_to_completion && !sdata->inbox.prepare_to_sleep()) {
+	// something arrived since we drained
+	sdata->sdata_lock.Unlock();
+	return;
+      }
       sdata->sdata_cond.Wait(sdata->sdata_lock);
+      if (run_to_completion) {
+	sdata->inbox.woken();
+      }
       sdata->sdata_lock.Unlock();
       sdata->sdata_op_ordering_lock.Lock();
+      if (run_to_completion) {
+	sdata->_drain_inbox(osd->op_prio_cutoff);
+      }
       if (sdata->pqueue->empty()) {
 	sdata->sdata_op_ordering_lock.Unlock();
 	return;
@@ -9932,17 +10236,19 @@ void OSD::ShardedOpWQ::_enqueue(OpQueueItem&& item) {
 
   ShardData* sdata = shard_list[shard_index];
   assert (NULL != sdata);
-  unsigned priority = item.get_priority();
-  unsigned cost = item.get_cost();
-  sdata->sdata_op_ordering_lock.Lock();
-
   dout(20) << __func__ << " " << item << dendl;
-  if (priority >= osd->op_prio_cutoff)
-    sdata->pqueue->enqueue_strict(
-      item.get_owner(), priority, std::move(item));
-  else
-    sdata->pqueue->enqueue(
-      item.get_owner(), priority, cost, std::move(item));
+  if (run_to_completion) {
+    // hand it to the shard thread without contending on its locks
+    if (sdata->inbox.push(std::move(item))) {
+      sdata->sdata_lock.Lock();
+      sdata->sdata_cond.SignalOne();
+      sdata->sdata_lock.Unlock();
+    }
+    return;
+  }
+
+  sdata->sdata_op_ordering_lock.Lock();
+  sdata->_enqueue(std::move(item), osd->op_prio_cutoff);
   sdata->sdata_op_ordering_lock.Unlock();
 
   sdata->sdata_lock.Lock();
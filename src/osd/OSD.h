@@ -57,6 +57,10 @@
 #include "common/PrioritizedQueue.h"
 #include "osd/mClockOpClassQueue.h"
 #include "osd/mClockClientQueue.h"
+#include "osd/PhiAccrualDetector.h"
+#include "osd/HotSpotTracker.h"
+#include "osd/RxBufferPool.h"
+#include "osd/ShardInbox.h"
 #include "messages/MOSDOp.h"
 #include "common/EventTrace.h"
 
@@ -78,6 +82,8 @@ enum {
   l_osd_op_r_lat_outb_hist,
   l_osd_op_r_process_lat,
   l_osd_op_r_prepare_lat,
+  l_osd_op_r_fast,
+  l_osd_op_r_slow,
   l_osd_op_w,
   l_osd_op_w_inb,
   l_osd_op_w_lat,
@@ -107,6 +113,8 @@ enum {
   l_osd_sop_push,
   l_osd_sop_push_inb,
   l_osd_sop_push_lat,
+  l_osd_repop_commit_lat,
+  l_osd_repop_commit_lat_hist,
 
   l_osd_pull,
   l_osd_push,
@@ -128,6 +136,8 @@ enum {
   l_osd_pg_stray,
   l_osd_pg_removing,
   l_osd_hb_to,
+  l_osd_hb_rtt,
+  l_osd_hb_phi_fail,
   l_osd_map,
   l_osd_mape,
   l_osd_mape_dup,
@@ -138,6 +148,7 @@ enum {
   l_osd_map_cache_miss,
   l_osd_map_cache_miss_low,
   l_osd_map_cache_miss_low_avg,
+  l_osd_map_cache_rebuild,
   l_osd_map_bl_cache_hit,
   l_osd_map_bl_cache_miss,
 
@@ -176,6 +187,8 @@ enum {
   l_osd_pg_info,
   l_osd_pg_fastinfo,
   l_osd_pg_biginfo,
+  l_osd_pg_fastinfo_embedded,
+  l_osd_pg_meta_keys,
 
   l_osd_last,
 };
@@ -263,6 +276,10 @@ public:
 
   md_config_cacher_t<uint64_t> osd_max_object_size;
   md_config_cacher_t<bool> osd_skip_data_digest;
+  md_config_cacher_t<bool> osd_pg_log_embed_fastinfo;
+  md_config_cacher_t<uint64_t> osd_op_fast_read_max_bytes;
+  md_config_cacher_t<uint64_t> osd_op_rx_buffer_min_bytes;
+  std::shared_ptr<RxBufferPool> rx_buffer_pool;
 
   void enqueue_back(OpQueueItem&& qi);
   void enqueue_front(OpQueueItem&& qi);
@@ -722,6 +739,13 @@ public:
   }
   void promote_throttle_recalibrate();
 
+  // -- hot objects and clients --
+  HotSpotTracker hot_spots;
+private:
+  utime_t last_hot_spot_decay;
+public:
+  void hot_spot_decay();
+
   // -- Objecter, for tiering reads/writes from/to other OSDs --
   Objecter *objecter;
   int m_objecter_finishers;
@@ -867,6 +891,7 @@ public:
   map<int64_t,int> deleted_pool_pg_nums;
 
   OSDMapRef try_get_map(epoch_t e);
+  OSDMap *_rebuild_map(epoch_t e);
   OSDMapRef get_map(epoch_t e) {
     OSDMapRef ret(try_get_map(e));
     assert(ret);
@@ -894,7 +919,11 @@ public:
     return _add_map_inc_bl(e, bl);
   }
   void _add_map_inc_bl(epoch_t e, bufferlist& bl);
-  bool get_inc_map_bl(epoch_t e, bufferlist& bl);
+  bool get_inc_map_bl(epoch_t e, bufferlist& bl) {
+    Mutex::Locker l(map_cache_lock);
+    return _get_inc_map_bl(e, bl);
+  }
+  bool _get_inc_map_bl(epoch_t e, bufferlist& bl);
 
   /// get last pg_num before a pool was deleted (if any)
   int get_deleted_pool_pg_num(int64_t pool);
@@ -1393,6 +1422,23 @@ private:
     utime_t last_rx_front;  ///< last time we got a ping reply on the front side
     utime_t last_rx_back;   ///< last time we got a ping reply on the back side
     epoch_t epoch;      ///< most recent epoch we wanted this peer
+    PhiAccrualDetector phi_front;  ///< reply arrivals on the front side
+    PhiAccrualDetector phi_back;   ///< reply arrivals on the back side
+    pow2_hist_t rtt_hist;          ///< ping round trip times (usec)
+
+    /// whether both sides have enough history for phi to mean anything
+    bool has_phi(size_t min_samples) const {
+      return phi_back.num_samples() >= min_samples &&
+	(!con_front || phi_front.num_samples() >= min_samples);
+    }
+    /// suspicion level of the worse side, once both have enough history
+    double get_phi(utime_t now, size_t min_samples) const {
+      if (!has_phi(min_samples)) {
+	return 0;
+      }
+      return std::max(phi_back.phi(now),
+		      con_front ? phi_front.phi(now) : 0.0);
+    }
 
     bool is_unhealthy(utime_t cutoff) const {
       return
@@ -1443,6 +1489,7 @@ private:
   }
   void heartbeat();
   void heartbeat_check();
+  void dump_heartbeat_peers(Formatter *f);
   void heartbeat_entry();
   void need_heartbeat_peer_update();
 
@@ -1527,6 +1574,10 @@ private:
 
   const io_queue op_queue;
   const unsigned int op_prio_cutoff;
+  /// one pinned thread per op shard; see osd_op_shard_run_to_completion
+  const bool op_run_to_completion;
+  /// shared by the mclock queues; see osd_op_queue_mclock_adaptive
+  ceph::mclock::BackgroundScale mclock_bg_scale;
 
   /*
    * The ordered op delivery chain is:
@@ -1541,6 +1592,13 @@ private:
    *
    * Multiple worker threads can operate on each shard.
    *
+   * In run-to-completion mode each shard has exactly one thread (optionally
+   * pinned to a cpu), which owns the shard's pgs.  Other threads do not
+   * touch pqueue to hand it work; they push onto the shard's lock-free
+   * inbox, which the shard thread drains into pqueue itself, and only
+   * take sdata_lock to wake it if it is sleeping.  Items requeued at the
+   * front (wake_pg_waiters etc) still go straight to pqueue.
+   *
    * Under normal circumstances, num_running == to_process.size().  There are
    * two times when that is not true: (1) when waiting_for_pg == true and
    * to_process is accumulating requests that are waiting for the pg to be
@@ -1587,6 +1645,28 @@ private:
 
       bool stop_waiting = false;
 
+      /// run-to-completion mode: items queued by other threads
+      ShardInbox<OpQueueItem> inbox;
+
+      void _enqueue(OpQueueItem&& item, unsigned cutoff) {
+	unsigned priority = item.get_priority();
+	unsigned cost = item.get_cost();
+	if (priority >= cutoff)
+	  pqueue->enqueue_strict(
+	    item.get_owner(), priority, std::move(item));
+	else
+	  pqueue->enqueue(
+	    item.get_owner(), priority, cost, std::move(item));
+      }
+
+      /// move inbox items into pqueue, oldest first; must hold
+      /// sdata_op_ordering_lock
+      void _drain_inbox(unsigned cutoff) {
+	inbox.drain([this, cutoff](OpQueueItem&& item) {
+	    _enqueue(std::move(item), cutoff);
+	  });
+      }
+
       void _enqueue_front(OpQueueItem&& item, unsigned cutoff) {
 	unsigned priority = item.get_priority();
 	unsigned cost = item.get_cost();
@@ -1603,7 +1683,8 @@ private:
       ShardData(
 	string lock_name, string ordering_lock,
 	uint64_t max_tok_per_prio, uint64_t min_cost, CephContext *cct,
-	io_queue opqueue)
+	io_queue opqueue,
+	const ceph::mclock::BackgroundScale *mclock_bg_scale)
 	: sdata_lock(lock_name.c_str(), false, true, false, cct),
 	  sdata_op_ordering_lock(ordering_lock.c_str(), false, true,
 				 false, cct) {
@@ -1616,9 +1697,11 @@ private:
 	    PrioritizedQueue<OpQueueItem,uint64_t>>(
 		max_tok_per_prio, min_cost);
 	} else if (opqueue == io_queue::mclock_opclass) {
-	  pqueue = std::make_unique<ceph::mClockOpClassQueue>(cct);
+	  pqueue = std::make_unique<ceph::mClockOpClassQueue>(
+	    cct, mclock_bg_scale);
 	} else if (opqueue == io_queue::mclock_client) {
-	  pqueue = std::make_unique<ceph::mClockClientQueue>(cct);
+	  pqueue = std::make_unique<ceph::mClockClientQueue>(
+	    cct, mclock_bg_scale);
 	}
       }
     }; // struct ShardData
@@ -1626,16 +1709,19 @@ private:
     vector<ShardData*> shard_list;
     OSD *osd;
     uint32_t num_shards;
+    bool run_to_completion;
 
   public:
     ShardedOpWQ(uint32_t pnum_shards,
+		bool rtc,
 		OSD *o,
 		time_t ti,
 		time_t si,
 		ShardedThreadPool* tp)
       : ShardedThreadPool::ShardedWQ<OpQueueItem>(ti, si, tp),
         osd(o),
-        num_shards(pnum_shards) {
+        num_shards(pnum_shards),
+        run_to_completion(rtc) {
       for (uint32_t i = 0; i < num_shards; i++) {
 	char lock_name[32] = {0};
 	snprintf(lock_name, sizeof(lock_name), "%s.%d", "OSD:ShardedOpWQ:", i);
@@ -1645,7 +1731,8 @@ private:
 	ShardData* one_shard = new ShardData(
 	  lock_name, order_lock,
 	  osd->cct->_conf->osd_op_pq_max_tokens_per_priority, 
-	  osd->cct->_conf->osd_op_pq_min_cost, osd->cct, osd->op_queue);
+	  osd->cct->_conf->osd_op_pq_min_cost, osd->cct, osd->op_queue,
+	  &osd->mclock_bg_scale);
 	shard_list.push_back(one_shard);
       }
     }
@@ -1709,6 +1796,15 @@ private:
 	sdata->sdata_op_ordering_lock.Lock();
 	f->open_object_section(queue_name);
 	sdata->pqueue->dump(f);
+	if (run_to_completion) {
+	  // not yet drained into pqueue; the shard thread only drains with
+	  // sdata_op_ordering_lock held
+	  f->open_array_section("inbox");
+	  sdata->inbox.for_each([f](const OpQueueItem& item) {
+	      f->dump_stream("item") << item;
+	    });
+	  f->close_section();
+	}
 	f->close_section();
 	sdata->sdata_op_ordering_lock.Unlock();
       }
@@ -1747,7 +1843,7 @@ private:
       auto &&sdata = shard_list[shard_index];
       assert(sdata);
       Mutex::Locker l(sdata->sdata_op_ordering_lock);
-      return sdata->pqueue->empty();
+      return sdata->pqueue->empty() && sdata->inbox.empty();
     }
   } op_shardedwq;
 
@@ -2126,6 +2222,8 @@ private:
   }
   void ms_fast_dispatch(Message *m) override;
   void ms_fast_preprocess(Message *m) override;
+  bool ms_get_rx_buffer(Connection *con, const ceph_msg_header& header,
+			bufferlist *bl) override;
   bool ms_dispatch(Message *m) override;
   bool ms_get_authorizer(int dest_type, AuthAuthorizer **authorizer, bool force_new) override;
   bool ms_verify_authorizer(Connection *con, int peer_type,
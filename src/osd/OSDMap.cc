@@ -1120,7 +1120,7 @@ void OSDMap::Incremental::generate_test_instances(list<Incremental*>& o)
 void OSDMap::set_epoch(epoch_t e)
 {
   epoch = e;
-  for (auto &pool : pools)
+  for (auto &pool : _get_pools_mutable())
     pool.second.last_change = e;
 }
 
@@ -1369,7 +1369,7 @@ uint64_t OSDMap::get_features(int entity_type, uint64_t *pmask) const
     features |= CEPH_FEATUREMASK_OSDMAP_PG_UPMAP;
   mask |= CEPH_FEATUREMASK_OSDMAP_PG_UPMAP;
 
-  for (auto &pool: pools) {
+  for (auto &pool: *pools) {
     if (pool.second.has_flag(pg_pool_t::FLAG_HASHPSPOOL)) {
       features |= CEPH_FEATURE_OSDHASHPSPOOL;
     }
@@ -1517,16 +1517,30 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
     n->osd_addrs = o->osd_addrs;
   }
 
-  // does crush match?
-  bufferlist oc, nc;
-  encode(*o->crush, oc, CEPH_FEATURES_SUPPORTED_DEFAULT);
-  encode(*n->crush, nc, CEPH_FEATURES_SUPPORTED_DEFAULT);
-  if (oc.contents_equal(nc)) {
-    n->crush = o->crush;
+  // does crush match?  (maps built from an incremental may already share)
+  if (o->crush != n->crush) {
+    bufferlist oc, nc;
+    encode(*o->crush, oc, CEPH_FEATURES_SUPPORTED_DEFAULT);
+    encode(*n->crush, nc, CEPH_FEATURES_SUPPORTED_DEFAULT);
+    if (oc.contents_equal(nc)) {
+      n->crush = o->crush;
+    }
+  }
+
+  // do pools match?
+  if (o->pools != n->pools &&
+      o->pools->size() == n->pools->size()) {
+    bufferlist op, np;
+    encode(*o->pools, op, CEPH_FEATURES_SUPPORTED_DEFAULT);
+    encode(*n->pools, np, CEPH_FEATURES_SUPPORTED_DEFAULT);
+    if (op.contents_equal(np)) {
+      n->pools = o->pools;
+    }
   }
 
   // does pg_temp match?
-  if (*o->pg_temp == *n->pg_temp)
+  if (o->pg_temp != n->pg_temp &&
+      *o->pg_temp == *n->pg_temp)
     n->pg_temp = o->pg_temp;
 
   // does primary_temp match?
@@ -1535,6 +1549,11 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
       n->primary_temp = o->primary_temp;
   }
 
+  // does primary_affinity match?
+  if (o->osd_primary_affinity && n->osd_primary_affinity &&
+      *o->osd_primary_affinity == *n->osd_primary_affinity)
+    n->osd_primary_affinity = o->osd_primary_affinity;
+
   // do uuids match?
   if (o->osd_uuid->size() == n->osd_uuid->size() &&
       *o->osd_uuid == *n->osd_uuid)
@@ -1790,8 +1809,9 @@ int OSDMap::apply_incremental(const Incremental &inc)
     pool_max = inc.new_pool_max;
 
   for (const auto &pool : inc.new_pools) {
-    pools[pool.first] = pool.second;
-    pools[pool.first].last_change = epoch;
+    auto& pi = _get_pools_mutable()[pool.first];
+    pi = pool.second;
+    pi.last_change = epoch;
   }
 
   new_removed_snaps = inc.new_removed_snaps;
@@ -1824,7 +1844,7 @@ int OSDMap::apply_incremental(const Incremental &inc)
   }
   
   for (const auto &pool : inc.old_pools) {
-    pools.erase(pool);
+    _get_pools_mutable().erase(pool);
     name_pool.erase(pool_name[pool]);
     pool_name.erase(pool);
   }
@@ -2393,10 +2413,10 @@ void OSDMap::encode_client_old(bufferlist& bl) const
   encode(modified, bl);
 
   // for encode(pools, bl);
-  __u32 n = pools.size();
+  __u32 n = pools->size();
   encode(n, bl);
 
-  for (const auto &pool : pools) {
+  for (const auto &pool : *pools) {
     n = pool.first;
     encode(n, bl);
     encode(pool.second, bl, 0);
@@ -2458,7 +2478,7 @@ void OSDMap::encode_classic(bufferlist& bl, uint64_t features) const
   encode(created, bl);
   encode(modified, bl);
 
-  encode(pools, bl, features);
+  encode(*pools, bl, features);
   encode(pool_name, bl);
   encode(pool_max, bl);
 
@@ -2532,7 +2552,7 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
     encode(created, bl);
     encode(modified, bl);
 
-    encode(pools, bl, features);
+    encode(*pools, bl, features);
     encode(pool_name, bl);
     encode(pool_max, bl);
 
@@ -2681,11 +2701,11 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
       decode(max_pools, p);
       pool_max = max_pools;
     }
-    pools.clear();
+    pools = std::make_shared<mempool::osdmap::map<int64_t,pg_pool_t>>();
     decode(n, p);
     while (n--) {
       decode(t, p);
-      decode(pools[t], p);
+      decode((*pools)[t], p);
     }
     if (v == 4) {
       decode(n, p);
@@ -2701,13 +2721,14 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
       pool_max = n;
     }
   } else {
-    decode(pools, p);
+    pools = std::make_shared<mempool::osdmap::map<int64_t,pg_pool_t>>();
+    decode(*pools, p);
     decode(pool_name, p);
     decode(pool_max, p);
   }
   // kludge around some old bug that zeroed out pool_max (#2307)
-  if (pools.size() && pool_max < pools.rbegin()->first) {
-    pool_max = pools.rbegin()->first;
+  if (pools->size() && pool_max < pools->rbegin()->first) {
+    pool_max = pools->rbegin()->first;
   }
 
   decode(flags, p);
@@ -2741,6 +2762,7 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
   bufferlist cbl;
   decode(cbl, p);
   auto cblp = cbl.begin();
+  crush = std::make_shared<CrushWrapper>();  // may be shared with another epoch
   crush->decode(cblp);
 
   // extended
@@ -2815,7 +2837,8 @@ void OSDMap::decode(bufferlist::iterator& bl)
     decode(created, bl);
     decode(modified, bl);
 
-    decode(pools, bl);
+    pools = std::make_shared<mempool::osdmap::map<int64_t,pg_pool_t>>();
+    decode(*pools, bl);
     decode(pool_name, bl);
     decode(pool_max, bl);
 
@@ -2850,6 +2873,7 @@ void OSDMap::decode(bufferlist::iterator& bl)
     bufferlist cbl;
     decode(cbl, bl);
     auto cblp = cbl.begin();
+    crush = std::make_shared<CrushWrapper>();  // may be shared with another epoch
     crush->decode(cblp);
     if (struct_v >= 3) {
       decode(erasure_code_profiles, bl);
@@ -3017,7 +3041,7 @@ void OSDMap::dump(Formatter *f) const
 		 ceph_release_name(require_osd_release));
 
   f->open_array_section("pools");
-  for (const auto &pool : pools) {
+  for (const auto &pool : *pools) {
     std::string name("<unknown>");
     const auto &pni = pool_name.find(pool.first);
     if (pni != pool_name.end())
@@ -3235,7 +3259,7 @@ string OSDMap::get_flag_string() const
 
 void OSDMap::print_pools(ostream& out) const
 {
-  for (const auto &pool : pools) {
+  for (const auto &pool : *pools) {
     std::string name("<unknown>");
     const auto &pni = pool_name.find(pool.first);
     if (pni != pool_name.end())
@@ -3546,7 +3570,7 @@ void OSDMap::print_oneline_summary(ostream& out) const
 
 bool OSDMap::crush_rule_in_use(int rule_id) const
 {
-  for (const auto &pool : pools) {
+  for (const auto &pool : *pools) {
     if (pool.second.crush_rule == rule_id)
       return true;
   }
@@ -3556,7 +3580,7 @@ bool OSDMap::crush_rule_in_use(int rule_id) const
 int OSDMap::validate_crush_rules(CrushWrapper *newcrush,
 				 ostream *ss) const
 {
-  for (auto& i : pools) {
+  for (auto& i : *pools) {
     auto& pool = i.second;
     int ruleno = pool.get_crush_rule();
     if (!newcrush->rule_exists(ruleno)) {
@@ -3649,24 +3673,25 @@ int OSDMap::build_simple_optioned(CephContext *cct, epoch_t e, uuid_d &fsid,
     pool_names.push_back("rbd");
     for (auto &plname : pool_names) {
       int64_t pool = ++pool_max;
-      pools[pool].type = pg_pool_t::TYPE_REPLICATED;
-      pools[pool].flags = cct->_conf->osd_pool_default_flags;
+      pg_pool_t& pi = _get_pools_mutable()[pool];
+      pi.type = pg_pool_t::TYPE_REPLICATED;
+      pi.flags = cct->_conf->osd_pool_default_flags;
       if (cct->_conf->osd_pool_default_flag_hashpspool)
-	pools[pool].set_flag(pg_pool_t::FLAG_HASHPSPOOL);
+	pi.set_flag(pg_pool_t::FLAG_HASHPSPOOL);
       if (cct->_conf->osd_pool_default_flag_nodelete)
-	pools[pool].set_flag(pg_pool_t::FLAG_NODELETE);
+	pi.set_flag(pg_pool_t::FLAG_NODELETE);
       if (cct->_conf->osd_pool_default_flag_nopgchange)
-	pools[pool].set_flag(pg_pool_t::FLAG_NOPGCHANGE);
+	pi.set_flag(pg_pool_t::FLAG_NOPGCHANGE);
       if (cct->_conf->osd_pool_default_flag_nosizechange)
-	pools[pool].set_flag(pg_pool_t::FLAG_NOSIZECHANGE);
-      pools[pool].size = cct->_conf->get_val<uint64_t>("osd_pool_default_size");
-      pools[pool].min_size = cct->_conf->get_osd_pool_default_min_size();
-      pools[pool].crush_rule = default_replicated_rule;
-      pools[pool].object_hash = CEPH_STR_HASH_RJENKINS;
-      pools[pool].set_pg_num(poolbase << pg_bits);
-      pools[pool].set_pgp_num(poolbase << pgp_bits);
-      pools[pool].last_change = epoch;
-      pools[pool].application_metadata.insert(
+	pi.set_flag(pg_pool_t::FLAG_NOSIZECHANGE);
+      pi.size = cct->_conf->get_val<uint64_t>("osd_pool_default_size");
+      pi.min_size = cct->_conf->get_osd_pool_default_min_size();
+      pi.crush_rule = default_replicated_rule;
+      pi.object_hash = CEPH_STR_HASH_RJENKINS;
+      pi.set_pg_num(poolbase << pg_bits);
+      pi.set_pgp_num(poolbase << pgp_bits);
+      pi.last_change = epoch;
+      pi.application_metadata.insert(
         {pg_pool_t::APPLICATION_NAME_RBD, {}});
       pool_name[pool] = plname;
       name_pool[plname] = pool;
@@ -4093,7 +4118,7 @@ int OSDMap::calc_pg_upmaps(
 {
   set<int64_t> only_pools;
   if (only_pools_orig.empty()) {
-    for (auto& i : pools) {
+    for (auto& i : *pools) {
       only_pools.insert(i.first);
     }
   } else {
@@ -4109,7 +4134,7 @@ int OSDMap::calc_pg_upmaps(
     int total_pgs = 0;
     float osd_weight_total = 0;
     map<int,float> osd_weight;
-    for (auto& i : pools) {
+    for (auto& i : *pools) {
       if (!only_pools.empty() && !only_pools.count(i.first))
 	continue;
       for (unsigned ps = 0; ps < i.second.get_pg_num(); ++ps) {
@@ -4945,8 +4970,8 @@ void OSDMap::check_health(health_check_map_t *checks) const
   // CACHE_POOL_NO_HIT_SET
   if (g_conf->mon_warn_on_cache_pools_without_hit_sets) {
     list<string> detail;
-    for (map<int64_t, pg_pool_t>::const_iterator p = pools.begin();
-	 p != pools.end();
+    for (map<int64_t, pg_pool_t>::const_iterator p = pools->begin();
+	 p != pools->end();
 	 ++p) {
       const pg_pool_t& info = p->second;
       if (info.cache_mode_requires_hit_set() &&
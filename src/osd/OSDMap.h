@@ -526,7 +526,8 @@ private:
   mempool::osdmap::map<pg_t,mempool::osdmap::vector<int32_t>> pg_upmap; ///< remap pg
   mempool::osdmap::map<pg_t,mempool::osdmap::vector<pair<int32_t,int32_t>>> pg_upmap_items; ///< remap osds in up set
 
-  mempool::osdmap::map<int64_t,pg_pool_t> pools;
+  /// shared copy-on-write between epochs; modify via _get_pools_mutable()
+  ceph::shared_ptr< mempool::osdmap::map<int64_t,pg_pool_t> > pools;
   mempool::osdmap::map<int64_t,string> pool_name;
   mempool::osdmap::map<string,map<string,string> > erasure_code_profiles;
   mempool::osdmap::map<string,int64_t> name_pool;
@@ -566,6 +567,15 @@ private:
 
   void _calc_up_osd_features();
 
+  /// pools, unshared from any other epoch that still references them
+  mempool::osdmap::map<int64_t,pg_pool_t>& _get_pools_mutable() {
+    if (pools.use_count() > 1) {
+      pools = std::make_shared<mempool::osdmap::map<int64_t,pg_pool_t>>(
+	*pools);
+    }
+    return *pools;
+  }
+
  public:
   bool have_crc() const { return crc_defined; }
   uint32_t get_crc() const { return crc; }
@@ -585,6 +595,7 @@ private:
 	     osd_addrs(std::make_shared<addrs_s>()),
 	     pg_temp(std::make_shared<PGTempMap>()),
 	     primary_temp(std::make_shared<mempool::osdmap::map<pg_t,int32_t>>()),
+	     pools(std::make_shared<mempool::osdmap::map<int64_t,pg_pool_t>>()),
 	     osd_uuid(std::make_shared<mempool::osdmap::vector<uuid_d>>()),
 	     cluster_snapshot_epoch(0),
 	     new_blacklist_entries(false),
@@ -611,8 +622,8 @@ public:
     // NOTE: this still references shared entity_addr_t's.
     osd_addrs.reset(new addrs_s(*o.osd_addrs));
 
-    // NOTE: we do not copy crush.  note that apply_incremental will
-    // allocate a new CrushWrapper, though.
+    // NOTE: we do not copy crush or pools.  apply_incremental will
+    // allocate a new CrushWrapper, and pools are unshared on first write.
   }
 
   // map info
@@ -1154,8 +1165,8 @@ public:
     pg_to_up_acting_osds(pg, &up, &up_primary, &acting, &acting_primary);
   }
   bool pg_is_ec(pg_t pg) const {
-    auto i = pools.find(pg.pool());
-    assert(i != pools.end());
+    auto i = pools->find(pg.pool());
+    assert(i != pools->end());
     return i->second.is_erasure();
   }
   bool get_primary_shard(const pg_t& pgid, spg_t *out) const {
@@ -1203,14 +1214,14 @@ public:
     return pool_max;
   }
   const mempool::osdmap::map<int64_t,pg_pool_t>& get_pools() const {
-    return pools;
+    return *pools;
   }
   mempool::osdmap::map<int64_t,pg_pool_t>& get_pools() {
-    return pools;
+    return _get_pools_mutable();
   }
   void get_pool_ids_by_rule(int rule_id, set<int64_t> *pool_ids) const {
     assert(pool_ids);
-    for (auto &p: pools) {
+    for (auto &p: *pools) {
       if (p.second.get_crush_rule() == rule_id) {
         pool_ids->insert(p.first);
       }
@@ -1228,29 +1239,29 @@ public:
     return pool_name;
   }
   bool have_pg_pool(int64_t p) const {
-    return pools.count(p);
+    return pools->count(p);
   }
   const pg_pool_t* get_pg_pool(int64_t p) const {
-    auto i = pools.find(p);
-    if (i != pools.end())
+    auto i = pools->find(p);
+    if (i != pools->end())
       return &i->second;
     return NULL;
   }
   unsigned get_pg_size(pg_t pg) const {
-    auto p = pools.find(pg.pool());
-    assert(p != pools.end());
+    auto p = pools->find(pg.pool());
+    assert(p != pools->end());
     return p->second.get_size();
   }
   int get_pg_type(pg_t pg) const {
-    auto p = pools.find(pg.pool());
-    assert(p != pools.end());
+    auto p = pools->find(pg.pool());
+    assert(p != pools->end());
     return p->second.get_type();
   }
 
 
   pg_t raw_pg_to_pg(pg_t pg) const {
-    auto p = pools.find(pg.pool());
-    assert(p != pools.end());
+    auto p = pools->find(pg.pool());
+    assert(p != pools->end());
     return p->second.raw_pg_to_pg(pg);
   }
 
@@ -3418,6 +3418,18 @@ int PG::_prepare_write_info(CephContext* cct,
   return 0;
 }
 
+bool PG::_embed_fast_info(map<string,bufferlist> *km, eversion_t last_update)
+{
+  auto head = km->find(last_update.get_key_name());
+  auto fi = km->find(fastinfo_key);
+  if (head == km->end() || fi == km->end()) {
+    return false;
+  }
+  head->second.claim_append(fi->second);
+  km->erase(fi);
+  return true;
+}
+
 void PG::_create(ObjectStore::Transaction& t, spg_t pgid, int bits)
 {
   coll_t coll(pgid);
@@ -3542,8 +3554,21 @@ void PG::write_if_dirty(ObjectStore::Transaction& t)
   if (dirty_big_info || dirty_info)
     prepare_write_info(&km);
   pg_log.write_log_and_missing(t, &km, coll, pgmeta_oid, pool.info.require_rollback());
-  if (!km.empty())
+  if (osd->osd_pg_log_embed_fastinfo &&
+      km.count(info.last_update.get_key_name())) {
+    // (re)writing the entry that may carry our latest info; make sure
+    // the info goes with it, or into its own key
+    if (!km.count(fastinfo_key) && !km.count(info_key)) {
+      prepare_write_info(&km);
+    }
+    if (_embed_fast_info(&km, info.last_update)) {
+      osd->logger->inc(l_osd_pg_fastinfo_embedded);
+    }
+  }
+  if (!km.empty()) {
     t.omap_setkeys(coll, pgmeta_oid, km);
+    osd->logger->inc(l_osd_pg_meta_keys, km.size());
+  }
 }
 
 void PG::trim_log()
@@ -3744,6 +3769,27 @@ int PG::read_info(
     decode(fast, p);
     fast.try_apply_to(&info);
   }
+
+  // log entries newer than that may carry a fastinfo after their
+  // checksummed body (osd_pg_log_embed_fastinfo)
+  auto it = store->get_omap_iterator(ch, pgmeta_oid);
+  if (it) {
+    for (it->lower_bound(info.last_update.get_key_name());
+	 it->valid() && isdigit(it->key()[0]);
+	 it->next(false)) {
+      bufferlist bl = it->value();
+      p = bl.begin();
+      bufferlist ebl;
+      __u32 crc;
+      decode(ebl, p);
+      decode(crc, p);
+      if (!p.end()) {
+	pg_fast_info_t fast;
+	decode(fast, p);
+	fast.try_apply_to(&info);
+      }
+    }
+  }
   return 0;
 }
 
@@ -2889,6 +2889,10 @@ public:
     bool dirty_epoch,
     bool try_fast_info,
     PerfCounters *logger = nullptr);
+  /// move a fastinfo update in km after the checksummed body of the log
+  /// entry for last_update, if km also writes that entry
+  static bool _embed_fast_info(map<string,bufferlist> *km,
+			       eversion_t last_update);
 protected:
   void write_if_dirty(ObjectStore::Transaction& t);
 
@@ -38,8 +38,7 @@ void PGLog::IndexedLog::split_out_child(
 {
   unindex();
   *target = IndexedLog(pg_log_t::split_out_child(child_pgid, split_bits));
-  index();
-  target->index();
+  index(PGLOG_INDEXED_OBJECTS);
   reset_rollback_info_trimmed_to_riter();
 }
 
@@ -91,13 +90,19 @@ void PGLog::IndexedLog::trim(
       }
     }
 
-    if (rollback_info_trimmed_to_riter == log.rend() ||
-	e.version == rollback_info_trimmed_to_riter->version) {
-      log.pop_front();
-      rollback_info_trimmed_to_riter = log.rend();
+    bool reset_riter = rollback_info_trimmed_to_riter == log.rend() ||
+      e.version == rollback_info_trimmed_to_riter->version;
+    if (spare.size() < max_spare) {
+      // park it for add() to reuse; drop anything that pins buffers
+      spare.splice(spare.end(), log, log.begin());
+      spare.back().snaps.clear();
+      spare.back().mod_desc = ObjectModDesc();
     } else {
       log.pop_front();
     }
+    if (reset_riter) {
+      rollback_info_trimmed_to_riter = log.rend();
+    }
   }
 
   while (!dups.empty()) {
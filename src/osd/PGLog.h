@@ -79,10 +79,11 @@ public:
    * plus some methods to manipulate it all.
    */
   struct IndexedLog : public pg_log_t {
-    mutable ceph::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
-    mutable ceph::unordered_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
-    mutable ceph::unordered_multimap<osd_reqid_t,pg_log_entry_t*> extra_caller_ops;
-    mutable ceph::unordered_map<osd_reqid_t,pg_log_dup_t*> dup_index;
+    mutable mempool::osd_pglog::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
+    // reqid indexes are only built once someone asks (i.e., on the primary)
+    mutable mempool::osd_pglog::unordered_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
+    mutable mempool::osd_pglog::unordered_multimap<osd_reqid_t,pg_log_entry_t*> extra_caller_ops;
+    mutable mempool::osd_pglog::unordered_map<osd_reqid_t,pg_log_dup_t*> dup_index;
 
     // recovery pointers
     list<pg_log_entry_t>::iterator complete_to; // not inclusive of referenced item
@@ -101,6 +102,14 @@ public:
     mempool::osd_pglog::list<pg_log_entry_t>::reverse_iterator
       rollback_info_trimmed_to_riter;
 
+    /**
+     * entries trimmed off the tail, kept for add() to reuse so that a
+     * steady stream of writes does not allocate a list node (plus the
+     * entry's name strings and reqid vector) per op
+     */
+    mempool::osd_pglog::list<pg_log_entry_t> spare;
+    static constexpr size_t max_spare = 128;
+
     template <typename F>
     void advance_can_rollback_to(eversion_t to, F &&f) {
       if (to > can_rollback_to)
@@ -144,7 +153,7 @@ public:
       rollback_info_trimmed_to_riter(log.rbegin())
     {
       reset_rollback_info_trimmed_to_riter();
-      index();
+      index(PGLOG_INDEXED_OBJECTS);
     }
 
     IndexedLog(const IndexedLog &rhs) :
@@ -185,7 +194,7 @@ public:
 
     mempool::osd_pglog::list<pg_log_entry_t> rewind_from_head(eversion_t newhead) {
       auto divergent = pg_log_t::rewind_from_head(newhead);
-      index();
+      reindex();
       reset_rollback_info_trimmed_to_riter();
       return divergent;
     }
@@ -214,7 +223,6 @@ public:
       *this = IndexedLog(o);
 
       skip_can_rollback_to_to_head();
-      index();
     }
 
     void split_out_child(
@@ -270,11 +278,10 @@ public:
       assert(version);
       assert(user_version);
       assert(return_code);
-      ceph::unordered_map<osd_reqid_t,pg_log_entry_t*>::const_iterator p;
       if (!(indexed_data & PGLOG_INDEXED_CALLER_OPS)) {
         index_caller_ops();
       }
-      p = caller_ops.find(r);
+      auto p = caller_ops.find(r);
       if (p != caller_ops.end()) {
 	*version = p->second->version;
 	*user_version = p->second->user_version;
@@ -287,15 +294,15 @@ public:
       if (!(indexed_data & PGLOG_INDEXED_EXTRA_CALLER_OPS)) {
         index_extra_caller_ops();
       }
-      p = extra_caller_ops.find(r);
-      if (p != extra_caller_ops.end()) {
-	for (auto i = p->second->extra_reqids.begin();
-	     i != p->second->extra_reqids.end();
+      auto ep = extra_caller_ops.find(r);
+      if (ep != extra_caller_ops.end()) {
+	for (auto i = ep->second->extra_reqids.begin();
+	     i != ep->second->extra_reqids.end();
 	     ++i) {
 	  if (i->first == r) {
-	    *version = p->second->version;
+	    *version = ep->second->version;
 	    *user_version = i->second;
-	    *return_code = p->second->return_code;
+	    *return_code = ep->second->return_code;
 	    return true;
 	  }
 	}
@@ -413,6 +420,13 @@ public:
       index(PGLOG_INDEXED_DUPS);
     }
 
+    /// drop all indexes and rebuild the object index; the rest are rebuilt
+    /// lazily on the next lookup
+    void reindex() {
+      unindex();
+      index(PGLOG_INDEXED_OBJECTS);
+    }
+
     void index(pg_log_entry_t& e) {
       if ((indexed_data & PGLOG_INDEXED_OBJECTS) && e.object_is_indexed()) {
         if (objects.count(e.soid) == 0 ||
@@ -461,8 +475,7 @@ public:
         for (auto j = e.extra_reqids.begin();
              j != e.extra_reqids.end();
              ++j) {
-          for (ceph::unordered_multimap<osd_reqid_t,pg_log_entry_t*>::iterator k =
-		 extra_caller_ops.find(j->first);
+          for (auto k = extra_caller_ops.find(j->first);
                k != extra_caller_ops.end() && k->first == j->first;
                ++k) {
             if (k->second == &e) {
@@ -498,8 +511,13 @@ public:
       // make sure our buffers don't pin bigger buffers
       e.mod_desc.trim_bl();
 
-      // add to log
-      log.push_back(e);
+      // add to log, reusing a trimmed entry if we have one
+      if (spare.empty()) {
+	log.push_back(e);
+      } else {
+	log.splice(log.end(), spare, spare.begin());
+	log.back() = e;
+      }
 
       // riter previously pointed to the previous entry
       if (rollback_info_trimmed_to_riter == log.rbegin())
@@ -0,0 +1,99 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_PHIACCRUALDETECTOR_H
+#define CEPH_OSD_PHIACCRUALDETECTOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+#include "include/utime.h"
+
+/**
+ * Phi accrual failure detector.
+ *
+ * Remembers the intervals between a peer's recent heartbeats and turns
+ * the time since the last one into a suspicion level
+ *
+ *   phi = -log10(P(interval > elapsed))
+ *
+ * assuming the intervals are normally distributed.  phi 1 means a 10%
+ * chance the peer is merely late, phi 3 a 0.1% chance, and so on, so a
+ * single threshold adapts to both fast and jittery peers.
+ */
+class PhiAccrualDetector {
+  std::deque<double> intervals;  ///< seconds, oldest first
+  size_t max_samples;
+  double sum = 0;
+  double sum_sq = 0;
+  utime_t last;                  ///< time of the last heartbeat
+
+public:
+  explicit PhiAccrualDetector(size_t max_samples = 100)
+    : max_samples(max_samples) {}
+
+  void reset() {
+    intervals.clear();
+    sum = sum_sq = 0;
+    last = utime_t();
+  }
+
+  size_t num_samples() const {
+    return intervals.size();
+  }
+
+  utime_t get_last() const {
+    return last;
+  }
+
+  /// note a heartbeat received at @now
+  void heartbeat(utime_t now) {
+    if (now <= last) {
+      return;
+    }
+    if (last != utime_t()) {
+      double i = now - last;
+      intervals.push_back(i);
+      sum += i;
+      sum_sq += i * i;
+      if (intervals.size() > max_samples) {
+	double o = intervals.front();
+	intervals.pop_front();
+	sum -= o;
+	sum_sq -= o * o;
+      }
+    }
+    last = now;
+  }
+
+  /// suspicion level at @now; 0 until a first interval is known
+  double phi(utime_t now) const {
+    if (intervals.empty() || now <= last) {
+      return 0;
+    }
+    double n = intervals.size();
+    double mean = sum / n;
+    double var = std::max(0.0, sum_sq / n - mean * mean);
+    // a perfectly regular peer would otherwise be suspected the moment
+    // it is a little late
+    double stddev = std::max(std::sqrt(var), mean / 10);
+    if (stddev <= 0) {
+      return 0;
+    }
+    double elapsed = now - last;
+    double p_later = 0.5 * std::erfc((elapsed - mean) / (stddev * M_SQRT2));
+    return -std::log10(std::max(p_later, 1e-300));
+  }
+};
+
+#endif
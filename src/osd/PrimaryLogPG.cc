@@ -2291,6 +2291,12 @@ void PrimaryLogPG::do_op(OpRequestRef& op)
 
   dout(25) << __func__ << " oi " << obc->obs.oi << dendl;
 
+  bool plain_read = op->may_read() && !op->may_write() && !op->may_cache();
+  if (plain_read && r == 0 && do_fast_read(op, obc)) {
+    osd->logger->inc(l_osd_op_r_fast);
+    return;
+  }
+
   OpContext *ctx = new OpContext(op, m->get_reqid(), &m->ops, obc, this);
 
   if (m->has_flag(CEPH_OSD_FLAG_SKIPRWLOCKS)) {
@@ -2354,6 +2360,8 @@ void PrimaryLogPG::do_op(OpRequestRef& op)
 
   op->mark_started();
 
+  if (plain_read)
+    osd->logger->inc(l_osd_op_r_slow);
   execute_ctx(ctx);
   utime_t prepare_latency = ceph_clock_now();
   prepare_latency -= op->get_dequeued_time();
@@ -2370,6 +2378,124 @@ void PrimaryLogPG::do_op(OpRequestRef& op)
   maybe_force_recovery();
 }
 
+/*
+ * Serve a lone READ, STAT or GETXATTR on a head object of a replicated,
+ * untiered pool without building an OpContext.  The read completes
+ * synchronously under the pg lock, so it is enough that a read lock
+ * could be granted right now.  Anything unusual, including any error,
+ * returns false and is left to the full path in execute_ctx().
+ */
+bool PrimaryLogPG::do_fast_read(OpRequestRef& op, ObjectContextRef& obc)
+{
+  MOSDOp *m = static_cast<MOSDOp*>(op->get_nonconst_req());
+  uint64_t max_bytes = osd->osd_op_fast_read_max_bytes;
+  if (!max_bytes ||
+      m->ops.size() != 1 ||
+      m->get_snapid() != CEPH_NOSNAP ||
+      (m->get_flags() & (CEPH_OSD_FLAG_SKIPRWLOCKS | CEPH_OSD_FLAG_FLUSH)) ||
+      !pool.info.is_replicated() ||
+      pool.info.is_tier() ||
+      !obc->obs.exists ||
+      obc->obs.oi.is_whiteout() ||
+      obc->obs.oi.is_lost() ||
+      obc->obs.oi.has_manifest()) {
+    return false;
+  }
+  if (obc->rwstate.state == ObjectContext::RWState::RWWRITE ||
+      obc->rwstate.state == ObjectContext::RWState::RWEXCL ||
+      !obc->rwstate.waiters.empty()) {
+    return false;
+  }
+
+  const object_info_t& oi = obc->obs.oi;
+  const hobject_t& soid = oi.soid;
+  OSDOp& osd_op = m->ops[0];
+  ceph_osd_op& rop = osd_op.op;
+  object_stat_sum_t delta_stats;
+  uint64_t data_off = 0;
+  int r;
+  switch (rop.op) {
+  case CEPH_OSD_OP_READ:
+    {
+      if (oi.truncate_seq < rop.extent.truncate_seq ||
+	  rop.extent.offset >= oi.size) {
+	return false;
+      }
+      uint64_t len = rop.extent.length;
+      if (len == 0 || rop.extent.offset + len > oi.size)
+	len = oi.size - rop.extent.offset;
+      if (len > max_bytes)
+	return false;
+      r = pgbackend->objects_read_sync(
+	soid, rop.extent.offset, len, rop.flags, &osd_op.outdata);
+      if (r < 0)
+	break;
+      // whole object?  can we verify the checksum?
+      if ((uint64_t)r == oi.size && oi.is_data_digest() &&
+	  osd_op.outdata.crc32c(-1) != oi.data_digest) {
+	r = -EIO;  // let the full path report and repair it
+	break;
+      }
+      data_off = rop.extent.offset;
+      rop.extent.length = r;
+      delta_stats.num_rd_kb += shift_round_up(r, 10);
+      delta_stats.num_rd++;
+      r = 0;
+    }
+    break;
+
+  case CEPH_OSD_OP_STAT:
+    encode(oi.size, osd_op.outdata);
+    encode(oi.mtime, osd_op.outdata);
+    delta_stats.num_rd++;
+    r = 0;
+    break;
+
+  case CEPH_OSD_OP_GETXATTR:
+    {
+      string aname;
+      bufferlist::iterator bp = osd_op.indata.begin();
+      bp.copy(rop.xattr.name_len, aname);
+      r = getattr_maybe_cache(obc, "_" + aname, &osd_op.outdata);
+      if (r < 0)
+	break;
+      rop.xattr.value_len = osd_op.outdata.length();
+      delta_stats.num_rd_kb += shift_round_up(osd_op.outdata.length(), 10);
+      delta_stats.num_rd++;
+      r = 0;
+    }
+    break;
+
+  default:
+    return false;
+  }
+  if (r < 0) {
+    dout(20) << __func__ << " " << soid << " " << osd_op << " got " << r
+	     << ", retrying via the full path" << dendl;
+    osd_op.outdata.clear();
+    return false;
+  }
+  osd_op.rval = 0;
+
+  dout(10) << __func__ << " " << soid << " " << osd_op
+	   << " ov " << oi.version << dendl;
+  op->mark_started();
+  unstable_stats.add(delta_stats);
+
+  MOSDOpReply *reply = new MOSDOpReply(m, 0, get_osdmap()->get_epoch(), 0,
+				       false, op->qos_resp);
+  uint64_t outb = osd_op.outdata.length();
+  reply->claim_op_out_data(m->ops);
+  reply->get_header().data_off = data_off;
+  log_op_stats(*op, 0, outb);
+  publish_stats_to_osd();
+  reply->set_reply_versions(eversion_t(), oi.user_version);
+  reply->set_result(0);
+  reply->add_flags(CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK);
+  osd->send_message_osd_client(reply, m->get_connection());
+  return true;
+}
+
 PrimaryLogPG::cache_result_t PrimaryLogPG::maybe_handle_manifest_detail(
   OpRequestRef op,
   bool write_ordered,
@@ -3951,26 +4077,31 @@ void PrimaryLogPG::reply_ctx(OpContext *ctx, int r, eversion_t v, version_t uv)
 
 void PrimaryLogPG::log_op_stats(OpContext *ctx)
 {
-  OpRequestRef op = ctx->op;
-  const MOSDOp *m = static_cast<const MOSDOp*>(op->get_req());
+  log_op_stats(*ctx->op, ctx->bytes_written, ctx->bytes_read);
+}
+
+void PrimaryLogPG::log_op_stats(OpRequest& op,
+				uint64_t inb,
+				uint64_t outb)
+{
+  const MOSDOp *m = static_cast<const MOSDOp*>(op.get_req());
 
   utime_t now = ceph_clock_now();
   utime_t latency = now;
-  latency -= ctx->op->get_req()->get_recv_stamp();
+  latency -= op.get_req()->get_recv_stamp();
   utime_t process_latency = now;
-  process_latency -= ctx->op->get_dequeued_time();
-
-  uint64_t inb = ctx->bytes_written;
-  uint64_t outb = ctx->bytes_read;
+  process_latency -= op.get_dequeued_time();
 
   osd->logger->inc(l_osd_op);
+  osd->hot_spots.record(info.pgid, m->get_hobj(), m->get_reqid().name,
+			 inb + outb);
 
   osd->logger->inc(l_osd_op_outb, outb);
   osd->logger->inc(l_osd_op_inb, inb);
   osd->logger->tinc(l_osd_op_lat, latency);
   osd->logger->tinc(l_osd_op_process_lat, process_latency);
 
-  if (op->may_read() && op->may_write()) {
+  if (op.may_read() && op.may_write()) {
     osd->logger->inc(l_osd_op_rw);
     osd->logger->inc(l_osd_op_rw_inb, inb);
     osd->logger->inc(l_osd_op_rw_outb, outb);
@@ -3978,13 +4109,13 @@ void PrimaryLogPG::log_op_stats(OpContext *ctx)
     osd->logger->hinc(l_osd_op_rw_lat_inb_hist, latency.to_nsec(), inb);
     osd->logger->hinc(l_osd_op_rw_lat_outb_hist, latency.to_nsec(), outb);
     osd->logger->tinc(l_osd_op_rw_process_lat, process_latency);
-  } else if (op->may_read()) {
+  } else if (op.may_read()) {
     osd->logger->inc(l_osd_op_r);
     osd->logger->inc(l_osd_op_r_outb, outb);
     osd->logger->tinc(l_osd_op_r_lat, latency);
     osd->logger->hinc(l_osd_op_r_lat_outb_hist, latency.to_nsec(), outb);
     osd->logger->tinc(l_osd_op_r_process_lat, process_latency);
-  } else if (op->may_write() || op->may_cache()) {
+  } else if (op.may_write() || op.may_cache()) {
     osd->logger->inc(l_osd_op_w);
     osd->logger->inc(l_osd_op_w_inb, inb);
     osd->logger->tinc(l_osd_op_w_lat, latency);
@@ -559,6 +559,11 @@ void ReplicatedBackend::do_repop_reply(OpRequestRef op)
     if (r->ack_type & CEPH_OSD_FLAG_ONDISK) {
       assert(ip_op.waiting_for_commit.count(from));
       ip_op.waiting_for_commit.erase(from);
+      utime_t lat = ceph_clock_now() - ip_op.start;
+      PerfCounters *logger = get_parent()->get_logger();
+      logger->tinc(l_osd_repop_commit_lat, lat);
+      logger->hinc(l_osd_repop_commit_lat_hist, lat.to_nsec(),
+		   ++ip_op.num_replies);
       if (ip_op.op) {
         ostringstream ss;
         ss << "sub_op_commit_rec from " << from;
@@ -894,7 +899,8 @@ Message * ReplicatedBackend::generate_subop(
   hobject_t discard_temp_oid,
   const bufferlist &log_entries,
   boost::optional<pg_hit_set_history_t> &hset_hist,
-  ObjectStore::Transaction &op_t,
+  const bufferlist &op_t_bl,
+  uint32_t op_t_data_off,
   pg_shard_t peer,
   const pg_info_t &pinfo)
 {
@@ -913,8 +919,8 @@ Message * ReplicatedBackend::generate_subop(
     ObjectStore::Transaction t;
     encode(t, wr->get_data());
   } else {
-    encode(op_t, wr->get_data());
-    wr->get_header().data_off = op_t.get_data_alignment();
+    wr->get_data() = op_t_bl;
+    wr->get_header().data_off = op_t_data_off;
   }
 
   wr->logbl = log_entries;
@@ -957,9 +963,13 @@ void ReplicatedBackend::issue_op(
       op->op->mark_sub_op_sent(ss.str());
     }
 
-    // avoid doing the same work in generate_subop
+    // avoid doing the same work in generate_subop: every repop shares
+    // these buffers (and the data buffers of op_t itself), so the
+    // transaction is encoded, and its data crc computed, only once
     bufferlist logs;
     encode(log_entries, logs);
+    bufferlist op_t_bl;
+    encode(op_t, op_t_bl);
 
     for (const auto& shard : get_parent()->get_acting_recovery_backfill_shards()) {
       if (shard == parent->whoami_shard()) continue;
@@ -977,7 +987,8 @@ void ReplicatedBackend::issue_op(
 	  discard_temp_oid,
 	  logs,
 	  hset_hist,
-	  op_t,
+	  op_t_bl,
+	  op_t.get_data_alignment(),
 	  shard,
 	  pinfo);
       if (op->op && op->op->pg_trace)
@@ -333,11 +333,13 @@ private:
     Context *on_commit;
     OpRequestRef op;
     eversion_t v;
+    utime_t start;          ///< when the op was submitted
+    unsigned num_replies = 0;
     InProgressOp(
       ceph_tid_t tid, Context *on_commit,
       OpRequestRef op, eversion_t v)
       : tid(tid), on_commit(on_commit),
-	op(op), v(v) {}
+	op(op), v(v), start(ceph_clock_now()) {}
     bool done() const {
       return waiting_for_commit.empty();
     }
@@ -379,7 +381,8 @@ private:
     hobject_t discard_temp_oid,
     const bufferlist &log_entries,
     boost::optional<pg_hit_set_history_t> &hset_history,
-    ObjectStore::Transaction &op_t,
+    const bufferlist &op_t_bl,
+    uint32_t op_t_data_off,
     pg_shard_t peer,
     const pg_info_t &pinfo);
   void issue_op(
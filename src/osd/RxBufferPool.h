@@ -0,0 +1,111 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_RXBUFFERPOOL_H
+#define CEPH_OSD_RXBUFFERPOOL_H
+
+#include <stdlib.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "include/buffer.h"
+#include "include/intarith.h"
+#include "include/page.h"
+#include "common/deleter.h"
+
+/**
+ * Page aligned buffers for the data of incoming writes.
+ *
+ * A multi-megabyte allocation is served by a fresh mmap, and faulting
+ * its pages in while the socket is read into it costs about as much as
+ * a copy.  Buffers handed out here come back when the last reference to
+ * them is dropped and are reused for the next write of the same size,
+ * keeping up to max_free_bytes of them around.
+ */
+class RxBufferPool : public std::enable_shared_from_this<RxBufferPool> {
+  std::mutex lock;
+  std::map<size_t, std::vector<char*>> free_bufs;  ///< by size
+  size_t free_bytes = 0;
+  const size_t max_free_bytes;
+
+  void put(char *buf, size_t size) {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      if (free_bytes + size <= max_free_bytes) {
+	free_bufs[size].push_back(buf);
+	free_bytes += size;
+	return;
+      }
+    }
+    ::free(buf);
+  }
+
+public:
+  /// sizes are rounded up to this, so similar writes share buffers
+  static const size_t UNIT = 64 * 1024;
+
+  explicit RxBufferPool(size_t max_free)
+    : max_free_bytes(max_free) {}
+  ~RxBufferPool() {
+    for (auto& p : free_bufs) {
+      for (auto buf : p.second) {
+	::free(buf);
+      }
+    }
+  }
+
+  /**
+   * get a buffer for len bytes of data found at offset off of its object
+   *
+   * Like the messenger's own rx buffers, the data starts at off's offset
+   * within a page, so that the page aligned parts of the write stay page
+   * aligned in memory.
+   */
+  bufferptr get(unsigned len, unsigned off) {
+    unsigned head = off & ~CEPH_PAGE_MASK;
+    size_t size = p2roundup<size_t>(head + len, UNIT);
+    char *buf = nullptr;
+    {
+      std::lock_guard<std::mutex> l(lock);
+      auto p = free_bufs.find(size);
+      if (p != free_bufs.end()) {
+	buf = p->second.back();
+	p->second.pop_back();
+	if (p->second.empty()) {
+	  free_bufs.erase(p);
+	}
+	free_bytes -= size;
+      }
+    }
+    if (!buf && ::posix_memalign((void**)&buf, CEPH_PAGE_SIZE, size)) {
+      throw std::bad_alloc();
+    }
+    auto pool = shared_from_this();
+    bufferptr bp(buffer::claim_buffer(
+		   size, buf,
+		   make_deleter([pool, buf, size] { pool->put(buf, size); })));
+    bp.set_offset(head);
+    bp.set_length(len);
+    return bp;
+  }
+
+  size_t get_free_bytes() {
+    std::lock_guard<std::mutex> l(lock);
+    return free_bytes;
+  }
+};
+
+#endif
@@ -0,0 +1,123 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_SHARDINBOX_H
+#define CEPH_OSD_SHARDINBOX_H
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+/**
+ * Lock-free handoff of work to a single consumer thread.
+ *
+ * Any number of producers push; one consumer takes everything pushed so
+ * far at once, oldest first.  Items pushed by one producer are drained
+ * in the order it pushed them.  Producers push onto a cas list, newest
+ * first, and the consumer swaps the whole list out, so there is no ABA.
+ *
+ * The consumer sleeps on a condition of its own.  To not miss a wakeup,
+ * it calls prepare_to_sleep() with the lock of that condition held and
+ * only waits if that returns true; a producer whose push() returns true
+ * takes the same lock before it signals.  Either the producer sees the
+ * consumer sleeping, or the consumer sees the item.
+ */
+template <typename T>
+class ShardInbox {
+  struct node {
+    T item;
+    node *next = nullptr;
+    explicit node(T&& i) : item(std::move(i)) {}
+  };
+  std::atomic<node*> head = {nullptr};  ///< newest first
+  std::atomic<bool> sleeping = {false};
+
+public:
+  ShardInbox() = default;
+  ShardInbox(const ShardInbox&) = delete;
+  ShardInbox& operator=(const ShardInbox&) = delete;
+  ~ShardInbox() {
+    node *n = head.exchange(nullptr);
+    while (n) {
+      node *next = n->next;
+      delete n;
+      n = next;
+    }
+  }
+
+  /// queue an item; returns true if the consumer must be woken
+  bool push(T&& item) {
+    node *n = new node(std::move(item));
+    n->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(n->next, n,
+				       std::memory_order_release,
+				       std::memory_order_relaxed))
+      ;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return sleeping.load(std::memory_order_relaxed);
+  }
+
+  bool empty() const {
+    return head.load() == nullptr;
+  }
+
+  /// consumer: pass every queued item to f, oldest first
+  template <typename F>
+  unsigned drain(F&& f) {
+    node *n = head.exchange(nullptr, std::memory_order_acquire);
+    node *fifo = nullptr;
+    while (n) {
+      node *next = n->next;
+      n->next = fifo;
+      fifo = n;
+      n = next;
+    }
+    unsigned count = 0;
+    while (fifo) {
+      node *next = fifo->next;
+      f(std::move(fifo->item));
+      delete fifo;
+      fifo = next;
+      ++count;
+    }
+    return count;
+  }
+
+  /// consumer, with the wakeup lock held: false if it must not wait
+  bool prepare_to_sleep() {
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!empty()) {
+      sleeping.store(false, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+  /// consumer: done waiting
+  void woken() {
+    sleeping.store(false, std::memory_order_relaxed);
+  }
+
+  /// look at queued items, oldest first; must not race with drain()
+  template <typename F>
+  void for_each(F&& f) const {
+    std::vector<const T*> items;
+    for (node *n = head.load(std::memory_order_acquire); n; n = n->next) {
+      items.push_back(&n->item);
+    }
+    for (auto i = items.rbegin(); i != items.rend(); ++i) {
+      f(**i);
+    }
+  }
+};
+
+#endif
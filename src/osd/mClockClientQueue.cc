@@ -33,10 +33,12 @@ namespace ceph {
    * class mClockClientQueue
    */
 
-  mClockClientQueue::mClockClientQueue(CephContext *cct) :
+  mClockClientQueue::mClockClientQueue(
+    CephContext *cct,
+    const ceph::mclock::BackgroundScale *bg_scale) :
     queue(std::bind(&mClockClientQueue::op_class_client_info_f, this, _1),
 	  cct->_conf->osd_op_queue_mclock_anticipation_timeout),
-    client_info_mgr(cct)
+    client_info_mgr(cct, bg_scale)
   {
     // empty
   }
@@ -55,6 +57,7 @@ namespace ceph {
 
   // Formatted output of the queue
   inline void mClockClientQueue::dump(ceph::Formatter *f) const {
+    f->dump_float("background_scale", client_info_mgr.get_bg_scale());
     queue.dump(f);
   }
 
@@ -78,6 +81,7 @@ namespace ceph {
 					 unsigned priority,
 					 unsigned cost,
 					 Request&& item) {
+    client_info_mgr.maybe_rescale();
     auto qos_params = item.get_qos_params();
     queue.enqueue_distributed(get_inner_client(cl, item), priority, cost,
 			      std::move(item), qos_params);
@@ -88,6 +92,7 @@ namespace ceph {
 					       unsigned priority,
 					       unsigned cost,
 					       Request&& item) {
+    client_info_mgr.maybe_rescale();
     queue.enqueue_front(get_inner_client(cl, item), priority, cost,
 			std::move(item));
   }
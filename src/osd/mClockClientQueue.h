@@ -49,7 +49,9 @@ namespace ceph {
 
   public:
 
-    mClockClientQueue(CephContext *cct);
+    mClockClientQueue(
+      CephContext *cct,
+      const ceph::mclock::BackgroundScale *bg_scale = nullptr);
 
     const crimson::dmclock::ClientInfo* op_class_client_info_f(const InnerClient& client);
 
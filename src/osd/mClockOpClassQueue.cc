@@ -33,10 +33,12 @@ namespace ceph {
    * class mClockOpClassQueue
    */
 
-  mClockOpClassQueue::mClockOpClassQueue(CephContext *cct) :
+  mClockOpClassQueue::mClockOpClassQueue(
+    CephContext *cct,
+    const ceph::mclock::BackgroundScale *bg_scale) :
     queue(std::bind(&mClockOpClassQueue::op_class_client_info_f, this, _1),
 	  cct->_conf->osd_op_queue_mclock_anticipation_timeout),
-    client_info_mgr(cct)
+    client_info_mgr(cct, bg_scale)
   {
     // empty
   }
@@ -49,6 +51,7 @@ namespace ceph {
 
   // Formatted output of the queue
   void mClockOpClassQueue::dump(ceph::Formatter *f) const {
+    f->dump_float("background_scale", client_info_mgr.get_bg_scale());
     queue.dump(f);
   }
 } // namespace ceph
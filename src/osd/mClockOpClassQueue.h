@@ -47,7 +47,9 @@ namespace ceph {
 
   public:
 
-    mClockOpClassQueue(CephContext *cct);
+    mClockOpClassQueue(
+      CephContext *cct,
+      const ceph::mclock::BackgroundScale *bg_scale = nullptr);
 
     const crimson::dmclock::ClientInfo*
     op_class_client_info_f(const osd_op_type_t& op_type);
@@ -92,6 +94,7 @@ namespace ceph {
 			unsigned priority,
 			unsigned cost,
 			Request&& item) override final {
+      client_info_mgr.maybe_rescale();
       queue.enqueue(client_info_mgr.osd_op_type(item),
 		    priority,
 		    cost,
@@ -103,6 +106,7 @@ namespace ceph {
 			      unsigned priority,
 			      unsigned cost,
 			      Request&& item) override final {
+      client_info_mgr.maybe_rescale();
       queue.enqueue_front(client_info_mgr.osd_op_type(item),
 			  priority,
 			  cost,
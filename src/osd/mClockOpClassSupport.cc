@@ -13,6 +13,8 @@
  */
 
 
+#include <algorithm>
+
 #include "common/dout.h"
 #include "osd/mClockOpClassSupport.h"
 #include "osd/OpQueueItem.h"
@@ -23,7 +25,26 @@ namespace ceph {
 
   namespace mclock {
 
-    OpClassClientInfoMgr::OpClassClientInfoMgr(CephContext *cct) :
+    double BackgroundScale::update(double latency,
+				   double target,
+				   double min_scale) {
+      double cur = get();
+      double next;
+      if (target > 0.0 && latency > target) {
+	next = std::max(min_scale, cur * std::max(0.5, target / latency));
+      } else {
+	next = std::min(1.0, cur + 0.1);
+      }
+      if (next != cur) {
+	scale.store(next, std::memory_order_relaxed);
+	gen.fetch_add(1, std::memory_order_release);
+      }
+      return next;
+    }
+
+    OpClassClientInfoMgr::OpClassClientInfoMgr(
+      CephContext *cct,
+      const BackgroundScale *bg_scale) :
       client_op(cct->_conf->osd_op_queue_mclock_client_op_res,
 		cct->_conf->osd_op_queue_mclock_client_op_wgt,
 		cct->_conf->osd_op_queue_mclock_client_op_lim),
@@ -44,7 +65,12 @@ namespace ceph {
 	    cct->_conf->osd_op_queue_mclock_pg_delete_lim),
       peering_event(cct->_conf->osd_op_queue_mclock_peering_event_res,
 		    cct->_conf->osd_op_queue_mclock_peering_event_wgt,
-		    cct->_conf->osd_op_queue_mclock_peering_event_lim)
+		    cct->_conf->osd_op_queue_mclock_peering_event_lim),
+      snaptrim_cfg(snaptrim),
+      recov_cfg(recov),
+      scrub_cfg(scrub),
+      pg_delete_cfg(pg_delete),
+      bg_scale(bg_scale)
     {
       constexpr int rep_ops[] = {
 	MSG_OSD_REPOP,
@@ -74,6 +100,21 @@ namespace ceph {
 	rep_op_msg_bitset.to_string() << dendl;
     }
 
+    void OpClassClientInfoMgr::rescale() {
+      bg_gen = bg_scale->get_gen();
+      double s = bg_scale->get();
+      // the queue reads client info on every tag calculation, so
+      // updating in place is enough; a limit of 0 stays unlimited
+      auto scaled = [s](const crimson::dmclock::ClientInfo& c) {
+	return crimson::dmclock::ClientInfo(
+	  c.reservation * s, c.weight * s, c.limit * s);
+      };
+      snaptrim = scaled(snaptrim_cfg);
+      recov = scaled(recov_cfg);
+      scrub = scaled(scrub_cfg);
+      pg_delete = scaled(pg_delete_cfg);
+    }
+
     void OpClassClientInfoMgr::add_rep_op_msg(int message_code) {
       assert(message_code >= 0 && message_code < int(rep_op_msg_bitset_size));
       rep_op_msg_bitset.set(message_code);
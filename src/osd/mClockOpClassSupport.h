@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <bitset>
 
 #include "dmclock/src/dmclock_server.h"
@@ -32,6 +33,30 @@ namespace ceph {
       peering_event
     };
 
+    /*
+     * Scale factor for the background op classes, adapted to the
+     * object store's commit latency when osd_op_queue_mclock_adaptive is
+     * set.  Written periodically by the OSD, read by every shard's queue.
+     */
+    class BackgroundScale {
+      std::atomic<double> scale{1.0};
+      std::atomic<uint32_t> gen{0};
+
+    public:
+
+      double get() const {
+	return scale.load(std::memory_order_relaxed);
+      }
+      uint32_t get_gen() const {
+	return gen.load(std::memory_order_acquire);
+      }
+
+      // feed one commit latency sample (seconds); cuts the scale in
+      // proportion to how far latency overshoots the target and
+      // recovers it additively otherwise.  Returns the new scale.
+      double update(double latency, double target, double min_scale);
+    }; // BackgroundScale
+
     class OpClassClientInfoMgr {
       crimson::dmclock::ClientInfo client_op;
       crimson::dmclock::ClientInfo osd_rep_op;
@@ -41,13 +66,36 @@ namespace ceph {
       crimson::dmclock::ClientInfo pg_delete;
       crimson::dmclock::ClientInfo peering_event;
 
+      // configured values of the background classes, before scaling
+      const crimson::dmclock::ClientInfo snaptrim_cfg;
+      const crimson::dmclock::ClientInfo recov_cfg;
+      const crimson::dmclock::ClientInfo scrub_cfg;
+      const crimson::dmclock::ClientInfo pg_delete_cfg;
+
+      const BackgroundScale *bg_scale;
+      uint32_t bg_gen = 0;
+
       static constexpr std::size_t rep_op_msg_bitset_size = 128;
       std::bitset<rep_op_msg_bitset_size> rep_op_msg_bitset;
       void add_rep_op_msg(int message_code);
+      void rescale();
 
     public:
 
-      OpClassClientInfoMgr(CephContext *cct);
+      OpClassClientInfoMgr(CephContext *cct,
+			   const BackgroundScale *bg_scale = nullptr);
+
+      // pick up a new background scale, if one was published; the
+      // caller must hold the lock of the queue using this manager
+      inline void maybe_rescale() {
+	if (bg_scale && bg_scale->get_gen() != bg_gen) {
+	  rescale();
+	}
+      }
+
+      double get_bg_scale() const {
+	return bg_scale ? bg_scale->get() : 1.0;
+      }
 
       inline const crimson::dmclock::ClientInfo*
       get_client_info(osd_op_type_t type) {
@@ -0,0 +1,43 @@
+#!/usr/bin/env bash
+#
+# Compare the default op shards with osd_op_shard_run_to_completion on a
+# local vstart cluster with memstore.  Run from the build directory:
+#
+#   ../src/script/run-to-completion-bench.sh [seconds] [threads] [size]
+#
+# Set SHARDS and CPUS (a comma separated list, one cpu per shard) to pin
+# the run-to-completion shard threads.
+
+set -e
+
+secs=${1:-30}
+threads=${2:-32}
+size=${3:-4096}
+shards=${SHARDS:-4}
+cpus=${CPUS:-}
+
+[ -x bin/ceph-osd ] || { echo "run me from the build directory" >&2; exit 1; }
+
+function bench() {
+    local name=$1
+    shift
+    MON=1 OSD=1 MGR=1 MDS=0 RGW=0 ../src/vstart.sh -n -x --memstore \
+        -o "osd_op_num_shards = $shards" "$@" > /dev/null 2>&1
+    bin/ceph osd pool create bench 32 > /dev/null 2>&1
+    bin/ceph osd pool set bench size 1 > /dev/null 2>&1
+    while bin/ceph pg stat | grep -qv '32 active+clean'; do
+        sleep 1
+    done
+    echo "== $name write"
+    bin/rados -p bench bench $secs write -b $size -t $threads --no-cleanup |
+        grep -E '^(Bandwidth|Average IOPS|Average Latency)'
+    echo "== $name read"
+    bin/rados -p bench bench $secs rand -t $threads |
+        grep -E '^(Bandwidth|Average IOPS|Average Latency)'
+    ../src/stop.sh
+}
+
+bench default
+bench run-to-completion \
+    -o "osd_op_shard_run_to_completion = true" \
+    -o "osd_op_shard_cpus = $cpus"
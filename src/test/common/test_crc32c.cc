@@ -44,6 +44,24 @@ TEST(Crc32c, Big) {
   free(a);
 }
 
+TEST(Crc32c, Blocks) {
+  unsigned max_len = 4099;
+  unsigned n = 11;
+  unsigned char *a = (unsigned char *)malloc(max_len * n);
+  for (unsigned i = 0; i < max_len * n; ++i)
+    a[i] = i * 7 + (i >> 8);
+  uint32_t out[11];
+  for (unsigned len : {1, 7, 8, 13, 512, 4096, 4099}) {
+    for (unsigned blocks = 0; blocks <= n; ++blocks) {
+      ceph_crc32c_blocks(-1, a, len, blocks, out);
+      for (unsigned b = 0; b < blocks; ++b) {
+	ASSERT_EQ(ceph_crc32c(-1, a + b * len, len), out[b]);
+      }
+    }
+  }
+  free(a);
+}
+
 TEST(Crc32c, Performance) {
   int len = 1000 * 1024 * 1024;
   char *a = (char *)malloc(len);
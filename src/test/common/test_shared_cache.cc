@@ -391,6 +391,31 @@ TEST(SharedCache_all, lru) {
   ASSERT_TRUE(cache.lookup(0).get());
 }
 
+TEST(SharedCache_all, lookup_refreshes_lru) {
+  const size_t SIZE = 3;
+  SharedLRU<int, int> cache(NULL, SIZE);
+
+  for (size_t i = 0; i < SIZE; ++i) {
+    cache.add(i, new int(i));
+  }
+  // 0 is the oldest entry; looking it up (and lookup_or_create on 1)
+  // must move them to the front so that 2 is evicted next
+  ASSERT_EQ(0, *cache.lookup(0));
+  ASSERT_EQ(1, *cache.lookup_or_create(1));
+  cache.add(SIZE, new int(SIZE));
+  ASSERT_FALSE(cache.lookup(2));
+  ASSERT_TRUE(cache.lookup(0).get());
+  ASSERT_TRUE(cache.lookup(1).get());
+  ASSERT_TRUE(cache.lookup(SIZE).get());
+
+  // a strong ref held outside the cache keeps a trimmed entry reachable
+  ceph::shared_ptr<int> held = cache.lookup(0);
+  for (size_t i = SIZE + 1; i < 3 * SIZE; ++i) {
+    cache.add(i, new int(i));
+  }
+  ASSERT_EQ(held, cache.lookup(0));
+}
+
 // Local Variables:
 // compile-command: "cd ../.. ; make unittest_shared_cache && ./unittest_shared_cache # --gtest_filter=*.* --log-to-stderr=true"
 // End:
@@ -0,0 +1,91 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation. See file COPYING.
+ *
+ */
+#include "common/space_saving.h"
+#include <gtest/gtest.h>
+
+TEST(SpaceSaving, Empty)
+{
+  SpaceSaving<int> s(0);
+  s.add(1, 10);
+  EXPECT_EQ(0u, s.size());
+  EXPECT_TRUE(s.top(5).empty());
+}
+
+TEST(SpaceSaving, Exact)
+{
+  SpaceSaving<int> s(4);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j <= i; j++) {
+      s.add(i, 100);
+    }
+  }
+  auto t = s.top(10);
+  ASSERT_EQ(3u, t.size());
+  EXPECT_EQ(2, t[0].first);
+  EXPECT_EQ(3u, t[0].second.count);
+  EXPECT_EQ(0u, t[0].second.error);
+  EXPECT_EQ(300u, t[0].second.bytes);
+  EXPECT_EQ(1, t[1].first);
+  EXPECT_EQ(0, t[2].first);
+
+  t = s.top(1);
+  ASSERT_EQ(1u, t.size());
+  EXPECT_EQ(2, t[0].first);
+}
+
+TEST(SpaceSaving, Replace)
+{
+  SpaceSaving<int> s(2);
+  s.add(1, 0, 5);
+  s.add(2, 0, 2);
+  s.add(3, 0);   // evicts 2 and inherits its count
+  EXPECT_EQ(2u, s.size());
+  auto t = s.top(2);
+  EXPECT_EQ(1, t[0].first);
+  EXPECT_EQ(5u, t[0].second.count);
+  EXPECT_EQ(3, t[1].first);
+  EXPECT_EQ(3u, t[1].second.count);
+  EXPECT_EQ(2u, t[1].second.error);
+}
+
+TEST(SpaceSaving, HeavyHitters)
+{
+  // keys 0..3 take half of a stream otherwise spread over 1000 keys
+  SpaceSaving<int> s(16);
+  for (int i = 0; i < 20000; i++) {
+    if (i % 2) {
+      s.add((i / 2) % 4, 1);
+    } else {
+      s.add(4 + (i / 2) % 1000, 1);
+    }
+  }
+  auto t = s.top(4);
+  ASSERT_EQ(4u, t.size());
+  for (auto& p : t) {
+    EXPECT_LT(p.first, 4);
+    EXPECT_GE(p.second.count, 2500u);
+    EXPECT_LE(p.second.count - p.second.error, 2500u);
+  }
+}
+
+TEST(SpaceSaving, Decay)
+{
+  SpaceSaving<int> s(4);
+  s.add(1, 8, 4);
+  s.add(2, 1);
+  s.decay();
+  auto t = s.top(4);
+  ASSERT_EQ(1u, t.size());
+  EXPECT_EQ(1, t[0].first);
+  EXPECT_EQ(2u, t[0].second.count);
+  EXPECT_EQ(4u, t[0].second.bytes);
+}
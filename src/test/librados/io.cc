@@ -237,6 +237,108 @@ TEST_F(LibRadosIoPP, ReadOpPP) {
   }
 }
 
+// lone reads, stats and getxattrs that the osd serves without an op
+// context (osd_op_fast_read_max_bytes) must look the same as the rest
+TEST_F(LibRadosIoPP, FastReadPP) {
+  bufferlist bl;
+  for (int i = 0; i < 4096; ++i) {
+    bl.append((char)(i % 251));
+  }
+  ASSERT_EQ(0, ioctx.write_full("foo", bl));
+  bufferlist xbl;
+  xbl.append("bar");
+  ASSERT_EQ(0, ioctx.setxattr("foo", "attr", xbl));
+
+  {
+    // an offset into the object
+    bufferlist out;
+    ASSERT_EQ(100, ioctx.read("foo", out, 100, 1000));
+    ASSERT_EQ(0, memcmp(out.c_str(), bl.c_str() + 1000, 100));
+  }
+  {
+    // running past the end, and len 0 for the whole object
+    bufferlist out;
+    ASSERT_EQ(96, ioctx.read("foo", out, 1000, 4000));
+    ASSERT_EQ(0, memcmp(out.c_str(), bl.c_str() + 4000, 96));
+    out.clear();
+    ASSERT_EQ(4096, ioctx.read("foo", out, 0, 0));
+    ASSERT_TRUE(out.contents_equal(bl));
+    out.clear();
+    ASSERT_EQ(0, ioctx.read("foo", out, 100, 8192));
+  }
+  {
+    uint64_t size;
+    time_t mtime;
+    ASSERT_EQ(0, ioctx.stat("foo", &size, &mtime));
+    ASSERT_EQ(4096u, size);
+    ASSERT_NE(0, mtime);
+  }
+  {
+    bufferlist out;
+    ASSERT_EQ(3, ioctx.getxattr("foo", "attr", out));
+    ASSERT_TRUE(out.contents_equal(xbl));
+    ASSERT_EQ(-ENODATA, ioctx.getxattr("foo", "nope", out));
+  }
+  {
+    bufferlist out;
+    ASSERT_EQ(-ENOENT, ioctx.read("nope", out, 100, 0));
+    uint64_t size;
+    ASSERT_EQ(-ENOENT, ioctx.stat("nope", &size, NULL));
+  }
+  {
+    // a read and a stat in one op
+    bufferlist read_bl;
+    uint64_t size = 0;
+    int rval1 = 1000, rval2 = 1000;
+    ObjectReadOperation op;
+    op.read(0, 10, &read_bl, &rval1);
+    op.stat(&size, NULL, &rval2);
+    ASSERT_EQ(0, ioctx.operate("foo", &op, NULL));
+    ASSERT_EQ(0, rval1);
+    ASSERT_EQ(0, rval2);
+    ASSERT_EQ(0, memcmp(read_bl.c_str(), bl.c_str(), 10));
+    ASSERT_EQ(4096u, size);
+  }
+  {
+    // larger than the fast path takes
+    bufferlist big;
+    for (int i = 0; i < 256 * 1024; ++i) {
+      big.append((char)(i % 241));
+    }
+    ASSERT_EQ(0, ioctx.write_full("big", big));
+    bufferlist out;
+    ASSERT_EQ(256 * 1024, ioctx.read("big", out, 0, 0));
+    ASSERT_TRUE(out.contents_equal(big));
+  }
+  {
+    // a snapshot read sees the old data, the head the new
+    ASSERT_EQ(0, ioctx.snap_create("snap1"));
+    bufferlist bl2;
+    bl2.append(std::string(4096, 'x'));
+    ASSERT_EQ(0, ioctx.write_full("foo", bl2));
+    snap_t snap;
+    ASSERT_EQ(0, ioctx.snap_lookup("snap1", &snap));
+    ioctx.snap_set_read(snap);
+    bufferlist out;
+    ASSERT_EQ(4096, ioctx.read("foo", out, 0, 0));
+    ASSERT_TRUE(out.contents_equal(bl));
+    ioctx.snap_set_read(LIBRADOS_SNAP_HEAD);
+    out.clear();
+    ASSERT_EQ(4096, ioctx.read("foo", out, 0, 0));
+    ASSERT_TRUE(out.contents_equal(bl2));
+    ASSERT_EQ(0, ioctx.snap_remove("snap1"));
+  }
+  {
+    // a truncate is seen right away
+    ASSERT_EQ(0, ioctx.trunc("foo", 10));
+    bufferlist out;
+    ASSERT_EQ(10, ioctx.read("foo", out, 4096, 0));
+    uint64_t size;
+    ASSERT_EQ(0, ioctx.stat("foo", &size, NULL));
+    ASSERT_EQ(10u, size);
+  }
+}
+
 TEST_F(LibRadosIoPP, SparseReadOpPP) {
   char buf[128];
   memset(buf, 0xcc, sizeof(buf));
@@ -801,6 +903,22 @@ TEST_F(LibRadosIoECPP, ReadOpPP) {
   }
 }
 
+// erasure coded pools never take the fast read path; make sure they
+// are not mistaken for replicated ones
+TEST_F(LibRadosIoECPP, FastReadPP) {
+  bufferlist bl;
+  for (unsigned i = 0; i < alignment; ++i) {
+    bl.append((char)(i % 251));
+  }
+  ASSERT_EQ(0, ioctx.write_full("foo", bl));
+  bufferlist out;
+  ASSERT_EQ(100, ioctx.read("foo", out, 100, 10));
+  ASSERT_EQ(0, memcmp(out.c_str(), bl.c_str() + 10, 100));
+  uint64_t size;
+  ASSERT_EQ(0, ioctx.stat("foo", &size, NULL));
+  ASSERT_EQ(alignment, size);
+}
+
 TEST_F(LibRadosIoECPP, SparseReadOpPP) {
   char buf[128];
   memset(buf, 0xcc, sizeof(buf));
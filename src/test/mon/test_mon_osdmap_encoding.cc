@@ -0,0 +1,151 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "messages/MOSDMap.h"
+#include "mon/OSDMonitor.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+MOSDMap *new_osdmap_message()
+{
+  uuid_d fsid;
+  fsid.parse("c0fb0f41-aa46-4f5c-b33f-b12b4c8cf2b8");
+  MOSDMap *m = new MOSDMap(fsid);
+  m->oldest_map = 3;
+  m->newest_map = 12;
+  m->gap_removed_snaps[10].insert(1, 5);
+  return m;
+}
+
+bool shares_payload(MOSDMap *a, MOSDMap *b)
+{
+  return a->get_payload().buffers().front().c_str() ==
+    b->get_payload().buffers().front().c_str();
+}
+
+} // anonymous namespace
+
+TEST(OSDMapEncoding, HitSharesWireBytes) {
+  auto cache = std::make_shared<Message::EncodingCache>();
+  MOSDMap *a = new_osdmap_message();
+  MOSDMap *b = new_osdmap_message();
+  MOSDMap *plain = new_osdmap_message();
+  a->set_encoding_cache(cache);
+  b->set_encoding_cache(cache);
+
+  a->encode(CEPH_FEATURES_ALL, MSG_CRC_ALL);
+  b->encode(CEPH_FEATURES_ALL, MSG_CRC_ALL);
+  plain->encode(CEPH_FEATURES_ALL, MSG_CRC_ALL);
+
+  // b took a's encoding instead of building its own
+  ASSERT_TRUE(shares_payload(a, b));
+  ASSERT_TRUE(a->get_payload().contents_equal(b->get_payload()));
+  ASSERT_EQ(a->get_header().version, b->get_header().version);
+  ASSERT_EQ(a->get_header().compat_version, b->get_header().compat_version);
+  ASSERT_EQ(a->get_header().front_len, b->get_header().front_len);
+  ASSERT_EQ(a->get_footer().front_crc, b->get_footer().front_crc);
+  ASSERT_EQ(a->get_footer().middle_crc, b->get_footer().middle_crc);
+  ASSERT_EQ(a->get_footer().data_crc, b->get_footer().data_crc);
+
+  // and it is what the message would have encoded by itself
+  ASSERT_FALSE(shares_payload(a, plain));
+  ASSERT_TRUE(plain->get_payload().contents_equal(b->get_payload()));
+  ASSERT_EQ(plain->get_header().version, b->get_header().version);
+  ASSERT_EQ(plain->get_footer().front_crc, b->get_footer().front_crc);
+  ASSERT_EQ(plain->get_footer().data_crc, b->get_footer().data_crc);
+
+  a->put();
+  b->put();
+  plain->put();
+}
+
+TEST(OSDMapEncoding, SeparateEntries) {
+  auto cache = std::make_shared<Message::EncodingCache>();
+  MOSDMap *full = new_osdmap_message();
+  full->set_encoding_cache(cache);
+  full->encode(CEPH_FEATURES_ALL, MSG_CRC_ALL);
+  ASSERT_EQ(4, full->get_header().version);
+
+  // an older peer gets the version its features call for
+  uint64_t features = CEPH_FEATURES_ALL & ~CEPH_FEATURE_OSDENC;
+  MOSDMap *old = new_osdmap_message();
+  old->set_encoding_cache(cache);
+  old->encode(features, MSG_CRC_ALL);
+  ASSERT_FALSE(shares_payload(full, old));
+  ASSERT_EQ(2, old->get_header().version);
+  ASSERT_EQ(2, old->get_header().compat_version);
+  ASSERT_NE(full->get_header().front_len, old->get_header().front_len);
+
+  MOSDMap *old2 = new_osdmap_message();
+  old2->set_encoding_cache(cache);
+  old2->encode(features, MSG_CRC_ALL);
+  ASSERT_TRUE(shares_payload(old, old2));
+  ASSERT_EQ(2, old2->get_header().version);
+  ASSERT_EQ(2, old2->get_header().compat_version);
+  ASSERT_EQ(old->get_footer().front_crc, old2->get_footer().front_crc);
+
+  // without crcs the footer says so, whichever entry it came from
+  MOSDMap *nocrc = new_osdmap_message();
+  nocrc->set_encoding_cache(cache);
+  nocrc->encode(CEPH_FEATURES_ALL, 0);
+  ASSERT_FALSE(shares_payload(full, nocrc));
+  ASSERT_EQ(4, nocrc->get_header().version);
+  ASSERT_TRUE(nocrc->get_footer().flags & CEPH_MSG_FOOTER_NOCRC);
+  ASSERT_TRUE(full->get_payload().contents_equal(nocrc->get_payload()));
+
+  MOSDMap *nocrc2 = new_osdmap_message();
+  nocrc2->set_encoding_cache(cache);
+  nocrc2->encode(CEPH_FEATURES_ALL, 0);
+  ASSERT_TRUE(shares_payload(nocrc, nocrc2));
+  ASSERT_TRUE(nocrc2->get_footer().flags & CEPH_MSG_FOOTER_NOCRC);
+
+  full->put();
+  old->put();
+  old2->put();
+  nocrc->put();
+  nocrc2->put();
+}
+
+TEST(OSDMapEncoding, BoundsDropEntries) {
+  OSDMapEncodings encodings;
+  auto c = encodings.get(1, 20, 5, 10, 100);
+  ASSERT_EQ(c, encodings.get(1, 20, 5, 10, 100));
+  ASSERT_NE(c, encodings.get(1, 20, 5, 11, 100));
+  ASSERT_EQ(2u, encodings.size());
+
+  // a new newest_map invalidates every encoded message
+  auto newer = encodings.get(1, 21, 5, 10, 100);
+  ASSERT_NE(c, newer);
+  ASSERT_EQ(1u, encodings.size());
+
+  // so does trimming, which moves oldest_map
+  auto trimmed = encodings.get(2, 21, 5, 10, 100);
+  ASSERT_NE(newer, trimmed);
+  ASSERT_EQ(1u, encodings.size());
+  ASSERT_EQ(trimmed, encodings.get(2, 21, 5, 10, 100));
+}
+
+TEST(OSDMapEncoding, BoundedSize) {
+  OSDMapEncodings encodings;
+  auto c = encodings.get(1, 20, 1, 10, 2);
+  encodings.get(1, 20, 11, 20, 2);
+  ASSERT_EQ(2u, encodings.size());
+  // a hit does not make room
+  ASSERT_EQ(c, encodings.get(1, 20, 1, 10, 2));
+  ASSERT_EQ(2u, encodings.size());
+  // a new range does
+  encodings.get(1, 20, 2, 10, 2);
+  ASSERT_EQ(1u, encodings.size());
+  ASSERT_NE(c, encodings.get(1, 20, 1, 10, 2));
+}
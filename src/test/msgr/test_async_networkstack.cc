@@ -25,6 +25,7 @@
 
 #include "acconfig.h"
 #include "include/Context.h"
+#include "include/stringify.h"
 
 #include "msg/async/Event.h"
 #include "msg/async/Stack.h"
@@ -552,6 +553,71 @@ TEST_P(NetworkWorkerTest, ComplexTest) {
   });
 }
 
+TEST_P(NetworkWorkerTest, LoopbackBackpressureTest) {
+  if (strcmp(GetParam(), "loopback"))
+    return;
+  const size_t max_queued = 65536;
+  g_ceph_context->_conf->set_val("ms_async_loopback_max_queued_bytes",
+                                 stringify(max_queued));
+  entity_addr_t bind_addr;
+  ASSERT_TRUE(bind_addr.parse(get_addr().c_str()));
+  exec_events([this, bind_addr, max_queued](Worker *worker) mutable {
+    if (worker->id != 0)
+      return;
+    EventCenter *center = &worker->center;
+    SocketOptions options;
+    ServerSocket bind_socket;
+    int r = worker->listen(bind_addr, options, &bind_socket);
+    ASSERT_EQ(0, r);
+    ConnectedSocket cli_socket, srv_socket;
+    r = worker->connect(bind_addr, options, &cli_socket);
+    ASSERT_EQ(0, r);
+    ASSERT_EQ(1, cli_socket.is_connected());
+    entity_addr_t cli_addr;
+    r = bind_socket.accept(&srv_socket, options, &cli_addr, worker);
+    ASSERT_EQ(0, r);
+
+    // the peer reads nothing, so sends stop being taken at the cap
+    const size_t chunk = 16384;
+    string expected;
+    bufferlist bl;
+    do {
+      string message(chunk, 'a' + expected.size() / chunk % 26);
+      bl.clear();
+      bl.append(message);
+      r = cli_socket.send(bl, false);
+      ASSERT_TRUE(r >= 0);
+      expected.append(message, 0, r);
+      ASSERT_LE(expected.size(), max_queued);
+    } while (r > 0);
+    ASSERT_EQ(max_queued, expected.size());
+
+    C_poll cb(center);
+    center->create_file_event(cli_socket.fd(), EVENT_WRITABLE, &cb);
+    ASSERT_FALSE(cb.poll(100));
+
+    // draining it makes the sender writable again
+    string read_string;
+    char buf[4096];
+    while (read_string.size() < expected.size()) {
+      r = srv_socket.read(buf, sizeof(buf));
+      ASSERT_TRUE(r > 0);
+      read_string.append(buf, r);
+    }
+    ASSERT_TRUE(cb.poll(500));
+    center->delete_file_event(cli_socket.fd(), EVENT_WRITABLE);
+    ASSERT_EQ(expected, read_string);
+    bl.clear();
+    bl.append("!");
+    ASSERT_EQ(1, cli_socket.send(bl, false));
+
+    bind_socket.abort_accept();
+    srv_socket.close();
+    cli_socket.close();
+  });
+  g_ceph_context->_conf->rm_val("ms_async_loopback_max_queued_bytes");
+}
+
 class StressFactory {
   struct Client;
   struct Server;
@@ -1047,7 +1113,8 @@ INSTANTIATE_TEST_CASE_P(
 #ifdef HAVE_DPDK
     "dpdk",
 #endif
-    "posix"
+    "posix",
+    "loopback"
   )
 );
 
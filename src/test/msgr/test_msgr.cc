@@ -766,6 +766,178 @@ TEST_P(MessengerTest, MessageTest) {
   client_msgr->wait();
 }
 
+class RxBufferDispatcher : public FakeDispatcher {
+ public:
+  bufferptr supplied;
+  unsigned supplied_count = 0;
+  bufferlist received;
+
+  explicit RxBufferDispatcher(bool s) : FakeDispatcher(s) {}
+  bool ms_get_rx_buffer(Connection *con, const ceph_msg_header& header,
+                        bufferlist *bl) override {
+    if (header.type != CEPH_MSG_PING)
+      return false;
+    Mutex::Locker l(lock);
+    supplied = buffer::create_page_aligned(header.data_len);
+    bl->push_back(supplied);
+    ++supplied_count;
+    return true;
+  }
+  void ms_fast_dispatch(Message *m) override {
+    {
+      Mutex::Locker l(lock);
+      received = m->get_data();
+    }
+    FakeDispatcher::ms_fast_dispatch(m);
+  }
+};
+
+TEST_P(MessengerTest, RxBufferTest) {
+  FakeDispatcher cli_dispatcher(false);
+  RxBufferDispatcher srv_dispatcher(true);
+  entity_addr_t bind_addr;
+  bind_addr.parse("127.0.0.1");
+  server_msgr->bind(bind_addr);
+  server_msgr->add_dispatcher_head(&srv_dispatcher);
+  server_msgr->start();
+  client_msgr->add_dispatcher_head(&cli_dispatcher);
+  client_msgr->start();
+
+  // the data lands in the buffer the server's dispatcher supplied
+  bufferlist bl;
+  string s("abcdefghijklmnopqrstuvwxyz");
+  for (int i = 0; i < 1024*30; i++)
+    bl.append(s);
+  MPing *m = new MPing();
+  m->set_data(bl);
+  ConnectionRef conn = client_msgr->get_connection(server_msgr->get_myinst());
+  conn->send_message(m);
+  {
+    utime_t t;
+    t += 1000*1000*500;
+    Mutex::Locker l(cli_dispatcher.lock);
+    while (!cli_dispatcher.got_new)
+      cli_dispatcher.cond.WaitInterval(cli_dispatcher.lock, t);
+    ASSERT_TRUE(cli_dispatcher.got_new);
+    cli_dispatcher.got_new = false;
+  }
+  {
+    Mutex::Locker l(srv_dispatcher.lock);
+    ASSERT_EQ(1u, srv_dispatcher.supplied_count);
+    ASSERT_TRUE(srv_dispatcher.received.contents_equal(bl));
+    ASSERT_EQ(srv_dispatcher.supplied.c_str(),
+              srv_dispatcher.received.buffers().front().c_str());
+    for (auto& p : srv_dispatcher.received.buffers()) {
+      ASSERT_GE(p.c_str(), srv_dispatcher.supplied.c_str());
+      ASSERT_LE(p.end_c_str(), srv_dispatcher.supplied.end_c_str());
+    }
+  }
+
+  server_msgr->shutdown();
+  client_msgr->shutdown();
+  server_msgr->wait();
+  client_msgr->wait();
+}
+
+class OrderedDispatcher : public Dispatcher {
+ public:
+  Mutex lock;
+  Cond cond;
+  map<ConnectionRef, uint64_t> next_seq;
+  uint64_t received = 0;
+  bool out_of_order = false;
+
+  OrderedDispatcher()
+    : Dispatcher(g_ceph_context), lock("OrderedDispatcher::lock") {}
+  bool ms_dispatch(Message *m) override {
+    uint64_t seq;
+    auto p = m->get_data().begin();
+    decode(seq, p);
+    Mutex::Locker l(lock);
+    uint64_t& next = next_seq[m->get_connection()];
+    if (seq != next)
+      out_of_order = true;
+    next = seq + 1;
+    ++received;
+    cond.Signal();
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) override {
+    return true;
+  }
+  void ms_handle_remote_reset(Connection *con) override {}
+  bool ms_handle_refused(Connection *con) override {
+    return false;
+  }
+  bool ms_verify_authorizer(Connection *con, int peer_type, int protocol,
+                            bufferlist& authorizer, bufferlist& authorizer_reply,
+                            bool& isvalid, CryptoKey& session_key) override {
+    isvalid = true;
+    return true;
+  }
+};
+
+TEST_P(MessengerTest, ShardedDispatchTest) {
+  g_ceph_context->_conf->set_val("ms_dispatch_shards", "4");
+  OrderedDispatcher srv_dispatcher, cli_dispatcher;
+  Messenger *server = Messenger::create(
+    g_ceph_context, string(GetParam()), entity_name_t::OSD(1),
+    "sharded_server", getpid(), 0);
+  server->set_policy(entity_name_t::TYPE_CLIENT,
+                     Messenger::Policy::stateful_server(0));
+  entity_addr_t bind_addr;
+  bind_addr.parse("127.0.0.1");
+  server->bind(bind_addr);
+  server->add_dispatcher_head(&srv_dispatcher);
+  server->start();
+
+  const int num_clients = 8, num_msgs = 200;
+  vector<Messenger*> clients;
+  vector<ConnectionRef> conns;
+  for (int i = 0; i < num_clients; ++i) {
+    Messenger *c = Messenger::create(
+      g_ceph_context, string(GetParam()), entity_name_t::CLIENT(-1),
+      "sharded_client", getpid(), 0);
+    c->set_policy(entity_name_t::TYPE_OSD,
+                  Messenger::Policy::lossless_client(0));
+    c->add_dispatcher_head(&cli_dispatcher);
+    c->start();
+    clients.push_back(c);
+    conns.push_back(c->get_connection(server->get_myinst()));
+  }
+
+  // interleave the connections so every shard has several to juggle
+  for (uint64_t seq = 0; seq < num_msgs; ++seq) {
+    for (auto& conn : conns) {
+      bufferlist bl;
+      encode(seq, bl);
+      MPing *m = new MPing();
+      m->set_data(bl);
+      ASSERT_EQ(0, conn->send_message(m));
+    }
+  }
+  {
+    Mutex::Locker l(srv_dispatcher.lock);
+    while (srv_dispatcher.received < num_clients * num_msgs)
+      srv_dispatcher.cond.Wait(srv_dispatcher.lock);
+    ASSERT_FALSE(srv_dispatcher.out_of_order);
+    ASSERT_EQ(num_clients, (int)srv_dispatcher.next_seq.size());
+    srv_dispatcher.next_seq.clear();
+  }
+
+  conns.clear();
+  for (auto c : clients) {
+    c->shutdown();
+    c->wait();
+    delete c;
+  }
+  server->shutdown();
+  server->wait();
+  delete server;
+  g_ceph_context->_conf->set_val("ms_dispatch_shards", "1");
+}
+
 
 class SyntheticWorkload;
 
@@ -1221,6 +1393,39 @@ TEST_P(MessengerTest, SyntheticStressTest1) {
 }
 
 
+TEST_P(MessengerTest, SyntheticZeroCopyTest) {
+  // every send of 4K or more goes out with MSG_ZEROCOPY (posix stack);
+  // over loopback the kernel copies anyway and each socket turns it off
+  // after its first completion, so keep replacing connections
+  g_ceph_context->_conf->set_val("ms_async_send_zerocopy_min_bytes", "4096");
+  SyntheticWorkload test_msg(8, 32, GetParam(), 100,
+                             Messenger::Policy::stateful_server(0),
+                             Messenger::Policy::lossless_client(0));
+  for (int i = 0; i < 20; ++i) {
+    test_msg.generate_connection();
+  }
+  gen_type rng(time(NULL));
+  for (int i = 0; i < 2000; ++i) {
+    if (!(i % 10)) {
+      lderr(g_ceph_context) << "Op " << i << ": " << dendl;
+      test_msg.print_internal_state();
+    }
+    boost::uniform_int<> true_false(0, 99);
+    int val = true_false(rng);
+    if (val > 80) {
+      test_msg.generate_connection();
+    } else if (val > 60) {
+      test_msg.drop_connection();
+    } else if (val > 10) {
+      test_msg.send_message();
+    } else {
+      usleep(rand() % 1000 + 500);
+    }
+  }
+  test_msg.wait_for_done();
+  g_ceph_context->_conf->set_val("ms_async_send_zerocopy_min_bytes", "0");
+}
+
 TEST_P(MessengerTest, SyntheticInjectTest) {
   uint64_t dispatch_throttle_bytes = g_ceph_context->_conf->ms_dispatch_throttle_bytes;
   g_ceph_context->_conf->set_val("ms_inject_socket_failures", "30");
@@ -1499,6 +1704,7 @@ INSTANTIATE_TEST_CASE_P(
   MessengerTest,
   ::testing::Values(
     "async+posix",
+    "async+loopback",
     "simple"
   )
 );
@@ -0,0 +1,216 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Replay an allocation trace against the bluestore allocators and report
+ * allocate() latency and the resulting fragmentation.
+ *
+ * Trace format, one operation per line ('#' starts a comment):
+ *
+ *   a <id> <want> <alloc_unit> <max_alloc_size>   allocate, remember as <id>
+ *   r <id>                                         release allocation <id>
+ *
+ * Without a trace a synthetic RBD-like churn is generated instead.
+ */
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+
+#include "common/ceph_argparse.h"
+#include "common/ceph_time.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "include/stringify.h"
+#include "os/bluestore/Allocator.h"
+
+struct alloc_op_t {
+  bool alloc;
+  uint64_t id;
+  uint64_t want = 0, unit = 0, max = 0;
+};
+
+static void usage(const char *name)
+{
+  cout << "usage: " << name << " [options]\n"
+       << "  --trace <file>        replay this trace\n"
+       << "  --ops <n>             synthetic ops when no trace (default 1000000)\n"
+       << "  --size <bytes>        device size (default 1T)\n"
+       << "  --block-size <bytes>  device block size (default 4096)\n"
+       << "  --types <a,b,..>      allocators to run (default stupid,bitmap,hybrid)\n"
+       << std::endl;
+}
+
+static bool load_trace(const string& fn, vector<alloc_op_t> *ops)
+{
+  std::ifstream in(fn);
+  if (!in) {
+    cerr << "unable to open " << fn << std::endl;
+    return false;
+  }
+  string line;
+  unsigned lineno = 0;
+  while (std::getline(in, line)) {
+    ++lineno;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream is(line);
+    string op;
+    alloc_op_t o;
+    is >> op >> o.id;
+    if (op == "a") {
+      o.alloc = true;
+      is >> o.want >> o.unit >> o.max;
+    } else if (op == "r") {
+      o.alloc = false;
+    } else {
+      cerr << fn << ":" << lineno << ": bad op '" << op << "'" << std::endl;
+      return false;
+    }
+    if (is.fail()) {
+      cerr << fn << ":" << lineno << ": parse error" << std::endl;
+      return false;
+    }
+    ops->push_back(o);
+  }
+  return true;
+}
+
+/// random 4k..4m writes over a working set, overwriting (and so releasing)
+/// older allocations once the device is mostly full
+static void gen_churn(uint64_t num_ops, uint64_t size, vector<alloc_op_t> *ops)
+{
+  std::mt19937_64 rng(0);
+  uint64_t live = 0;
+  uint64_t next_id = 0;
+  map<uint64_t,uint64_t> outstanding; // id -> bytes
+  for (uint64_t i = 0; i < num_ops; ++i) {
+    if (live > size * 3 / 4 && !outstanding.empty()) {
+      auto p = outstanding.lower_bound(rng() % next_id);
+      if (p == outstanding.end()) {
+	p = outstanding.begin();
+      }
+      ops->push_back(alloc_op_t{false, p->first});
+      live -= p->second;
+      outstanding.erase(p);
+      continue;
+    }
+    uint64_t want = 4096ull << (rng() % 11);
+    ops->push_back(alloc_op_t{true, next_id, want, 4096, 524288});
+    outstanding[next_id++] = want;
+    live += want;
+  }
+}
+
+static void run(const string& type, uint64_t size, uint64_t block_size,
+		const vector<alloc_op_t>& ops)
+{
+  std::unique_ptr<Allocator> alloc(
+    Allocator::create(g_ceph_context, type, size, block_size));
+  if (!alloc) {
+    cerr << "unknown allocator " << type << std::endl;
+    return;
+  }
+  alloc->init_add_free(0, size);
+
+  map<uint64_t,PExtentVector> allocated;
+  uint64_t num_allocs = 0, failed = 0;
+  ceph::timespan total = ceph::timespan::zero();
+  ceph::timespan worst = ceph::timespan::zero();
+  for (auto& o : ops) {
+    if (o.alloc) {
+      if (alloc->reserve(o.want) < 0) {
+	++failed;
+	continue;
+      }
+      PExtentVector extents;
+      auto start = ceph::mono_clock::now();
+      int64_t r = alloc->allocate(o.want, o.unit, o.max, 0, &extents);
+      ceph::timespan dur = ceph::mono_clock::now() - start;
+      total += dur;
+      worst = std::max(worst, dur);
+      ++num_allocs;
+      if (r < (int64_t)o.want) {
+	++failed;
+	alloc->unreserve(o.want - std::max<int64_t>(r, 0));
+      }
+      allocated[o.id].swap(extents);
+    } else {
+      auto p = allocated.find(o.id);
+      if (p == allocated.end()) {
+	continue;
+      }
+      interval_set<uint64_t> release_set;
+      for (auto& e : p->second) {
+	release_set.insert(e.offset, e.length);
+      }
+      alloc->release(release_set);
+      allocated.erase(p);
+    }
+  }
+  cout << type << ": " << num_allocs << " allocs, " << failed << " failed, "
+       << "avg " << (num_allocs ? total / num_allocs : total)
+       << " max " << worst
+       << ", free " << pretty_si_t(alloc->get_free()) << "B"
+       << ", fragmentation " << alloc->get_fragmentation()
+       << std::endl;
+  alloc->shutdown();
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  auto cct = global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT,
+			 CODE_ENVIRONMENT_UTILITY,
+			 CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+
+  string trace;
+  uint64_t num_ops = 1000000;
+  uint64_t size = 1ull << 40;
+  uint64_t block_size = 4096;
+  string types = "stupid,bitmap,hybrid";
+  for (auto i = args.begin(); i != args.end();) {
+    string val;
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--trace", (char*)NULL)) {
+      trace = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--ops", (char*)NULL)) {
+      num_ops = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--size", (char*)NULL)) {
+      size = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--block-size", (char*)NULL)) {
+      block_size = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--types", (char*)NULL)) {
+      types = val;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      cerr << "unknown option " << *i << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  vector<alloc_op_t> ops;
+  if (!trace.empty()) {
+    if (!load_trace(trace, &ops)) {
+      return 1;
+    }
+  } else {
+    gen_churn(num_ops, size, &ops);
+  }
+  cout << ops.size() << " ops, device " << pretty_si_t(size) << "B" << std::endl;
+
+  std::istringstream ts(types);
+  string type;
+  while (std::getline(ts, type, ',')) {
+    run(type, size, block_size, ops);
+  }
+  return 0;
+}
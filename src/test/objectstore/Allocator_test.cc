@@ -4,6 +4,7 @@
  * In memory space allocator test cases.
  * Author: Ramesh Chander, Ramesh.Chander@sandisk.com
  */
+#include <cmath>
 #include <iostream>
 #include <boost/scoped_ptr.hpp>
 #include <gtest/gtest.h>
@@ -218,7 +219,7 @@ TEST_P(AllocTest, test_alloc_big)
 
 TEST_P(AllocTest, test_alloc_hint_bmap)
 {
-  if (GetParam() == std::string("stupid")) {
+  if (GetParam() != std::string("bitmap")) {
     return;
   }
   int64_t blocks = BitMapArea::get_level_factor(g_ceph_context, 2) * 4;
@@ -290,11 +291,197 @@ TEST_P(AllocTest, test_alloc_non_aligned_len)
   EXPECT_EQ(want_size, alloc->allocate(want_size, alloc_unit, 0, &extents));
 }
 
+TEST_P(AllocTest, test_alloc_fragmentation)
+{
+  if (GetParam() == std::string("bitmap")) {
+    return;
+  }
+  int64_t block_size = 4096;
+  int64_t blocks = 1024;
+  init_alloc(blocks * block_size, block_size);
+  alloc->init_add_free(0, blocks * block_size);
+  EXPECT_EQ(0.0, alloc->get_fragmentation());
+
+  // allocate everything in single blocks, then free every other one
+  EXPECT_EQ(0, alloc->reserve(blocks * block_size));
+  PExtentVector extents;
+  EXPECT_EQ(blocks * block_size,
+	    alloc->allocate(blocks * block_size, block_size, block_size,
+			    (int64_t) 0, &extents));
+  interval_set<uint64_t> release_set;
+  for (size_t i = 0; i < extents.size(); i += 2) {
+    release_set.insert(extents[i].offset, extents[i].length);
+  }
+  alloc->release(release_set);
+  EXPECT_EQ((uint64_t)blocks / 2 * block_size, alloc->get_free());
+  EXPECT_GT(alloc->get_fragmentation(), 0.9);
+
+  // and the rest, which coalesces it all again
+  release_set.clear();
+  for (size_t i = 1; i < extents.size(); i += 2) {
+    release_set.insert(extents[i].offset, extents[i].length);
+  }
+  alloc->release(release_set);
+  EXPECT_EQ(0.0, alloc->get_fragmentation());
+}
+
+TEST_P(AllocTest, test_alloc_hybrid_spill)
+{
+  if (GetParam() != std::string("hybrid")) {
+    return;
+  }
+  // room for 16 extents in the trees, the rest go to the bitmap
+  g_conf->set_val("bluestore_hybrid_alloc_mem_cap", "1024");
+  int64_t block_size = 4096;
+  int64_t blocks = 1024;
+  init_alloc(blocks * block_size, block_size);
+  g_conf->set_val("bluestore_hybrid_alloc_mem_cap", "64M");
+
+  for (int64_t i = 0; i < blocks; i += 2) {
+    alloc->init_add_free(i * block_size, block_size);
+  }
+  EXPECT_EQ((uint64_t)blocks / 2 * block_size, alloc->get_free());
+
+  // everything can still be allocated, most of it from the bitmap
+  EXPECT_EQ(0, alloc->reserve(blocks / 2 * block_size));
+  PExtentVector extents;
+  EXPECT_EQ(blocks / 2 * block_size,
+	    alloc->allocate(blocks / 2 * block_size, block_size, 0,
+			    (int64_t) 0, &extents));
+  EXPECT_EQ((size_t)blocks / 2, extents.size());
+  EXPECT_EQ(0u, alloc->get_free());
+  EXPECT_EQ(-ENOSPC, alloc->reserve(block_size));
+
+  // releasing the gaps too merges spilled blocks back into one extent
+  interval_set<uint64_t> release_set;
+  for (auto& e : extents) {
+    release_set.insert(e.offset, e.length);
+  }
+  for (int64_t i = 1; i < blocks; i += 2) {
+    release_set.insert(i * block_size, block_size);
+  }
+  alloc->release(release_set);
+  EXPECT_EQ((uint64_t)blocks * block_size, alloc->get_free());
+  EXPECT_EQ(0.0, alloc->get_fragmentation());
+  EXPECT_EQ(0, alloc->reserve(blocks * block_size));
+  extents.clear();
+  EXPECT_EQ(blocks * block_size,
+	    alloc->allocate(blocks * block_size, block_size, 0,
+			    (int64_t) 0, &extents));
+  EXPECT_EQ(1u, extents.size());
+}
+
+TEST_P(AllocTest, test_alloc_hybrid_bitmap_runs)
+{
+  if (GetParam() != std::string("hybrid")) {
+    return;
+  }
+  // keep only the largest extent in the trees
+  g_conf->set_val("bluestore_hybrid_alloc_mem_cap", "64");
+  int64_t block_size = 4096;
+  int64_t blocks = 2600;
+  init_alloc(blocks * block_size, block_size);
+  g_conf->set_val("bluestore_hybrid_alloc_mem_cap", "64M");
+
+  // runs of assorted lengths crossing bitmap words, one spanning two
+  // whole words, and the largest last
+  interval_set<uint64_t> expected;
+  for (int64_t i = 0; i < 46; ++i) {
+    expected.insert((i * 50 + i % 7) * block_size,
+		    (1 + (i * 13) % 40) * block_size);
+  }
+  expected.insert(2304 * block_size, 130 * block_size);
+  expected.insert(2440 * block_size, 160 * block_size);
+  double sum_sq = 0;
+  for (auto p = expected.begin(); p != expected.end(); ++p) {
+    alloc->init_add_free(p.get_start(), p.get_len());
+    sum_sq += (double)p.get_len() * p.get_len();
+  }
+
+  interval_set<uint64_t> got;
+  ASSERT_TRUE(alloc->foreach_free([&](uint64_t offset, uint64_t length) {
+	got.insert(offset, length);
+      }));
+  EXPECT_EQ(expected, got);
+  EXPECT_DOUBLE_EQ(1.0 - sqrt(sum_sq) / expected.size(),
+		   alloc->get_fragmentation());
+}
+
+TEST_P(AllocTest, test_alloc_fragmentation_churn)
+{
+  if (GetParam() == std::string("bitmap")) {
+    return;
+  }
+  // the hybrid allocator spills most extents to its bitmap
+  g_conf->set_val("bluestore_hybrid_alloc_mem_cap", "2048");
+  int64_t block_size = 4096;
+  int64_t blocks = 4096;
+  init_alloc(blocks * block_size, block_size);
+  g_conf->set_val("bluestore_hybrid_alloc_mem_cap", "64M");
+  alloc->init_add_free(0, blocks * block_size);
+  alloc->init_rm_free(100 * block_size, 300 * block_size);
+
+  // the score is kept up to date as extents are split and merged, so it
+  // must match one computed from the free extents
+  auto check = [&] {
+    double sum_sq = 0;
+    uint64_t free = 0;
+    ASSERT_TRUE(alloc->foreach_free([&](uint64_t offset, uint64_t length) {
+	  sum_sq += (double)length * length;
+	  free += length;
+	}));
+    ASSERT_EQ(alloc->get_free(), free);
+    double expected = free ? 1.0 - sqrt(sum_sq) / free : 0.0;
+    ASSERT_NEAR(expected, alloc->get_fragmentation(), 1e-9);
+  };
+
+  srand(1);
+  std::vector<PExtentVector> allocated;
+  for (int round = 0; round < 2000; ++round) {
+    if (allocated.empty() || rand() % 3) {
+      uint64_t want = (1 + rand() % 70) * block_size;
+      if (alloc->reserve(want) == 0) {
+	PExtentVector extents;
+	ASSERT_EQ((int64_t)want,
+		  alloc->allocate(want, block_size, 0, (int64_t)0, &extents));
+	allocated.push_back(extents);
+      }
+    } else {
+      size_t i = rand() % allocated.size();
+      interval_set<uint64_t> release_set;
+      for (auto& e : allocated[i]) {
+	release_set.insert(e.offset, e.length);
+      }
+      alloc->release(release_set);
+      allocated.erase(allocated.begin() + i);
+    }
+    if (round % 50 == 0) {
+      check();
+    }
+  }
+  check();
+
+  // giving it all back leaves one extent on either side of the hole
+  interval_set<uint64_t> release_set;
+  for (auto& extents : allocated) {
+    for (auto& e : extents) {
+      release_set.insert(e.offset, e.length);
+    }
+  }
+  alloc->release(release_set);
+  check();
+  EXPECT_EQ((uint64_t)(blocks - 300) * block_size, alloc->get_free());
+  interval_set<uint64_t> got;
+  ASSERT_TRUE(alloc->foreach_free([&](uint64_t offset, uint64_t length) {
+	got.insert(offset, length);
+      }));
+  EXPECT_EQ(2u, got.num_intervals());
+}
 
 INSTANTIATE_TEST_CASE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap"));
+  ::testing::Values("stupid", "bitmap", "hybrid"));
 
 #else
 
@@ -0,0 +1,147 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Measure Checksummer::calculate() and verify() throughput for each
+ * bluestore checksum type, over either one contiguous buffer or a
+ * bufferlist fragmented into unaligned pieces (as a read assembled from
+ * several extents and the cache would be).
+ */
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include "common/Checksummer.h"
+#include "common/ceph_argparse.h"
+#include "common/ceph_time.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "include/stringify.h"
+
+static void usage(const char *name)
+{
+  cout << "usage: " << name << " [options]\n"
+       << "  --size <bytes>        bytes per pass (default 4M)\n"
+       << "  --block-size <bytes>  csum block size (default 4096)\n"
+       << "  --iterations <n>      passes per type (default 256)\n"
+       << "  --types <a,b,..>      csum types (default crc32c,crc32c_16,crc32c_8,xxhash32,xxhash64)\n"
+       << "  --frag                split the data into unaligned fragments\n"
+       << std::endl;
+}
+
+template<class Alg>
+static void run(const string& type, size_t block_size, unsigned iterations,
+		const bufferlist& bl)
+{
+  size_t len = bl.length();
+  bufferptr csum(len / block_size * sizeof(typename Alg::value_t));
+
+  auto start = ceph::mono_clock::now();
+  for (unsigned i = 0; i < iterations; ++i) {
+    Checksummer::calculate<Alg>(block_size, 0, len, bl, &csum);
+  }
+  ceph::timespan calc = ceph::mono_clock::now() - start;
+
+  start = ceph::mono_clock::now();
+  for (unsigned i = 0; i < iterations; ++i) {
+    int r = Checksummer::verify<Alg>(block_size, 0, len, bl, csum);
+    assert(r == -1);
+  }
+  ceph::timespan verify = ceph::mono_clock::now() - start;
+
+  double mb = (double)len * iterations / 1048576;
+  cout << type << ": calculate "
+       << mb / std::chrono::duration<double>(calc).count() << " MB/s, "
+       << "verify "
+       << mb / std::chrono::duration<double>(verify).count() << " MB/s"
+       << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  auto cct = global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT,
+			 CODE_ENVIRONMENT_UTILITY,
+			 CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+
+  uint64_t size = 4 << 20;
+  uint64_t block_size = 4096;
+  unsigned iterations = 256;
+  string types = "crc32c,crc32c_16,crc32c_8,xxhash32,xxhash64";
+  bool frag = false;
+  for (auto i = args.begin(); i != args.end();) {
+    string val;
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--size", (char*)NULL)) {
+      size = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--block-size", (char*)NULL)) {
+      block_size = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--iterations", (char*)NULL)) {
+      iterations = strtoul(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--types", (char*)NULL)) {
+      types = val;
+    } else if (ceph_argparse_flag(args, i, "--frag", (char*)NULL)) {
+      frag = true;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      cerr << "unknown option " << *i << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!block_size || size < block_size) {
+    cerr << "size must be at least one block" << std::endl;
+    return 1;
+  }
+  size -= size % block_size;
+
+  bufferptr bp = buffer::create_page_aligned(size);
+  std::mt19937 rng(0);
+  for (unsigned i = 0; i < size; ++i) {
+    bp.c_str()[i] = rng();
+  }
+  bufferlist bl;
+  if (frag) {
+    uint64_t pos = 0;
+    while (pos < size) {
+      uint64_t l = std::min<uint64_t>(size - pos, 1 + rng() % (3 * block_size));
+      bl.append(bp, pos, l);
+      pos += l;
+    }
+  } else {
+    bl.append(bp);
+  }
+  cout << pretty_si_t(size) << "B in " << bl.get_num_buffers() << " buffers, "
+       << "block " << pretty_si_t(block_size) << "B, "
+       << iterations << " iterations" << std::endl;
+
+  std::istringstream ts(types);
+  string type;
+  while (std::getline(ts, type, ',')) {
+    switch (Checksummer::get_csum_string_type(type)) {
+    case Checksummer::CSUM_XXHASH32:
+      run<Checksummer::xxhash32>(type, block_size, iterations, bl);
+      break;
+    case Checksummer::CSUM_XXHASH64:
+      run<Checksummer::xxhash64>(type, block_size, iterations, bl);
+      break;
+    case Checksummer::CSUM_CRC32C:
+      run<Checksummer::crc32c>(type, block_size, iterations, bl);
+      break;
+    case Checksummer::CSUM_CRC32C_16:
+      run<Checksummer::crc32c_16>(type, block_size, iterations, bl);
+      break;
+    case Checksummer::CSUM_CRC32C_8:
+      run<Checksummer::crc32c_8>(type, block_size, iterations, bl);
+      break;
+    default:
+      cerr << "unknown csum type " << type << std::endl;
+    }
+  }
+  return 0;
+}
@@ -16,6 +16,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <time.h>
 #include <sys/mount.h>
 #include <boost/scoped_ptr.hpp>
@@ -4529,6 +4531,129 @@ TEST_P(StoreTestSpecificAUSize, SyntheticMatrixPreferDeferred) {
   do_matrix(m, store, doSyntheticTest);
 }
 
+TEST_P(StoreTestSpecificAUSize, SyntheticMatrixKVPipeline) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  // read when the kv threads start, i.e. on every (re)mount
+  g_conf->set_val("bluestore_kv_sync_pipeline", "true");
+  g_conf->set_val("bluestore_kv_finalize_threads", "4");
+
+  const char *m[][10] = {
+    { "bluestore_min_alloc_size", "4096", "65536", 0 }, // to be the first!
+    { "max_write", "65536", 0 },
+    { "max_size", "1048576", 0 },
+    { "alignment", "512", 0 },
+    { "bluestore_prefer_deferred_size", "32768", "0", 0},
+    { 0 },
+  };
+  do_matrix(m, store, doSyntheticTest);
+
+  g_conf->set_val("bluestore_kv_sync_pipeline", "false");
+  g_conf->set_val("bluestore_kv_finalize_threads", "1");
+  g_conf->apply_changes(NULL);
+}
+
+TEST_P(StoreTestSpecificAUSize, KVPipelineCommitOrder) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  g_conf->set_val("bluestore_kv_sync_pipeline", "true");
+  g_conf->set_val("bluestore_kv_finalize_threads", "4");
+  // make every write below deferred
+  g_conf->set_val("bluestore_prefer_deferred_size", "131072");
+  StartDeferred(65536);
+
+  int r;
+  const unsigned num_colls = 8, num_rounds = 100, num_slots = 16;
+  const unsigned block = 4096;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  vector<coll_t> cids;
+  vector<ObjectStore::CollectionHandle> chs;
+  for (unsigned i = 0; i < num_colls; ++i) {
+    cids.push_back(coll_t(spg_t(pg_t(i, 601), shard_id_t::NO_SHARD)));
+    chs.push_back(store->create_new_collection(cids[i]));
+    ObjectStore::Transaction t;
+    t.create_collection(cids[i], 0);
+    t.touch(cids[i], hoid);
+    r = queue_transaction(store, chs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // every sequencer must see its commits in submission order, whichever
+  // finalize thread it lands on
+  std::mutex lock;
+  vector<vector<unsigned>> committed(num_colls);
+  for (unsigned round = 0; round < num_rounds; ++round) {
+    for (unsigned i = 0; i < num_colls; ++i) {
+      ObjectStore::Transaction t;
+      bufferlist bl;
+      bl.append(string(block, 'a' + (round + i) % 26));
+      t.write(cids[i], hoid, (round % num_slots) * block, block, bl);
+      t.register_on_commit(new FunctionContext([&, i, round](int) {
+	    std::lock_guard<std::mutex> l(lock);
+	    committed[i].push_back(round);
+	  }));
+      r = store->queue_transaction(chs[i], std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+  for (unsigned i = 0; i < num_colls; ++i) {
+    C_SaferCond c;
+    ObjectStore::Transaction t;
+    t.register_on_commit(&c);
+    r = store->queue_transaction(chs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+    c.wait();
+  }
+  {
+    std::lock_guard<std::mutex> l(lock);
+    for (unsigned i = 0; i < num_colls; ++i) {
+      ASSERT_EQ(num_rounds, committed[i].size());
+      for (unsigned round = 0; round < num_rounds; ++round) {
+	ASSERT_EQ(round, committed[i][round]);
+      }
+    }
+  }
+
+  auto verify = [&]() {
+    for (unsigned i = 0; i < num_colls; ++i) {
+      bufferlist expected, bl;
+      for (unsigned slot = 0; slot < num_slots; ++slot) {
+	// the last round that wrote this slot
+	unsigned last = slot + (num_rounds - 1 - slot) / num_slots * num_slots;
+	expected.append(string(block, 'a' + (last + i) % 26));
+      }
+      r = store->read(chs[i], hoid, 0, num_slots * block, bl);
+      ASSERT_EQ((int)(num_slots * block), r);
+      ASSERT_TRUE(bl_eq(expected, bl));
+    }
+  };
+  verify();
+
+  // deferred writes may still be pending; they must be replayed or
+  // flushed across a remount
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  for (unsigned i = 0; i < num_colls; ++i) {
+    chs[i] = store->open_collection(cids[i]);
+  }
+  verify();
+
+  for (unsigned i = 0; i < num_colls; ++i) {
+    ObjectStore::Transaction t;
+    t.remove(cids[i], hoid);
+    t.remove_collection(cids[i]);
+    r = queue_transaction(store, chs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  g_conf->set_val("bluestore_kv_sync_pipeline", "false");
+  g_conf->set_val("bluestore_kv_finalize_threads", "1");
+  g_conf->set_val("bluestore_prefer_deferred_size", "0");
+}
+
 TEST_P(StoreTest, AttrSynthetic) {
   MixedGenerator gen(447);
   gen_type rng(time(NULL));
@@ -6703,6 +6828,83 @@ TEST_P(StoreTest, KVDBStatsTest) {
 }
 
 #if defined(WITH_BLUESTORE)
+TEST_P(StoreTest, BluestoreReadahead) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  g_conf->set_val("bluestore_default_buffered_read", "false");
+  g_conf->set_val("bluestore_readahead_max_bytes", "1048576");
+  g_conf->set_val("bluestore_readahead_min_bytes", "65536");
+  g_conf->set_val("bluestore_readahead_trigger_requests", "2");
+  g_conf->apply_changes(NULL);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  const unsigned obj_len = 4 * 1048576;
+  const unsigned read_len = 65536;
+  bufferlist data;
+  for (unsigned i = 0; i < obj_len / read_len; ++i) {
+    data.append(string(read_len, 'a' + i % 26));
+  }
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, hoid, 0, data.length(), data);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // start with a cold cache
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t fetched = logger->get(l_bluestore_readahead_bytes);
+  uint64_t hits = logger->get(l_bluestore_readahead_hit_bytes);
+  for (unsigned off = 0; off < obj_len; off += read_len) {
+    if (off == obj_len / 2) {
+      // overwrite data that is (probably) being read ahead; the reader
+      // must see the new contents
+      ObjectStore::Transaction t;
+      bufferlist bl;
+      bl.append(string(read_len, '!'));
+      t.write(cid, hoid, off + read_len, bl.length(), bl);
+      r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+      bufferlist expected;
+      expected.substr_of(data, 0, off + read_len);
+      expected.append(bl);
+      expected.append(data.c_str() + off + 2 * read_len,
+		      obj_len - off - 2 * read_len);
+      data.swap(expected);
+    }
+    bufferlist bl, expected;
+    r = store->read(ch, hoid, off, read_len, bl);
+    ASSERT_EQ((int)read_len, r);
+    expected.substr_of(data, off, read_len);
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+  ASSERT_GT(logger->get(l_bluestore_readahead_bytes), fetched);
+  ASSERT_GT(logger->get(l_bluestore_readahead_hit_bytes), hits);
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  g_conf->set_val("bluestore_default_buffered_read", "true");
+  g_conf->set_val("bluestore_readahead_max_bytes", "0");
+  g_conf->set_val("bluestore_readahead_min_bytes", "65536");
+  g_conf->set_val("bluestore_readahead_trigger_requests", "2");
+  g_conf->apply_changes(NULL);
+}
+
 TEST_P(StoreTestSpecificAUSize, garbageCollection) {
   int r;
   coll_t cid;
@@ -7066,6 +7268,417 @@ TEST_P(StoreTest, BluestoreRepairTest) {
 
   g_ceph_context->_conf->apply_changes(NULL);
 }
+
+TEST_P(StoreTestSpecificAUSize, BluestoreLocklessReadsStress) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  // cache shards pick the option up when they are created, and a tiny
+  // cache keeps the trimmer busy underneath the readers
+  g_conf->set_val("bluestore_cache_lockless_reads", "true");
+  g_conf->set_val("bluestore_cache_size", "2000000");
+  g_conf->set_val("bluestore_default_buffered_read", "true");
+  StartDeferred(65536);
+
+  int r;
+  const unsigned num_objects = 200;
+  const unsigned obj_len = 16384;
+  coll_t cid(spg_t(pg_t(0, 53), shard_id_t::NO_SHARD));
+  coll_t tid(spg_t(pg_t(2, 53), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  auto tch = store->create_new_collection(tid);
+
+  // object i is named obj<i> or obj<i>-r; odd ones go to tid on split
+  auto make_oid = [](unsigned i, bool renamed) {
+    return ghobject_t(hobject_t(
+      "obj" + stringify(i) + (renamed ? "-r" : ""), "", CEPH_NOSNAP,
+      i << 1, 53, ""));
+  };
+  vector<bufferlist> contents(num_objects);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 1);
+    for (unsigned i = 0; i < num_objects; ++i) {
+      string tag = stringify(i) + ":";
+      while (contents[i].length() < obj_len)
+	contents[i].append(tag);
+      contents[i].splice(obj_len, contents[i].length() - obj_len);
+      t.write(cid, make_oid(i, false), 0, obj_len, contents[i]);
+    }
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // nothing may ASSERT while the readers run: the worker threads can't
+  // fail the test, and returning early would leave them joinable.
+  // results are collected and checked once they are joined.
+  std::atomic<bool> stop = { false };
+  std::atomic<unsigned> bad_reads = { 0 };
+  std::atomic<int> first_bad = { -1 };
+  std::atomic<uint64_t> good_reads = { 0 };
+  int txn_r = 0;
+  vector<std::thread> readers;
+  for (unsigned n = 0; n < 4; ++n) {
+    readers.emplace_back([&, n]() {
+      gen_type rng(n);
+      boost::uniform_int<> pick(0, num_objects - 1);
+      while (!stop) {
+	unsigned i = pick(rng);
+	// the object may be under either name and in either collection
+	// right now; whichever read finds it must see its data
+	for (auto c : { ch, tch }) {
+	  for (bool renamed : { false, true }) {
+	    bufferlist bl;
+	    int rr = store->read(c, make_oid(i, renamed), 0, obj_len, bl);
+	    if (rr == -ENOENT)
+	      continue;
+	    if (rr != (int)obj_len || !bl_eq(contents[i], bl)) {
+	      int none = -1;
+	      first_bad.compare_exchange_strong(none, i);
+	      ++bad_reads;
+	    } else {
+	      ++good_reads;
+	    }
+	  }
+	}
+      }
+    });
+  }
+
+  auto rename_all = [&](bool split, bool to_renamed) {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i < num_objects; ++i) {
+      coll_t c = (split && (i & 1)) ? tid : cid;
+      t.collection_move_rename(c, make_oid(i, !to_renamed),
+			       c, make_oid(i, to_renamed));
+      if (i % 20 == 19) {
+	int rr = queue_transaction(store, ch, std::move(t));
+	if (rr && !txn_r)
+	  txn_r = rr;
+	t = ObjectStore::Transaction();
+      }
+    }
+  };
+  bool renamed = false;
+  for (unsigned round = 0; round < 6; ++round) {
+    renamed = !renamed;
+    rename_all(false, renamed);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(tid, 2);
+    t.split_collection(cid, 2, 2, tid);
+    r = queue_transaction(store, tch, std::move(t));
+    if (r && !txn_r)
+      txn_r = r;
+  }
+  tch->flush();
+  for (unsigned round = 0; round < 6; ++round) {
+    renamed = !renamed;
+    rename_all(true, renamed);
+  }
+  ch->flush();
+  tch->flush();
+
+  stop = true;
+  for (auto& t : readers)
+    t.join();
+  ASSERT_EQ(0, txn_r);
+  ASSERT_EQ(0u, bad_reads.load()) << "first bad read of obj"
+				  << first_bad.load();
+  ASSERT_GT(good_reads.load(), 0u);
+
+  for (unsigned i = 0; i < num_objects; ++i) {
+    bufferlist bl;
+    auto& c = (i & 1) ? tch : ch;
+    r = store->read(c, make_oid(i, renamed), 0, obj_len, bl);
+    ASSERT_EQ((int)obj_len, r);
+    ASSERT_TRUE(bl_eq(contents[i], bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i < num_objects; ++i) {
+      t.remove((i & 1) ? tid : cid, make_oid(i, renamed));
+    }
+    t.remove_collection(cid);
+    t.remove_collection(tid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  g_conf->set_val("bluestore_cache_lockless_reads", "false");
+  g_conf->set_val("bluestore_cache_size", "0");
+}
+
+// Allocator checkpoint tests: each remount is followed by a write that
+// has to come from space the rebuilt allocator believes is free, and
+// every earlier object is read back from disk to catch double allocation.
+static const unsigned alloc_checkpoint_obj_len = 0x100000;
+
+static ghobject_t alloc_checkpoint_oid(unsigned i)
+{
+  return ghobject_t(hobject_t(sobject_t("ac" + stringify(i), CEPH_NOSNAP)));
+}
+
+static void alloc_checkpoint_write_and_verify(
+  ObjectStore *store, const coll_t& cid, unsigned n)
+{
+  auto ch = store->open_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(alloc_checkpoint_obj_len, 'a' + n % 26));
+    t.write(cid, alloc_checkpoint_oid(n), 0, bl.length(), bl);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  for (unsigned i = 0; i < n; ++i) {
+    bufferlist expected, bl;
+    expected.append(std::string(alloc_checkpoint_obj_len, 'a' + i % 26));
+    ASSERT_EQ((int)alloc_checkpoint_obj_len,
+	      store->read(ch, alloc_checkpoint_oid(i), 0,
+			  alloc_checkpoint_obj_len, bl));
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+}
+
+static void alloc_checkpoint_cleanup(
+  ObjectStore *store, const coll_t& cid, unsigned n)
+{
+  auto ch = store->open_collection(cid);
+  ObjectStore::Transaction t;
+  for (unsigned i = 0; i < n; ++i) {
+    t.remove(cid, alloc_checkpoint_oid(i));
+  }
+  t.remove_collection(cid);
+  ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+}
+
+TEST_P(StoreTestSpecificAUSize, BluestoreAllocCheckpointReload) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  g_conf->set_val("bluestore_alloc_checkpoint", "true");
+  StartDeferred(65536);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t loaded = logger->get(l_bluestore_alloc_checkpoint_loaded);
+  coll_t cid(spg_t(pg_t(0, 611), shard_id_t::NO_SHARD));
+  {
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  alloc_checkpoint_write_and_verify(store.get(), cid, 0);
+
+  for (unsigned n = 1; n < 4; ++n) {
+    store_statfs_t before, after;
+    ASSERT_EQ(0, store->statfs(&before));
+    store->umount();
+    // a plain fsck must leave the checkpoint for the next mount
+    ASSERT_EQ(0, store->fsck(false));
+    ASSERT_EQ(0, store->mount());
+    ASSERT_EQ(loaded + n, logger->get(l_bluestore_alloc_checkpoint_loaded));
+    ASSERT_EQ(0, store->statfs(&after));
+    ASSERT_EQ(before.available, after.available);
+    alloc_checkpoint_write_and_verify(store.get(), cid, n);
+  }
+
+  // repair consumes it
+  store->umount();
+  ASSERT_EQ(0, store->repair(false));
+  ASSERT_EQ(loaded + 4, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded + 4, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  alloc_checkpoint_write_and_verify(store.get(), cid, 4);
+
+  alloc_checkpoint_cleanup(store.get(), cid, 5);
+  g_conf->set_val("bluestore_alloc_checkpoint", "false");
+}
+
+TEST_P(StoreTestSpecificAUSize, BluestoreAllocCheckpointCrash) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  g_conf->set_val("bluestore_alloc_checkpoint", "true");
+  StartDeferred(65536);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t loaded = logger->get(l_bluestore_alloc_checkpoint_loaded);
+  coll_t cid(spg_t(pg_t(0, 612), shard_id_t::NO_SHARD));
+  {
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  alloc_checkpoint_write_and_verify(store.get(), cid, 0);
+
+  // die between writing the checkpoint and recording its nonce
+  g_conf->set_val("bluestore_debug_alloc_checkpoint_omit_key", "true");
+  store->umount();
+  g_conf->set_val("bluestore_debug_alloc_checkpoint_omit_key", "false");
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  alloc_checkpoint_write_and_verify(store.get(), cid, 1);
+
+  // die after a checkpoint was loaded and the store was written to; not
+  // saving on umount leaves the kv store exactly as a crash would
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded + 1, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  alloc_checkpoint_write_and_verify(store.get(), cid, 2);
+  g_conf->set_val("bluestore_alloc_checkpoint", "false");
+  store->umount();
+  g_conf->set_val("bluestore_alloc_checkpoint", "true");
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded + 1, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  alloc_checkpoint_write_and_verify(store.get(), cid, 3);
+
+  store->umount();
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  alloc_checkpoint_cleanup(store.get(), cid, 4);
+  g_conf->set_val("bluestore_alloc_checkpoint", "false");
+}
+
+TEST_P(StoreTestSpecificAUSize, BluestoreAllocCheckpointDisabled) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  g_conf->set_val("bluestore_alloc_checkpoint", "true");
+  StartDeferred(65536);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t loaded = logger->get(l_bluestore_alloc_checkpoint_loaded);
+  coll_t cid(spg_t(pg_t(0, 613), shard_id_t::NO_SHARD));
+  {
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  alloc_checkpoint_write_and_verify(store.get(), cid, 0);
+
+  // saved with the option on, then mounted with it off: discarded
+  store->umount();
+  g_conf->set_val("bluestore_alloc_checkpoint", "false");
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  alloc_checkpoint_write_and_verify(store.get(), cid, 1);
+
+  // and not saved either
+  store->umount();
+  g_conf->set_val("bluestore_alloc_checkpoint", "true");
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  alloc_checkpoint_write_and_verify(store.get(), cid, 2);
+
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded + 1, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  alloc_checkpoint_write_and_verify(store.get(), cid, 3);
+
+  store->umount();
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  alloc_checkpoint_cleanup(store.get(), cid, 4);
+  g_conf->set_val("bluestore_alloc_checkpoint", "false");
+}
+
+TEST_P(StoreTestSpecificAUSize, BluestoreAllocCheckpointStaleNonce) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  g_conf->set_val("bluestore_alloc_checkpoint", "true");
+  StartDeferred(65536);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t loaded = logger->get(l_bluestore_alloc_checkpoint_loaded);
+  coll_t cid(spg_t(pg_t(0, 614), shard_id_t::NO_SHARD));
+  {
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  alloc_checkpoint_write_and_verify(store.get(), cid, 0);
+
+  g_conf->set_val("bluestore_debug_alloc_checkpoint_stale_nonce", "true");
+  store->umount();
+  g_conf->set_val("bluestore_debug_alloc_checkpoint_stale_nonce", "false");
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  alloc_checkpoint_write_and_verify(store.get(), cid, 1);
+
+  // the stale nonce was consumed, the next clean umount saves again
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded + 1, logger->get(l_bluestore_alloc_checkpoint_loaded));
+  alloc_checkpoint_write_and_verify(store.get(), cid, 2);
+
+  store->umount();
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  alloc_checkpoint_cleanup(store.get(), cid, 3);
+  g_conf->set_val("bluestore_alloc_checkpoint", "false");
+}
+
+TEST_P(StoreTestSpecificAUSize, BluestoreExtentMapV3Fence) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  g_conf->set_val("bluestore_extent_map_shard_compact", "false");
+  StartDeferred(65536);
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+
+  coll_t cid(spg_t(pg_t(0, 615), shard_id_t::NO_SHARD));
+  ghobject_t hoid(hobject_t("Object 1", "", CEPH_NOSNAP, 0, 0, ""));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    bufferlist bl;
+    bl.append(std::string(0x10000, 'a'));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  // legacy shards leave older releases able to mount us
+  ASSERT_FALSE(bstore->is_extent_map_v3_fenced());
+
+  g_conf->set_val("bluestore_extent_map_shard_compact", "true");
+  g_conf->apply_changes(NULL);
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(0x10000, 'b'));
+    t.write(cid, hoid, 0x10000, bl.length(), bl);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  ASSERT_TRUE(bstore->is_extent_map_v3_fenced());
+
+  // the fence is persistent, even once compact shards are turned off
+  g_conf->set_val("bluestore_extent_map_shard_compact", "false");
+  g_conf->apply_changes(NULL);
+  ch.reset();
+  store->umount();
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  ASSERT_TRUE(bstore->is_extent_map_v3_fenced());
+  ch = store->open_collection(cid);
+  {
+    bufferlist expected, bl;
+    expected.append(std::string(0x10000, 'a'));
+    expected.append(std::string(0x10000, 'b'));
+    ASSERT_EQ(0x20000, store->read(ch, hoid, 0, 0x20000, bl));
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+}
 #endif  // WITH_BLUESTORE
 
 int main(int argc, char **argv) {
@@ -0,0 +1,129 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "common/ceph_argparse.h"
+#include "common/ceph_context.h"
+#include "common/config.h"
+#include "include/stringify.h"
+#include <gtest/gtest.h>
+
+#include "os/bluestore/BlockDevice.h"
+#include "os/bluestore/ioring.h"
+
+static string get_temp_bdev(uint64_t size)
+{
+  static int n = 0;
+  string fn = "ceph_test_bdev.tmp.block." + stringify(getpid())
+    + "." + stringify(++n);
+  int fd = ::open(fn.c_str(), O_CREAT|O_RDWR|O_TRUNC, 0644);
+  assert(fd >= 0);
+  int r = ::ftruncate(fd, size);
+  assert(r >= 0);
+  ::close(fd);
+  return fn;
+}
+
+static void aio_cb(void *priv, void *priv2)
+{
+}
+
+class KernelDeviceTest : public ::testing::TestWithParam<const char*> {
+public:
+  string fn;
+  BlockDevice *bdev = nullptr;
+
+  void SetUp() override {
+    // ioring_hipri reaps by polling if the filesystem under the temp
+    // file supports it, and otherwise exercises the fallback
+    bool hipri = string(GetParam()) == "ioring_hipri";
+    bool ioring = hipri || string(GetParam()) == "ioring";
+    if (ioring && !ioring_queue_t::supported()) {
+      return;
+    }
+    g_ceph_context->_conf->set_val("bdev_ioring", ioring ? "true" : "false");
+    g_ceph_context->_conf->set_val("bdev_ioring_hipri",
+				   hipri ? "true" : "false");
+    g_ceph_context->_conf->apply_changes(NULL);
+    fn = get_temp_bdev(64 * 1048576);
+    bdev = BlockDevice::create(g_ceph_context, fn, aio_cb, nullptr,
+			       aio_cb, nullptr);
+    ASSERT_EQ(0, bdev->open(fn));
+  }
+  void TearDown() override {
+    if (bdev) {
+      bdev->close();
+      delete bdev;
+      ::unlink(fn.c_str());
+    }
+    g_ceph_context->_conf->set_val("bdev_ioring", "false");
+    g_ceph_context->_conf->set_val("bdev_ioring_hipri", "false");
+    g_ceph_context->_conf->apply_changes(NULL);
+  }
+};
+
+TEST_P(KernelDeviceTest, write_read) {
+  if (!bdev) {
+    cout << "io_uring not supported, skipping" << std::endl;
+    return;
+  }
+  const unsigned num = 256;
+  const uint64_t len = 16384;
+
+  IOContext wioc(g_ceph_context, nullptr);
+  for (unsigned i = 0; i < num; ++i) {
+    bufferlist bl;
+    bl.append(buffer::create_page_aligned(len));
+    memset(bl.c_str(), 'a' + i % 26, len);
+    ASSERT_EQ(0, bdev->aio_write(i * len, bl, &wioc, false));
+  }
+  bdev->aio_submit(&wioc);
+  wioc.aio_wait();
+  ASSERT_EQ(0, bdev->flush());
+
+  // read back through aio and the synchronous path
+  IOContext rioc(g_ceph_context, nullptr);
+  vector<bufferlist> bls(num);
+  for (unsigned i = 0; i < num; ++i) {
+    ASSERT_EQ(0, bdev->aio_read(i * len, len, &bls[i], &rioc));
+  }
+  bdev->aio_submit(&rioc);
+  rioc.aio_wait();
+  for (unsigned i = 0; i < num; ++i) {
+    ASSERT_EQ(len, bls[i].length());
+    bufferlist bl;
+    IOContext ioc(g_ceph_context, nullptr);
+    ASSERT_EQ(0, bdev->read(i * len, len, &bl, &ioc, false));
+    ASSERT_TRUE(bl.contents_equal(bls[i]));
+    for (unsigned j = 0; j < len; ++j) {
+      ASSERT_EQ((char)('a' + i % 26), bls[i][j]);
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+  KernelDevice,
+  KernelDeviceTest,
+  ::testing::Values(
+    "aio",
+    "ioring",
+    "ioring_hipri"));
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  auto cct = global_init(nullptr, args, CEPH_ENTITY_TYPE_CLIENT,
+			 CODE_ENVIRONMENT_UTILITY,
+			 CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
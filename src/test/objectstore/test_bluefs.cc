@@ -13,6 +13,7 @@
 #include "include/stringify.h"
 #include "include/scope_guard.h"
 #include "common/errno.h"
+#include "common/perf_counters.h"
 #include <gtest/gtest.h>
 
 #include "os/bluestore/BlueFS.h"
@@ -567,6 +568,142 @@ TEST(BlueFS, test_replay) {
   rm_temp_bdev(fn);
 }
 
+TEST(BlueFS, test_wal_and_db_writers) {
+  uint64_t size = 1048576 * 128;
+  string fn_db = get_temp_bdev(size);
+  string fn_wal = get_temp_bdev(size);
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_WAL, fn_wal, false));
+  fs.add_block_extent(BlueFS::BDEV_WAL, 1048576, size - 1048576);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, fn_db, false));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, size - 1048576);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.mkdir("db"));
+  ASSERT_EQ(0, fs.mkdir("db.wal"));
+
+  const unsigned wal_records = 2000;
+  const char *rec = "0123456789abcdef";
+  const uint64_t sst_chunk = 1048576;
+  const unsigned sst_chunks = 32;
+  std::unique_ptr<char[]> sst_data = gen_buffer(sst_chunk);
+
+  // a WAL writer doing small synchronous appends while SST output is
+  // being flushed to the db device
+  int wal_r = 0, sst_r = 0;
+  std::thread wal([&]() {
+      BlueFS::FileWriter *h;
+      wal_r = fs.open_for_write("db.wal", "000001.log", &h, false);
+      if (wal_r < 0)
+	return;
+      for (unsigned i = 0; i < wal_records && wal_r == 0; ++i) {
+	h->append(rec, 16);
+	wal_r = fs.fsync(h);
+      }
+      fs.close_writer(h);
+    });
+  std::thread sst([&]() {
+      BlueFS::FileWriter *h;
+      sst_r = fs.open_for_write("db", "000002.sst", &h, false);
+      if (sst_r < 0)
+	return;
+      for (unsigned i = 0; i < sst_chunks; ++i) {
+	h->append(sst_data.get(), sst_chunk);
+	fs.flush(h);
+      }
+      sst_r = fs.fsync(h);
+      fs.close_writer(h);
+    });
+  wal.join();
+  sst.join();
+  ASSERT_EQ(0, wal_r);
+  ASSERT_EQ(0, sst_r);
+
+  {
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("db.wal", "000001.log", &h));
+    bufferlist bl;
+    BlueFS::FileReaderBuffer buf(4096);
+    ASSERT_EQ((int)(wal_records * 16),
+	      fs.read(h, &buf, 0, wal_records * 16, &bl, NULL));
+    for (unsigned i = 0; i < wal_records; ++i) {
+      ASSERT_EQ(0, memcmp(rec, bl.c_str() + i * 16, 16));
+    }
+    delete h;
+  }
+  {
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("db", "000002.sst", &h));
+    for (unsigned i = 0; i < sst_chunks; ++i) {
+      bufferlist bl;
+      ASSERT_EQ((int)sst_chunk,
+		fs.read(h, &h->buf, i * sst_chunk, sst_chunk, &bl, NULL));
+      ASSERT_EQ(0, memcmp(sst_data.get(), bl.c_str(), sst_chunk));
+    }
+    delete h;
+  }
+  fs.umount();
+  // the file sizes and extents must have made it to the log
+  ASSERT_EQ(0, fs.mount());
+  uint64_t wal_size, sst_size;
+  ASSERT_EQ(0, fs.stat("db.wal", "000001.log", &wal_size, NULL));
+  ASSERT_EQ(0, fs.stat("db", "000002.sst", &sst_size, NULL));
+  ASSERT_EQ(wal_records * 16, wal_size);
+  ASSERT_EQ(sst_chunk * sst_chunks, sst_size);
+  fs.umount();
+  rm_temp_bdev(fn_db);
+  rm_temp_bdev(fn_wal);
+}
+
+TEST(BlueFS, test_log_commit_flushes_other_devices) {
+  uint64_t size = 1048576 * 128;
+  string fn_db = get_temp_bdev(size);
+  string fn_wal = get_temp_bdev(size);
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_WAL, fn_wal, false));
+  fs.add_block_extent(BlueFS::BDEV_WAL, 1048576, size - 1048576);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, fn_db, false));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, size - 1048576);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.mkdir("db"));
+  ASSERT_EQ(0, fs.mkdir("db.wal"));
+  {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.open_for_write("db.wal", "000001.log", &h, false));
+    h->append("init", 4);
+    ASSERT_EQ(0, fs.fsync(h));
+    fs.close_writer(h);
+  }
+
+  // an SST on the db device, flushed but not fsynced: its new size and
+  // extents go out with the next log commit
+  const uint64_t sst_len = 1048576;
+  std::unique_ptr<char[]> sst_data = gen_buffer(sst_len);
+  BlueFS::FileWriter *sst;
+  ASSERT_EQ(0, fs.open_for_write("db", "000002.sst", &sst, false));
+  sst->append(sst_data.get(), sst_len);
+  fs.flush(sst);
+
+  // a new WAL file on the wal device commits the log, which must not
+  // become durable before the SST data it now points at
+  PerfCounters *logger = fs.get_perf_counters();
+  uint64_t db_flushes = logger->get_tavg_ns(l_bluefs_db_flush_lat).first;
+  BlueFS::FileWriter *wal;
+  ASSERT_EQ(0, fs.open_for_write("db.wal", "000003.log", &wal, false));
+  wal->append("0123456789abcdef", 16);
+  ASSERT_EQ(0, fs.fsync(wal));
+  ASSERT_LT(db_flushes, logger->get_tavg_ns(l_bluefs_db_flush_lat).first);
+
+  fs.close_writer(wal);
+  fs.close_writer(sst);
+  fs.umount();
+  rm_temp_bdev(fn_db);
+  rm_temp_bdev(fn_wal);
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
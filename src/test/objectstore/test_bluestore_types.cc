@@ -306,6 +306,57 @@ TEST(bluestore_blob_t, calc_csum)
   }
 }
 
+TEST(bluestore_blob_t, calc_csum_fragmented)
+{
+  // blocks straddling buffer boundaries must checksum the same as when
+  // the data is contiguous
+  const unsigned len = 0x10000;
+  bufferptr bp(len);
+  for (unsigned i = 0; i < len; ++i)
+    bp.c_str()[i] = i * 13 + (i >> 10);
+  bufferlist contig;
+  contig.append(bp);
+  bufferlist frag;
+  unsigned pos = 0, step = 1;
+  while (pos < len) {
+    unsigned l = std::min(len - pos, step);
+    frag.append(bp, pos, l);
+    pos += l;
+    step = step * 3 + 1;
+  }
+  ASSERT_EQ(len, frag.length());
+  ASSERT_GT(frag.get_num_buffers(), 1u);
+
+  for (unsigned csum_type = Checksummer::CSUM_NONE + 1;
+       csum_type < Checksummer::CSUM_MAX;
+       ++csum_type) {
+    for (unsigned order : {9, 12}) {
+      bluestore_blob_t a, b;
+      a.init_csum(csum_type, order, len);
+      b.init_csum(csum_type, order, len);
+      a.calc_csum(0, contig);
+      b.calc_csum(0, frag);
+      ASSERT_EQ(a.csum_data.length(), b.csum_data.length());
+      ASSERT_EQ(0, memcmp(a.csum_data.c_str(), b.csum_data.c_str(),
+			  a.csum_data.length()));
+      int bad_off;
+      uint64_t bad_csum;
+      ASSERT_EQ(0, a.verify_csum(0, frag, &bad_off, &bad_csum));
+      ASSERT_EQ(-1, bad_off);
+
+      // corrupt a byte in a late block; it must be reported, not an
+      // earlier one
+      bufferlist bad;
+      bad.append(frag);
+      bad.rebuild();
+      unsigned corrupt = len - (1u << order) * 3 + 5;
+      bad.c_str()[corrupt] ^= 1;
+      ASSERT_EQ(-1, a.verify_csum(0, bad, &bad_off, &bad_csum));
+      ASSERT_EQ((int)(corrupt & ~((1u << order) - 1)), bad_off);
+    }
+  }
+}
+
 TEST(bluestore_blob_t, csum_bench)
 {
   bufferlist bl;
@@ -1179,6 +1230,111 @@ TEST(ExtentMap, compress_extent_map)
   ASSERT_EQ(6u, em.extent_map.size());
 }
 
+static void populate_extent_map(BlueStore::Collection *coll,
+				BlueStore::ExtentMap& em,
+				unsigned num_blobs)
+{
+  // fragmented object: each blob is 8k with csum, referenced by two 4k
+  // extents, with a hole after every blob
+  for (unsigned i = 0; i < num_blobs; ++i) {
+    BlueStore::BlobRef b(new BlueStore::Blob);
+    b->shared_blob = new BlueStore::SharedBlob(coll);
+    b->dirty_blob().allocated_test(
+      bluestore_pextent_t(0x100000 + i * 0x10000, 0x2000));
+    b->dirty_blob().init_csum(Checksummer::CSUM_CRC32C, 12, 0x2000);
+    uint32_t off = i * 0x3000;
+    em.extent_map.insert(*new BlueStore::Extent(off, 0, 0x1000, b));
+    em.extent_map.insert(*new BlueStore::Extent(off + 0x1000, 0x1000, 0x1000,
+						b));
+  }
+}
+
+TEST(ExtentMap, encode_decode_compact)
+{
+  BlueStore store(g_ceph_context, "", 4096);
+  BlueStore::LRUCache cache(g_ceph_context);
+  BlueStore::CollectionRef coll(new BlueStore::Collection(&store, &cache, coll_t()));
+  BlueStore::Onode onode(coll.get(), ghobject_t(), "");
+
+  // nothing to fence, there is no db
+  store.inject_extent_map_v3_fence();
+  for (auto compact : {"false", "true"}) {
+    g_ceph_context->_conf->set_val("bluestore_extent_map_shard_compact",
+				   compact);
+    store._set_extent_map_format();
+
+    BlueStore::ExtentMap em(&onode);
+    populate_extent_map(coll.get(), em, 20);
+    bufferlist bl;
+    unsigned n = 0;
+    ASSERT_FALSE(em.encode_some(0, 0xffffffff, bl, &n));
+    ASSERT_EQ(40u, n);
+    ASSERT_EQ(string(compact) == "true" ? 3 : 2, (int)(__u8)bl[0]);
+    bl.rebuild();
+
+    BlueStore::ExtentMap em2(&onode);
+    ASSERT_EQ(40u, em2.decode_some(bl));
+    auto p = em.extent_map.begin();
+    auto q = em2.extent_map.begin();
+    for (; p != em.extent_map.end(); ++p, ++q) {
+      ASSERT_NE(q, em2.extent_map.end());
+      ASSERT_EQ(p->logical_offset, q->logical_offset);
+      ASSERT_EQ(p->blob_offset, q->blob_offset);
+      ASSERT_EQ(p->length, q->length);
+      const bluestore_blob_t& a = p->blob->get_blob();
+      const bluestore_blob_t& b = q->blob->get_blob();
+      ASSERT_EQ(a.get_extents(), b.get_extents());
+      ASSERT_EQ(a.get_csum_count(), b.get_csum_count());
+      ASSERT_EQ(0, memcmp(a.csum_data.c_str(), b.csum_data.c_str(),
+			  a.csum_data.length()));
+      // csum data is copied out, not shared with the shard buffer
+      const char *c = b.csum_data.c_str();
+      ASSERT_TRUE(c < bl.c_str() || c >= bl.c_str() + bl.length());
+    }
+    ASSERT_EQ(q, em2.extent_map.end());
+    // both extents of a blob decode to the same Blob
+    auto r = em2.extent_map.begin();
+    auto s = r;
+    ++s;
+    ASSERT_EQ(r->blob, s->blob);
+    ASSERT_EQ(0x2000u, r->blob->get_referenced_bytes());
+  }
+  g_ceph_context->_conf->set_val("bluestore_extent_map_shard_compact",
+				 "false");
+  store._set_extent_map_format();
+}
+
+TEST(ExtentMap, decode_repeat)
+{
+  BlueStore store(g_ceph_context, "", 4096);
+  BlueStore::LRUCache cache(g_ceph_context);
+  BlueStore::CollectionRef coll(new BlueStore::Collection(&store, &cache, coll_t()));
+  BlueStore::Onode onode(coll.get(), ghobject_t(), "");
+
+  store.inject_extent_map_v3_fence();
+  for (auto compact : {"false", "true"}) {
+    g_ceph_context->_conf->set_val("bluestore_extent_map_shard_compact",
+				   compact);
+    store._set_extent_map_format();
+
+    BlueStore::ExtentMap em(&onode);
+    populate_extent_map(coll.get(), em, 16);
+    bufferlist bl;
+    unsigned n = 0;
+    ASSERT_FALSE(em.encode_some(0, 0xffffffff, bl, &n));
+    bl.rebuild();
+
+    // decoding must not consume or alter the shard buffer
+    for (int i = 0; i < 100; ++i) {
+      BlueStore::ExtentMap em2(&onode);
+      ASSERT_EQ(n, em2.decode_some(bl));
+    }
+  }
+  g_ceph_context->_conf->set_val("bluestore_extent_map_shard_compact",
+				 "false");
+  store._set_extent_map_format();
+}
+
 TEST(GarbageCollector, BasicTest)
 {
   BlueStore::LRUCache cache(g_ceph_context);
@@ -9,6 +9,8 @@
 #include "common/common_init.h"
 
 #include "osd/mClockOpClassQueue.h"
+#include "osd/OpRequest.h"
+#include "messages/MOSDOp.h"
 
 
 int main(int argc, char **argv) {
@@ -182,3 +184,97 @@ TEST_F(MClockOpClassQueueTest, TestRemoveByClass) {
   r = q.dequeue();
   ASSERT_EQ(104u, r.get_map_epoch());
 }
+
+
+TEST(MClockBackgroundScaleTest, TestUpdate) {
+  ceph::mclock::BackgroundScale s;
+  ASSERT_EQ(1.0, s.get());
+  uint32_t gen = s.get_gen();
+
+  // under target: already at full scale, nothing to publish
+  ASSERT_EQ(1.0, s.update(.01, .05, .1));
+  ASSERT_EQ(gen, s.get_gen());
+
+  // 2x over target halves it, and it never drops below the floor
+  ASSERT_DOUBLE_EQ(.5, s.update(.1, .05, .1));
+  ASSERT_NE(gen, s.get_gen());
+  for (int i = 0; i < 10; ++i) {
+    s.update(1.0, .05, .1);
+  }
+  ASSERT_DOUBLE_EQ(.1, s.get());
+
+  // and it recovers additively once latency is back under target
+  ASSERT_DOUBLE_EQ(.2, s.update(.01, .05, .1));
+  for (int i = 0; i < 20; ++i) {
+    s.update(.01, .05, .1);
+  }
+  ASSERT_EQ(1.0, s.get());
+}
+
+
+TEST_F(MClockOpClassQueueTest, TestBackgroundScale) {
+  // weights only, and small enough that the tag increments (seconds)
+  // dwarf the time the test takes, so the order is purely by weight
+  g_conf->set_val("osd_op_queue_mclock_client_op_res", "0");
+  g_conf->set_val("osd_op_queue_mclock_client_op_wgt", "1");
+  g_conf->set_val("osd_op_queue_mclock_client_op_lim", "0");
+  g_conf->set_val("osd_op_queue_mclock_recov_res", "0");
+  g_conf->set_val("osd_op_queue_mclock_recov_wgt", "1");
+  g_conf->set_val("osd_op_queue_mclock_recov_lim", "0");
+  g_conf->apply_changes(nullptr);
+
+  OpTracker tracker(g_ceph_context, false, 1);
+  auto create_client_op = [&](epoch_t e, uint64_t owner) {
+    spg_t pgid;
+    OpRequestRef op = tracker.create_request<OpRequest, Message*>(
+      new MOSDOp(0, e, hobject_t(), pgid, e, 0, 0));
+    return Request(OpQueueItem(unique_ptr<OpQueueItem::OpQueueable>(new PGOpItem(pgid, op)),
+			       12, 12,
+			       utime_t(), owner, e));
+  };
+
+  // with both classes backlogged, dequeue half of what is queued and
+  // return the fraction of it that was background work
+  const unsigned n = 100;
+  auto background_share = [&](ceph::mclock::BackgroundScale *s) {
+    mClockOpClassQueue sq(g_ceph_context, s);
+    for (unsigned i = 0; i < n; ++i) {
+      sq.enqueue(client1, 12, 0, create_client_op(i, client1));
+      sq.enqueue(client2, 12, 0, create_recovery(i, client2));
+    }
+    unsigned background = 0;
+    for (unsigned i = 0; i < n; ++i) {
+      Request r = sq.dequeue();
+      if (r.get_op_type() != OpQueueItem::op_type_t::client_op) {
+	++background;
+      }
+    }
+    EXPECT_EQ(n, sq.length());
+    return double(background) / n;
+  };
+
+  ceph::mclock::BackgroundScale s;
+  EXPECT_NEAR(.5, background_share(&s), .02);
+
+  // 4x over target: scale .5, i.e. background gets 1 in 3
+  ASSERT_DOUBLE_EQ(.5, s.update(.2, .05, .1));
+  EXPECT_NEAR(1.0 / 3, background_share(&s), .02);
+
+  // .25: 1 in 5
+  ASSERT_DOUBLE_EQ(.25, s.update(.2, .05, .1));
+  EXPECT_NEAR(.2, background_share(&s), .02);
+
+  // client ops are never scaled, so recovering restores the split
+  for (int i = 0; i < 10; ++i) {
+    s.update(.01, .05, .1);
+  }
+  EXPECT_NEAR(.5, background_share(&s), .02);
+
+  g_conf->set_val("osd_op_queue_mclock_client_op_res", "1000");
+  g_conf->set_val("osd_op_queue_mclock_client_op_wgt", "500");
+  g_conf->set_val("osd_op_queue_mclock_client_op_lim", "0");
+  g_conf->set_val("osd_op_queue_mclock_recov_res", "0");
+  g_conf->set_val("osd_op_queue_mclock_recov_wgt", "1");
+  g_conf->set_val("osd_op_queue_mclock_recov_lim", "0.001");
+  g_conf->apply_changes(nullptr);
+}
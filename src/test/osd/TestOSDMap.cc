@@ -497,6 +497,51 @@ TEST_F(OSDMapTest, PrimaryAffinity) {
   }
 }
 
+TEST_F(OSDMapTest, ShareUnchangedAcrossEpochs) {
+  set_up_map();
+  const OSDMap& prev = osdmap;
+
+  // an incremental that leaves crush and pools alone shares them
+  OSDMap next;
+  next.deepish_copy_from(osdmap);
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.fsid = osdmap.get_fsid();
+    inc.new_weight[0] = CEPH_OSD_OUT;
+    ASSERT_EQ(0, next.apply_incremental(inc));
+  }
+  const OSDMap& cnext = next;
+  ASSERT_EQ(prev.crush, cnext.crush);
+  ASSERT_EQ(&prev.get_pools(), &cnext.get_pools());
+
+  // an independently decoded copy is deduped against the older epoch
+  {
+    bufferlist bl;
+    next.encode(bl, CEPH_FEATURES_SUPPORTED_DEFAULT | CEPH_FEATURE_RESERVED);
+    OSDMap decoded;
+    decoded.decode(bl);
+    const OSDMap& cdecoded = decoded;
+    ASSERT_NE(prev.crush, cdecoded.crush);
+    ASSERT_NE(&prev.get_pools(), &cdecoded.get_pools());
+    OSDMap::dedup(&prev, &decoded);
+    ASSERT_EQ(prev.crush, cdecoded.crush);
+    ASSERT_EQ(&prev.get_pools(), &cdecoded.get_pools());
+  }
+
+  // changing a pool copies the pools on write
+  {
+    OSDMap::Incremental inc(next.get_epoch() + 1);
+    inc.fsid = next.get_fsid();
+    pg_pool_t *p = inc.get_new_pool(my_rep_pool,
+				    prev.get_pg_pool(my_rep_pool));
+    p->size = 2;
+    ASSERT_EQ(0, next.apply_incremental(inc));
+  }
+  ASSERT_NE(&prev.get_pools(), &cnext.get_pools());
+  ASSERT_EQ(3u, prev.get_pg_pool(my_rep_pool)->get_size());
+  ASSERT_EQ(2u, cnext.get_pg_pool(my_rep_pool)->get_size());
+}
+
 TEST_F(OSDMapTest, parse_osd_id_list) {
   set_up_map();
   set<int> out;
@@ -23,6 +23,7 @@
 #include <signal.h>
 #include "gtest/gtest.h"
 #include "osd/PGLog.h"
+#include "osd/PG.h"
 #include "osd/OSDMap.h"
 #include "include/coredumpctl.h"
 #include "../objectstore/store_test_fixture.h"
@@ -2933,6 +2934,58 @@ TEST_F(PGLogTrimTest, TestGetRequest) {
   EXPECT_FALSE(result);
 }
 
+TEST_F(PGLogTrimTest, TestAddAfterTrim) {
+  SetUp(1, 2, 20);
+  PGLog::IndexedLog log;
+  log.head = mk_evt(30, 0);
+  log.skip_can_rollback_to_to_head();
+  log.head = mk_evt(9, 0);
+
+  entity_name_t client = entity_name_t::CLIENT(777);
+
+  log.add(mk_ple_mod(mk_obj(1), mk_evt(10, 100), mk_evt(8, 70),
+		     osd_reqid_t(client, 8, 1)));
+  log.add(mk_ple_mod(mk_obj(2), mk_evt(15, 150), mk_evt(10, 100),
+		     osd_reqid_t(client, 8, 2)));
+  log.add(mk_ple_mod(mk_obj(3), mk_evt(15, 155), mk_evt(15, 150),
+		     osd_reqid_t(client, 8, 3)));
+
+  eversion_t version;
+  version_t user_version;
+  int return_code;
+
+  // build the reqid index before trimming
+  EXPECT_TRUE(log.get_request(osd_reqid_t(client, 8, 1),
+			      &version, &user_version, &return_code));
+  EXPECT_EQ(mk_evt(10, 100), version);
+
+  log.trim(cct, mk_evt(15, 150), nullptr, nullptr, nullptr);
+  EXPECT_EQ(1u, log.log.size());
+
+  // new entries may land in the trimmed entries' memory
+  log.add(mk_ple_mod(mk_obj(4), mk_evt(20, 160), mk_evt(15, 155),
+		     osd_reqid_t(client, 8, 4)));
+  log.add(mk_ple_mod(mk_obj(5), mk_evt(20, 161), mk_evt(20, 160),
+		     osd_reqid_t(client, 8, 5)));
+  EXPECT_EQ(3u, log.log.size());
+  EXPECT_EQ(mk_obj(5), log.log.back().soid);
+
+  EXPECT_TRUE(log.get_request(osd_reqid_t(client, 8, 5),
+			      &version, &user_version, &return_code));
+  EXPECT_EQ(mk_evt(20, 161), version);
+  EXPECT_TRUE(log.get_request(osd_reqid_t(client, 8, 4),
+			      &version, &user_version, &return_code));
+  EXPECT_EQ(mk_evt(20, 160), version);
+  // trimmed ops are answered from the dups
+  EXPECT_TRUE(log.get_request(osd_reqid_t(client, 8, 1),
+			      &version, &user_version, &return_code));
+  EXPECT_EQ(mk_evt(10, 100), version);
+
+  EXPECT_FALSE(log.logged_object(mk_obj(1)));
+  EXPECT_TRUE(log.logged_object(mk_obj(4)));
+  EXPECT_EQ(mk_evt(20, 161), log.objects.find(mk_obj(5))->second->version);
+}
+
 TEST_F(PGLogTest, _merge_object_divergent_entries) {
   {
     // Test for issue 20843
@@ -2990,6 +3043,152 @@ TEST_F(PGLogTest, _merge_object_divergent_entries) {
   }
 }
 
+// osd_pg_log_embed_fastinfo: the pgmeta keys PG::write_if_dirty writes
+// with the fastinfo moved into the newest log entry, read back through
+// PG::read_info and PGLog::read_log_and_missing
+class PGLogEmbedFastInfoTest : public PGLogTestBase, public StoreTestFixture {
+public:
+  PGLogEmbedFastInfoTest() : StoreTestFixture("memstore") {}
+
+  spg_t pgid = spg_t(pg_t(1, 1));
+  coll_t coll = coll_t(pgid);
+  ghobject_t pgmeta_oid = pgid.make_pgmeta_oid();
+  ObjectStore::CollectionHandle ch;
+  pg_info_t info, last_written_info;
+  PastIntervals past_intervals;
+
+  void SetUp() override {
+    StoreTestFixture::SetUp();
+    ch = store->create_new_collection(coll);
+    ObjectStore::Transaction t;
+    PG::_create(t, pgid, 0);
+    PG::_init(t, pgid, nullptr);
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+    info.pgid = pgid;
+    write_info(nullptr, true, false);
+  }
+
+  void TearDown() override {
+    ch.reset();
+    StoreTestFixture::TearDown();
+  }
+
+  /// advance the fields a client write changes, and log it
+  pg_log_entry_t advance(unsigned v) {
+    pg_log_entry_t e = mk_ple_mod(mk_obj(v), mk_evt(10, v), eversion_t(),
+				  osd_reqid_t(entity_name_t::CLIENT(777), 8, v));
+    info.last_update = info.last_complete = e.version;
+    info.last_user_version = v;
+    info.stats.version = e.version;
+    info.stats.reported_seq = v;
+    info.stats.stats.sum.num_objects = v;
+    info.stats.stats.sum.num_bytes = v * 4096;
+    return e;
+  }
+
+  /// write e (if any) and the info, as write_if_dirty would
+  void write_info(const pg_log_entry_t *e, bool dirty_big_info, bool embed) {
+    map<string,bufferlist> km;
+    ASSERT_EQ(0, PG::_prepare_write_info(g_ceph_context, &km, 10,
+					 info, last_written_info,
+					 past_intervals, dirty_big_info,
+					 false, true));
+    if (e) {
+      e->encode_with_checksum(km[e->get_key_name()]);
+    }
+    if (embed) {
+      ASSERT_TRUE(PG::_embed_fast_info(&km, info.last_update));
+    }
+    ObjectStore::Transaction t;
+    t.omap_setkeys(coll, pgmeta_oid, km);
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+
+  void read_info(pg_info_t *out) {
+    PastIntervals pi;
+    __u8 struct_v;
+    ASSERT_EQ(0, PG::read_info(store.get(), pgid, coll, *out, pi, struct_v));
+  }
+
+  bool has_key(const string& key) {
+    set<string> keys = {key};
+    map<string,bufferlist> values;
+    store->omap_get_values(ch, pgmeta_oid, keys, &values);
+    return values.count(key);
+  }
+};
+
+TEST_F(PGLogEmbedFastInfoTest, RoundTrip) {
+  list<pg_log_entry_t> written;
+  for (unsigned v = 1; v <= 5; ++v) {
+    written.push_back(advance(v));
+    write_info(&written.back(), false, true);
+    EXPECT_FALSE(has_key("_fastinfo"));
+
+    pg_info_t r;
+    read_info(&r);
+    EXPECT_EQ(info.last_update, r.last_update);
+    EXPECT_EQ(info, r);
+  }
+
+  // the log reader skips the trailing info
+  PGLog pglog(g_ceph_context);
+  ostringstream err;
+  pglog.read_log_and_missing(store.get(), ch, pgmeta_oid, info, err, false);
+  ASSERT_EQ(written.size(), pglog.get_log().log.size());
+  auto p = pglog.get_log().log.begin();
+  for (auto& e : written) {
+    EXPECT_EQ(e.version, p->version);
+    EXPECT_EQ(e.soid, p->soid);
+    EXPECT_EQ(e.reqid, p->reqid);
+    ++p;
+  }
+}
+
+TEST_F(PGLogEmbedFastInfoTest, Fallback) {
+  for (unsigned v = 1; v <= 3; ++v) {
+    pg_log_entry_t e = advance(v);
+    write_info(&e, false, true);
+  }
+  pg_info_t at3 = info;
+
+  // the transaction for v4 never made it: v3 is the newest info
+  pg_info_t unwritten = info;
+  advance(4);
+  info = unwritten;
+  pg_info_t r;
+  read_info(&r);
+  EXPECT_EQ(at3, r);
+
+  // an entry written without an info (e.g. by a peer that does not
+  // embed) leaves the embedded one behind it in effect
+  {
+    pg_log_entry_t e = advance(4);
+    ObjectStore::Transaction t;
+    map<string,bufferlist> km;
+    e.encode_with_checksum(km[e.get_key_name()]);
+    t.omap_setkeys(coll, pgmeta_oid, km);
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+  read_info(&r);
+  EXPECT_EQ(at3, r);
+
+  // a full info write at the same version wins over the embedded copy,
+  // and so does a _fastinfo key written after it
+  info = at3;
+  info.stats.reported_seq = 100;
+  write_info(nullptr, true, false);
+  read_info(&r);
+  EXPECT_EQ(100u, r.stats.reported_seq);
+  EXPECT_EQ(at3.last_update, r.last_update);
+
+  pg_log_entry_t e = advance(5);
+  write_info(&e, false, false);
+  EXPECT_TRUE(has_key("_fastinfo"));
+  read_info(&r);
+  EXPECT_EQ(info, r);
+}
+
 TEST(eversion_t, get_key_name) {
   eversion_t a(1234, 5678);
   std::string a_key_name = a.get_key_name();
@@ -0,0 +1,68 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "gtest/gtest.h"
+#include "osd/PhiAccrualDetector.h"
+
+TEST(PhiAccrualDetector, Empty) {
+  PhiAccrualDetector d;
+  ASSERT_EQ(0.0, d.phi(utime_t(100, 0)));
+  d.heartbeat(utime_t(100, 0));
+  // a single heartbeat gives no interval yet
+  ASSERT_EQ(0u, d.num_samples());
+  ASSERT_EQ(0.0, d.phi(utime_t(200, 0)));
+}
+
+TEST(PhiAccrualDetector, Rises) {
+  PhiAccrualDetector d;
+  utime_t t(1000, 0);
+  for (int i = 0; i < 50; ++i) {
+    // alternate 0.8s and 1.2s
+    t += (i % 2) ? 1.2 : 0.8;
+    d.heartbeat(t);
+  }
+  ASSERT_EQ(49u, d.num_samples());
+
+  // on time: barely suspicious
+  utime_t now = t;
+  now += 1.0;
+  ASSERT_LT(d.phi(now), 1.0);
+
+  // suspicion grows monotonically as the peer stays silent
+  double prev = d.phi(now);
+  for (int i = 0; i < 10; ++i) {
+    now += 0.5;
+    double p = d.phi(now);
+    ASSERT_GE(p, prev);
+    prev = p;
+  }
+  ASSERT_GT(prev, 8.0);
+
+  // a reply resets it
+  d.heartbeat(now);
+  ASSERT_EQ(0.0, d.phi(now));
+}
+
+TEST(PhiAccrualDetector, Window) {
+  PhiAccrualDetector d(10);
+  utime_t t(1000, 0);
+  for (int i = 0; i < 100; ++i) {
+    t += 10.0;
+    d.heartbeat(t);
+  }
+  // slow history is forgotten once the peer speeds up
+  for (int i = 0; i < 10; ++i) {
+    t += 1.0;
+    d.heartbeat(t);
+  }
+  ASSERT_EQ(10u, d.num_samples());
+  utime_t now = t;
+  now += 5.0;
+  ASSERT_GT(d.phi(now), 8.0);
+
+  // out of order arrivals are ignored
+  utime_t earlier = t;
+  earlier -= 0.5;
+  d.heartbeat(earlier);
+  ASSERT_EQ(t, d.get_last());
+}
@@ -0,0 +1,51 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "gtest/gtest.h"
+#include "osd/RxBufferPool.h"
+
+TEST(RxBufferPool, Layout) {
+  auto pool = std::make_shared<RxBufferPool>(1 << 20);
+  // the data keeps its object offset's place within a page
+  bufferptr bp = pool->get(10000, 3 * CEPH_PAGE_SIZE + 100);
+  ASSERT_EQ(10000u, bp.length());
+  ASSERT_EQ(100u, (uintptr_t)bp.c_str() & ~CEPH_PAGE_MASK);
+  bufferptr aligned = pool->get(8192, 0);
+  ASSERT_EQ(0u, (uintptr_t)aligned.c_str() & ~CEPH_PAGE_MASK);
+}
+
+TEST(RxBufferPool, Reuse) {
+  auto pool = std::make_shared<RxBufferPool>(1 << 20);
+  const char *first;
+  {
+    bufferlist bl;
+    bl.push_back(pool->get(100000, 0));
+    first = bl.c_str();
+    ASSERT_EQ(0u, pool->get_free_bytes());
+  }
+  // back once the last reference is gone, and handed out again
+  ASSERT_EQ(2 * RxBufferPool::UNIT, pool->get_free_bytes());
+  bufferptr again = pool->get(RxBufferPool::UNIT + 1, 0);
+  ASSERT_EQ(first, again.c_str());
+  ASSERT_EQ(0u, pool->get_free_bytes());
+  // a different size class is not
+  bufferptr other = pool->get(100, 0);
+  ASSERT_NE(first, other.c_str());
+}
+
+TEST(RxBufferPool, Bounded) {
+  auto pool = std::make_shared<RxBufferPool>(RxBufferPool::UNIT);
+  {
+    bufferptr a = pool->get(RxBufferPool::UNIT, 0);
+    bufferptr b = pool->get(RxBufferPool::UNIT, 0);
+  }
+  ASSERT_EQ(RxBufferPool::UNIT, pool->get_free_bytes());
+}
+
+TEST(RxBufferPool, OutlivesPool) {
+  auto pool = std::make_shared<RxBufferPool>(1 << 20);
+  bufferptr bp = pool->get(100, 0);
+  pool.reset();
+  // the buffer still holds the pool, and frees itself into it
+  memset(bp.c_str(), 0, bp.length());
+}
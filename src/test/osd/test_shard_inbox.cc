@@ -0,0 +1,143 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "osd/ShardInbox.h"
+
+typedef std::pair<unsigned, unsigned> item_t;  ///< producer, seq
+
+TEST(ShardInbox, Fifo) {
+  ShardInbox<item_t> inbox;
+  ASSERT_TRUE(inbox.empty());
+  for (unsigned i = 0; i < 10; ++i) {
+    ASSERT_FALSE(inbox.push(item_t(0, i)));
+  }
+  ASSERT_FALSE(inbox.empty());
+
+  unsigned n = 0;
+  inbox.for_each([&n](const item_t& i) {
+      EXPECT_EQ(n++, i.second);
+    });
+  ASSERT_EQ(10u, n);
+  ASSERT_FALSE(inbox.empty());
+
+  n = 0;
+  ASSERT_EQ(10u, inbox.drain([&n](item_t&& i) {
+	EXPECT_EQ(n++, i.second);
+      }));
+  ASSERT_TRUE(inbox.empty());
+  ASSERT_EQ(0u, inbox.drain([](item_t&& i) {}));
+}
+
+TEST(ShardInbox, SleepHandshake) {
+  ShardInbox<item_t> inbox;
+  // an item pushed before the consumer gets to sleep keeps it awake
+  inbox.push(item_t(0, 0));
+  ASSERT_FALSE(inbox.prepare_to_sleep());
+  ASSERT_FALSE(inbox.push(item_t(0, 1)));
+  ASSERT_EQ(2u, inbox.drain([](item_t&& i) {}));
+
+  // once it is going to sleep, producers are told to wake it
+  ASSERT_TRUE(inbox.prepare_to_sleep());
+  ASSERT_TRUE(inbox.push(item_t(0, 2)));
+  inbox.woken();
+  ASSERT_FALSE(inbox.push(item_t(0, 3)));
+  ASSERT_EQ(2u, inbox.drain([](item_t&& i) {}));
+}
+
+TEST(ShardInbox, WakeupAfterEmptyDrain) {
+  ShardInbox<item_t> inbox;
+  std::mutex lock;
+  std::condition_variable cond;
+  std::atomic<bool> asleep = {false};
+  unsigned drained = 0;
+  bool may_sleep = false, woken = false;
+
+  std::thread consumer([&] {
+      std::unique_lock<std::mutex> l(lock);
+      // nothing to drain, so go to sleep
+      drained = inbox.drain([](item_t&& i) {});
+      may_sleep = inbox.prepare_to_sleep();
+      asleep = true;
+      woken = cond.wait_for(l, std::chrono::seconds(30)) ==
+	std::cv_status::no_timeout;
+      inbox.woken();
+    });
+  while (!asleep) {
+    std::this_thread::yield();
+  }
+  bool wake = inbox.push(item_t(0, 0));
+  if (wake) {
+    std::lock_guard<std::mutex> l(lock);
+    cond.notify_one();
+  }
+  consumer.join();
+  ASSERT_EQ(0u, drained);
+  ASSERT_TRUE(may_sleep);
+  ASSERT_TRUE(wake);
+  ASSERT_TRUE(woken);
+  ASSERT_EQ(1u, inbox.drain([](item_t&& i) {}));
+}
+
+TEST(ShardInbox, ConcurrentProducers) {
+  const unsigned num_producers = 4;
+  const unsigned per_producer = 100000;
+  ShardInbox<item_t> inbox;
+  std::mutex lock;
+  std::condition_variable cond;
+
+  std::vector<std::thread> producers;
+  for (unsigned p = 0; p < num_producers; ++p) {
+    producers.emplace_back([&, p] {
+	for (unsigned i = 0; i < per_producer; ++i) {
+	  if (inbox.push(item_t(p, i))) {
+	    std::lock_guard<std::mutex> l(lock);
+	    cond.notify_one();
+	  }
+	}
+      });
+  }
+
+  // the consumer checks each producer's items come out in order, the
+  // way a pg's ops must, and that it is never left asleep with items
+  std::vector<unsigned> next(num_producers, 0);
+  unsigned out_of_order = 0, total = 0, missed = 0;
+  while (total < num_producers * per_producer) {
+    unsigned n = inbox.drain([&](item_t&& i) {
+	if (i.second != next[i.first]) {
+	  ++out_of_order;
+	}
+	next[i.first] = i.second + 1;
+      });
+    total += n;
+    if (n) {
+      continue;
+    }
+    std::unique_lock<std::mutex> l(lock);
+    if (!inbox.prepare_to_sleep()) {
+      continue;
+    }
+    // a producer pushes and wakes us well within this
+    if (cond.wait_for(l, std::chrono::seconds(10)) ==
+	std::cv_status::timeout) {
+      ++missed;
+    }
+    inbox.woken();
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+
+  ASSERT_EQ(0u, out_of_order);
+  ASSERT_EQ(0u, missed);
+  ASSERT_EQ(num_producers * per_producer, total);
+  for (auto n : next) {
+    ASSERT_EQ(per_producer, n);
+  }
+  ASSERT_TRUE(inbox.empty());
+}